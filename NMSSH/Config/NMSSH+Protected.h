@@ -3,10 +3,15 @@
 
 #import <CoreFoundation/CoreFoundation.h>
 #import <netinet/in.h>
+#import <netinet/tcp.h>
 #import <sys/socket.h>
 #import <arpa/inet.h>
+#import <poll.h>
+#import <stdatomic.h>
 #import "socket_helper.h"
 
+@class NMSSHBufferPool;
+
 #define kNMSSHBufferSize (0x4000)
 
 #define NMSSHLogVerbose(frmt, ...) [[NMSSHLogger logger] logVerbose:[NSString stringWithFormat:frmt, ##__VA_ARGS__]]
@@ -16,4 +21,220 @@
 
 #define strlen (unsigned int)strlen
 
+typedef NS_ENUM(NSInteger, NMSSHOperationStatus) {
+    /** The operation is waiting on the socket or on a local event */
+    NMSSHOperationStatusBlocked,
+    /** The operation did some work and should be stepped again */
+    NMSSHOperationStatusProgress,
+    /** The operation completed and delivered its result */
+    NMSSHOperationStatusDone
+};
+
+/** Status of a step that may have done some work before blocking */
+NS_INLINE NMSSHOperationStatus NMSSHOperationStatusForProgress(BOOL progress) {
+    return progress ? NMSSHOperationStatusProgress : NMSSHOperationStatusBlocked;
+}
+
+@interface NMSSHOperation ()
+
+/** The session driving the operation */
+@property (nonatomic, weak) NMSSHSession *session;
+
+/**
+ Advance the operation using non-blocking libssh2 calls. Called on the session
+ queue whenever the socket or a local event may let the operation progress.
+ When abortError is set the step must release its resources and finish.
+ */
+@property (nonatomic, copy) NMSSHOperationStatus (^step)(NMSSHOperation *operation);
+
+/** Absolute time after which the operation is aborted, 0 for no limit */
+@property (atomic, assign) CFAbsoluteTime deadline;
+
+/** Set once the operation has been cancelled, timed out or lost its session */
+@property (nonatomic, strong) NSError *abortError;
+
+/** Whether the operation is aborted when the session is not connected, default YES */
+@property (nonatomic, assign) BOOL requiresSession;
+
++ (instancetype)operationWithSession:(NMSSHSession *)session step:(NMSSHOperationStatus (^)(NMSSHOperation *operation))step;
+
++ (NSError *)errorWithCode:(NMSSHOperationError)code description:(NSString *)description;
+
+/** Set the deadline relative to now, a non-positive timeout means no limit */
+- (void)setTimeout:(NSNumber *)timeout;
+
+- (NMSSHOperationStatus)performStep;
+
+@end
+
+@interface NMSSHSession (Protected)
+
+/** Serial queue on which asynchronous operations are driven */
+- (dispatch_queue_t)sessionQueue;
+
+/**
+ Add an operation to the session and start driving it. Can be called from any
+ thread.
+ */
+- (void)startOperation:(NMSSHOperation *)operation;
+
+/** Step the pending operations on the session queue. */
+- (void)pumpOperationsAsync;
+
+/**
+ libssh2 keeps the state of some requests in the session (opening a channel,
+ starting a SCP transfer), only one operation at a time may issue them.
+
+ @returns NO while another operation holds the lock
+ */
+- (BOOL)acquireRequestLockForOperation:(NMSSHOperation *)operation;
+
+/** Release the lock taken with acquireRequestLockForOperation:. */
+- (void)releaseRequestLockForOperation:(NMSSHOperation *)operation;
+
+/** Run a block on the callback queue. */
+- (void)dispatchCallback:(dispatch_block_t)block;
+
+/** Run a block on the session queue and wait for it, inline when already on it. */
+- (void)performSyncOnSessionQueue:(dispatch_block_t)block;
+
+/**
+ Wait until the session socket is ready in the direction libssh2 is blocked on.
+
+ @param deadline Absolute time at which to give up, or 0 to wait without limit
+ @returns A positive value when ready, 0 when the deadline expired,
+          `NMSSH_WAITSOCKET_INTERRUPTED` if cancelPendingOperations was called
+ */
+- (int)waitSocketUntil:(CFAbsoluteTime)deadline;
+
+/**
+ Discard a cancellation request issued before the current operation started.
+ */
+- (void)resetCancellation;
+
+/** Buffers shared by the channels of the session, only used on the session queue */
+- (NMSSHBufferPool *)bufferPool;
+
+/**
+ Number of reads that got data from the session socket. Packets of any
+ channel may have arrived when it changed.
+ */
+- (uint64_t)receiveCount;
+
+/** The host key blob sent by the server, nil if the session is not connected */
+- (NSData *)hostKey;
+
+/**
+ Mark the start of a call of the synchronous API, which uses libssh2 outside
+ of the session queue. No keepalive probe is sent until the matching
+ endSynchronousCall, and a probe already sent is waited for.
+ */
+- (void)beginSynchronousCall;
+
+/** Mark the end of a call started with beginSynchronousCall. */
+- (void)endSynchronousCall;
+
+/**
+ Probe the server if a keepalive is due, called by NMSSHKeepAliveScheduler.
+
+ @param now The current absolute time
+ @returns NO once the session no longer expects keepalives
+ */
+- (BOOL)keepAliveTimerFired:(CFAbsoluteTime)now;
+
+@end
+
+@interface NMSSHChannel (Protected)
+
+/**
+ Run a command on a channel of its own without blocking.
+
+ @param command Any shell script that is available on the server
+ @param timeout The time to wait (in seconds) before giving up, 0 for no limit
+ @param output Block called on the session queue with each chunk of output.
+     The chunk points to a pooled buffer and is only valid during the call.
+ @param completion Block called on the session queue with the exit status and
+     the name of the signal that terminated the command, if any
+ @returns The operation handle
+ */
+- (NMSSHOperation *)operationForCommand:(NSString *)command
+                                timeout:(NSNumber *)timeout
+                                 output:(void (^)(NSData *data, BOOL isStderr))output
+                             completion:(void (^)(int exitStatus, NSString *exitSignal, NSError *error))completion;
+
+/**
+ Run a command on a channel of its own without blocking, feeding its
+ standard input.
+
+ The input is written as the channel window allows, concurrently with reading
+ the output, and EOF is sent once the reader reached the end.
+
+ @param command Any shell script that is available on the server
+ @param timeout The time to wait (in seconds) before giving up, 0 for no limit
+ @param input Block called on the session queue to read the next chunk of
+     input into a buffer. Returns the number of bytes read, 0 at the end of
+     the input or -1 with errno set on error. EAGAIN means no data is
+     available yet, the reader must then pump the session once there is.
+ @param output Block called on the session queue with each chunk of output.
+     The chunk points to a pooled buffer and is only valid during the call.
+ @param completion Block called on the session queue with the exit status and
+     the name of the signal that terminated the command, if any
+ @returns The operation handle
+ */
+- (NMSSHOperation *)operationForCommand:(NSString *)command
+                                timeout:(NSNumber *)timeout
+                                  input:(ssize_t (^)(void *buffer, size_t length))input
+                                 output:(void (^)(NSData *data, BOOL isStderr))output
+                             completion:(void (^)(int exitStatus, NSString *exitSignal, NSError *error))completion;
+
+/**
+ Run a command on a channel of its own without blocking, with backpressure on
+ its output.
+
+ While outputBlocked returns YES the channel is not read, the output stays in
+ the channel window and the server stops sending once it is full.
+
+ @param outputBlocked Block called on the session queue before each read,
+     returns YES while the output can't be taken. The caller must pump the
+     session once it can be taken again.
+ @see operationForCommand:timeout:input:output:completion:
+ */
+- (NMSSHOperation *)operationForCommand:(NSString *)command
+                                timeout:(NSNumber *)timeout
+                                  input:(ssize_t (^)(void *buffer, size_t length))input
+                                 output:(void (^)(NSData *data, BOOL isStderr))output
+                          outputBlocked:(BOOL (^)(void))outputBlocked
+                             completion:(void (^)(int exitStatus, NSString *exitSignal, NSError *error))completion;
+
+@end
+
+@interface NMSSHCommandResult ()
+@property (nonatomic, assign) int exitStatus;
+@property (nonatomic, strong) NSString *exitSignal;
+@property (nonatomic, assign) NSTimeInterval duration;
+@property (nonatomic, strong) NSError *error;
+
+/** Append a chunk of output to the result */
+- (void)appendData:(NSData *)data isStderr:(BOOL)isStderr;
+
+@end
+
+@interface NMSSHKnownHostsStore (Protected)
+
+/** The key type written at the start of a host key blob, e.g. `ssh-rsa` */
++ (NSString *)typeOfKey:(NSData *)key;
+
+@end
+
+@interface NMSSHHostKeyScanResult ()
+@property (nonatomic, strong) NSString *hostname;
+@property (nonatomic, assign) NSInteger port;
+@property (nonatomic, strong) NSData *hostKey;
+@property (nonatomic, strong) NSString *fingerprint;
+@property (nonatomic, assign) NMSSHKnownHostStatus status;
+@property (nonatomic, assign) BOOL recorded;
+@property (nonatomic, assign) NSTimeInterval duration;
+@property (nonatomic, strong) NSError *error;
+@end
+
 #endif
@@ -0,0 +1,30 @@
+#import "NMSSH.h"
+
+/**
+ NMSSHBufferPool recycles fixed-size buffers, so a connection only holds
+ memory while data is in flight and busy connections don't allocate one per
+ chunk.
+
+ A pool is not thread safe, each session keeps one used on its session queue.
+ */
+@interface NMSSHBufferPool : NSObject
+
+/** Length of the buffers handed out */
+@property (nonatomic, readonly) NSUInteger bufferSize;
+
+/**
+ Create a pool.
+
+ @param bufferSize Length of the buffers
+ @param capacity Maximum number of idle buffers kept for reuse
+ @returns NMSSHBufferPool instance
+ */
+- (instancetype)initWithBufferSize:(NSUInteger)bufferSize capacity:(NSUInteger)capacity;
+
+/** Take a buffer of `bufferSize` bytes, its contents are undefined. */
+- (NSMutableData *)acquireBuffer;
+
+/** Give a buffer back, buffers of another size are dropped. */
+- (void)releaseBuffer:(NSMutableData *)buffer;
+
+@end
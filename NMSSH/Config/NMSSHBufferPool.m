@@ -0,0 +1,39 @@
+#import "NMSSHBufferPool.h"
+
+@interface NMSSHBufferPool ()
+@property (nonatomic, assign) NSUInteger bufferSize;
+@property (nonatomic, assign) NSUInteger capacity;
+@property (nonatomic, strong) NSMutableArray *buffers;
+@end
+
+@implementation NMSSHBufferPool
+
+- (instancetype)initWithBufferSize:(NSUInteger)bufferSize capacity:(NSUInteger)capacity {
+    if ((self = [super init])) {
+        [self setBufferSize:bufferSize];
+        [self setCapacity:capacity];
+        [self setBuffers:[[NSMutableArray alloc] initWithCapacity:capacity]];
+    }
+
+    return self;
+}
+
+- (NSMutableData *)acquireBuffer {
+    NSMutableData *buffer = [self.buffers lastObject];
+
+    if (!buffer) {
+        return [[NSMutableData alloc] initWithLength:self.bufferSize];
+    }
+
+    [self.buffers removeLastObject];
+
+    return buffer;
+}
+
+- (void)releaseBuffer:(NSMutableData *)buffer {
+    if (buffer && [buffer length] == self.bufferSize && [self.buffers count] < self.capacity) {
+        [self.buffers addObject:buffer];
+    }
+}
+
+@end
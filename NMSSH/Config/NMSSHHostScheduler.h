@@ -0,0 +1,128 @@
+#import "NMSSH.h"
+
+@class NMSSHHostScheduler;
+
+/**
+ Hosts handed to an NMSSHHostScheduler together. Owners subclass it to
+ capture their settings when the batch is started.
+ */
+@interface NMSSHHostBatch : NSObject
+
+/** Time (in seconds) each host may take, 0 for no limit */
+@property (nonatomic, assign) double timeout;
+
+/** Results of the finished tasks, in the order they finished */
+@property (nonatomic, strong) NSMutableArray *results;
+
+/** Number of tasks not finished yet */
+@property (nonatomic, assign) NSUInteger remaining;
+
+@property (nonatomic, copy) void (^resultHandler)(id result);
+@property (nonatomic, copy) void (^completion)(NSArray *results);
+
+@end
+
+/** The work on one host of a batch */
+@interface NMSSHHostTask : NSObject
+
+@property (nonatomic, weak) NMSSHHostBatch *batch;
+@property (nonatomic, strong) id result;
+@property (nonatomic, strong) NMSSHSession *session;
+@property (nonatomic, strong) NMSSHOperation *operation;
+@property (nonatomic, assign) CFAbsoluteTime startTime;
+@property (nonatomic, strong) NSError *abortError;
+@property (nonatomic, assign) BOOL finished;
+
+@end
+
+@protocol NMSSHHostSchedulerDelegate <NSObject>
+
+/** Most tasks in flight at once, read before starting pending tasks */
+- (NSUInteger)maxConcurrentHosts;
+
+/** Queue the result and completion blocks are called on */
+- (dispatch_queue_t)callbackQueue;
+
+/**
+ Start the first step of a task. The delegate sets its session, reporting
+ to the scheduler queue, and its operation.
+ */
+- (void)hostScheduler:(NMSSHHostScheduler *)scheduler startTask:(NMSSHHostTask *)task;
+
+/** Record in the result of a task how it finished */
+- (void)hostScheduler:(NMSSHHostScheduler *)scheduler didFinishTask:(NMSSHHostTask *)task error:(NSError *)error;
+
+/** Every task of a batch has finished, its completion is about to be called */
+- (void)hostScheduler:(NMSSHHostScheduler *)scheduler didCompleteBatch:(NMSSHHostBatch *)batch;
+
+@end
+
+/**
+ NMSSHHostScheduler runs tasks on many hosts with a bounded number of them in
+ flight, a timeout per host and a session each, for NMSSHFleetExecutor and
+ NMSSHHostKeyScanner.
+
+ Sessions report to the scheduler queue, and all the methods but the
+ initializer must be called on it.
+ */
+@interface NMSSHHostScheduler : NSObject
+
+@property (nonatomic, weak) id<NMSSHHostSchedulerDelegate> delegate;
+
+#if OS_OBJECT_USE_OBJC
+@property (nonatomic, readonly, strong) dispatch_queue_t queue;
+#else
+@property (nonatomic, readonly, assign) dispatch_queue_t queue;
+#endif
+
+/**
+ Create a scheduler with a serial queue of its own.
+
+ @param label Label of the queue
+ @returns NMSSHHostScheduler instance
+ */
+- (instancetype)initWithLabel:(const char *)label;
+
+/**
+ Queue the tasks of a batch, a batch without tasks completes at once.
+
+ @param batch The batch, its results and remaining count are set up here
+ @param tasks NMSSHHostTask objects with their result set
+ */
+- (void)addBatch:(NMSSHHostBatch *)batch tasks:(NSArray *)tasks;
+
+/**
+ Finish the pending tasks and abort the ones in flight.
+
+ @param error Error the tasks finish with
+ */
+- (void)cancelWithError:(NSError *)error;
+
+/**
+ Checks the outcome of a step, finishing the task when it failed or was
+ aborted while the step's completion was on its way.
+
+ @returns YES if the task should go on with its next step
+ */
+- (BOOL)shouldContinueTask:(NMSSHHostTask *)task success:(BOOL)success error:(NSError *)error;
+
+/**
+ Abort a task, it finishes once its current operation reports back.
+
+ @param task The task, may be nil
+ @param error Error the task finishes with
+ */
+- (void)abortTask:(NMSSHHostTask *)task error:(NSError *)error;
+
+/**
+ Finish a task, record its result and start the next pending ones.
+
+ @param task The task
+ @param error Error of the last step, the abort error takes precedence
+ */
+- (void)finishTask:(NMSSHHostTask *)task error:(NSError *)error;
+
+/** Time left to a task, never 0 which means no limit */
+- (NSNumber *)remainingTimeForTask:(NMSSHHostTask *)task;
+
+@end
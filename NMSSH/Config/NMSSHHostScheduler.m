@@ -0,0 +1,199 @@
+#import "NMSSHHostScheduler.h"
+#import "NMSSH+Protected.h"
+
+@implementation NMSSHHostBatch
+@end
+
+@implementation NMSSHHostTask
+@end
+
+@interface NMSSHHostScheduler ()
+@property (nonatomic, strong) NSMutableArray *pendingTasks;
+@property (nonatomic, strong) NSMutableSet *activeTasks;
+@property (nonatomic, strong) NSMutableSet *batches;
+
+#if OS_OBJECT_USE_OBJC
+@property (nonatomic, readwrite, strong) dispatch_queue_t queue;
+#else
+@property (nonatomic, readwrite, assign) dispatch_queue_t queue;
+#endif
+@end
+
+@implementation NMSSHHostScheduler
+
+// -----------------------------------------------------------------------------
+#pragma mark - INITIALIZER
+// -----------------------------------------------------------------------------
+
+- (instancetype)initWithLabel:(const char *)label {
+    if ((self = [super init])) {
+        [self setPendingTasks:[[NSMutableArray alloc] init]];
+        [self setActiveTasks:[[NSMutableSet alloc] init]];
+        [self setBatches:[[NSMutableSet alloc] init]];
+        [self setQueue:dispatch_queue_create(label, DISPATCH_QUEUE_SERIAL)];
+    }
+
+    return self;
+}
+
+- (void)dealloc {
+#if !(OS_OBJECT_USE_OBJC)
+    dispatch_release(_queue);
+#endif
+}
+
+// -----------------------------------------------------------------------------
+#pragma mark - BATCHES
+// -----------------------------------------------------------------------------
+
+- (void)addBatch:(NMSSHHostBatch *)batch tasks:(NSArray *)tasks {
+    [batch setResults:[[NSMutableArray alloc] initWithCapacity:[tasks count]]];
+    [batch setRemaining:[tasks count]];
+
+    if ([tasks count] == 0) {
+        [self completeBatch:batch];
+        return;
+    }
+
+    [self.batches addObject:batch];
+
+    for (NMSSHHostTask *task in tasks) {
+        [task setBatch:batch];
+        [self.pendingTasks addObject:task];
+    }
+
+    [self startPendingTasks];
+}
+
+- (void)cancelWithError:(NSError *)error {
+    NSArray *pendingTasks = [self.pendingTasks copy];
+    [self.pendingTasks removeAllObjects];
+
+    for (NMSSHHostTask *task in pendingTasks) {
+        [self finishTask:task error:error];
+    }
+
+    for (NMSSHHostTask *task in [self.activeTasks allObjects]) {
+        [self abortTask:task error:error];
+    }
+}
+
+- (void)completeBatch:(NMSSHHostBatch *)batch {
+    [self.delegate hostScheduler:self didCompleteBatch:batch];
+
+    if (batch.completion) {
+        void (^completion)(NSArray *) = batch.completion;
+        NSArray *results = [batch.results copy];
+        dispatch_async([self.delegate callbackQueue] ?: dispatch_get_main_queue(), ^{
+            completion(results);
+        });
+    }
+
+    [self.batches removeObject:batch];
+}
+
+// -----------------------------------------------------------------------------
+#pragma mark - TASKS
+// -----------------------------------------------------------------------------
+
+- (void)startPendingTasks {
+    NSUInteger limit = MAX([self.delegate maxConcurrentHosts], 1);
+
+    while ([self.activeTasks count] < limit && [self.pendingTasks count] > 0) {
+        NMSSHHostTask *task = [self.pendingTasks firstObject];
+        [self.pendingTasks removeObjectAtIndex:0];
+        [self startTask:task];
+    }
+}
+
+- (void)startTask:(NMSSHHostTask *)task {
+    [self.activeTasks addObject:task];
+    [task setStartTime:CFAbsoluteTimeGetCurrent()];
+
+    // The timeout covers the whole task, whichever step it is in
+    double timeout = task.batch.timeout;
+    if (timeout > 0) {
+        __weak NMSSHHostTask *weakTask = task;
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(timeout * NSEC_PER_SEC)), self.queue, ^{
+            [self abortTask:weakTask error:[NMSSHOperation errorWithCode:NMSSHOperationTimeoutError
+                                                             description:@"Host timed out"]];
+        });
+    }
+
+    [self.delegate hostScheduler:self startTask:task];
+}
+
+- (BOOL)shouldContinueTask:(NMSSHHostTask *)task success:(BOOL)success error:(NSError *)error {
+    if (task.finished) {
+        return NO;
+    }
+
+    if (task.abortError || !success) {
+        [self finishTask:task error:error];
+        return NO;
+    }
+
+    return YES;
+}
+
+- (void)abortTask:(NMSSHHostTask *)task error:(NSError *)error {
+    if (!task || task.finished || task.abortError) {
+        return;
+    }
+
+    // The task finishes once its current operation reports back
+    [task setAbortError:error];
+    [task.operation cancel];
+}
+
+- (NSNumber *)remainingTimeForTask:(NMSSHHostTask *)task {
+    double timeout = task.batch.timeout;
+    if (timeout <= 0) {
+        return @0;
+    }
+
+    // Never pass 0 which means no limit
+    return @(MAX(timeout - (CFAbsoluteTimeGetCurrent() - task.startTime), 0.001));
+}
+
+- (void)finishTask:(NMSSHHostTask *)task error:(NSError *)error {
+    if (task.finished) {
+        return;
+    }
+
+    [task setFinished:YES];
+    [task setOperation:nil];
+
+    [self.delegate hostScheduler:self didFinishTask:task error:task.abortError ?: error];
+
+    // Disconnecting waits on the session queue, keep it off the scheduler queue
+    NMSSHSession *session = task.session;
+    [task setSession:nil];
+    if (session) {
+        dispatch_async(session.sessionQueue, ^{
+            [session disconnect];
+        });
+    }
+
+    [self.activeTasks removeObject:task];
+
+    NMSSHHostBatch *batch = task.batch;
+    id result = task.result;
+    [batch.results addObject:result];
+    [batch setRemaining:batch.remaining - 1];
+
+    if (batch.resultHandler) {
+        void (^resultHandler)(id) = batch.resultHandler;
+        dispatch_async([self.delegate callbackQueue] ?: dispatch_get_main_queue(), ^{
+            resultHandler(result);
+        });
+    }
+
+    if (batch.remaining == 0) {
+        [self completeBatch:batch];
+    }
+
+    [self startPendingTasks];
+}
+
+@end
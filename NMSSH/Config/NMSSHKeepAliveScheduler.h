@@ -0,0 +1,22 @@
+#import "NMSSH.h"
+
+/**
+ NMSSHKeepAliveScheduler drives the keepalives of every session from a single
+ timer, so an idle session costs no thread and no timer of its own.
+
+ Sessions are held weakly. Once a second each registered session is asked
+ whether a keepalive is due, see `-[NMSSHSession keepAliveTimerFired:]`.
+ */
+@interface NMSSHKeepAliveScheduler : NSObject
+
+/** The process-wide scheduler */
++ (instancetype)sharedScheduler;
+
+/**
+ Start serving a session, it is dropped once it stops expecting keepalives.
+
+ @param session The session to serve
+ */
+- (void)addSession:(NMSSHSession *)session;
+
+@end
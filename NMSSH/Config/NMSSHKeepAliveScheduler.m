@@ -0,0 +1,82 @@
+#import "NMSSHKeepAliveScheduler.h"
+#import "NMSSH+Protected.h"
+
+/** Resolution of the keepalive intervals, in seconds */
+static const int64_t kNMSSHKeepAliveTick = 1;
+
+@interface NMSSHKeepAliveScheduler ()
+@property (nonatomic, strong) NSHashTable *sessions;
+@property (nonatomic, assign) BOOL timerActive;
+
+#if OS_OBJECT_USE_OBJC
+@property (nonatomic, strong) dispatch_queue_t queue;
+@property (nonatomic, strong) dispatch_source_t timer;
+#else
+@property (nonatomic, assign) dispatch_queue_t queue;
+@property (nonatomic, assign) dispatch_source_t timer;
+#endif
+@end
+
+@implementation NMSSHKeepAliveScheduler
+
++ (instancetype)sharedScheduler {
+    static NMSSHKeepAliveScheduler *scheduler = nil;
+
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        scheduler = [[NMSSHKeepAliveScheduler alloc] init];
+    });
+
+    return scheduler;
+}
+
+- (instancetype)init {
+    if ((self = [super init])) {
+        [self setSessions:[NSHashTable weakObjectsHashTable]];
+        [self setQueue:dispatch_queue_create("NMSSH.keepAliveQueue", DISPATCH_QUEUE_SERIAL)];
+
+        // The timer is created suspended, it only runs while sessions are registered
+        [self setTimer:dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, self.queue)];
+        dispatch_source_set_timer(self.timer,
+                                  dispatch_time(DISPATCH_TIME_NOW, kNMSSHKeepAliveTick * NSEC_PER_SEC),
+                                  kNMSSHKeepAliveTick * NSEC_PER_SEC,
+                                  NSEC_PER_SEC / 4);
+
+        __weak NMSSHKeepAliveScheduler *weakSelf = self;
+        dispatch_source_set_event_handler(self.timer, ^{
+            [weakSelf timerFired];
+        });
+    }
+
+    return self;
+}
+
+- (void)addSession:(NMSSHSession *)session {
+    dispatch_async(self.queue, ^{
+        [self.sessions addObject:session];
+        [self updateTimer];
+    });
+}
+
+- (void)timerFired {
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+
+    for (NMSSHSession *session in [self.sessions allObjects]) {
+        if (![session keepAliveTimerFired:now]) {
+            [self.sessions removeObject:session];
+        }
+    }
+
+    [self updateTimer];
+}
+
+- (void)updateTimer {
+    BOOL active = [[self.sessions allObjects] count] > 0;
+
+    if (active != self.timerActive) {
+        active ? dispatch_resume(self.timer) : dispatch_suspend(self.timer);
+        [self setTimerActive:active];
+    }
+}
+
+@end
@@ -0,0 +1,75 @@
+#import "NMSSH.h"
+
+/**
+ NMSSHSocketRelay copies bytes in both directions between a local socket and
+ a channel of a session, either a `direct-tcpip` channel it opens or a
+ forwarded channel accepted from the server.
+
+ The relay is driven by the session's asynchronous engine: it is stepped on
+ the session queue whenever the session socket or the local socket is ready,
+ and never blocks. Each direction holds at most one buffer in flight, so a
+ slow reader on either side stops the relay from reading the other side and
+ the backpressure propagates through the channel window.
+
+ The relay owns the local socket and closes it once done.
+ */
+@interface NMSSHSocketRelay : NSObject
+
+/** Host at the far end of the relay, for logging */
+@property (nonatomic, readonly) NSString *host;
+
+/** Port at the far end of the relay, for logging */
+@property (nonatomic, readonly) NSInteger port;
+
+/**
+ Block called on the session queue once the `direct-tcpip` channel is open,
+ or failed to open, before any data is relayed.
+ */
+@property (nonatomic, copy) void (^openHandler)(NSError *error);
+
+/** Bytes read from the local socket and written to the channel */
+@property (atomic, readonly) uint64_t bytesSent;
+
+/** Bytes read from the channel and written to the local socket */
+@property (atomic, readonly) uint64_t bytesReceived;
+
+/**
+ Create a relay opening a channel to host:port through a session.
+
+ @param session An authenticated session, used through its asynchronous API
+ @param socket A connected stream socket, the relay takes ownership of it
+ @param host Host the server connects to
+ @param port Port the server connects to
+ @returns NMSSHSocketRelay instance
+ */
+- (instancetype)initWithSession:(NMSSHSession *)session socket:(int)socket host:(NSString *)host port:(NSInteger)port;
+
+/**
+ Create a relay for a channel accepted from a forwarding listener.
+
+ @param session The session of the channel
+ @param channel An open channel, the relay takes ownership of it
+ @param socket A stream socket, possibly still connecting, the relay takes
+     ownership of it. A negative value fails the relay and closes the channel.
+ @param host Host the socket connects to
+ @param port Port the socket connects to
+ @returns NMSSHSocketRelay instance
+ */
+- (instancetype)initWithSession:(NMSSHSession *)session
+                        channel:(LIBSSH2_CHANNEL *)channel
+                         socket:(int)socket
+                           host:(NSString *)host
+                           port:(NSInteger)port;
+
+/**
+ Open the channel and start relaying.
+
+ @param completion Block called on the session queue once both directions
+     reached end of file or the relay failed
+ */
+- (void)startWithCompletion:(void (^)(NSError *error))completion;
+
+/** Stop relaying, close the channel and the local socket. Can be called from any thread. */
+- (void)close;
+
+@end
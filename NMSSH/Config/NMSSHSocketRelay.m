@@ -0,0 +1,522 @@
+#import "NMSSHSocketRelay.h"
+#import "NMSSH+Protected.h"
+#import "NMSSHBufferPool.h"
+
+/** Chunks moved in one step before yielding to the other operations */
+static const NSUInteger kNMSSHRelayMaxChunksPerStep = 16;
+
+typedef NS_ENUM(NSInteger, NMSSHRelayStep) {
+    NMSSHRelayStepOpen,
+    NMSSHRelayStepConnect,
+    NMSSHRelayStepTransfer,
+    NMSSHRelayStepClose,
+    NMSSHRelayStepFree,
+    NMSSHRelayStepDone
+};
+
+@interface NMSSHSocketRelay () {
+    int _socket;
+    LIBSSH2_CHANNEL *_channel;
+
+    // Local socket -> channel, nil while idle
+    NSMutableData *_outgoing;
+    size_t _outgoingOffset, _outgoingLength;
+
+    // Channel -> local socket, nil while idle
+    NSMutableData *_incoming;
+    size_t _incomingOffset, _incomingLength;
+}
+
+@property (nonatomic, weak) NMSSHSession *session;
+@property (nonatomic, strong) NSString *host;
+@property (nonatomic, assign) NSInteger port;
+@property (atomic, assign) uint64_t bytesSent;
+@property (atomic, assign) uint64_t bytesReceived;
+
+@property (nonatomic, weak) NMSSHOperation *operation;
+@property (nonatomic, assign) NMSSHRelayStep step;
+@property (nonatomic, assign) BOOL pending;
+@property (nonatomic, strong) NSError *failure;
+
+@property (nonatomic, assign) BOOL socketReadable;
+@property (nonatomic, assign) BOOL socketWritable;
+@property (nonatomic, assign) BOOL channelReadable;
+@property (nonatomic, assign) uint64_t seenReceiveCount;
+@property (nonatomic, assign) BOOL localEOF;
+@property (nonatomic, assign) BOOL sentEOF;
+@property (nonatomic, assign) BOOL remoteEOF;
+@property (nonatomic, assign) BOOL shutDown;
+
+@property (nonatomic, assign) BOOL readSourceActive;
+@property (nonatomic, assign) BOOL writeSourceActive;
+
+#if OS_OBJECT_USE_OBJC
+@property (nonatomic, strong) dispatch_source_t readSource;
+@property (nonatomic, strong) dispatch_source_t writeSource;
+#else
+@property (nonatomic, assign) dispatch_source_t readSource;
+@property (nonatomic, assign) dispatch_source_t writeSource;
+#endif
+@end
+
+@implementation NMSSHSocketRelay
+
+// -----------------------------------------------------------------------------
+#pragma mark - INITIALIZER
+// -----------------------------------------------------------------------------
+
+- (instancetype)initWithSession:(NMSSHSession *)session socket:(int)socket host:(NSString *)host port:(NSInteger)port {
+    if ((self = [super init])) {
+        [self setSession:session];
+        [self setHost:host];
+        [self setPort:port];
+        _socket = socket;
+
+        // Nothing is known about either side until a read says otherwise
+        [self setSocketReadable:YES];
+        [self setSocketWritable:YES];
+        [self setChannelReadable:YES];
+    }
+
+    return self;
+}
+
+- (instancetype)initWithSession:(NMSSHSession *)session
+                        channel:(LIBSSH2_CHANNEL *)channel
+                         socket:(int)socket
+                           host:(NSString *)host
+                           port:(NSInteger)port {
+    if ((self = [self initWithSession:session socket:socket host:host port:port])) {
+        _channel = channel;
+        [self setStep:NMSSHRelayStepConnect];
+    }
+
+    return self;
+}
+
+- (void)dealloc {
+    [self closeSocket];
+}
+
+// -----------------------------------------------------------------------------
+#pragma mark - RELAY
+// -----------------------------------------------------------------------------
+
+- (void)startWithCompletion:(void (^)(NSError *))completion {
+    NMSSHSession *session = self.session;
+
+    if (_socket < 0) {
+        [self failWithDescription:@"No socket to relay"];
+        [self setStep:NMSSHRelayStepClose];
+    }
+    else {
+        int flags = fcntl(_socket, F_GETFL);
+        if (flags < 0 || fcntl(_socket, F_SETFL, flags | O_NONBLOCK) < 0) {
+            NMSSHLogWarn(@"Unable to make the relayed socket non-blocking: %s", strerror(errno));
+        }
+
+        [self createSocketSourcesOnQueue:session.sessionQueue];
+    }
+
+    NMSSHOperation *operation = [NMSSHOperation operationWithSession:session step:^NMSSHOperationStatus(NMSSHOperation *operation) {
+        NMSSHOperationStatus status = [self stepOperation:operation];
+
+        if (status == NMSSHOperationStatusDone) {
+            [self releaseBuffers];
+            [self closeSocket];
+
+            if (completion) {
+                completion(self.failure);
+            }
+        }
+        else {
+            [self updateSocketSources];
+        }
+
+        return status;
+    }];
+
+    [self setOperation:operation];
+    [session startOperation:operation];
+}
+
+- (void)close {
+    [self.operation cancel];
+}
+
+- (NMSSHOperationStatus)stepOperation:(NMSSHOperation *)operation {
+    NMSSHSession *session = operation.session;
+    BOOL progress = NO;
+
+    // The channel went away with the session
+    if (!session.rawSession) {
+        _channel = NULL;
+        [self setPending:NO];
+        [self setFailure:self.failure ?: operation.abortError];
+        [self setStep:NMSSHRelayStepDone];
+    }
+
+    // A channel being opened must be allocated before it can be closed
+    if (operation.abortError && !self.pending && self.step < NMSSHRelayStepClose) {
+        [self setFailure:self.failure ?: operation.abortError];
+        [self setStep:NMSSHRelayStepClose];
+    }
+
+    while (self.step != NMSSHRelayStepDone) {
+        int rc;
+
+        switch (self.step) {
+            case NMSSHRelayStepOpen:
+                if (![session acquireRequestLockForOperation:operation]) {
+                    return NMSSHOperationStatusForProgress(progress);
+                }
+
+                _channel = libssh2_channel_direct_tcpip(session.rawSession, [self.host UTF8String], (int)self.port);
+                if ((self.pending = (!_channel && libssh2_session_last_errno(session.rawSession) == LIBSSH2_ERROR_EAGAIN))) {
+                    return NMSSHOperationStatusForProgress(progress);
+                }
+
+                [session releaseRequestLockForOperation:operation];
+
+                if (!_channel) {
+                    NMSSHLogError(@"Unable to open a channel to %@:%ld through %@: %@",
+                                  self.host, (long)self.port, session.host, [[session lastError] localizedDescription]);
+                    [self setFailure:[NMSSHOperation errorWithCode:NMSSHOperationFailedError
+                                                       description:[NSString stringWithFormat:@"Unable to open a channel to %@:%ld", self.host, (long)self.port]]];
+                    [self setStep:NMSSHRelayStepDone];
+                    [self channelOpened];
+                    break;
+                }
+
+                NMSSHLogVerbose(@"Relaying to %@:%ld through %@", self.host, (long)self.port, session.host);
+                [self channelOpened];
+                [self setStep:NMSSHRelayStepTransfer];
+                break;
+
+            case NMSSHRelayStepConnect: {
+                // The socket becomes writable once the TCP connection is established
+                struct pollfd fds = { _socket, POLLOUT, 0 };
+                if (poll(&fds, 1, 0) == 0) {
+                    [self setSocketWritable:NO];
+                    return NMSSHOperationStatusForProgress(progress);
+                }
+
+                int error = 0;
+                socklen_t length = sizeof(error);
+                if (getsockopt(_socket, SOL_SOCKET, SO_ERROR, &error, &length) != 0) {
+                    error = errno;
+                }
+
+                if (error) {
+                    [self failWithDescription:[NSString stringWithFormat:@"Unable to connect to %@:%ld: %s", self.host, (long)self.port, strerror(error)]];
+                    [self setStep:NMSSHRelayStepClose];
+                    break;
+                }
+
+                NMSSHLogVerbose(@"Relaying a forwarded channel to %@:%ld", self.host, (long)self.port);
+                [self setSocketWritable:YES];
+                [self setStep:NMSSHRelayStepTransfer];
+                break;
+            }
+
+            case NMSSHRelayStepTransfer: {
+                NSUInteger chunks = 0;
+                BOOL moved;
+
+                while ((moved = [self transfer]) && ++chunks < kNMSSHRelayMaxChunksPerStep);
+                progress = progress || chunks > 0 || moved;
+
+                if (self.failure || (self.sentEOF && self.shutDown)) {
+                    [self setStep:NMSSHRelayStepClose];
+                    break;
+                }
+
+                return NMSSHOperationStatusForProgress(progress);
+            }
+
+            case NMSSHRelayStepClose:
+                rc = _channel ? libssh2_channel_close(_channel) : 0;
+                if (rc == LIBSSH2_ERROR_EAGAIN) {
+                    return NMSSHOperationStatusForProgress(progress);
+                }
+
+                [self setStep:NMSSHRelayStepFree];
+                break;
+
+            default:
+                rc = _channel ? libssh2_channel_free(_channel) : 0;
+                if (rc == LIBSSH2_ERROR_EAGAIN) {
+                    return NMSSHOperationStatusForProgress(progress);
+                }
+
+                _channel = NULL;
+                [self setStep:NMSSHRelayStepDone];
+                break;
+        }
+
+        progress = YES;
+    }
+
+    NMSSHLogVerbose(@"Relay to %@:%ld closed after %llu bytes sent, %llu received",
+                    self.host, (long)self.port, self.bytesSent, self.bytesReceived);
+
+    return NMSSHOperationStatusDone;
+}
+
+/**
+ Move at most one chunk in each direction. Buffers are only held while data
+ is in flight, an idle relay costs no memory besides its own state.
+
+ @returns Whether anything moved
+ */
+- (BOOL)transfer {
+    NMSSHBufferPool *pool = self.session.bufferPool;
+    uint64_t initialReceiveCount = self.session.receiveCount;
+    BOOL progress = NO;
+
+    // Local socket -> channel
+    if (!_outgoing && !self.localEOF && self.socketReadable) {
+        NSMutableData *buffer = [pool acquireBuffer];
+        ssize_t rc = read(_socket, [buffer mutableBytes], [buffer length]);
+
+        if (rc > 0) {
+            _outgoing = buffer;
+            _outgoingOffset = 0;
+            _outgoingLength = rc;
+            progress = YES;
+        }
+        else {
+            [pool releaseBuffer:buffer];
+
+            if (rc == 0) {
+                [self setLocalEOF:YES];
+                progress = YES;
+            }
+            else if (errno == EAGAIN || errno == EINTR) {
+                [self setSocketReadable:NO];
+            }
+            else {
+                [self failWithDescription:[NSString stringWithFormat:@"Error reading the relayed socket: %s", strerror(errno)]];
+                return NO;
+            }
+        }
+    }
+
+    // Written straight from the buffer the socket was read into, the channel window paces the reads
+    if (_outgoing) {
+        ssize_t rc = libssh2_channel_write(_channel, (char *)[_outgoing mutableBytes] + _outgoingOffset, _outgoingLength - _outgoingOffset);
+
+        if (rc > 0) {
+            _outgoingOffset += rc;
+            [self setBytesSent:self.bytesSent + rc];
+            progress = YES;
+
+            if (_outgoingOffset == _outgoingLength) {
+                [pool releaseBuffer:_outgoing];
+                _outgoing = nil;
+            }
+        }
+        else if (rc != LIBSSH2_ERROR_EAGAIN) {
+            [self failWithDescription:@"Error writing to the channel"];
+            return NO;
+        }
+    }
+    else if (self.localEOF && !self.sentEOF) {
+        int rc = libssh2_channel_send_eof(_channel);
+
+        if (rc == 0) {
+            [self setSentEOF:YES];
+            progress = YES;
+        }
+        else if (rc != LIBSSH2_ERROR_EAGAIN) {
+            [self failWithDescription:@"Error sending EOF to the channel"];
+            return NO;
+        }
+    }
+
+    // Packets only arrive for the channel when the session socket got data, whichever channel read it
+    uint64_t receiveCount = self.session.receiveCount;
+    if (receiveCount != self.seenReceiveCount) {
+        [self setSeenReceiveCount:receiveCount];
+        [self setChannelReadable:YES];
+    }
+
+    // Channel -> local socket
+    if (!_incoming && !self.remoteEOF && self.channelReadable) {
+        NSMutableData *buffer = [pool acquireBuffer];
+        ssize_t rc = libssh2_channel_read(_channel, [buffer mutableBytes], [buffer length]);
+
+        if (rc > 0) {
+            _incoming = buffer;
+            _incomingOffset = 0;
+            _incomingLength = rc;
+            progress = YES;
+        }
+        else {
+            [pool releaseBuffer:buffer];
+
+            if (libssh2_channel_eof(_channel) == 1) {
+                [self setRemoteEOF:YES];
+                progress = YES;
+            }
+            else if (rc == LIBSSH2_ERROR_EAGAIN || rc == 0) {
+                [self setChannelReadable:NO];
+            }
+            else {
+                [self failWithDescription:@"Error reading from the channel"];
+                return NO;
+            }
+        }
+    }
+
+    if (_incoming && self.socketWritable) {
+        ssize_t rc = write(_socket, (char *)[_incoming mutableBytes] + _incomingOffset, _incomingLength - _incomingOffset);
+
+        if (rc > 0) {
+            _incomingOffset += rc;
+            [self setBytesReceived:self.bytesReceived + rc];
+            progress = YES;
+
+            if (_incomingOffset == _incomingLength) {
+                [pool releaseBuffer:_incoming];
+                _incoming = nil;
+            }
+        }
+        else if (rc < 0 && (errno == EAGAIN || errno == EINTR)) {
+            [self setSocketWritable:NO];
+        }
+        else {
+            [self failWithDescription:[NSString stringWithFormat:@"Error writing to the relayed socket: %s", strerror(errno)]];
+            return NO;
+        }
+    }
+    else if (!_incoming && self.remoteEOF && !self.shutDown) {
+        shutdown(_socket, SHUT_WR);
+        [self setShutDown:YES];
+        progress = YES;
+    }
+
+    // libssh2 may have received packets of other channels meanwhile, they need another pass
+    if (self.session.receiveCount != initialReceiveCount) {
+        progress = YES;
+    }
+
+    return progress;
+}
+
+- (void)channelOpened {
+    if (self.openHandler) {
+        self.openHandler(self.failure);
+        [self setOpenHandler:nil];
+    }
+}
+
+- (void)releaseBuffers {
+    NMSSHBufferPool *pool = self.session.bufferPool;
+
+    [pool releaseBuffer:_outgoing];
+    [pool releaseBuffer:_incoming];
+    _outgoing = nil;
+    _incoming = nil;
+}
+
+- (void)failWithDescription:(NSString *)description {
+    NMSSHLogWarn(@"Relay to %@:%ld: %@", self.host, (long)self.port, description);
+    [self setFailure:[NMSSHOperation errorWithCode:NMSSHOperationFailedError description:description]];
+}
+
+// -----------------------------------------------------------------------------
+#pragma mark - LOCAL SOCKET
+// -----------------------------------------------------------------------------
+
+- (void)createSocketSourcesOnQueue:(dispatch_queue_t)queue {
+    __weak NMSSHSocketRelay *weakSelf = self;
+
+    // Each event is handled once, the next step decides whether to listen again
+    [self setReadSource:dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, _socket, 0, queue)];
+    dispatch_source_set_event_handler(self.readSource, ^{
+        NMSSHSocketRelay *relay = weakSelf;
+        [relay setSocketReadable:YES];
+        [relay setReadSourceActive:NO];
+        [relay.session pumpOperationsAsync];
+    });
+
+    [self setWriteSource:dispatch_source_create(DISPATCH_SOURCE_TYPE_WRITE, _socket, 0, queue)];
+    dispatch_source_set_event_handler(self.writeSource, ^{
+        NMSSHSocketRelay *relay = weakSelf;
+        [relay setSocketWritable:YES];
+        [relay setWriteSourceActive:NO];
+        [relay.session pumpOperationsAsync];
+    });
+}
+
+- (void)updateSocketSources {
+    BOOL transferring = (self.step == NMSSHRelayStepTransfer);
+    BOOL connecting = (self.step == NMSSHRelayStepConnect);
+
+    [self setReadSourceActive:transferring && !self.socketReadable && !_outgoing && !self.localEOF];
+    [self setWriteSourceActive:!self.socketWritable && (connecting || (transferring && _incoming != nil))];
+}
+
+- (void)setReadSourceActive:(BOOL)active {
+    if (self.readSource && active != _readSourceActive) {
+        active ? dispatch_resume(self.readSource) : dispatch_suspend(self.readSource);
+    }
+
+    _readSourceActive = active && self.readSource;
+}
+
+- (void)setWriteSourceActive:(BOOL)active {
+    if (self.writeSource && active != _writeSourceActive) {
+        active ? dispatch_resume(self.writeSource) : dispatch_suspend(self.writeSource);
+    }
+
+    _writeSourceActive = active && self.writeSource;
+}
+
+- (void)closeSocket {
+    int sock = _socket;
+    _socket = -1;
+
+    // The sources watch the descriptor until their cancel handlers ran
+    dispatch_group_t group = dispatch_group_create();
+
+    // A suspended source must be resumed before it can be released
+    if (self.readSource) {
+        dispatch_group_enter(group);
+        dispatch_source_set_cancel_handler(self.readSource, ^{
+            dispatch_group_leave(group);
+        });
+        [self setReadSourceActive:YES];
+        dispatch_source_cancel(self.readSource);
+#if !(OS_OBJECT_USE_OBJC)
+        dispatch_release(self.readSource);
+#endif
+        [self setReadSource:nil];
+    }
+
+    if (self.writeSource) {
+        dispatch_group_enter(group);
+        dispatch_source_set_cancel_handler(self.writeSource, ^{
+            dispatch_group_leave(group);
+        });
+        [self setWriteSourceActive:YES];
+        dispatch_source_cancel(self.writeSource);
+#if !(OS_OBJECT_USE_OBJC)
+        dispatch_release(self.writeSource);
+#endif
+        [self setWriteSource:nil];
+    }
+
+    if (sock >= 0) {
+        dispatch_group_notify(group, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+            close(sock);
+        });
+    }
+
+#if !(OS_OBJECT_USE_OBJC)
+    dispatch_release(group);
+#endif
+}
+
+@end
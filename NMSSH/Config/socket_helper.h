@@ -1,3 +1,27 @@
 #import "libssh2.h"
 
-int waitsocket(int socket_fd, LIBSSH2_SESSION *session);
\ No newline at end of file
+/** Returned by waitsocket_timeout() when the wait was interrupted through the wakeup descriptor. */
+#define NMSSH_WAITSOCKET_INTERRUPTED (-2)
+
+/**
+ Wait up to 500ms for the socket to be ready in the direction libssh2 is
+ blocked on.
+ */
+int waitsocket(int socket_fd, LIBSSH2_SESSION *session);
+
+/**
+ Wait for the socket to be ready in the direction libssh2 is blocked on.
+
+ A negative timeout waits until the socket is ready. If wakeup_fd is a valid
+ descriptor the wait is interrupted as soon as it becomes readable.
+
+ Returns a positive value when the socket is ready, 0 on timeout,
+ NMSSH_WAITSOCKET_INTERRUPTED when interrupted and -1 on error.
+ */
+int waitsocket_timeout(int socket_fd, LIBSSH2_SESSION *session, int timeout_ms, int wakeup_fd);
+
+/**
+ Wait for the given poll() events on the socket, like waitsocket_timeout()
+ without a libssh2 session (e.g. while the TCP connection is established).
+ */
+int waitsocket_events(int socket_fd, short events, int timeout_ms, int wakeup_fd);
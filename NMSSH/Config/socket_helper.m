@@ -1,34 +1,59 @@
 #import "socket_helper.h"
 #import <Foundation/Foundation.h>
-#import <sys/time.h>
+#import <poll.h>
 
 int waitsocket(int socket_fd, LIBSSH2_SESSION *session) {
-    struct timeval timeout;
-
-    fd_set fd;
-    fd_set *writefd = NULL;
-    fd_set *readfd = NULL;
-
-    int rc;
-    int dir;
-    timeout.tv_sec = 0;
-    timeout.tv_usec = 500000;
+    return waitsocket_timeout(socket_fd, session, 500, -1);
+}
 
-    FD_ZERO(&fd);
-    FD_SET(socket_fd, &fd);
+int waitsocket_timeout(int socket_fd, LIBSSH2_SESSION *session, int timeout_ms, int wakeup_fd) {
+    short events = 0;
 
     // Now make sure we wait in the correct direction
-    dir = libssh2_session_block_directions(session);
+    int dir = libssh2_session_block_directions(session);
 
     if (dir & LIBSSH2_SESSION_BLOCK_INBOUND) {
-        readfd = &fd;
+        events |= POLLIN;
     }
 
     if (dir & LIBSSH2_SESSION_BLOCK_OUTBOUND) {
-        writefd = &fd;
+        events |= POLLOUT;
+    }
+
+    // Without a direction, wait for incoming data rather than spinning on a writable socket
+    if (events == 0) {
+        events = POLLIN;
+    }
+
+    return waitsocket_events(socket_fd, events, timeout_ms, wakeup_fd);
+}
+
+int waitsocket_events(int socket_fd, short events, int timeout_ms, int wakeup_fd) {
+    // poll() has no FD_SETSIZE limit, unlike select()
+    struct pollfd fds[2];
+    nfds_t nfds = 1;
+
+    fds[0].fd = socket_fd;
+    fds[0].events = events;
+    fds[0].revents = 0;
+
+    if (wakeup_fd >= 0) {
+        fds[1].fd = wakeup_fd;
+        fds[1].events = POLLIN;
+        fds[1].revents = 0;
+        nfds++;
+    }
+
+    int rc = poll(fds, nfds, timeout_ms < 0 ? -1 : timeout_ms);
+
+    if (rc < 0) {
+        // A signal is not a failure, let the caller re-evaluate its deadline
+        return errno == EINTR ? 0 : -1;
+    }
+
+    if (nfds > 1 && (fds[1].revents & POLLIN)) {
+        return NMSSH_WAITSOCKET_INTERRUPTED;
     }
 
-    rc = select(socket_fd + 1, readfd, writefd, NULL, &timeout);
-    
     return rc;
 }
@@ -1,6 +1,6 @@
 #import "NMSSH.h"
 
-@class NMSSHSession, NMSFTPFile;
+@class NMSSHSession, NMSFTPFile, NMSSHOperation;
 
 /**
  NMSFTP provides functionality for working with SFTP servers.
@@ -307,4 +307,249 @@
  */
 - (BOOL)copyContentsOfPath:(nonnull NSString *)fromPath toFileAtPath:(nonnull NSString *)toPath progress:(BOOL (^_Nullable)(NSUInteger copied, NSUInteger totalBytes))progress;
 
+/// ----------------------------------------------------------------------------
+/// @name Asynchronous operations
+/// ----------------------------------------------------------------------------
+
+/*
+ The asynchronous variants never block the calling thread. Their completion
+ blocks are called on the session's callback queue, progress blocks are called
+ on the session queue. Operations started on the same NMSFTP instance are run
+ one after the other, in the order they were started.
+ */
+
+/**
+ Create and connect to a SFTP session without blocking the calling thread.
+
+ @param completion The block called once the SFTP session is ready or failed
+ @returns The operation handle
+ */
+- (nonnull NMSSHOperation *)connectWithCompletion:(void (^_Nullable)(BOOL success, NSError *_Nullable error))completion;
+
+/**
+ Move or rename an item without blocking the calling thread.
+
+ @param sourcePath Item to move
+ @param destPath Destination to move to
+ @param completion The block called with the result
+ @returns The operation handle
+ */
+- (nonnull NMSSHOperation *)moveItemAtPath:(nonnull NSString *)sourcePath
+                                    toPath:(nonnull NSString *)destPath
+                                completion:(void (^_Nullable)(BOOL success, NSError *_Nullable error))completion;
+
+/**
+ Test if a directory exists at the specified path without blocking the calling
+ thread.
+
+ @param path Path to check
+ @param completion The block called with the result
+ @returns The operation handle
+ */
+- (nonnull NMSSHOperation *)directoryExistsAtPath:(nonnull NSString *)path
+                                       completion:(void (^_Nonnull)(BOOL exists, NSError *_Nullable error))completion;
+
+/**
+ Create a directory at path without blocking the calling thread.
+
+ @param path Path to directory
+ @param completion The block called with the result
+ @returns The operation handle
+ */
+- (nonnull NMSSHOperation *)createDirectoryAtPath:(nonnull NSString *)path
+                                       completion:(void (^_Nullable)(BOOL success, NSError *_Nullable error))completion;
+
+/**
+ Remove directory at path without blocking the calling thread.
+
+ @param path Existing directory
+ @param completion The block called with the result
+ @returns The operation handle
+ */
+- (nonnull NMSSHOperation *)removeDirectoryAtPath:(nonnull NSString *)path
+                                       completion:(void (^_Nullable)(BOOL success, NSError *_Nullable error))completion;
+
+/**
+ Get a list of files for a directory path without blocking the calling thread.
+
+ @param path Existing directory to list items from
+ @param completion The block called with the sorted list of files, `nil` on error
+ @returns The operation handle
+ */
+- (nonnull NMSSHOperation *)contentsOfDirectoryAtPath:(nonnull NSString *)path
+                                           completion:(void (^_Nonnull)(NSArray<NMSFTPFile *> *_Nullable contents, NSError *_Nullable error))completion;
+
+/**
+ Get information about a file without blocking the calling thread.
+
+ @param path Path to file
+ @param completion The block called with the file information, `nil` on error
+ @returns The operation handle
+ */
+- (nonnull NMSSHOperation *)infoForFileAtPath:(nonnull NSString *)path
+                                   completion:(void (^_Nonnull)(NMSFTPFile *_Nullable file, NSError *_Nullable error))completion;
+
+/**
+ Test if a file exists at the specified path without blocking the calling
+ thread.
+
+ @param path Path to check
+ @param completion The block called with the result
+ @returns The operation handle
+ */
+- (nonnull NMSSHOperation *)fileExistsAtPath:(nonnull NSString *)path
+                                  completion:(void (^_Nonnull)(BOOL exists, NSError *_Nullable error))completion;
+
+/**
+ Create a symbolic link without blocking the calling thread.
+
+ @param linkPath Path that will be linked to
+ @param destPath Path the link will be created at
+ @param completion The block called with the result
+ @returns The operation handle
+ */
+- (nonnull NMSSHOperation *)createSymbolicLinkAtPath:(nonnull NSString *)linkPath
+                                 withDestinationPath:(nonnull NSString *)destPath
+                                          completion:(void (^_Nullable)(BOOL success, NSError *_Nullable error))completion;
+
+/**
+ Remove file at path without blocking the calling thread.
+
+ @param path Path to existing file
+ @param completion The block called with the result
+ @returns The operation handle
+ */
+- (nonnull NMSSHOperation *)removeFileAtPath:(nonnull NSString *)path
+                                  completion:(void (^_Nullable)(BOOL success, NSError *_Nullable error))completion;
+
+/**
+ Read the contents of a file without blocking the calling thread.
+
+ @param path An existing file path
+ @param progress Method called periodically with number of bytes downloaded and total file size.
+        Returns NO to abort.
+ @param completion The block called with the file contents, `nil` on error
+ @returns The operation handle
+ */
+- (nonnull NMSSHOperation *)contentsAtPath:(nonnull NSString *)path
+                                  progress:(BOOL (^_Nullable)(NSUInteger got, NSUInteger totalBytes))progress
+                                completion:(void (^_Nonnull)(NSData *_Nullable contents, NSError *_Nullable error))completion;
+
+/**
+ Read the contents of a file into a stream without blocking the calling thread.
+
+ @param path An existing file path
+ @param outputStream Stream to write the contents to, written on the session queue
+ @param progress Method called periodically with number of bytes downloaded and total file size.
+        Returns NO to abort.
+ @param completion The block called with the result
+ @returns The operation handle
+ */
+- (nonnull NMSSHOperation *)contentsAtPath:(nonnull NSString *)path
+                                  toStream:(nonnull NSOutputStream *)outputStream
+                                  progress:(BOOL (^_Nullable)(NSUInteger got, NSUInteger totalBytes))progress
+                                completion:(void (^_Nullable)(BOOL success, NSError *_Nullable error))completion;
+
+/**
+ Resume reading the contents of a file into a stream without blocking the
+ calling thread.
+
+ Bytes before _offset_ are skipped, e.g. the ones a previous, interrupted
+ download already wrote to the stream.
+
+ @param path An existing file path
+ @param outputStream Stream to write the contents to, written on the session queue
+ @param offset Position in the file to start reading at
+ @param progress Method called periodically with the position reached in the file and total file size.
+        Returns NO to abort.
+ @param completion The block called with the result
+ @returns The operation handle
+ */
+- (nonnull NMSSHOperation *)contentsAtPath:(nonnull NSString *)path
+                                  toStream:(nonnull NSOutputStream *)outputStream
+                                fromOffset:(unsigned long long)offset
+                                  progress:(BOOL (^_Nullable)(NSUInteger got, NSUInteger totalBytes))progress
+                                completion:(void (^_Nullable)(BOOL success, NSError *_Nullable error))completion;
+
+/**
+ Overwrite the contents of a file without blocking the calling thread.
+
+ If no file exists, one is created.
+
+ @param contents Bytes to write
+ @param path File path to write bytes at
+ @param progress Method called periodically with number of bytes sent. Returns NO to abort.
+ @param completion The block called with the result
+ @returns The operation handle
+ */
+- (nonnull NMSSHOperation *)writeContents:(nonnull NSData *)contents
+                             toFileAtPath:(nonnull NSString *)path
+                                 progress:(BOOL (^_Nullable)(NSUInteger sent))progress
+                               completion:(void (^_Nullable)(BOOL success, NSError *_Nullable error))completion;
+
+/**
+ Overwrite the contents of a file with a local file without blocking the
+ calling thread.
+
+ If no file exists, one is created.
+
+ @param localPath File path to read bytes at
+ @param path File path to write bytes at
+ @param progress Method called periodically with number of bytes sent. Returns NO to abort.
+ @param completion The block called with the result
+ @returns The operation handle
+ */
+- (nonnull NMSSHOperation *)writeFileAtPath:(nonnull NSString *)localPath
+                               toFileAtPath:(nonnull NSString *)path
+                                   progress:(BOOL (^_Nullable)(NSUInteger sent))progress
+                                 completion:(void (^_Nullable)(BOOL success, NSError *_Nullable error))completion;
+
+/**
+ Overwrite the contents of a file with a stream without blocking the calling
+ thread.
+
+ If no file exists, one is created.
+
+ @param inputStream Stream to read bytes from, read on the session queue
+ @param path File path to write bytes at
+ @param progress Method called periodically with number of bytes sent. Returns NO to abort.
+ @param completion The block called with the result
+ @returns The operation handle
+ */
+- (nonnull NMSSHOperation *)writeStream:(nonnull NSInputStream *)inputStream
+                           toFileAtPath:(nonnull NSString *)path
+                               progress:(BOOL (^_Nullable)(NSUInteger sent))progress
+                             completion:(void (^_Nullable)(BOOL success, NSError *_Nullable error))completion;
+
+/**
+ Resume the upload of a stream without blocking the calling thread.
+
+ The stream is read from the current size of the remote file.
+
+ @param inputStream Stream to read bytes from, read on the session queue
+ @param path File path to write bytes at
+ @param progress Method called periodically with number of bytes sent and the total size of the file.
+        Returns NO to abort.
+ @param completion The block called with the result
+ @returns The operation handle
+ */
+- (nonnull NMSSHOperation *)resumeStream:(nonnull NSInputStream *)inputStream
+                            toFileAtPath:(nonnull NSString *)path
+                                progress:(BOOL (^_Nullable)(NSUInteger delta, NSUInteger totalBytes))progress
+                              completion:(void (^_Nullable)(BOOL success, NSError *_Nullable error))completion;
+
+/**
+ Append a stream to the end of a file without blocking the calling thread.
+
+ If no file exists, one is created.
+
+ @param inputStream Stream to read bytes from, read on the session queue
+ @param path File path to write bytes at
+ @param completion The block called with the result
+ @returns The operation handle
+ */
+- (nonnull NMSSHOperation *)appendStream:(nonnull NSInputStream *)inputStream
+                            toFileAtPath:(nonnull NSString *)path
+                              completion:(void (^_Nullable)(BOOL success, NSError *_Nullable error))completion;
+
 @end
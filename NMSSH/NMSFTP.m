@@ -1,10 +1,26 @@
 #import "NMSFTP.h"
 #import "NMSSH+Protected.h"
 
+/** Steps of the asynchronous file operations */
+typedef NS_ENUM(NSInteger, NMSFTPStep) {
+    NMSFTPStepOpen,
+    NMSFTPStepStat,
+    NMSFTPStepTransfer,
+    NMSFTPStepClose
+};
+
+/** Where the asynchronous uploads start writing */
+typedef NS_ENUM(NSInteger, NMSFTPWriteMode) {
+    NMSFTPWriteModeTruncate,
+    NMSFTPWriteModeAppend,
+    NMSFTPWriteModeResume
+};
+
 @interface NMSFTP ()
 @property (nonatomic, strong) NMSSHSession *session;
 @property (nonatomic, assign) LIBSSH2_SFTP *sftpSession;
 @property (nonatomic, readwrite, getter = isConnected) BOOL connected;
+@property (nonatomic, strong) NSMutableArray *pendingOperations;
 
 - (BOOL)writeStream:(NSInputStream *)inputStream toSFTPHandle:(LIBSSH2_SFTP_HANDLE *)handle;
 - (BOOL)writeStream:(NSInputStream *)inputStream toSFTPHandle:(LIBSSH2_SFTP_HANDLE *)handle progress:(BOOL (^)(NSUInteger))progress;
@@ -28,6 +44,7 @@
 - (instancetype)initWithSession:(NMSSHSession *)session {
     if ((self = [super init])) {
         [self setSession:session];
+        [self setPendingOperations:[[NSMutableArray alloc] init]];
 
         // Make sure we were provided a valid session
         if (![session isKindOfClass:[NMSSHSession class]]) {
@@ -43,10 +60,16 @@
 // -----------------------------------------------------------------------------
 
 - (BOOL)connect {
+    // Keepalive probes wait for each call of the synchronous API, not for the
+    // idle time between them
+    NMSSHSession *session = self.session;
+    [session beginSynchronousCall];
+
     // Set blocking mode
-    libssh2_session_set_blocking(self.session.rawSession, 1);
+    libssh2_session_set_blocking(session.rawSession, 1);
 
-    [self setSftpSession:libssh2_sftp_init(self.session.rawSession)];
+    [self setSftpSession:libssh2_sftp_init(session.rawSession)];
+    [session endSynchronousCall];
 
     if (!self.sftpSession) {
         NMSSHLogError(@"Unable to init SFTP session");
@@ -60,7 +83,11 @@
 }
 
 - (void)disconnect {
+    NMSSHSession *session = self.session;
+    [session beginSynchronousCall];
     libssh2_sftp_shutdown(self.sftpSession);
+    [session endSynchronousCall];
+
     [self setConnected:NO];
 }
 
@@ -69,7 +96,12 @@
 // -----------------------------------------------------------------------------
 
 - (BOOL)moveItemAtPath:(NSString *)sourcePath toPath:(NSString *)destPath {
-    return libssh2_sftp_rename(self.sftpSession, [sourcePath UTF8String], [destPath UTF8String]) == 0;
+    NMSSHSession *session = self.session;
+    [session beginSynchronousCall];
+    int rc = libssh2_sftp_rename(self.sftpSession, [sourcePath UTF8String], [destPath UTF8String]);
+    [session endSynchronousCall];
+
+    return rc == 0;
 }
 
 // -----------------------------------------------------------------------------
@@ -92,6 +124,15 @@
 }
 
 - (BOOL)directoryExistsAtPath:(NSString *)path {
+    NMSSHSession *session = self.session;
+    [session beginSynchronousCall];
+    BOOL exists = [self isDirectoryAtPath:path];
+    [session endSynchronousCall];
+
+    return exists;
+}
+
+- (BOOL)isDirectoryAtPath:(NSString *)path {
     LIBSSH2_SFTP_HANDLE *handle = [self openFileAtPath:path flags:LIBSSH2_FXF_READ mode:0];
 
     if (!handle) {
@@ -106,19 +147,36 @@
 }
 
 - (BOOL)createDirectoryAtPath:(NSString *)path {
+    NMSSHSession *session = self.session;
+    [session beginSynchronousCall];
     int rc = libssh2_sftp_mkdir(self.sftpSession, [path UTF8String],
                                 LIBSSH2_SFTP_S_IRWXU|
                                 LIBSSH2_SFTP_S_IRGRP|LIBSSH2_SFTP_S_IXGRP|
                                 LIBSSH2_SFTP_S_IROTH|LIBSSH2_SFTP_S_IXOTH);
+    [session endSynchronousCall];
 
     return rc == 0;
 }
 
 - (BOOL)removeDirectoryAtPath:(NSString *)path {
-    return libssh2_sftp_rmdir(self.sftpSession, [path UTF8String]) == 0;
+    NMSSHSession *session = self.session;
+    [session beginSynchronousCall];
+    int rc = libssh2_sftp_rmdir(self.sftpSession, [path UTF8String]);
+    [session endSynchronousCall];
+
+    return rc == 0;
 }
 
 - (NSArray *)contentsOfDirectoryAtPath:(NSString *)path {
+    NMSSHSession *session = self.session;
+    [session beginSynchronousCall];
+    NSArray *contents = [self readDirectoryAtPath:path];
+    [session endSynchronousCall];
+
+    return contents;
+}
+
+- (NSArray *)readDirectoryAtPath:(NSString *)path {
     LIBSSH2_SFTP_HANDLE *handle = [self openDirectoryAtPath:path];
 
     if (!handle) {
@@ -170,6 +228,15 @@
 // -----------------------------------------------------------------------------
 
 - (NMSFTPFile *)infoForFileAtPath:(NSString *)path {
+    NMSSHSession *session = self.session;
+    [session beginSynchronousCall];
+    NMSFTPFile *file = [self statFileAtPath:path];
+    [session endSynchronousCall];
+
+    return file;
+}
+
+- (NMSFTPFile *)statFileAtPath:(NSString *)path {
     LIBSSH2_SFTP_HANDLE *handle = [self openFileAtPath:path flags:LIBSSH2_FXF_READ mode:0];
 
     if (!handle) {
@@ -206,6 +273,15 @@
 }
 
 - (BOOL)fileExistsAtPath:(NSString *)path {
+    NMSSHSession *session = self.session;
+    [session beginSynchronousCall];
+    BOOL exists = [self isFileAtPath:path];
+    [session endSynchronousCall];
+
+    return exists;
+}
+
+- (BOOL)isFileAtPath:(NSString *)path {
     LIBSSH2_SFTP_HANDLE *handle = [self openFileAtPath:path flags:LIBSSH2_FXF_READ mode:0];
 
     if (!handle) {
@@ -221,13 +297,21 @@
 
 - (BOOL)createSymbolicLinkAtPath:(NSString *)linkPath
              withDestinationPath:(NSString *)destPath {
+    NMSSHSession *session = self.session;
+    [session beginSynchronousCall];
     int rc = libssh2_sftp_symlink(self.sftpSession, [destPath UTF8String], (char *)[linkPath UTF8String]);
+    [session endSynchronousCall];
 
     return rc == 0;
 }
 
 - (BOOL)removeFileAtPath:(NSString *)path {
-    return libssh2_sftp_unlink(self.sftpSession, [path UTF8String]) == 0;
+    NMSSHSession *session = self.session;
+    [session beginSynchronousCall];
+    int rc = libssh2_sftp_unlink(self.sftpSession, [path UTF8String]);
+    [session endSynchronousCall];
+
+    return rc == 0;
 }
 
 - (NSData *)contentsAtPath:(NSString *)path {
@@ -251,13 +335,22 @@
 }
 
 - (BOOL)readContentsAtPath:(NSString *)path toStream:(NSOutputStream *)outputStream progress:(BOOL (^)(NSUInteger, NSUInteger))progress {
+    NMSSHSession *session = self.session;
+    [session beginSynchronousCall];
+    BOOL success = [self downloadContentsAtPath:path toStream:outputStream progress:progress];
+    [session endSynchronousCall];
+
+    return success;
+}
+
+- (BOOL)downloadContentsAtPath:(NSString *)path toStream:(NSOutputStream *)outputStream progress:(BOOL (^)(NSUInteger, NSUInteger))progress {
     LIBSSH2_SFTP_HANDLE *handle = [self openFileAtPath:path flags:LIBSSH2_FXF_READ mode:0];
     
     if (!handle) {
         return NO;
     }
     
-    NMSFTPFile *file = [self infoForFileAtPath:path];
+    NMSFTPFile *file = [self statFileAtPath:path];
     if (!file) {
         NMSSHLogWarn(@"contentsAtPath:progress: failed to get file attributes");
         return NO;
@@ -323,6 +416,15 @@
 }
 
 - (BOOL)writeStream:(NSInputStream *)inputStream toFileAtPath:(NSString *)path progress:(BOOL (^)(NSUInteger))progress {
+    NMSSHSession *session = self.session;
+    [session beginSynchronousCall];
+    BOOL success = [self uploadStream:inputStream toFileAtPath:path progress:progress];
+    [session endSynchronousCall];
+
+    return success;
+}
+
+- (BOOL)uploadStream:(NSInputStream *)inputStream toFileAtPath:(NSString *)path progress:(BOOL (^)(NSUInteger))progress {
     if ([inputStream streamStatus] == NSStreamStatusNotOpen) {
         [inputStream open];
     }
@@ -354,6 +456,15 @@
 }
 
 - (BOOL)resumeStream:(NSInputStream *)inputStream toFileAtPath:(NSString *)path progress:(BOOL (^)( NSUInteger, NSUInteger ))progress {
+    NMSSHSession *session = self.session;
+    [session beginSynchronousCall];
+    BOOL success = [self uploadRemainderOfStream:inputStream toFileAtPath:path progress:progress];
+    [session endSynchronousCall];
+
+    return success;
+}
+
+- (BOOL)uploadRemainderOfStream:(NSInputStream *)inputStream toFileAtPath:(NSString *)path progress:(BOOL (^)( NSUInteger, NSUInteger ))progress {
     if ([inputStream streamStatus] == NSStreamStatusNotOpen) {
         [inputStream open];
     }
@@ -433,6 +544,15 @@
 }
 
 - (BOOL)appendStream:(NSInputStream *)inputStream toFileAtPath:(NSString *)path {
+    NMSSHSession *session = self.session;
+    [session beginSynchronousCall];
+    BOOL success = [self uploadStream:inputStream appendingToFileAtPath:path];
+    [session endSynchronousCall];
+
+    return success;
+}
+
+- (BOOL)uploadStream:(NSInputStream *)inputStream appendingToFileAtPath:(NSString *)path {
     if ([inputStream streamStatus] == NSStreamStatusNotOpen) {
         [inputStream open];
     }
@@ -507,7 +627,16 @@
     return YES;
 }
 
-- (BOOL)copyContentsOfPath:(NSString *)fromPath toFileAtPath:(NSString *)toPath progress:(BOOL (^)(NSUInteger, NSUInteger))progress
+- (BOOL)copyContentsOfPath:(NSString *)fromPath toFileAtPath:(NSString *)toPath progress:(BOOL (^)(NSUInteger, NSUInteger))progress {
+    NMSSHSession *session = self.session;
+    [session beginSynchronousCall];
+    BOOL success = [self duplicateContentsOfPath:fromPath toFileAtPath:toPath progress:progress];
+    [session endSynchronousCall];
+
+    return success;
+}
+
+- (BOOL)duplicateContentsOfPath:(NSString *)fromPath toFileAtPath:(NSString *)toPath progress:(BOOL (^)(NSUInteger, NSUInteger))progress
 {
     // Open handle for reading.
     LIBSSH2_SFTP_HANDLE *fromHandle = [self openFileAtPath:fromPath flags:LIBSSH2_FXF_READ mode:0];
@@ -555,4 +684,661 @@
     return YES;
 }
 
+// -----------------------------------------------------------------------------
+#pragma mark - ASYNCHRONOUS OPERATIONS
+// -----------------------------------------------------------------------------
+
+- (NMSSHOperation *)startOperationWithStep:(NMSSHOperationStatus (^)(NMSFTP *sftp, NMSSHOperation *operation))step {
+    __weak NMSFTP *weakSelf = self;
+    __block BOOL queued = NO;
+
+    NMSSHOperation *operation = [NMSSHOperation operationWithSession:self.session step:^NMSSHOperationStatus(NMSSHOperation *operation) {
+        NMSFTP *sftp = weakSelf;
+
+        // Nobody is left to report to
+        if (!sftp) {
+            return NMSSHOperationStatusDone;
+        }
+
+        // libssh2 keeps the state of a pending request in the SFTP session, run them one at a time
+        if (!queued) {
+            [sftp.pendingOperations addObject:operation];
+            queued = YES;
+        }
+
+        // Operations that never started can give up right away
+        if ([sftp.pendingOperations firstObject] != operation && !operation.abortError) {
+            return NMSSHOperationStatusBlocked;
+        }
+
+        NMSSHOperationStatus status = step(sftp, operation);
+
+        if (status == NMSSHOperationStatusDone) {
+            [sftp.pendingOperations removeObjectIdenticalTo:operation];
+        }
+
+        return status;
+    }];
+
+    [self.session startOperation:operation];
+
+    return operation;
+}
+
+- (NSError *)errorForOperation:(NMSSHOperation *)operation pending:(BOOL)pending {
+    // A request already sent must complete before giving up
+    if (operation.abortError && !(pending && operation.session.rawSession)) {
+        return operation.abortError;
+    }
+
+    if (!self.isConnected) {
+        return [NMSSHOperation errorWithCode:NMSSHOperationFailedError description:@"SFTP session not connected"];
+    }
+
+    return nil;
+}
+
+- (BOOL)lastRequestWouldBlock {
+    return self.session.rawSession && libssh2_session_last_errno(self.session.rawSession) == LIBSSH2_ERROR_EAGAIN;
+}
+
+- (void (^)(BOOL, NSError *))callbackForCompletion:(void (^)(BOOL, NSError *))completion {
+    __weak NMSSHSession *session = self.session;
+
+    return ^(BOOL success, NSError *error) {
+        if (completion) {
+            [session dispatchCallback:^{
+                completion(success, error);
+            }];
+        }
+    };
+}
+
+- (NMSSHOperation *)performRequest:(int (^)(LIBSSH2_SFTP *sftpSession))request
+                        completion:(void (^)(BOOL, NSError *))completion {
+    __block BOOL pending = NO;
+
+    return [self startOperationWithStep:^NMSSHOperationStatus(NMSFTP *sftp, NMSSHOperation *operation) {
+        NSError *error = [sftp errorForOperation:operation pending:pending];
+
+        if (!error) {
+            int rc = request(sftp.sftpSession);
+
+            if ((pending = (rc == LIBSSH2_ERROR_EAGAIN))) {
+                return NMSSHOperationStatusBlocked;
+            }
+
+            if (rc) {
+                error = [sftp.session lastError];
+            }
+        }
+
+        completion(error == nil, error);
+
+        return NMSSHOperationStatusDone;
+    }];
+}
+
+- (NMSSHOperation *)attributesAtPath:(NSString *)path
+                          completion:(void (^)(LIBSSH2_SFTP_ATTRIBUTES *, NSError *))completion {
+    __block LIBSSH2_SFTP_ATTRIBUTES attributes;
+
+    // A single stat request rather than the open/fstat/close of the synchronous API
+    return [self performRequest:^int(LIBSSH2_SFTP *sftpSession) {
+        return libssh2_sftp_stat_ex(sftpSession, [path UTF8String], (unsigned int)strlen([path UTF8String]),
+                                    LIBSSH2_SFTP_STAT, &attributes);
+    } completion:^(BOOL success, NSError *error) {
+        completion(success ? &attributes : NULL, error);
+    }];
+}
+
+- (NMSSHOperation *)connectWithCompletion:(void (^)(BOOL, NSError *))completion {
+    void (^callback)(BOOL, NSError *) = [self callbackForCompletion:completion];
+    __block BOOL pending = NO;
+
+    return [self startOperationWithStep:^NMSSHOperationStatus(NMSFTP *sftp, NMSSHOperation *operation) {
+        NMSSHSession *session = operation.session;
+        NSError *error = (pending && session.rawSession ? nil : operation.abortError);
+
+        if (!error && !sftp.isConnected) {
+            // Starting the subsystem opens a channel
+            if (![session acquireRequestLockForOperation:operation]) {
+                return NMSSHOperationStatusBlocked;
+            }
+
+            LIBSSH2_SFTP *sftpSession = libssh2_sftp_init(session.rawSession);
+
+            if ((pending = (!sftpSession && [sftp lastRequestWouldBlock]))) {
+                return NMSSHOperationStatusBlocked;
+            }
+
+            if (sftpSession) {
+                [sftp setSftpSession:sftpSession];
+                [sftp setConnected:YES];
+                [sftp setBufferSize:kNMSSHBufferSize];
+            }
+            else {
+                NMSSHLogError(@"Unable to init SFTP session");
+                error = [session lastError];
+            }
+        }
+
+        callback(error == nil, error);
+
+        return NMSSHOperationStatusDone;
+    }];
+}
+
+- (NMSSHOperation *)moveItemAtPath:(NSString *)sourcePath toPath:(NSString *)destPath completion:(void (^)(BOOL, NSError *))completion {
+    return [self performRequest:^int(LIBSSH2_SFTP *sftpSession) {
+        return libssh2_sftp_rename(sftpSession, [sourcePath UTF8String], [destPath UTF8String]);
+    } completion:[self callbackForCompletion:completion]];
+}
+
+- (NMSSHOperation *)directoryExistsAtPath:(NSString *)path completion:(void (^)(BOOL, NSError *))completion {
+    void (^callback)(BOOL, NSError *) = [self callbackForCompletion:completion];
+
+    return [self attributesAtPath:path completion:^(LIBSSH2_SFTP_ATTRIBUTES *attributes, NSError *error) {
+        callback(attributes && LIBSSH2_SFTP_S_ISDIR(attributes->permissions), error);
+    }];
+}
+
+- (NMSSHOperation *)createDirectoryAtPath:(NSString *)path completion:(void (^)(BOOL, NSError *))completion {
+    return [self performRequest:^int(LIBSSH2_SFTP *sftpSession) {
+        return libssh2_sftp_mkdir(sftpSession, [path UTF8String],
+                                  LIBSSH2_SFTP_S_IRWXU|
+                                  LIBSSH2_SFTP_S_IRGRP|LIBSSH2_SFTP_S_IXGRP|
+                                  LIBSSH2_SFTP_S_IROTH|LIBSSH2_SFTP_S_IXOTH);
+    } completion:[self callbackForCompletion:completion]];
+}
+
+- (NMSSHOperation *)removeDirectoryAtPath:(NSString *)path completion:(void (^)(BOOL, NSError *))completion {
+    return [self performRequest:^int(LIBSSH2_SFTP *sftpSession) {
+        return libssh2_sftp_rmdir(sftpSession, [path UTF8String]);
+    } completion:[self callbackForCompletion:completion]];
+}
+
+- (NMSSHOperation *)contentsOfDirectoryAtPath:(NSString *)path completion:(void (^)(NSArray *, NSError *))completion {
+    NSArray *ignoredFiles = @[@".", @".."];
+    NSMutableArray *contents = [NSMutableArray array];
+    __weak NMSSHSession *session = self.session;
+
+    __block NMSFTPStep step = NMSFTPStepOpen;
+    __block LIBSSH2_SFTP_HANDLE *handle = NULL;
+    __block BOOL pending = NO;
+    __block NSError *failure = nil;
+
+    return [self startOperationWithStep:^NMSSHOperationStatus(NMSFTP *sftp, NMSSHOperation *operation) {
+        BOOL worked = NO;
+        int rc;
+
+        // The handle went away with the SFTP session
+        if (!sftp.isConnected || !operation.session.rawSession) {
+            handle = NULL;
+        }
+
+        while (!failure && step < NMSFTPStepClose) {
+            // Cancel and deadline are honored between requests, not only on entry
+            if ((failure = [sftp errorForOperation:operation pending:pending])) {
+                break;
+            }
+
+            if (step == NMSFTPStepOpen) {
+                handle = libssh2_sftp_opendir(sftp.sftpSession, [path UTF8String]);
+
+                if ((pending = (!handle && [sftp lastRequestWouldBlock]))) {
+                    return NMSSHOperationStatusForProgress(worked);
+                }
+
+                if (!handle) {
+                    NMSSHLogError(@"Could not open directory at path %@", path);
+                    failure = [sftp.session lastError];
+                    break;
+                }
+
+                step = NMSFTPStepTransfer;
+            }
+            else {
+                char buffer[512];
+                LIBSSH2_SFTP_ATTRIBUTES fileAttributes;
+
+                rc = libssh2_sftp_readdir(handle, buffer, sizeof(buffer), &fileAttributes);
+
+                if ((pending = (rc == LIBSSH2_ERROR_EAGAIN))) {
+                    return NMSSHOperationStatusForProgress(worked);
+                }
+
+                if (rc < 0) {
+                    NMSSHLogError(@"Unable to read directory");
+                    failure = [sftp.session lastError];
+                    break;
+                }
+
+                if (rc == 0) {
+                    step = NMSFTPStepClose;
+                    break;
+                }
+
+                NSString *fileName = [[NSString alloc] initWithBytes:buffer length:rc encoding:NSUTF8StringEncoding];
+                if (![ignoredFiles containsObject:fileName]) {
+                    // Append a "/" at the end of all directories
+                    if (LIBSSH2_SFTP_S_ISDIR(fileAttributes.permissions)) {
+                        fileName = [fileName stringByAppendingString:@"/"];
+                    }
+
+                    NMSFTPFile *file = [[NMSFTPFile alloc] initWithFilename:fileName];
+                    [file populateValuesFromSFTPAttributes:fileAttributes];
+                    [contents addObject:file];
+                }
+            }
+
+            worked = YES;
+        }
+
+        if (handle) {
+            rc = libssh2_sftp_closedir(handle);
+
+            if ((pending = (rc == LIBSSH2_ERROR_EAGAIN))) {
+                return NMSSHOperationStatusForProgress(worked);
+            }
+
+            if (rc < 0) {
+                NMSSHLogError(@"Failed to close directory");
+            }
+
+            handle = NULL;
+        }
+
+        NSArray *result = (failure ? nil : [contents sortedArrayUsingComparator:^NSComparisonResult(id obj1, id obj2) {
+            return [obj1 compare:obj2];
+        }]);
+        NSError *error = failure;
+
+        [session dispatchCallback:^{
+            completion(result, error);
+        }];
+
+        return NMSSHOperationStatusDone;
+    }];
+}
+
+- (NMSSHOperation *)infoForFileAtPath:(NSString *)path completion:(void (^)(NMSFTPFile *, NSError *))completion {
+    __weak NMSSHSession *session = self.session;
+
+    return [self attributesAtPath:path completion:^(LIBSSH2_SFTP_ATTRIBUTES *attributes, NSError *error) {
+        NMSFTPFile *file = nil;
+
+        if (attributes) {
+            file = [[NMSFTPFile alloc] initWithFilename:path.lastPathComponent];
+            [file populateValuesFromSFTPAttributes:*attributes];
+        }
+
+        [session dispatchCallback:^{
+            completion(file, error);
+        }];
+    }];
+}
+
+- (NMSSHOperation *)fileExistsAtPath:(NSString *)path completion:(void (^)(BOOL, NSError *))completion {
+    void (^callback)(BOOL, NSError *) = [self callbackForCompletion:completion];
+
+    return [self attributesAtPath:path completion:^(LIBSSH2_SFTP_ATTRIBUTES *attributes, NSError *error) {
+        callback(attributes && !LIBSSH2_SFTP_S_ISDIR(attributes->permissions), error);
+    }];
+}
+
+- (NMSSHOperation *)createSymbolicLinkAtPath:(NSString *)linkPath
+                         withDestinationPath:(NSString *)destPath
+                                  completion:(void (^)(BOOL, NSError *))completion {
+    return [self performRequest:^int(LIBSSH2_SFTP *sftpSession) {
+        return libssh2_sftp_symlink(sftpSession, [destPath UTF8String], (char *)[linkPath UTF8String]);
+    } completion:[self callbackForCompletion:completion]];
+}
+
+- (NMSSHOperation *)removeFileAtPath:(NSString *)path completion:(void (^)(BOOL, NSError *))completion {
+    return [self performRequest:^int(LIBSSH2_SFTP *sftpSession) {
+        return libssh2_sftp_unlink(sftpSession, [path UTF8String]);
+    } completion:[self callbackForCompletion:completion]];
+}
+
+- (NMSSHOperation *)contentsAtPath:(NSString *)path
+                          progress:(BOOL (^)(NSUInteger, NSUInteger))progress
+                        completion:(void (^)(NSData *, NSError *))completion {
+    NSOutputStream *outputStream = [NSOutputStream outputStreamToMemory];
+    __weak NMSSHSession *session = self.session;
+
+    return [self readContentsAtPath:path toStream:outputStream offset:0 progress:progress completion:^(BOOL success, NSError *error) {
+        NSData *contents = (success ? [outputStream propertyForKey:NSStreamDataWrittenToMemoryStreamKey] : nil);
+
+        [session dispatchCallback:^{
+            completion(contents, error);
+        }];
+    }];
+}
+
+- (NMSSHOperation *)contentsAtPath:(NSString *)path
+                          toStream:(NSOutputStream *)outputStream
+                          progress:(BOOL (^)(NSUInteger, NSUInteger))progress
+                        completion:(void (^)(BOOL, NSError *))completion {
+    return [self readContentsAtPath:path toStream:outputStream offset:0 progress:progress
+                         completion:[self callbackForCompletion:completion]];
+}
+
+- (NMSSHOperation *)contentsAtPath:(NSString *)path
+                          toStream:(NSOutputStream *)outputStream
+                        fromOffset:(unsigned long long)offset
+                          progress:(BOOL (^)(NSUInteger, NSUInteger))progress
+                        completion:(void (^)(BOOL, NSError *))completion {
+    return [self readContentsAtPath:path toStream:outputStream offset:offset progress:progress
+                         completion:[self callbackForCompletion:completion]];
+}
+
+- (NMSSHOperation *)readContentsAtPath:(NSString *)path
+                              toStream:(NSOutputStream *)outputStream
+                                offset:(unsigned long long)offset
+                              progress:(BOOL (^)(NSUInteger, NSUInteger))progress
+                            completion:(void (^)(BOOL, NSError *))completion {
+    NSMutableData *buffer = [[NSMutableData alloc] initWithLength:self.bufferSize];
+
+    __block NMSFTPStep step = NMSFTPStepOpen;
+    __block LIBSSH2_SFTP_HANDLE *handle = NULL;
+    __block LIBSSH2_SFTP_ATTRIBUTES attributes;
+    __block NSUInteger got = (NSUInteger)offset;
+    __block BOOL pending = NO;
+    __block NSError *failure = nil;
+
+    return [self startOperationWithStep:^NMSSHOperationStatus(NMSFTP *sftp, NMSSHOperation *operation) {
+        BOOL worked = NO;
+        ssize_t rc;
+
+        // The handle went away with the SFTP session
+        if (!sftp.isConnected || !operation.session.rawSession) {
+            handle = NULL;
+        }
+
+        while (!failure && step < NMSFTPStepClose) {
+            // Cancel and deadline are honored between requests, not only on entry
+            if ((failure = [sftp errorForOperation:operation pending:pending])) {
+                break;
+            }
+
+            switch (step) {
+                case NMSFTPStepOpen:
+                    handle = libssh2_sftp_open(sftp.sftpSession, [path UTF8String], LIBSSH2_FXF_READ, 0);
+
+                    if ((pending = (!handle && [sftp lastRequestWouldBlock]))) {
+                        return NMSSHOperationStatusForProgress(worked);
+                    }
+
+                    if (!handle) {
+                        NMSSHLogError(@"Could not open file at path %@", path);
+                        failure = [sftp.session lastError];
+                        break;
+                    }
+
+                    if (offset > 0) {
+                        libssh2_sftp_seek64(handle, offset);
+                    }
+
+                    if ([outputStream streamStatus] == NSStreamStatusNotOpen) {
+                        [outputStream open];
+                    }
+
+                    step = NMSFTPStepStat;
+                    break;
+
+                case NMSFTPStepStat:
+                    rc = libssh2_sftp_fstat(handle, &attributes);
+
+                    if ((pending = (rc == LIBSSH2_ERROR_EAGAIN))) {
+                        return NMSSHOperationStatusForProgress(worked);
+                    }
+
+                    if (rc < 0) {
+                        NMSSHLogWarn(@"contentsAtPath:progress: failed to get file attributes");
+                        failure = [sftp.session lastError];
+                        break;
+                    }
+
+                    step = NMSFTPStepTransfer;
+                    break;
+
+                default: {
+                    rc = libssh2_sftp_read(handle, [buffer mutableBytes], [buffer length]);
+
+                    if ((pending = (rc == LIBSSH2_ERROR_EAGAIN))) {
+                        return NMSSHOperationStatusForProgress(worked);
+                    }
+
+                    if (rc < 0) {
+                        failure = [sftp.session lastError];
+                        break;
+                    }
+
+                    if (rc == 0) {
+                        step = NMSFTPStepClose;
+                        break;
+                    }
+
+                    NSUInteger written = 0;
+                    NSInteger writeResult;
+                    do {
+                        writeResult = [outputStream write:(const uint8_t *)[buffer bytes] + written maxLength:rc - written];
+                        written += MAX(0, writeResult);
+                    } while (written < rc && writeResult > 0);
+
+                    if (written < rc) {
+                        failure = [outputStream streamError] ?: [NMSSHOperation errorWithCode:NMSSHOperationFailedError
+                                                                                  description:@"Unable to write to the stream"];
+                        break;
+                    }
+
+                    got += rc;
+                    if (progress && !progress(got, (NSUInteger)attributes.filesize)) {
+                        failure = [NMSSHOperation errorWithCode:NMSSHOperationCancelledError description:@"Download cancelled"];
+                    }
+                    break;
+                }
+            }
+
+            worked = YES;
+        }
+
+        // Release the handle even when the transfer failed
+        if (handle) {
+            if ((pending = (libssh2_sftp_close_handle(handle) == LIBSSH2_ERROR_EAGAIN))) {
+                return NMSSHOperationStatusForProgress(worked);
+            }
+
+            handle = NULL;
+        }
+
+        [outputStream close];
+        completion(failure == nil, failure);
+
+        return NMSSHOperationStatusDone;
+    }];
+}
+
+- (NMSSHOperation *)writeContents:(NSData *)contents
+                     toFileAtPath:(NSString *)path
+                         progress:(BOOL (^)(NSUInteger))progress
+                       completion:(void (^)(BOOL, NSError *))completion {
+    return [self writeStream:[NSInputStream inputStreamWithData:contents] toFileAtPath:path progress:progress completion:completion];
+}
+
+- (NMSSHOperation *)writeFileAtPath:(NSString *)localPath
+                       toFileAtPath:(NSString *)path
+                           progress:(BOOL (^)(NSUInteger))progress
+                         completion:(void (^)(BOOL, NSError *))completion {
+    return [self writeStream:[NSInputStream inputStreamWithFileAtPath:localPath] toFileAtPath:path progress:progress completion:completion];
+}
+
+- (NMSSHOperation *)writeStream:(NSInputStream *)inputStream
+                   toFileAtPath:(NSString *)path
+                       progress:(BOOL (^)(NSUInteger))progress
+                     completion:(void (^)(BOOL, NSError *))completion {
+    return [self writeStream:inputStream toFileAtPath:path mode:NMSFTPWriteModeTruncate progress:^BOOL(NSUInteger sent, NSUInteger total) {
+        return !progress || progress(sent);
+    } completion:[self callbackForCompletion:completion]];
+}
+
+- (NMSSHOperation *)resumeStream:(NSInputStream *)inputStream
+                    toFileAtPath:(NSString *)path
+                        progress:(BOOL (^)(NSUInteger, NSUInteger))progress
+                      completion:(void (^)(BOOL, NSError *))completion {
+    return [self writeStream:inputStream toFileAtPath:path mode:NMSFTPWriteModeResume progress:progress
+                  completion:[self callbackForCompletion:completion]];
+}
+
+- (NMSSHOperation *)appendStream:(NSInputStream *)inputStream
+                    toFileAtPath:(NSString *)path
+                      completion:(void (^)(BOOL, NSError *))completion {
+    return [self writeStream:inputStream toFileAtPath:path mode:NMSFTPWriteModeAppend progress:nil
+                  completion:[self callbackForCompletion:completion]];
+}
+
+- (NMSSHOperation *)writeStream:(NSInputStream *)inputStream
+                   toFileAtPath:(NSString *)path
+                           mode:(NMSFTPWriteMode)mode
+                       progress:(BOOL (^)(NSUInteger, NSUInteger))progress
+                     completion:(void (^)(BOOL, NSError *))completion {
+    NSMutableData *buffer = [[NSMutableData alloc] initWithLength:self.bufferSize];
+    unsigned long flags = LIBSSH2_FXF_WRITE|LIBSSH2_FXF_CREAT|(mode == NMSFTPWriteModeTruncate ? LIBSSH2_FXF_TRUNC : LIBSSH2_FXF_READ);
+
+    __block NMSFTPStep step = NMSFTPStepOpen;
+    __block LIBSSH2_SFTP_HANDLE *handle = NULL;
+    __block LIBSSH2_SFTP_ATTRIBUTES attributes;
+    __block NSUInteger length = 0, offset = 0, sent = 0;
+    __block BOOL pending = NO;
+    __block NSError *failure = nil;
+
+    attributes.filesize = 0;
+
+    return [self startOperationWithStep:^NMSSHOperationStatus(NMSFTP *sftp, NMSSHOperation *operation) {
+        BOOL worked = NO;
+        ssize_t rc;
+
+        // The handle went away with the SFTP session
+        if (!sftp.isConnected || !operation.session.rawSession) {
+            handle = NULL;
+        }
+
+        while (!failure && step < NMSFTPStepClose) {
+            // Cancel and deadline are honored between requests, not only on entry
+            if ((failure = [sftp errorForOperation:operation pending:pending])) {
+                break;
+            }
+
+            switch (step) {
+                case NMSFTPStepOpen:
+                    if ([inputStream streamStatus] == NSStreamStatusNotOpen) {
+                        [inputStream open];
+                    }
+
+                    if (![inputStream hasBytesAvailable]) {
+                        NMSSHLogWarn(@"No bytes available in the stream");
+                        failure = [NMSSHOperation errorWithCode:NMSSHOperationFailedError description:@"No bytes available in the stream"];
+                        break;
+                    }
+
+                    handle = libssh2_sftp_open(sftp.sftpSession, [path UTF8String], flags,
+                                               LIBSSH2_SFTP_S_IRUSR|LIBSSH2_SFTP_S_IWUSR|LIBSSH2_SFTP_S_IRGRP|LIBSSH2_SFTP_S_IROTH);
+
+                    if ((pending = (!handle && [sftp lastRequestWouldBlock]))) {
+                        return NMSSHOperationStatusForProgress(worked);
+                    }
+
+                    if (!handle) {
+                        NMSSHLogError(@"Could not open file at path %@", path);
+                        failure = [sftp.session lastError];
+                        break;
+                    }
+
+                    step = (mode == NMSFTPWriteModeTruncate ? NMSFTPStepTransfer : NMSFTPStepStat);
+                    break;
+
+                case NMSFTPStepStat:
+                    rc = libssh2_sftp_fstat(handle, &attributes);
+
+                    if ((pending = (rc == LIBSSH2_ERROR_EAGAIN))) {
+                        return NMSSHOperationStatusForProgress(worked);
+                    }
+
+                    if (rc < 0) {
+                        NMSSHLogError(@"Unable to get attributes of file %@", path);
+                        failure = [sftp.session lastError];
+                        break;
+                    }
+
+                    libssh2_sftp_seek64(handle, attributes.filesize);
+                    NMSSHLogVerbose(@"Seek to position %llu of destFile", attributes.filesize);
+
+                    // Skip what has already been uploaded
+                    if (mode == NMSFTPWriteModeResume) {
+                        [inputStream setProperty:@(attributes.filesize) forKey:NSStreamFileCurrentOffsetKey];
+                    }
+
+                    step = NMSFTPStepTransfer;
+                    break;
+
+                default:
+                    if (offset == length) {
+                        NSInteger bytesRead = ([inputStream hasBytesAvailable] ? [inputStream read:[buffer mutableBytes] maxLength:[buffer length]] : 0);
+
+                        if (bytesRead < 0) {
+                            failure = [inputStream streamError] ?: [NMSSHOperation errorWithCode:NMSSHOperationFailedError
+                                                                                    description:@"Unable to read from the stream"];
+                            break;
+                        }
+
+                        if (bytesRead == 0) {
+                            step = NMSFTPStepClose;
+                            break;
+                        }
+
+                        offset = 0;
+                        length = bytesRead;
+                    }
+
+                    rc = libssh2_sftp_write(handle, (const char *)[buffer bytes] + offset, length - offset);
+
+                    if ((pending = (rc == LIBSSH2_ERROR_EAGAIN))) {
+                        return NMSSHOperationStatusForProgress(worked);
+                    }
+
+                    if (rc < 0) {
+                        NMSSHLogWarn(@"libssh2_sftp_write failed (Error %li)", (long)rc);
+                        failure = [sftp.session lastError];
+                        break;
+                    }
+
+                    offset += rc;
+                    sent += rc;
+
+                    if (progress && !progress(sent, sent + (NSUInteger)attributes.filesize)) {
+                        failure = [NMSSHOperation errorWithCode:NMSSHOperationCancelledError description:@"Upload cancelled"];
+                    }
+                    break;
+            }
+
+            worked = YES;
+        }
+
+        // Release the handle even when the transfer failed
+        if (handle) {
+            if ((pending = (libssh2_sftp_close_handle(handle) == LIBSSH2_ERROR_EAGAIN))) {
+                return NMSSHOperationStatusForProgress(worked);
+            }
+
+            handle = NULL;
+        }
+
+        [inputStream close];
+        completion(failure == nil, failure);
+
+        return NMSSHOperationStatusDone;
+    }];
+}
+
 @end
@@ -8,9 +8,23 @@
 
 #import "NMSSHSessionDelegate.h"
 #import "NMSSHChannelDelegate.h"
+#import "NMSSHTerminalDelegate.h"
 
+#import "NMSSHOperation.h"
+#import "NMSSHCredentials.h"
+#import "NMSSHCredentialCache.h"
 #import "NMSSHSession.h"
+#import "NMSSHKnownHostsStore.h"
 #import "NMSSHChannel.h"
+#import "NMSSHTerminal.h"
+#import "NMSSHScrollbackBuffer.h"
+#import "NMSSHCommandResult.h"
+#import "NMSSHFleetExecutor.h"
+#import "NMSSHHostKeyScanResult.h"
+#import "NMSSHHostKeyScanner.h"
+#import "NMSSHResilientSession.h"
+#import "NMSSHTunnel.h"
+#import "NMSSHSocksProxy.h"
 #import "NMSFTP.h"
 #import "NMSFTPFile.h"
 #import "NMSSHConfig.h"
@@ -1,6 +1,6 @@
 #import "NMSSH.h"
 
-@class NMSSHSession;
+@class NMSSHSession, NMSSHOperation, NMSSHCommandResult, NMSSHTerminal, NMSSHScrollbackBuffer;
 @protocol NMSSHChannelDelegate;
 
 typedef NS_ENUM(NSInteger, NMSSHChannelError) {
@@ -11,7 +11,8 @@ typedef NS_ENUM(NSInteger, NMSSHChannelError) {
     NMSSHChannelAllocationError,
     NMSSHChannelRequestShellError,
     NMSSHChannelWriteError,
-    NMSSHChannelReadError
+    NMSSHChannelReadError,
+    NMSSHChannelCancelledError
 };
 
 typedef NS_ENUM(NSInteger, NMSSHChannelPtyTerminal) {
@@ -42,6 +43,30 @@ typedef NS_ENUM(NSInteger, NMSSHChannelType)  {
 /** Size of the buffers used by the channel, defaults to 0x4000 */
 @property (nonatomic, assign) NSUInteger bufferSize;
 
+/**
+ Initial size of the receive window of the channels opened for commands and
+ shells, defaults to 2 MiB.
+
+ The server stops sending when the window is full, a window smaller than the
+ bandwidth-delay product of the link caps the throughput at window / RTT.
+ */
+@property (nonatomic, assign) NSUInteger windowSize;
+
+/**
+ Largest packet the server may send on the channels opened for commands and
+ shells, defaults to 32 KiB. libssh2 can't take larger packets, smaller ones
+ lower the latency of interactive channels sharing the connection.
+ */
+@property (nonatomic, assign) NSUInteger packetSize;
+
+/**
+ Size the receive window may grow up to while a command's output or a SCP
+ download flows, defaults to 16 MiB. The window follows the bandwidth-delay
+ product measured on the channel, using the session's `roundTripTime` when
+ keepalives are enabled. 0 disables the growth.
+ */
+@property (nonatomic, assign) NSUInteger maxWindowSize;
+
 /// ----------------------------------------------------------------------------
 /// @name Setting the Delegate
 /// ----------------------------------------------------------------------------
@@ -103,6 +128,12 @@ typedef NS_ENUM(NSInteger, NMSSHChannelType)  {
  If requestPty is enabled request a pseudo terminal before running the
  command.
 
+ The wait can be interrupted from another thread with
+ `-[NMSSHSession cancelPendingOperations]`.
+
+ Output that isn't valid UTF-8 is decoded as Latin-1, use
+ `executeForData:error:timeout:` to get the exact bytes.
+
  @param command Any shell script that is available on the server
  @param error Error handler
  @param timeout The time to wait (in seconds) before giving up on the request
@@ -110,6 +141,177 @@ typedef NS_ENUM(NSInteger, NMSSHChannelType)  {
  */
 - (nullable NSString *)execute:(nonnull NSString *)command error:(NSError * _Nullable * _Nullable)error timeout:(nonnull NSNumber *)timeout;
 
+/**
+ Execute a shell command on the server with a given timeout and return its
+ raw output.
+
+ Behaves like `execute:error:timeout:` but skips decoding the output, for
+ binary output or callers parsing the bytes themselves. `lastResponse` is
+ not set.
+
+ @param command Any shell script that is available on the server
+ @param error Error handler
+ @param timeout The time to wait (in seconds) before giving up on the request
+ @returns Shell command output
+ */
+- (nullable NSData *)executeForData:(nonnull NSString *)command error:(NSError * _Nullable * _Nullable)error timeout:(nonnull NSNumber *)timeout;
+
+/**
+ Execute a shell command on the server without blocking the calling thread.
+
+ Each call opens its own channel, several commands can run at once on the same
+ session. The environment variables and PTY settings are read when the call is
+ made. If the command exits with a non-zero status the error is populated with
+ its standard error output.
+
+ @param command Any shell script that is available on the server
+ @param timeout The time to wait (in seconds) before giving up, 0 for no limit
+ @param completion The block called on the session's callback queue with the
+        command output and the error, if any
+ @returns The operation handle
+ */
+- (nonnull NMSSHOperation *)execute:(nonnull NSString *)command
+                            timeout:(nonnull NSNumber *)timeout
+                         completion:(void (^_Nullable)(NSString *_Nullable response, NSError *_Nullable error))completion;
+
+/**
+ Execute a shell command on the server, streaming its output as it arrives.
+
+ The output is handed over as raw bytes, chunk by chunk, and never
+ accumulated: memory use does not depend on the amount of output. Standard
+ output and standard error are read as they arrive, so a command filling up
+ either stream can't stall the other one.
+
+ The output blocks are called on the session queue, in order, and should
+ return quickly: the other channels of the session wait meanwhile.
+
+ @param command Any shell script that is available on the server
+ @param timeout The time to wait (in seconds) before giving up, 0 for no limit
+ @param output Block called with each chunk written to standard output
+ @param errorOutput Block called with each chunk written to standard error
+ @param completion The block called on the session's callback queue with the
+        exit status, the name of the signal that terminated the command
+        (e.g. `TERM`), if any, and the error that prevented the command from
+        running to completion, if any
+ @returns The operation handle
+ */
+- (nonnull NMSSHOperation *)execute:(nonnull NSString *)command
+                            timeout:(nonnull NSNumber *)timeout
+                             output:(void (^_Nullable)(NSData *_Nonnull data))output
+                        errorOutput:(void (^_Nullable)(NSData *_Nonnull data))errorOutput
+                         completion:(void (^_Nullable)(int exitStatus, NSString *_Nullable exitSignal, NSError *_Nullable error))completion;
+
+/**
+ Execute a shell command on the server, writing its output to file
+ descriptors as it arrives.
+
+ The descriptors are written on the session queue and are not closed. While
+ a non-blocking descriptor is full the command's output is left on the
+ server, which stops sending once the channel window is full; other
+ operations of the session go on. A write error aborts the command.
+
+ @param command Any shell script that is available on the server
+ @param timeout The time to wait (in seconds) before giving up, 0 for no limit
+ @param outputFileDescriptor Descriptor standard output is written to, -1 to discard it
+ @param errorFileDescriptor Descriptor standard error is written to, -1 to discard it
+ @param completion The block called on the session's callback queue with the
+        exit status, the name of the signal that terminated the command, if
+        any, and the error that prevented the command from running to
+        completion, if any
+ @returns The operation handle
+ */
+- (nonnull NMSSHOperation *)execute:(nonnull NSString *)command
+                            timeout:(nonnull NSNumber *)timeout
+               outputFileDescriptor:(int)outputFileDescriptor
+                errorFileDescriptor:(int)errorFileDescriptor
+                         completion:(void (^_Nullable)(int exitStatus, NSString *_Nullable exitSignal, NSError *_Nullable error))completion;
+
+/**
+ Execute a shell command on the server, feeding a stream to its standard input.
+
+ The input is sent while the output is read, as fast as the channel window
+ allows, and EOF is sent once the stream is exhausted, like
+ `ssh host mysql < dump.sql`.
+
+ The stream is opened if needed, read on the session queue and closed once
+ the command ended. It is only read when it has bytes available, and looked
+ at again every few milliseconds otherwise: prefer
+ `execute:timeout:inputFileDescriptor:output:errorOutput:completion:` for
+ pipes and sockets.
+
+ @param command Any shell script that is available on the server
+ @param timeout The time to wait (in seconds) before giving up, 0 for no limit
+ @param input Stream read into the standard input of the command
+ @param output Block called on the session queue with each chunk written to standard output
+ @param errorOutput Block called on the session queue with each chunk written to standard error
+ @param completion The block called on the session's callback queue with the
+        exit status, the name of the signal that terminated the command, if
+        any, and the error that prevented the command from running to
+        completion, if any
+ @returns The operation handle
+ */
+- (nonnull NMSSHOperation *)execute:(nonnull NSString *)command
+                            timeout:(nonnull NSNumber *)timeout
+                              input:(nonnull NSInputStream *)input
+                             output:(void (^_Nullable)(NSData *_Nonnull data))output
+                        errorOutput:(void (^_Nullable)(NSData *_Nonnull data))errorOutput
+                         completion:(void (^_Nullable)(int exitStatus, NSString *_Nullable exitSignal, NSError *_Nullable error))completion;
+
+/**
+ Execute a shell command on the server, feeding a file descriptor to its
+ standard input.
+
+ The descriptor is read until end of file and is not closed. Pipes and
+ sockets are only read when they have data, the session is woken up as more
+ arrives.
+
+ @param command Any shell script that is available on the server
+ @param timeout The time to wait (in seconds) before giving up, 0 for no limit
+ @param inputFileDescriptor Descriptor read into the standard input of the command
+ @param output Block called on the session queue with each chunk written to standard output
+ @param errorOutput Block called on the session queue with each chunk written to standard error
+ @param completion The block called on the session's callback queue with the
+        exit status, the name of the signal that terminated the command, if
+        any, and the error that prevented the command from running to
+        completion, if any
+ @returns The operation handle
+ */
+- (nonnull NMSSHOperation *)execute:(nonnull NSString *)command
+                            timeout:(nonnull NSNumber *)timeout
+                inputFileDescriptor:(int)inputFileDescriptor
+                             output:(void (^_Nullable)(NSData *_Nonnull data))output
+                        errorOutput:(void (^_Nullable)(NSData *_Nonnull data))errorOutput
+                         completion:(void (^_Nullable)(int exitStatus, NSString *_Nullable exitSignal, NSError *_Nullable error))completion;
+
+/**
+ Execute a batch of shell commands on the server concurrently, each on a
+ channel of its own.
+
+ Up to `maxConcurrent` channels are in flight at once: their requests and
+ replies share the round trips instead of waiting for each other, so the
+ batch takes about as long as its slowest command rather than the sum of
+ them. Servers limit the channels of a connection, OpenSSH accepts 10 by
+ default (`MaxSessions`).
+
+ A command failing does not affect the other commands, the failure is
+ reported in its result's `error`. Cancelling the returned operation cancels
+ every command that has not completed.
+
+ @param commands Shell scripts that are available on the server
+ @param maxConcurrent Maximum number of commands running at once
+ @param timeout The time (in seconds) each command is given, 0 for no limit
+ @param resultHandler Block called on the session's callback queue as soon as
+        each command completes
+ @param completion Block called on the session's callback queue once every
+        command completed, with the results in the order of `commands`
+ @returns The operation handle
+ */
+- (nonnull NMSSHOperation *)executeCommands:(nonnull NSArray<NSString *> *)commands
+                              maxConcurrent:(NSUInteger)maxConcurrent
+                                    timeout:(nonnull NSNumber *)timeout
+                              resultHandler:(void (^_Nullable)(NMSSHCommandResult *_Nonnull result))resultHandler
+                                 completion:(void (^_Nullable)(NSArray<NMSSHCommandResult *> *_Nonnull results))completion;
+
 /// ----------------------------------------------------------------------------
 /// @name Remote shell session
 /// ----------------------------------------------------------------------------
@@ -117,6 +319,39 @@ typedef NS_ENUM(NSInteger, NMSSHChannelType)  {
 /** User-defined environment variables for the session, defaults to `nil` */
 @property (nonatomic, nullable, strong) NSDictionary *environmentVariables;
 
+/**
+ Time (in seconds) shell output is held back to be delivered along with the
+ output that follows, defaults to 0.
+
+ The output read on each wake up of the socket is delivered in a single
+ delegate call per stream. A few milliseconds let busy shells, such as a build
+ streaming its log, batch their output into far fewer calls.
+ */
+@property (nonatomic, assign) NSTimeInterval outputCoalescingInterval;
+
+/**
+ Amount of shell output (in bytes) delivered at once whatever the
+ `outputCoalescingInterval`, defaults to 64 KiB.
+ */
+@property (nonatomic, assign) NSUInteger outputCoalescingSize;
+
+/**
+ Screen model updated with the shell output, defaults to `nil`.
+
+ The terminal is fed on the queue reading the shell output, before the
+ delegate is told about the output, and its replies to the remote programs are
+ written on the shell. Its size follows `requestSizeWidth:height:`.
+ */
+@property (nonatomic, nullable, strong) NMSSHTerminal *terminal;
+
+/**
+ Buffer recording the standard output of the shell, defaults to `nil`.
+
+ Unlike `lastResponse`, which only holds the last chunk read, the buffer keeps
+ the history of the session within a fixed amount of memory.
+ */
+@property (nonatomic, nullable, strong) NMSSHScrollbackBuffer *scrollback;
+
 /**
  Request a remote shell on the channel.
 
@@ -180,6 +415,36 @@ typedef NS_ENUM(NSInteger, NMSSHChannelType)  {
  */
 - (BOOL)writeData:(nonnull NSData *)data error:(NSError * _Nullable * _Nullable)error timeout:(nonnull NSNumber *)timeout;
 
+/**
+ Queue data to be written on the remote shell without blocking.
+
+ The queued data is written in order as the remote window opens, on the
+ queue reading the shell output. Each write is reported once fully written,
+ or failed along with the writes queued after it when the channel fails or
+ the shell is closed. Writes made with the blocking methods are not ordered
+ with the queued ones.
+
+ The return value lets a producer, such as a paste or a file being piped in,
+ slow down: once it returns NO, the producer should wait for
+ `channelDidDrainWriteQueue:` before queueing more data.
+
+ @param data Any data
+ @param completion Block called on the session's `callbackQueue` with nil
+     once the data has been written, or the error that failed it
+ @returns NO if the queue reached the `writeHighWaterMark` or the write was
+     rejected, YES otherwise
+ */
+- (BOOL)writeData:(nonnull NSData *)data completion:(void (^ _Nullable)(NSError * _Nullable error))completion;
+
+/**
+ Amount of queued shell input (in bytes) above which `writeData:completion:`
+ asks the producer to wait, defaults to 1 MiB.
+ */
+@property (nonatomic, assign) NSUInteger writeHighWaterMark;
+
+/** Amount of queued shell input (in bytes) not written yet (read-only). */
+@property (atomic, readonly) NSUInteger queuedWriteSize;
+
 /**
  Request size for the remote pseudo terminal.
 
@@ -250,5 +515,37 @@ typedef NS_ENUM(NSInteger, NMSSHChannelType)  {
                 to:(nonnull NSString *)remotePath
           progress:(BOOL (^_Nullable)(NSUInteger))progress;
 
+/**
+ Upload a local file to a remote server without blocking the calling thread.
+
+ @param localPath Path to a file on the local computer
+ @param remotePath Path to save the file to
+ @param progress Block called on the session queue with the number of bytes
+        uploaded. Returns NO to abort.
+ @param completion The block called on the session's callback queue once the
+        transfer ended
+ @returns The operation handle
+ */
+- (nonnull NMSSHOperation *)uploadFile:(nonnull NSString *)localPath
+                                    to:(nonnull NSString *)remotePath
+                              progress:(BOOL (^_Nullable)(NSUInteger))progress
+                            completion:(void (^_Nullable)(BOOL success, NSError *_Nullable error))completion;
+
+/**
+ Download a remote file to the local filesystem without blocking the calling
+ thread.
+
+ @param remotePath Path to a file on the remote server
+ @param localPath Path to save the file to
+ @param progress Block called on the session queue with the number of bytes
+        downloaded and the total file size. Returns NO to abort.
+ @param completion The block called on the session's callback queue once the
+        transfer ended
+ @returns The operation handle
+ */
+- (nonnull NMSSHOperation *)downloadFile:(nonnull NSString *)remotePath
+                                      to:(nonnull NSString *)localPath
+                                progress:(BOOL (^_Nullable)(NSUInteger, NSUInteger))progress
+                              completion:(void (^_Nullable)(BOOL success, NSError *_Nullable error))completion;
 
 @end
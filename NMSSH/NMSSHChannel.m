@@ -1,21 +1,211 @@
 #import "NMSSHChannel.h"
 #import "NMSSH+Protected.h"
 
-@interface NMSSHChannel ()
+/** Default limit of the automatic receive window growth */
+static const NSUInteger kNMSSHMaxWindowSize = 16 * 1024 * 1024;
+
+/** Default amount of shell output delivered in one delegate call */
+static const NSUInteger kNMSSHOutputCoalescingSize = 64 * 1024;
+
+/** Default amount of queued shell input above which producers are asked to wait */
+static const NSUInteger kNMSSHWriteHighWaterMark = 1024 * 1024;
+
+/** Time (in seconds) before a stream without bytes available is read again */
+static const double kNMSSHInputStreamRetryInterval = 0.01;
+
+static void *kNMSSHShellQueueKey = &kNMSSHShellQueueKey;
+
+/** State of the automatic growth of a channel's receive window */
+typedef struct {
+    unsigned long maxWindowSize;
+    NSTimeInterval roundTripTime;
+    CFAbsoluteTime startTime;
+    uint64_t received;
+    unsigned long pendingAdjustment;
+} NMSSHWindowTuner;
+
+@interface NMSSHChannel () {
+    // Updated off the shell queue too, so producers never wait on it
+    _Atomic(NSUInteger) _queuedWriteSize;
+}
+
 @property (nonatomic, strong) NMSSHSession *session;
 @property (nonatomic, assign) LIBSSH2_CHANNEL *channel;
 
 @property (nonatomic, readwrite) NMSSHChannelType type;
 @property (nonatomic, assign) const char *ptyTerminalName;
 @property (nonatomic, strong) NSString *lastResponse;
+@property (nonatomic, assign) NMSSHWindowTuner windowTuner;
+
+// Shell output waiting to be delivered, and the bytes of a code point split between reads
+@property (nonatomic, strong) NSMutableData *shellOutput;
+@property (nonatomic, strong) NSMutableData *shellErrorOutput;
+@property (nonatomic, strong) NSMutableData *shellOutputTail;
+@property (nonatomic, strong) NSMutableData *shellErrorOutputTail;
+@property (nonatomic, assign) BOOL shellFlushScheduled;
+
+// Shell input waiting to be written, with the completion of each write
+@property (nonatomic, strong) NSMutableArray *shellWrites;
+@property (nonatomic, strong) NSMutableArray *shellWriteCompletions;
+@property (nonatomic, assign) NSUInteger shellWriteOffset;
+@property (nonatomic, assign) BOOL shellWriteFull;
 
 #if OS_OBJECT_USE_OBJC
 @property (nonatomic, strong) dispatch_source_t source;
+@property (nonatomic, strong) dispatch_source_t writeSource;
+@property (nonatomic, strong) dispatch_queue_t shellQueue;
 #else
 @property (nonatomic, assign) dispatch_source_t source;
+@property (nonatomic, assign) dispatch_source_t writeSource;
+@property (nonatomic, assign) dispatch_queue_t shellQueue;
 #endif
 @end
 
+/** Steps of the asynchronous channel operations */
+typedef NS_ENUM(NSInteger, NMSSHChannelStep) {
+    NMSSHChannelStepOpen,
+    NMSSHChannelStepEnvironment,
+    NMSSHChannelStepPty,
+    NMSSHChannelStepExec,
+    NMSSHChannelStepTransfer,
+    NMSSHChannelStepSendEOF,
+    NMSSHChannelStepWaitEOF,
+    NMSSHChannelStepClose,
+    NMSSHChannelStepWaitClosed,
+    NMSSHChannelStepFree
+};
+
+/**
+ Close and free a channel without blocking, starting from the given step.
+ Returns LIBSSH2_ERROR_EAGAIN until the channel has been freed.
+
+ The exit status and signal, if requested, are set once the channel is closed.
+ */
+static int channel_teardown(LIBSSH2_SESSION *session, LIBSSH2_CHANNEL **channel, NMSSHChannelStep *step,
+                            int *exitStatus, NSString **exitSignal) {
+    int rc;
+
+    while (*channel) {
+        switch (*step) {
+            case NMSSHChannelStepClose:
+                rc = libssh2_channel_close(*channel);
+                if (rc == LIBSSH2_ERROR_EAGAIN) {
+                    return rc;
+                }
+
+                *step = (rc == 0 ? NMSSHChannelStepWaitClosed : NMSSHChannelStepFree);
+                break;
+
+            case NMSSHChannelStepWaitClosed:
+                rc = libssh2_channel_wait_closed(*channel);
+                if (rc == LIBSSH2_ERROR_EAGAIN) {
+                    return rc;
+                }
+
+                if (exitStatus) {
+                    *exitStatus = libssh2_channel_get_exit_status(*channel);
+                }
+
+                if (exitSignal) {
+                    char *signal = NULL;
+                    size_t length = 0;
+
+                    if (libssh2_channel_get_exit_signal(*channel, &signal, &length, NULL, NULL, NULL, NULL) == 0 && signal) {
+                        *exitSignal = [[NSString alloc] initWithBytes:signal length:length encoding:NSUTF8StringEncoding];
+                        libssh2_free(session, signal);
+                    }
+                }
+
+                *step = NMSSHChannelStepFree;
+                break;
+
+            default:
+                rc = libssh2_channel_free(*channel);
+                if (rc == LIBSSH2_ERROR_EAGAIN) {
+                    *step = NMSSHChannelStepFree;
+                    return rc;
+                }
+
+                *channel = NULL;
+                break;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ Start tracking the data received on a channel.
+
+ @param maxWindowSize Size the window may grow up to, 0 to disable growth
+ @param roundTripTime The round trip time of the link, 0 if unknown
+ */
+static void window_tuner_start(NMSSHWindowTuner *tuner, unsigned long maxWindowSize, NSTimeInterval roundTripTime) {
+    memset(tuner, 0, sizeof(*tuner));
+    tuner->maxWindowSize = maxWindowSize;
+    tuner->roundTripTime = roundTripTime;
+    tuner->startTime = CFAbsoluteTimeGetCurrent();
+}
+
+/**
+ Account for data read from a channel and grow its receive window when it is
+ smaller than the bandwidth-delay product measured so far. libssh2 only tops
+ the window up to its initial size, a larger window is kept up here.
+ */
+static void window_tuner_update(NMSSHWindowTuner *tuner, LIBSSH2_CHANNEL *channel, ssize_t received) {
+    if (received <= 0 || tuner->maxWindowSize == 0 || tuner->roundTripTime <= 0) {
+        return;
+    }
+
+    tuner->received += received;
+
+    // An adjustment that could not be sent at once is sent again as is
+    if (tuner->pendingAdjustment == 0) {
+        double elapsed = CFAbsoluteTimeGetCurrent() - tuner->startTime;
+        if (elapsed < tuner->roundTripTime) {
+            return;
+        }
+
+        // Twice the bandwidth-delay product keeps data flowing while the adjustment travels
+        double target = MIN(2.0 * tuner->received / elapsed * tuner->roundTripTime, (double)tuner->maxWindowSize);
+        unsigned long window = libssh2_channel_window_read_ex(channel, NULL, NULL);
+
+        if (window >= target / 2) {
+            return;
+        }
+
+        tuner->pendingAdjustment = (unsigned long)target - window;
+    }
+
+    int rc = libssh2_channel_receive_window_adjust2(channel, tuner->pendingAdjustment, 0, NULL);
+    if (rc != LIBSSH2_ERROR_EAGAIN) {
+        NMSSHLogVerbose(@"Receive window grown by %lu bytes (return code = %i)", tuner->pendingAdjustment, rc);
+        tuner->pendingAdjustment = 0;
+    }
+}
+
+/**
+ Length of the longest prefix of a buffer that does not end in the middle of
+ a UTF-8 sequence. The bytes left (at most 3) start a code point whose end
+ has not been read yet.
+ */
+static NSUInteger utf8_complete_length(const uint8_t *bytes, NSUInteger length) {
+    // Walk back to the lead byte of the last sequence
+    NSUInteger start = length;
+    while (start > 0 && length - start < 3 && (bytes[start - 1] & 0xC0) == 0x80) {
+        start--;
+    }
+
+    if (start == 0) {
+        return length;
+    }
+
+    uint8_t lead = bytes[start - 1];
+    NSUInteger expected = ((lead & 0xE0) == 0xC0 ? 2 : (lead & 0xF0) == 0xE0 ? 3 : (lead & 0xF8) == 0xF0 ? 4 : 1);
+
+    return (length - (start - 1) < expected ? start - 1 : length);
+}
+
 @implementation NMSSHChannel
 
 // -----------------------------------------------------------------------------
@@ -26,6 +216,12 @@
     if ((self = [super init])) {
         [self setSession:session];
         [self setBufferSize:kNMSSHBufferSize];
+        [self setWindowSize:LIBSSH2_CHANNEL_WINDOW_DEFAULT];
+        [self setPacketSize:LIBSSH2_CHANNEL_PACKET_DEFAULT];
+        [self setMaxWindowSize:kNMSSHMaxWindowSize];
+        [self setOutputCoalescingInterval:0];
+        [self setOutputCoalescingSize:kNMSSHOutputCoalescingSize];
+        [self setWriteHighWaterMark:kNMSSHWriteHighWaterMark];
         [self setRequestPty:NO];
         [self setPtyTerminalType:NMSSHChannelPtyTerminalVanilla];
         [self setType:NMSSHChannelTypeClosed];
@@ -39,6 +235,14 @@
     return self;
 }
 
+- (void)dealloc {
+#if !(OS_OBJECT_USE_OBJC)
+    if (_shellQueue) {
+        dispatch_release(_shellQueue);
+    }
+#endif
+}
+
 - (BOOL)openChannel:(NSError *__autoreleasing *)error {
     if (self.channel != NULL) {
         NMSSHLogWarn(@"The channel will be closed before continue");
@@ -54,7 +258,10 @@
     libssh2_session_set_blocking(self.session.rawSession, 1);
 
     // Open up the channel
-    LIBSSH2_CHANNEL *channel = libssh2_channel_open_session(self.session.rawSession);
+    CFAbsoluteTime openTime = CFAbsoluteTimeGetCurrent();
+    LIBSSH2_CHANNEL *channel = libssh2_channel_open_ex(self.session.rawSession, "session", sizeof("session") - 1,
+                                                       (unsigned int)self.windowSize,
+                                                       (unsigned int)MIN(self.packetSize, LIBSSH2_CHANNEL_PACKET_DEFAULT), NULL, 0);
 
     if (channel == NULL){
         NMSSHLogError(@"Unable to open a session");
@@ -68,6 +275,7 @@
     }
 
     [self setChannel:channel];
+    window_tuner_start(&_windowTuner, self.maxWindowSize, [self roundTripTimeWithOpenTime:openTime]);
 
     // Try to set environment variables
     if (self.environmentVariables) {
@@ -103,6 +311,16 @@
     return YES;
 }
 
+/**
+ The round trip time measured by the keepalives, or else the time a channel
+ took to open, an upper bound good enough to size its window.
+ */
+- (NSTimeInterval)roundTripTimeWithOpenTime:(CFAbsoluteTime)openTime {
+    NSTimeInterval roundTripTime = self.session.roundTripTime;
+
+    return roundTripTime > 0 ? roundTripTime : CFAbsoluteTimeGetCurrent() - openTime;
+}
+
 - (void)closeChannel {
     // Set blocking mode
     if (self.session.rawSession) {
@@ -176,6 +394,35 @@
 }
 
 - (NSString *)execute:(NSString *)command error:(NSError *__autoreleasing *)error timeout:(NSNumber *)timeout {
+    NSData *output = [self executeForData:command error:error timeout:timeout];
+    if (!output) {
+        return nil;
+    }
+
+    // Decoded once, chunks may split multibyte sequences. Output that isn't
+    // valid UTF-8 falls back to Latin-1, which maps every byte
+    NSString *response = [[NSString alloc] initWithData:output encoding:NSUTF8StringEncoding];
+    if (!response) {
+        NMSSHLogWarn(@"Command output is not valid UTF-8, decoded as Latin-1");
+        response = [[NSString alloc] initWithData:output encoding:NSISOLatin1StringEncoding];
+    }
+
+    [self setLastResponse:response];
+
+    return self.lastResponse;
+}
+
+- (NSData *)executeForData:(NSString *)command error:(NSError *__autoreleasing *)error timeout:(NSNumber *)timeout {
+    // Keepalive probes wait for the command, libssh2 is used from this thread
+    NMSSHSession *session = self.session;
+    [session beginSynchronousCall];
+    NSData *output = [self runCommand:command error:error timeout:timeout];
+    [session endSynchronousCall];
+
+    return output;
+}
+
+- (NSData *)runCommand:(NSString *)command error:(NSError *__autoreleasing *)error timeout:(NSNumber *)timeout {
     NMSSHLogInfo(@"Exec command %@", command);
 
     // In case of error...
@@ -186,6 +433,7 @@
     }
 
     [self setLastResponse:nil];
+    [self.session resetCancellation];
 
     int rc = 0;
     [self setType:NMSSHChannelTypeExec];
@@ -214,52 +462,45 @@
     // Set the timeout for blocking session
     CFAbsoluteTime time = CFAbsoluteTimeGetCurrent() + [timeout doubleValue];
 
-    // Fetch response from output buffer
-    NSMutableString *response = [[NSMutableString alloc] init];
+    // The output is read straight into a single growing buffer
+    NSMutableData *response = [[NSMutableData alloc] initWithCapacity:self.bufferSize];
+    BOOL exitStatusChecked = NO;
+
     for (;;) {
         ssize_t rc;
-        char buffer[self.bufferSize];
-        char errorBuffer[self.bufferSize];
 
         do {
-            rc = libssh2_channel_read(self.channel, buffer, (ssize_t)sizeof(buffer));
-
-            if (rc > 0) {
-                [response appendFormat:@"%@", [[NSString alloc] initWithBytes:buffer length:rc encoding:NSUTF8StringEncoding]];
-            }
+            rc = [self readStream:0 appendingTo:response];
 
-            // Store all errors that might occur
-            if (libssh2_channel_get_exit_status(self.channel)) {
-                if (error) {
-                    ssize_t erc = libssh2_channel_read_stderr(self.channel, errorBuffer, (ssize_t)sizeof(errorBuffer));
+            // Report the standard error of a failed command
+            if (error && !exitStatusChecked && libssh2_channel_get_exit_status(self.channel)) {
+                char errorBuffer[self.bufferSize];
+                ssize_t erc = libssh2_channel_read_stderr(self.channel, errorBuffer, (ssize_t)sizeof(errorBuffer));
 
-                    NSString *desc = [[NSString alloc] initWithBytes:errorBuffer length:erc encoding:NSUTF8StringEncoding];
-                    if (!desc) {
-                        desc = @"An unspecified error occurred";
-                    }
+                NSString *desc = (erc > 0 ? [[NSString alloc] initWithBytes:errorBuffer length:erc encoding:NSUTF8StringEncoding] : nil);
+                if (!desc) {
+                    desc = @"An unspecified error occurred";
+                }
 
-                    [userInfo setObject:desc forKey:NSLocalizedDescriptionKey];
-                    [userInfo setObject:[NSString stringWithFormat:@"%zi", erc] forKey:NSLocalizedFailureReasonErrorKey];
+                [userInfo setObject:desc forKey:NSLocalizedDescriptionKey];
+                [userInfo setObject:[NSString stringWithFormat:@"%zi", erc] forKey:NSLocalizedFailureReasonErrorKey];
 
-                    *error = [NSError errorWithDomain:@"NMSSH"
-                                                 code:NMSSHChannelExecutionError
-                                             userInfo:userInfo];
-                }
+                *error = [NSError errorWithDomain:@"NMSSH"
+                                             code:NMSSHChannelExecutionError
+                                         userInfo:userInfo];
+                exitStatusChecked = YES;
             }
 
             if (libssh2_channel_eof(self.channel) == 1 || rc == 0) {
-                while ((rc  = libssh2_channel_read(self.channel, buffer, (ssize_t)sizeof(buffer))) > 0) {
-                    [response appendFormat:@"%@", [[NSString alloc] initWithBytes:buffer length:rc encoding:NSUTF8StringEncoding] ];
-                }
+                while ([self readStream:0 appendingTo:response] > 0);
 
-                [self setLastResponse:[response copy]];
                 [self closeChannel];
 
-                return self.lastResponse;
+                return response;
             }
 
-            // Check if the connection timed out
-            if ([timeout longValue] > 0 && time < CFAbsoluteTimeGetCurrent()) {
+            // Check if the connection timed out, the socket wait returns at once past the deadline
+            if ([timeout doubleValue] > 0 && time <= CFAbsoluteTimeGetCurrent()) {
                 if (error) {
                     NSString *desc = @"Connection timed out";
 
@@ -270,14 +511,11 @@
                                              userInfo:userInfo];
                 }
 
-                while ((rc  = libssh2_channel_read(self.channel, buffer, (ssize_t)sizeof(buffer))) > 0) {
-                    [response appendFormat:@"%@", [[NSString alloc] initWithBytes:buffer length:rc encoding:NSUTF8StringEncoding] ];
-                }
+                while ([self readStream:0 appendingTo:response] > 0);
 
-                [self setLastResponse:[response copy]];
                 [self closeChannel];
 
-                return self.lastResponse;
+                return response;
             }
         } while (rc > 0);
 
@@ -285,7 +523,20 @@
             break;
         }
 
-        waitsocket(CFSocketGetNative([self.session socket]), self.session.rawSession);
+        // Wait no longer than the time left before the timeout
+        if ([self.session waitSocketUntil:([timeout doubleValue] > 0 ? time : 0)] == NMSSH_WAITSOCKET_INTERRUPTED) {
+            if (error) {
+                [userInfo setObject:@"Execution cancelled" forKey:NSLocalizedDescriptionKey];
+                *error = [NSError errorWithDomain:@"NMSSH"
+                                             code:NMSSHChannelCancelledError
+                                         userInfo:userInfo];
+            }
+
+            NMSSHLogInfo(@"Command execution cancelled");
+            [self closeChannel];
+
+            return nil;
+        }
     }
 
     // If we've got this far, it means fetching execution response failed
@@ -302,196 +553,1210 @@
     return nil;
 }
 
-// -----------------------------------------------------------------------------
-#pragma mark - REMOTE SHELL SESSION
-// -----------------------------------------------------------------------------
+/**
+ Read a stream of the channel at the end of a buffer. The buffer grows
+ geometrically, reads stop allocating once it fits the output.
 
-- (BOOL)startShell:(NSError *__autoreleasing *)error  {
-    NMSSHLogInfo(@"Starting shell");
+ @param streamId 0 for the standard output, `SSH_EXTENDED_DATA_STDERR` for the standard error
+ @param data The buffer to append to
+ @returns The libssh2_channel_read_ex() return code
+ */
+- (ssize_t)readStream:(int)streamId appendingTo:(NSMutableData *)data {
+    NSUInteger length = [data length];
+    [data setLength:length + self.bufferSize];
 
-    if (![self openChannel:error]) {
-        return NO;
-    }
+    ssize_t rc = libssh2_channel_read_ex(self.channel, streamId, (char *)[data mutableBytes] + length, self.bufferSize);
+    [data setLength:length + MAX(rc, 0)];
+    window_tuner_update(&_windowTuner, self.channel, rc);
 
-    // Set non-blocking mode
-    libssh2_session_set_blocking(self.session.rawSession, 0);
+    return rc;
+}
 
-    // Fetch response from output buffer
-#if !(OS_OBJECT_USE_OBJC)
-    if (self.source) {
-        dispatch_release(self.source);
-    }
-#endif
+- (NMSSHOperation *)execute:(NSString *)command timeout:(NSNumber *)timeout completion:(void (^)(NSString *, NSError *))completion {
+    NSMutableData *output = [[NSMutableData alloc] init];
+    NSMutableData *errorOutput = [[NSMutableData alloc] init];
+    __weak NMSSHSession *session = self.session;
 
-    [self setLastResponse:nil];
-    [self setSource:dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, CFSocketGetNative([self.session socket]),
-                                           0, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0))];
-    dispatch_source_set_event_handler(self.source, ^{
-        NMSSHLogVerbose(@"Data available on the socket!");
-        ssize_t rc, erc=0;
-        char buffer[self.bufferSize];
+    return [self operationForCommand:command timeout:timeout output:^(NSData *data, BOOL isStderr) {
+        [(isStderr ? errorOutput : output) appendData:data];
+    } completion:^(int exitStatus, NSString *exitSignal, NSError *error) {
+        NSString *response = [[NSString alloc] initWithData:output encoding:NSUTF8StringEncoding];
 
-        while (self.channel != NULL) {
+        if (!error && exitStatus != 0) {
+            NSString *description = [[NSString alloc] initWithData:errorOutput encoding:NSUTF8StringEncoding];
+            if ([description length] == 0) {
+                description = @"An unspecified error occurred";
+            }
 
-            rc = libssh2_channel_read(self.channel, buffer, (ssize_t)sizeof(buffer));
-            erc = libssh2_channel_read_stderr(self.channel, buffer, (ssize_t)sizeof(buffer));
+            error = [NSError errorWithDomain:@"NMSSH"
+                                        code:NMSSHChannelExecutionError
+                                    userInfo:@{ NSLocalizedDescriptionKey         : description,
+                                                NSLocalizedFailureReasonErrorKey  : [NSString stringWithFormat:@"%i", exitStatus],
+                                                @"command"                        : command }];
+        }
 
-            if (!(rc >=0 || erc >= 0)) {
-                NMSSHLogVerbose(@"Return code of response %ld, error %ld", (long)rc, (long)erc);
+        if (completion) {
+            [session dispatchCallback:^{
+                completion(response, error);
+            }];
+        }
+    }];
+}
 
-                if (rc == LIBSSH2_ERROR_SOCKET_RECV || erc == LIBSSH2_ERROR_SOCKET_RECV) {
-                    NMSSHLogVerbose(@"Error received, closing channel...");
-                    [self closeShell];
-                }
-                return;
-            }
-            else if (rc > 0) {
-                NSData *data = [[NSData alloc] initWithBytes:buffer length:rc];
-                NSString *response = [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding];
-                [self setLastResponse:[response copy]];
+- (NMSSHOperation *)execute:(NSString *)command
+                    timeout:(NSNumber *)timeout
+                     output:(void (^)(NSData *))output
+                errorOutput:(void (^)(NSData *))errorOutput
+                 completion:(void (^)(int, NSString *, NSError *))completion {
+    return [self execute:command timeout:timeout inputReader:nil output:output errorOutput:errorOutput cleanup:nil completion:completion];
+}
 
-                if (response && self.delegate && [self.delegate respondsToSelector:@selector(channel:didReadData:)]) {
-                    [self.delegate channel:self didReadData:self.lastResponse];
-                }
+- (NMSSHOperation *)execute:(NSString *)command
+                    timeout:(NSNumber *)timeout
+                      input:(NSInputStream *)input
+                     output:(void (^)(NSData *))output
+                errorOutput:(void (^)(NSData *))errorOutput
+                 completion:(void (^)(int, NSString *, NSError *))completion {
+    __weak NMSSHSession *session = self.session;
+    __block BOOL retryScheduled = NO;
+
+    return [self execute:command timeout:timeout inputReader:^ssize_t(void *buffer, size_t length) {
+        if ([input streamStatus] == NSStreamStatusNotOpen) {
+            [input open];
+        }
 
-                if (self.delegate && [self.delegate respondsToSelector:@selector(channel:didReadRawData:)]) {
-                    [self.delegate channel:self didReadRawData:data];
-                }
+        NSStreamStatus status = [input streamStatus];
+        if (status == NSStreamStatusAtEnd) {
+            return 0;
+        }
+
+        // Never block the session queue on a stream without bytes, look again shortly
+        if (status != NSStreamStatusError && ![input hasBytesAvailable]) {
+            NMSSHSession *strongSession = session;
+            if (strongSession && !retryScheduled) {
+                retryScheduled = YES;
+                dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(kNMSSHInputStreamRetryInterval * NSEC_PER_SEC)), strongSession.sessionQueue, ^{
+                    retryScheduled = NO;
+                    [session pumpOperationsAsync];
+                });
             }
-            else if (erc > 0) {
-                NSData *data = [[NSData alloc] initWithBytes:buffer length:erc];
-                NSString *response = [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding];
 
-                if (response && self.delegate && [self.delegate respondsToSelector:@selector(channel:didReadError:)]) {
-                    [self.delegate channel:self didReadError:response];
-                }
+            errno = EAGAIN;
+            return -1;
+        }
 
-                if (self.delegate && [self.delegate respondsToSelector:@selector(channel:didReadRawError:)]) {
-                    [self.delegate channel:self didReadRawError:data];
-                }
-            }
-            else if (libssh2_channel_eof(self.channel) == 1) {
-                NMSSHLogVerbose(@"Host EOF received, closing channel...");
-                [self closeShell];
-                return;
-            }
+        NSInteger rc = [input read:buffer maxLength:length];
+        if (rc < 0) {
+            errno = EIO;
         }
-    });
 
-    dispatch_source_set_cancel_handler(self.source, ^{
-        NMSSHLogVerbose(@"Shell source cancelled");
+        return rc;
+    } output:output errorOutput:errorOutput cleanup:^{
+        [input close];
+    } completion:completion];
+}
 
-        if (self.delegate && [self.delegate respondsToSelector:@selector(channelShellDidClose:)]) {
-            [self.delegate channelShellDidClose:self];
-        }
+- (NMSSHOperation *)execute:(NSString *)command
+                    timeout:(NSNumber *)timeout
+        inputFileDescriptor:(int)inputFileDescriptor
+                     output:(void (^)(NSData *))output
+                errorOutput:(void (^)(NSData *))errorOutput
+                 completion:(void (^)(int, NSString *, NSError *))completion {
+    __weak NMSSHSession *session = self.session;
+    __block BOOL armed = NO;
+
+    // Wakes the session up once a pipe or socket has more input
+    dispatch_source_t source = dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, inputFileDescriptor, 0, self.session.sessionQueue);
+    dispatch_source_set_event_handler(source, ^{
+        armed = NO;
+        dispatch_suspend(source);
+        [session pumpOperationsAsync];
     });
 
-    dispatch_resume(self.source);
+    return [self execute:command timeout:timeout inputReader:^ssize_t(void *buffer, size_t length) {
+        struct pollfd fds = { .fd = inputFileDescriptor, .events = POLLIN };
+        ssize_t rc = -1;
+        errno = EAGAIN;
 
-    int rc = 0;
+        // Regular files are always readable, never block on a pipe
+        if (poll(&fds, 1, 0) > 0) {
+            while ((rc = read(inputFileDescriptor, buffer, length)) < 0 && errno == EINTR);
+        }
 
-    // Try opening the shell
-    while ((rc = libssh2_channel_shell(self.channel)) == LIBSSH2_ERROR_EAGAIN) {
-        waitsocket(CFSocketGetNative([self.session socket]), [self.session rawSession]);
-    }
+        if (rc < 0 && errno == EAGAIN && !armed) {
+            armed = YES;
+            dispatch_resume(source);
+        }
 
-    if (rc != 0) {
-        NMSSHLogError(@"Shell request error");
-        if (error) {
-            *error = [NSError errorWithDomain:@"NMSSH"
-                                         code:NMSSHChannelRequestShellError
-                                     userInfo:@{ NSLocalizedDescriptionKey : [[self.session lastError] localizedDescription] }];
+        return rc;
+    } output:output errorOutput:errorOutput cleanup:^{
+        // A suspended source can't be cancelled
+        if (!armed) {
+            dispatch_resume(source);
         }
 
-        [self closeShell];
-        return NO;
-    }
+        dispatch_source_cancel(source);
+#if !(OS_OBJECT_USE_OBJC)
+        dispatch_release(source);
+#endif
+    } completion:completion];
+}
 
-    NMSSHLogVerbose(@"Shell allocated");
-    [self setType:NMSSHChannelTypeShell];
+/**
+ Run a command streaming its input and output. The cleanup block is called on
+ the session queue once the command ended, the completion on the callback
+ queue.
+ */
+- (NMSSHOperation *)execute:(NSString *)command
+                    timeout:(NSNumber *)timeout
+                inputReader:(ssize_t (^)(void *, size_t))input
+                     output:(void (^)(NSData *))output
+                errorOutput:(void (^)(NSData *))errorOutput
+                    cleanup:(dispatch_block_t)cleanup
+                 completion:(void (^)(int, NSString *, NSError *))completion {
+    __weak NMSSHSession *session = self.session;
+
+    return [self operationForCommand:command timeout:timeout input:input output:^(NSData *data, BOOL isStderr) {
+        void (^sink)(NSData *) = (isStderr ? errorOutput : output);
+
+        // The chunk lives in a pooled buffer, the caller may keep it
+        if (sink) {
+            sink([NSData dataWithBytes:[data bytes] length:[data length]]);
+        }
+    } completion:^(int exitStatus, NSString *exitSignal, NSError *error) {
+        if (cleanup) {
+            cleanup();
+        }
 
-    return YES;
+        if (completion) {
+            [session dispatchCallback:^{
+                completion(exitStatus, exitSignal, error);
+            }];
+        }
+    }];
 }
 
-- (void)closeShell {
-    if (self.source) {
-        dispatch_source_cancel(self.source);
+- (NMSSHOperation *)execute:(NSString *)command
+                    timeout:(NSNumber *)timeout
+       outputFileDescriptor:(int)outputFileDescriptor
+        errorFileDescriptor:(int)errorFileDescriptor
+                 completion:(void (^)(int, NSString *, NSError *))completion {
+    __weak NMSSHSession *session = self.session;
+    __block __weak NMSSHOperation *weakOperation = nil;
+    __block NSError *writeError = nil;
+
+    // Output a non-blocking descriptor didn't take yet, the channel is not read meanwhile
+    __block NSMutableData *unwritten = nil;
+    __block int unwrittenDescriptor = -1;
+    __block dispatch_source_t writeSource = nil;
+
+    void (^fail)(int) = ^(int errnum) {
+        NMSSHLogError(@"Error writing the output of a command: %s", strerror(errnum));
+        writeError = [NSError errorWithDomain:@"NMSSH"
+                                         code:NMSSHChannelWriteError
+                                     userInfo:@{ NSLocalizedDescriptionKey : [NSString stringWithFormat:@"Error writing the output: %s", strerror(errnum)],
+                                                 @"command"                : command }];
+        unwritten = nil;
+        [weakOperation cancel];
+    };
+
+    // Write as much as the descriptor takes, returns NO once it is full
+    BOOL (^flush)(void) = ^BOOL{
+        while ([unwritten length] > 0) {
+            ssize_t rc = write(unwrittenDescriptor, [unwritten bytes], [unwritten length]);
+
+            if (rc < 0 && errno == EAGAIN) {
+                return NO;
+            }
+            else if (rc < 0 && errno != EINTR) {
+                fail(errno);
+                return YES;
+            }
+            else if (rc > 0) {
+                [unwritten replaceBytesInRange:NSMakeRange(0, rc) withBytes:NULL length:0];
+            }
+        }
+
+        unwritten = nil;
+        return YES;
+    };
+
+    void (^cancelWriteSource)(void) = ^{
+        if (writeSource) {
+            dispatch_source_cancel(writeSource);
 #if !(OS_OBJECT_USE_OBJC)
-        dispatch_release(self.source);
+            dispatch_release(writeSource);
 #endif
-        [self setSource: nil];
-    }
+            writeSource = nil;
+        }
+    };
 
-    if (self.type == NMSSHChannelTypeShell) {
-        // Set blocking mode
-        libssh2_session_set_blocking(self.session.rawSession, 1);
+    NMSSHOperation *operation = [self operationForCommand:command timeout:timeout input:nil output:^(NSData *data, BOOL isStderr) {
+        int fd = (isStderr ? errorFileDescriptor : outputFileDescriptor);
+        if (fd < 0 || writeError) {
+            return;
+        }
 
-        [self sendEOF];
-    }
+        const uint8_t *bytes = [data bytes];
+        NSUInteger length = [data length];
 
-    [self closeChannel];
-}
+        while (length > 0) {
+            ssize_t rc = write(fd, bytes, length);
 
-- (BOOL)write:(NSString *)command error:(NSError *__autoreleasing *)error {
-    return [self write:command error:error timeout:@0];
-}
+            if (rc < 0 && errno == EAGAIN) {
+                break;
+            }
+            else if (rc < 0 && errno != EINTR) {
+                fail(errno);
+                return;
+            }
+            else if (rc > 0) {
+                bytes += rc;
+                length -= rc;
+            }
+        }
 
-- (BOOL)write:(NSString *)command error:(NSError *__autoreleasing *)error timeout:(NSNumber *)timeout {
-    return [self writeData:[command dataUsingEncoding:NSUTF8StringEncoding] error:error timeout:timeout];
-}
+        if (length == 0 || !session) {
+            return;
+        }
 
-- (BOOL)writeData:(NSData *)data error:(NSError *__autoreleasing *)error {
-    return [self writeData:data error:error timeout:@0];
+        // Keep the rest and resume reading the channel once the descriptor drained
+        unwritten = [[NSMutableData alloc] initWithBytes:bytes length:length];
+        unwrittenDescriptor = fd;
+
+        writeSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_WRITE, fd, 0, session.sessionQueue);
+        dispatch_source_set_event_handler(writeSource, ^{
+            if (flush()) {
+                cancelWriteSource();
+                [session pumpOperationsAsync];
+            }
+        });
+        dispatch_resume(writeSource);
+    } outputBlocked:^BOOL{
+        return unwritten != nil;
+    } completion:^(int exitStatus, NSString *exitSignal, NSError *error) {
+        cancelWriteSource();
+        unwritten = nil;
+
+        if (completion) {
+            NSError *failure = writeError ?: error;
+            [session dispatchCallback:^{
+                completion(exitStatus, exitSignal, failure);
+            }];
+        }
+    }];
+
+    weakOperation = operation;
+
+    return operation;
 }
 
-- (BOOL)writeData:(NSData *)data error:(NSError *__autoreleasing *)error timeout:(NSNumber *)timeout {
-    if (self.type != NMSSHChannelTypeShell) {
-        NMSSHLogError(@"Shell required");
-        return NO;
+- (NMSSHOperation *)executeCommands:(NSArray *)commands
+                      maxConcurrent:(NSUInteger)maxConcurrent
+                            timeout:(NSNumber *)timeout
+                      resultHandler:(void (^)(NMSSHCommandResult *))resultHandler
+                         completion:(void (^)(NSArray *))completion {
+    NMSSHLogInfo(@"Executing a batch of %lu commands", (unsigned long)[commands count]);
+
+    NSMutableArray *results = [[NSMutableArray alloc] initWithCapacity:[commands count]];
+    for (NSString *command in commands) {
+        [results addObject:[[NMSSHCommandResult alloc] initWithHost:self.session.host command:command]];
     }
 
-    ssize_t rc;
+    NSUInteger limit = MAX(maxConcurrent, 1);
+    NSMutableArray *running = [[NSMutableArray alloc] init];
+    __block NSUInteger next = 0, remaining = [commands count];
 
-    // Set the timeout
-    CFAbsoluteTime time = CFAbsoluteTimeGetCurrent() + [timeout doubleValue];
+    // The batch only schedules the commands, each one is an operation of its own
+    NMSSHOperation *batch = [NMSSHOperation operationWithSession:self.session step:^NMSSHOperationStatus(NMSSHOperation *operation) {
+        NMSSHSession *session = operation.session;
+        BOOL progress = NO;
 
-    // Try writing on shell
-    while ((rc = libssh2_channel_write(self.channel, [data bytes], [data length])) == LIBSSH2_ERROR_EAGAIN) {
-        // Check if the connection timed out
-        if ([timeout longValue] > 0 && time < CFAbsoluteTimeGetCurrent()) {
-            if (error) {
-                NSString *description = @"Connection timed out";
+        [running filterUsingPredicate:[NSPredicate predicateWithFormat:@"finished == NO"]];
 
-                *error = [NSError errorWithDomain:@"NMSSH"
-                                             code:NMSSHChannelExecutionTimeout
-                                         userInfo:@{ NSLocalizedDescriptionKey : description }];
+        if (operation.abortError) {
+            [running makeObjectsPerformSelector:@selector(cancel)];
+
+            // Commands that never started report the reason right away
+            for (; next < [results count]; next++, remaining--) {
+                NMSSHCommandResult *result = results[next];
+                [result setError:operation.abortError];
+
+                if (resultHandler) {
+                    [session dispatchCallback:^{
+                        resultHandler(result);
+                    }];
+                }
             }
+        }
 
-            return NO;
+        while (next < [results count] && [running count] < limit) {
+            NMSSHCommandResult *result = results[next++];
+            CFAbsoluteTime startTime = CFAbsoluteTimeGetCurrent();
+
+            // Output and completion are reported on the session queue
+            [running addObject:[self operationForCommand:result.command timeout:timeout output:^(NSData *data, BOOL isStderr) {
+                [result appendData:data isStderr:isStderr];
+            } completion:^(int exitStatus, NSString *exitSignal, NSError *error) {
+                [result setExitStatus:exitStatus];
+                [result setExitSignal:exitSignal];
+                [result setError:error];
+                [result setDuration:CFAbsoluteTimeGetCurrent() - startTime];
+                remaining--;
+
+                if (resultHandler) {
+                    [session dispatchCallback:^{
+                        resultHandler(result);
+                    }];
+                }
+            }]];
+
+            progress = YES;
         }
 
-        waitsocket(CFSocketGetNative([self.session socket]), self.session.rawSession);
-    }
+        if (remaining > 0) {
+            return NMSSHOperationStatusForProgress(progress);
+        }
 
-    if (rc < 0) {
-        NMSSHLogError(@"Error writing on the shell");
-        if (error) {
-            NSString *command = [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding];
-            *error = [NSError errorWithDomain:@"NMSSH"
-                                         code:NMSSHChannelWriteError
-                                     userInfo:@{ NSLocalizedDescriptionKey : [[self.session lastError] localizedDescription],
-                                                 @"command"                : command }];
+        if (completion) {
+            [session dispatchCallback:^{
+                completion(results);
+            }];
         }
-    }
 
-    return YES;
+        return NMSSHOperationStatusDone;
+    }];
+
+    [self.session startOperation:batch];
+
+    return batch;
 }
 
-- (BOOL)requestSizeWidth:(NSUInteger)width height:(NSUInteger)height {
-    int rc = libssh2_channel_request_pty_size(self.channel, (int)width, (int)height);
+- (NMSSHOperation *)operationForCommand:(NSString *)command
+                                timeout:(NSNumber *)timeout
+                                 output:(void (^)(NSData *, BOOL))output
+                             completion:(void (^)(int, NSString *, NSError *))completion {
+    return [self operationForCommand:command timeout:timeout input:nil output:output completion:completion];
+}
+
+- (NMSSHOperation *)operationForCommand:(NSString *)command
+                                timeout:(NSNumber *)timeout
+                                  input:(ssize_t (^)(void *, size_t))input
+                                 output:(void (^)(NSData *, BOOL))output
+                             completion:(void (^)(int, NSString *, NSError *))completion {
+    return [self operationForCommand:command timeout:timeout input:input output:output outputBlocked:nil completion:completion];
+}
+
+- (NMSSHOperation *)operationForCommand:(NSString *)command
+                                timeout:(NSNumber *)timeout
+                                  input:(ssize_t (^)(void *, size_t))input
+                                 output:(void (^)(NSData *, BOOL))output
+                          outputBlocked:(BOOL (^)(void))outputBlocked
+                             completion:(void (^)(int, NSString *, NSError *))completion {
+    NMSSHLogInfo(@"Exec command %@ asynchronously", command);
+
+    // Settings are captured now, the channel object may be reconfigured meanwhile
+    NSDictionary *environment = [self.environmentVariables copy];
+    NSArray *keys = [environment allKeys];
+    BOOL requestPty = self.requestPty;
+    const char *terminal = self.ptyTerminalName;
+    NSUInteger bufferSize = self.bufferSize;
+    unsigned int windowSize = (unsigned int)self.windowSize;
+    unsigned int packetSize = (unsigned int)MIN(self.packetSize, LIBSSH2_CHANNEL_PACKET_DEFAULT);
+    unsigned long maxWindowSize = self.maxWindowSize;
+
+    __block NMSSHChannelStep step = NMSSHChannelStepOpen;
+    __block LIBSSH2_CHANNEL *channel = NULL;
+    __block NSUInteger keyIndex = 0;
+    __block BOOL pending = NO;
+    __block int exitStatus = -1;
+    __block NSString *exitSignal = nil;
+    __block NSError *failure = nil;
+    __block CFAbsoluteTime openTime = 0;
+    __block NMSSHWindowTuner windowTuner;
+
+    // Standard input waiting to be written, held only while data is in flight
+    __block NSMutableData *inputBuffer = nil;
+    __block size_t inputOffset = 0, inputLength = 0;
+    __block BOOL inputAtEnd = NO, inputClosed = (input == nil);
+
+    NMSSHOperation *operation = [NMSSHOperation operationWithSession:self.session step:^NMSSHOperationStatus(NMSSHOperation *operation) {
+        NMSSHSession *session = operation.session;
+        BOOL progress = NO;
+        int rc;
+
+        // The channel went away with the session
+        if (!session.rawSession) {
+            channel = NULL;
+            pending = NO;
+        }
+
+        while (step < NMSSHChannelStepClose) {
+            // A request already sent must complete before the channel can be closed
+            if (operation.abortError && !pending) {
+                failure = failure ?: operation.abortError;
+                step = NMSSHChannelStepClose;
+                break;
+            }
+
+            switch (step) {
+                case NMSSHChannelStepOpen:
+                    if (![session acquireRequestLockForOperation:operation]) {
+                        return NMSSHOperationStatusForProgress(progress);
+                    }
+
+                    openTime = openTime ?: CFAbsoluteTimeGetCurrent();
+                    channel = libssh2_channel_open_ex(session.rawSession, "session", sizeof("session") - 1, windowSize, packetSize, NULL, 0);
+                    if ((pending = (!channel && libssh2_session_last_errno(session.rawSession) == LIBSSH2_ERROR_EAGAIN))) {
+                        return NMSSHOperationStatusForProgress(progress);
+                    }
+
+                    [session releaseRequestLockForOperation:operation];
+
+                    if (!channel) {
+                        NMSSHLogError(@"Unable to open a session");
+                        failure = [NSError errorWithDomain:@"NMSSH"
+                                                      code:NMSSHChannelAllocationError
+                                                  userInfo:@{ NSLocalizedDescriptionKey : @"Channel allocation error" }];
+                        step = NMSSHChannelStepClose;
+                        break;
+                    }
+
+                    // Opening the channel took about one round trip
+                    window_tuner_start(&windowTuner, maxWindowSize,
+                                       session.roundTripTime > 0 ? session.roundTripTime : CFAbsoluteTimeGetCurrent() - openTime);
+
+                    step = NMSSHChannelStepEnvironment;
+                    break;
+
+                case NMSSHChannelStepEnvironment:
+                    // As in the synchronous API, refused variables are ignored
+                    for (; keyIndex < [keys count]; keyIndex++) {
+                        NSString *key = keys[keyIndex];
+                        NSString *value = environment[key];
+
+                        if ([key isKindOfClass:[NSString class]] && [value isKindOfClass:[NSString class]] &&
+                            (pending = (libssh2_channel_setenv(channel, [key UTF8String], [value UTF8String]) == LIBSSH2_ERROR_EAGAIN))) {
+                            return NMSSHOperationStatusForProgress(progress);
+                        }
+                    }
+
+                    step = (requestPty ? NMSSHChannelStepPty : NMSSHChannelStepExec);
+                    break;
+
+                case NMSSHChannelStepPty:
+                    rc = libssh2_channel_request_pty(channel, terminal);
+                    if ((pending = (rc == LIBSSH2_ERROR_EAGAIN))) {
+                        return NMSSHOperationStatusForProgress(progress);
+                    }
+
+                    if (rc) {
+                        NMSSHLogError(@"Error requesting pseudo terminal");
+                        failure = [NSError errorWithDomain:@"NMSSH"
+                                                      code:NMSSHChannelRequestPtyError
+                                                  userInfo:@{ NSLocalizedDescriptionKey : [NSString stringWithFormat:@"Error requesting %s pty: %@", terminal, [[session lastError] localizedDescription]] }];
+                        step = NMSSHChannelStepClose;
+                        break;
+                    }
+
+                    step = NMSSHChannelStepExec;
+                    break;
+
+                case NMSSHChannelStepExec:
+                    rc = libssh2_channel_exec(channel, [command UTF8String]);
+                    if ((pending = (rc == LIBSSH2_ERROR_EAGAIN))) {
+                        return NMSSHOperationStatusForProgress(progress);
+                    }
+
+                    if (rc) {
+                        NMSSHLogError(@"Error executing command");
+                        failure = [NSError errorWithDomain:@"NMSSH"
+                                                      code:NMSSHChannelExecutionError
+                                                  userInfo:@{ NSLocalizedDescriptionKey        : [[session lastError] localizedDescription],
+                                                              NSLocalizedFailureReasonErrorKey : [NSString stringWithFormat:@"%i", rc],
+                                                              @"command"                       : command }];
+                        step = NMSSHChannelStepClose;
+                        break;
+                    }
+
+                    step = NMSSHChannelStepTransfer;
+                    break;
+
+                default: {
+                    NMSSHBufferPool *pool = session.bufferPool;
+                    BOOL sent = NO;
+
+                    // Feed the standard input as far as the channel window allows
+                    if (!inputClosed && inputOffset == inputLength && !inputAtEnd) {
+                        inputBuffer = inputBuffer ?: [pool acquireBuffer];
+                        ssize_t nin = input([inputBuffer mutableBytes], MIN(bufferSize, [inputBuffer length]));
+
+                        if (nin > 0) {
+                            inputOffset = 0;
+                            inputLength = nin;
+                        }
+                        else if (nin == 0) {
+                            inputAtEnd = YES;
+                        }
+                        else if (errno != EAGAIN) {
+                            NMSSHLogError(@"Error reading the standard input of the command: %s", strerror(errno));
+                            failure = [NSError errorWithDomain:@"NMSSH"
+                                                          code:NMSSHChannelReadError
+                                                      userInfo:@{ NSLocalizedDescriptionKey : [NSString stringWithFormat:@"Error reading the standard input: %s", strerror(errno)],
+                                                                  @"command"                : command }];
+                            step = NMSSHChannelStepClose;
+                            break;
+                        }
+                    }
+
+                    if (!inputClosed && inputOffset < inputLength) {
+                        ssize_t nwritten = libssh2_channel_write(channel, (char *)[inputBuffer bytes] + inputOffset, inputLength - inputOffset);
+
+                        // A full window leaves nothing in flight, the command can still be aborted
+                        pending = (nwritten == LIBSSH2_ERROR_EAGAIN && libssh2_channel_window_write(channel) > 0);
+
+                        if (nwritten < 0 && nwritten != LIBSSH2_ERROR_EAGAIN) {
+                            NMSSHLogError(@"Error writing the standard input of the command");
+                            failure = [NSError errorWithDomain:@"NMSSH"
+                                                          code:NMSSHChannelWriteError
+                                                      userInfo:@{ NSLocalizedDescriptionKey : [[session lastError] localizedDescription],
+                                                                  @"command"                : command }];
+                            step = NMSSHChannelStepClose;
+                            break;
+                        }
+
+                        if (nwritten > 0) {
+                            inputOffset += nwritten;
+                            sent = YES;
+                        }
+                    }
+                    else if (!inputClosed && inputAtEnd) {
+                        rc = libssh2_channel_send_eof(channel);
+                        pending = (rc == LIBSSH2_ERROR_EAGAIN);
+                        inputClosed = sent = !pending;
+                    }
+
+                    if (inputBuffer && inputOffset == inputLength) {
+                        [pool releaseBuffer:inputBuffer];
+                        inputBuffer = nil;
+                    }
+
+                    // Leave the output in the channel window until it can be taken
+                    if (outputBlocked && outputBlocked()) {
+                        if (sent) {
+                            break;
+                        }
+
+                        return NMSSHOperationStatusForProgress(progress);
+                    }
+
+                    // Drain both streams so that neither can stall the channel window
+                    NSMutableData *buffer = [pool acquireBuffer];
+                    size_t length = MIN(bufferSize, [buffer length]);
+
+                    ssize_t nread = libssh2_channel_read(channel, [buffer mutableBytes], length);
+                    ssize_t nerror = (nread > 0 ? 0 : libssh2_channel_read_stderr(channel, [buffer mutableBytes], length));
+                    window_tuner_update(&windowTuner, channel, MAX(nread, nerror));
+
+                    BOOL received = (nread > 0 || nerror > 0);
+                    if (received && output) {
+                        output([NSData dataWithBytesNoCopy:[buffer mutableBytes] length:(nread > 0 ? nread : nerror) freeWhenDone:NO], nread <= 0);
+                    }
+
+                    [pool releaseBuffer:buffer];
+
+                    if (received || sent) {
+                        break;
+                    }
+
+                    if (libssh2_channel_eof(channel) == 1) {
+                        step = NMSSHChannelStepClose;
+                    }
+                    else if (nread == LIBSSH2_ERROR_EAGAIN || nerror == LIBSSH2_ERROR_EAGAIN || (nread == 0 && nerror == 0)) {
+                        return NMSSHOperationStatusForProgress(progress);
+                    }
+                    else {
+                        NMSSHLogError(@"Error fetching response from command");
+                        failure = [NSError errorWithDomain:@"NMSSH"
+                                                      code:NMSSHChannelExecutionResponseError
+                                                  userInfo:@{ NSLocalizedDescriptionKey : [[session lastError] localizedDescription],
+                                                              @"command"                : command }];
+                        step = NMSSHChannelStepClose;
+                    }
+                    break;
+                }
+            }
+
+            progress = YES;
+        }
+
+        if (inputBuffer) {
+            [session.bufferPool releaseBuffer:inputBuffer];
+            inputBuffer = nil;
+        }
+
+        NSString *signal = nil;
+        rc = channel_teardown(session.rawSession, &channel, &step, &exitStatus, &signal);
+        exitSignal = signal ?: exitSignal;
+
+        if (rc == LIBSSH2_ERROR_EAGAIN) {
+            return NMSSHOperationStatusForProgress(progress);
+        }
+
+        if (completion) {
+            completion(exitStatus, exitSignal, failure);
+        }
+
+        return NMSSHOperationStatusDone;
+    }];
+
+    [operation setTimeout:timeout];
+    [self.session startOperation:operation];
+
+    return operation;
+}
+
+// -----------------------------------------------------------------------------
+#pragma mark - REMOTE SHELL SESSION
+// -----------------------------------------------------------------------------
+
+- (BOOL)startShell:(NSError *__autoreleasing *)error  {
+    NMSSHSession *session = self.session;
+    [session beginSynchronousCall];
+    BOOL started = [self openShell:error];
+    [session endSynchronousCall];
+
+    return started;
+}
+
+- (BOOL)openShell:(NSError *__autoreleasing *)error {
+    NMSSHLogInfo(@"Starting shell");
+
+    if (![self openChannel:error]) {
+        return NO;
+    }
+
+    // Set non-blocking mode
+    libssh2_session_set_blocking(self.session.rawSession, 0);
+
+    // Fetch response from output buffer
+#if !(OS_OBJECT_USE_OBJC)
+    if (self.source) {
+        dispatch_release(self.source);
+    }
+#endif
+
+    [self setLastResponse:nil];
+    [self setShellOutput:[[NSMutableData alloc] init]];
+    [self setShellErrorOutput:[[NSMutableData alloc] init]];
+    [self setShellOutputTail:[[NSMutableData alloc] init]];
+    [self setShellErrorOutputTail:[[NSMutableData alloc] init]];
+
+    // Reads, writes and delayed deliveries are serialized on a queue of the channel
+    if (!self.shellQueue) {
+        [self setShellQueue:dispatch_queue_create("NMSSH.shellQueue", DISPATCH_QUEUE_SERIAL)];
+        dispatch_set_target_queue(self.shellQueue, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0));
+        dispatch_queue_set_specific(self.shellQueue, kNMSSHShellQueueKey, (__bridge void *)self, NULL);
+    }
+
+    [self performSyncOnShellQueue:^{
+        [self setShellWrites:[[NSMutableArray alloc] init]];
+        [self setShellWriteCompletions:[[NSMutableArray alloc] init]];
+        [self setShellWriteOffset:0];
+        [self setShellWriteFull:NO];
+        atomic_store(&self->_queuedWriteSize, 0);
+    }];
+
+    [self setSource:dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, CFSocketGetNative([self.session socket]),
+                                           0, self.shellQueue)];
+    dispatch_source_set_event_handler(self.source, ^{
+        [self performShellCall:^{
+            [self readShellOutput];
+        }];
+    });
+
+    dispatch_source_set_cancel_handler(self.source, ^{
+        NMSSHLogVerbose(@"Shell source cancelled");
+
+        if (self.delegate && [self.delegate respondsToSelector:@selector(channelShellDidClose:)]) {
+            [self.delegate channelShellDidClose:self];
+        }
+    });
+
+    dispatch_resume(self.source);
+
+    int rc = 0;
+    [self.session resetCancellation];
+
+    // Try opening the shell
+    while ((rc = libssh2_channel_shell(self.channel)) == LIBSSH2_ERROR_EAGAIN) {
+        if ([self.session waitSocketUntil:0] == NMSSH_WAITSOCKET_INTERRUPTED) {
+            break;
+        }
+    }
+
+    if (rc != 0) {
+        NMSSHLogError(@"Shell request error");
+        if (error) {
+            *error = [NSError errorWithDomain:@"NMSSH"
+                                         code:NMSSHChannelRequestShellError
+                                     userInfo:@{ NSLocalizedDescriptionKey : [[self.session lastError] localizedDescription] }];
+        }
+
+        [self closeShell];
+        return NO;
+    }
+
+    NMSSHLogVerbose(@"Shell allocated");
+    [self setType:NMSSHChannelTypeShell];
+
+    return YES;
+}
+
+- (void)readShellOutput {
+    NMSSHLogVerbose(@"Data available on the socket!");
+
+    while (self.channel != NULL) {
+        // Each stream has a buffer of its own, neither overwrites the other
+        ssize_t rc = [self readStream:0 appendingTo:self.shellOutput];
+        ssize_t erc = [self readStream:SSH_EXTENDED_DATA_STDERR appendingTo:self.shellErrorOutput];
+
+        if (rc < 0 && erc < 0) {
+            NMSSHLogVerbose(@"Return code of response %ld, error %ld", (long)rc, (long)erc);
+
+            if (rc == LIBSSH2_ERROR_SOCKET_RECV || erc == LIBSSH2_ERROR_SOCKET_RECV) {
+                NMSSHLogVerbose(@"Error received, closing channel...");
+                [self flushShellOutput];
+                [self closeShell];
+                return;
+            }
+
+            break;
+        }
+
+        if (rc <= 0 && erc <= 0 && libssh2_channel_eof(self.channel) == 1) {
+            NMSSHLogVerbose(@"Host EOF received, closing channel...");
+            [self flushShellOutput];
+            [self closeShell];
+            return;
+        }
+
+        // Bound the memory held by a fast stream
+        if ([self.shellOutput length] + [self.shellErrorOutput length] >= self.outputCoalescingSize) {
+            [self flushShellOutput];
+        }
+    }
+
+    // The packets just read may have opened the remote window
+    [self drainShellWrites];
+
+    if ([self.shellOutput length] + [self.shellErrorOutput length] == 0) {
+        return;
+    }
+
+    if (self.outputCoalescingInterval <= 0) {
+        [self flushShellOutput];
+    }
+    else if (!self.shellFlushScheduled) {
+        [self setShellFlushScheduled:YES];
+
+        __weak NMSSHChannel *weakSelf = self;
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(self.outputCoalescingInterval * NSEC_PER_SEC)), self.shellQueue, ^{
+            [weakSelf flushShellOutput];
+        });
+    }
+}
+
+/** Deliver the shell output read so far to the delegate, one call per stream */
+- (void)flushShellOutput {
+    [self setShellFlushScheduled:NO];
+
+    if ([self.shellOutput length] > 0) {
+        NSData *data = self.shellOutput;
+        [self setShellOutput:[[NSMutableData alloc] init]];
+
+        [self.scrollback appendData:data];
+        [self.terminal processData:data];
+
+        NSString *response = [self decodeUTF8:data tail:self.shellOutputTail];
+        if ([response length] > 0) {
+            [self setLastResponse:response];
+        }
+
+        if ([response length] > 0 && self.delegate && [self.delegate respondsToSelector:@selector(channel:didReadData:)]) {
+            [self.delegate channel:self didReadData:response];
+        }
+
+        if (self.delegate && [self.delegate respondsToSelector:@selector(channel:didReadRawData:)]) {
+            [self.delegate channel:self didReadRawData:data];
+        }
+    }
+
+    if ([self.shellErrorOutput length] > 0) {
+        NSData *data = self.shellErrorOutput;
+        [self setShellErrorOutput:[[NSMutableData alloc] init]];
+
+        NSString *response = [self decodeUTF8:data tail:self.shellErrorOutputTail];
+
+        if ([response length] > 0 && self.delegate && [self.delegate respondsToSelector:@selector(channel:didReadError:)]) {
+            [self.delegate channel:self didReadError:response];
+        }
+
+        if (self.delegate && [self.delegate respondsToSelector:@selector(channel:didReadRawError:)]) {
+            [self.delegate channel:self didReadRawError:data];
+        }
+    }
+}
+
+/**
+ Decode a chunk of a UTF-8 stream.
+
+ @param data The chunk to decode
+ @param tail The incomplete code point left by the previous chunk, replaced
+     with the one ending this chunk, if any
+ @returns The decoded text, nil if the chunk is not valid UTF-8
+ */
+- (NSString *)decodeUTF8:(NSData *)data tail:(NSMutableData *)tail {
+    NSData *bytes = data;
+
+    if ([tail length] > 0) {
+        NSMutableData *joined = [tail mutableCopy];
+        [joined appendData:data];
+        bytes = joined;
+    }
+
+    NSUInteger length = utf8_complete_length([bytes bytes], [bytes length]);
+    [tail setData:[bytes subdataWithRange:NSMakeRange(length, [bytes length] - length)]];
+
+    return [[NSString alloc] initWithBytes:[bytes bytes] length:length encoding:NSUTF8StringEncoding];
+}
+
+- (void)setTerminal:(NMSSHTerminal *)terminal {
+    [_terminal setResponseHandler:nil];
+    _terminal = terminal;
+
+    __weak NMSSHChannel *weakSelf = self;
+    [terminal setResponseHandler:^(NSData *response) {
+        [weakSelf writeData:response completion:nil];
+    }];
+}
+
+- (void)closeShell {
+    if (self.source) {
+        dispatch_source_cancel(self.source);
+#if !(OS_OBJECT_USE_OBJC)
+        dispatch_release(self.source);
+#endif
+        [self setSource: nil];
+    }
+
+    // Pending writes are failed on the shell queue, which owns them
+    if (self.shellQueue) {
+        dispatch_block_t cancelWrites = ^{
+            [self failShellWrites:[NSError errorWithDomain:@"NMSSH"
+                                                      code:NMSSHChannelCancelledError
+                                                  userInfo:@{ NSLocalizedDescriptionKey : @"Shell closed" }]];
+        };
+
+        if ([self isOnShellQueue]) {
+            cancelWrites();
+        }
+        else {
+            dispatch_async(self.shellQueue, cancelWrites);
+        }
+    }
+
+    NMSSHSession *session = self.session;
+    [session beginSynchronousCall];
+
+    if (self.type == NMSSHChannelTypeShell) {
+        // Set blocking mode
+        libssh2_session_set_blocking(self.session.rawSession, 1);
+
+        [self sendEOF];
+    }
+
+    [self closeChannel];
+    [session endSynchronousCall];
+}
+
+- (BOOL)write:(NSString *)command error:(NSError *__autoreleasing *)error {
+    return [self write:command error:error timeout:@0];
+}
+
+- (BOOL)write:(NSString *)command error:(NSError *__autoreleasing *)error timeout:(NSNumber *)timeout {
+    return [self writeData:[command dataUsingEncoding:NSUTF8StringEncoding] error:error timeout:timeout];
+}
+
+- (BOOL)writeData:(NSData *)data error:(NSError *__autoreleasing *)error {
+    return [self writeData:data error:error timeout:@0];
+}
+
+- (BOOL)writeData:(NSData *)data error:(NSError *__autoreleasing *)error timeout:(NSNumber *)timeout {
+    NMSSHSession *session = self.session;
+    [session beginSynchronousCall];
+    BOOL written = [self writeShellData:data error:error timeout:timeout];
+    [session endSynchronousCall];
+
+    return written;
+}
+
+- (BOOL)writeShellData:(NSData *)data error:(NSError *__autoreleasing *)error timeout:(NSNumber *)timeout {
+    if (self.type != NMSSHChannelTypeShell) {
+        NMSSHLogError(@"Shell required");
+        return NO;
+    }
+
+    ssize_t rc;
+
+    // Set the timeout
+    CFAbsoluteTime time = CFAbsoluteTimeGetCurrent() + [timeout doubleValue];
+    [self.session resetCancellation];
+
+    // Try writing on shell
+    while ((rc = libssh2_channel_write(self.channel, [data bytes], [data length])) == LIBSSH2_ERROR_EAGAIN) {
+        // Check if the connection timed out, the socket wait returns at once past the deadline
+        if ([timeout doubleValue] > 0 && time <= CFAbsoluteTimeGetCurrent()) {
+            if (error) {
+                NSString *description = @"Connection timed out";
+
+                *error = [NSError errorWithDomain:@"NMSSH"
+                                             code:NMSSHChannelExecutionTimeout
+                                         userInfo:@{ NSLocalizedDescriptionKey : description }];
+            }
+
+            return NO;
+        }
+
+        // Wait no longer than the time left before the timeout
+        if ([self.session waitSocketUntil:([timeout doubleValue] > 0 ? time : 0)] == NMSSH_WAITSOCKET_INTERRUPTED) {
+            if (error) {
+                *error = [NSError errorWithDomain:@"NMSSH"
+                                             code:NMSSHChannelCancelledError
+                                         userInfo:@{ NSLocalizedDescriptionKey : @"Write cancelled" }];
+            }
+
+            return NO;
+        }
+    }
+
+    if (rc < 0) {
+        NMSSHLogError(@"Error writing on the shell");
+        if (error) {
+            NSString *command = [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding];
+            *error = [NSError errorWithDomain:@"NMSSH"
+                                         code:NMSSHChannelWriteError
+                                     userInfo:@{ NSLocalizedDescriptionKey : [[self.session lastError] localizedDescription],
+                                                 @"command"                : command }];
+        }
+
+        return NO;
+    }
+
+    return YES;
+}
+
+- (BOOL)writeData:(NSData *)data completion:(void (^)(NSError *))completion {
+    if (self.type != NMSSHChannelTypeShell || !self.shellQueue) {
+        NMSSHLogError(@"Shell required");
+
+        if (completion) {
+            [self.session dispatchCallback:^{
+                completion([NSError errorWithDomain:@"NMSSH"
+                                               code:NMSSHChannelWriteError
+                                           userInfo:@{ NSLocalizedDescriptionKey : @"Shell required" }]);
+            }];
+        }
+
+        return NO;
+    }
+
+    NSData *write = [data copy];
+    id writeCompletion = (completion ? [completion copy] : [NSNull null]);
+
+    // Counted at once, the write itself may be queued behind a read of the shell
+    NSUInteger queuedWriteSize = atomic_fetch_add(&_queuedWriteSize, [write length]) + [write length];
+    BOOL belowHighWaterMark = queuedWriteSize < self.writeHighWaterMark;
+
+    // Never wait for the shell queue, which may be waiting for the caller's queue
+    dispatch_async(self.shellQueue, ^{
+        [self.shellWrites addObject:write];
+        [self.shellWriteCompletions addObject:writeCompletion];
+
+        if (!belowHighWaterMark) {
+            [self setShellWriteFull:YES];
+        }
+
+        // Nothing is written while waiting for the socket, its handler drains the queue
+        if (!self.writeSource) {
+            [self performShellCall:^{
+                [self drainShellWrites];
+            }];
+        }
+    });
+
+    return belowHighWaterMark;
+}
+
+- (NSUInteger)queuedWriteSize {
+    return atomic_load(&_queuedWriteSize);
+}
+
+/** Run libssh2 calls of the shell, which keepalive probes wait for */
+- (void)performShellCall:(dispatch_block_t)block {
+    NMSSHSession *session = self.session;
+    [session beginSynchronousCall];
+    block();
+    [session endSynchronousCall];
+}
+
+- (BOOL)isOnShellQueue {
+    return dispatch_get_specific(kNMSSHShellQueueKey) == (__bridge void *)self;
+}
+
+- (void)performSyncOnShellQueue:(dispatch_block_t)block {
+    if ([self isOnShellQueue]) {
+        block();
+    }
+    else {
+        dispatch_sync(self.shellQueue, block);
+    }
+}
+
+/** Write as much queued shell input as the channel accepts, without blocking */
+- (void)drainShellWrites {
+    while ([self.shellWrites count] > 0) {
+        if (self.type != NMSSHChannelTypeShell || self.channel == NULL) {
+            [self failShellWrites:[NSError errorWithDomain:@"NMSSH"
+                                                      code:NMSSHChannelCancelledError
+                                                  userInfo:@{ NSLocalizedDescriptionKey : @"Shell closed" }]];
+            return;
+        }
+
+        NSData *data = [self.shellWrites firstObject];
+        ssize_t rc = 0;
+
+        if (self.shellWriteOffset < [data length]) {
+            rc = libssh2_channel_write(self.channel, (const char *)[data bytes] + self.shellWriteOffset,
+                                       [data length] - self.shellWriteOffset);
+        }
+
+        if (rc == LIBSSH2_ERROR_EAGAIN) {
+            // A full remote window is reopened by a packet the read source
+            // picks up, a full socket buffer needs to wait for the socket
+            if (libssh2_session_block_directions(self.session.rawSession) & LIBSSH2_SESSION_BLOCK_OUTBOUND) {
+                [self waitShellWritable];
+            }
+
+            return;
+        }
+
+        if (rc < 0) {
+            NMSSHLogError(@"Error writing on the shell");
+            [self failShellWrites:[NSError errorWithDomain:@"NMSSH"
+                                                      code:NMSSHChannelWriteError
+                                                  userInfo:@{ NSLocalizedDescriptionKey : [[self.session lastError] localizedDescription] }]];
+            return;
+        }
+
+        [self setShellWriteOffset:self.shellWriteOffset + rc];
+        atomic_fetch_sub(&_queuedWriteSize, rc);
+
+        if (self.shellWriteOffset == [data length]) {
+            [self completeShellWrite:nil];
+        }
+    }
+
+    if (self.shellWriteFull) {
+        [self setShellWriteFull:NO];
+
+        if (self.delegate && [self.delegate respondsToSelector:@selector(channelDidDrainWriteQueue:)]) {
+            [self.delegate channelDidDrainWriteQueue:self];
+        }
+    }
+}
+
+/** Drain the write queue once the session socket accepts data again */
+- (void)waitShellWritable {
+    if (self.writeSource) {
+        return;
+    }
+
+    [self setWriteSource:dispatch_source_create(DISPATCH_SOURCE_TYPE_WRITE, CFSocketGetNative([self.session socket]),
+                                                0, self.shellQueue)];
+
+    __weak NMSSHChannel *weakSelf = self;
+    dispatch_source_set_event_handler(self.writeSource, ^{
+        [weakSelf cancelShellWriteSource];
+        [weakSelf performShellCall:^{
+            [weakSelf drainShellWrites];
+        }];
+    });
+
+    dispatch_resume(self.writeSource);
+}
+
+- (void)cancelShellWriteSource {
+    if (self.writeSource) {
+        dispatch_source_cancel(self.writeSource);
+#if !(OS_OBJECT_USE_OBJC)
+        dispatch_release(self.writeSource);
+#endif
+        [self setWriteSource:nil];
+    }
+}
+
+/** Remove the first queued write and report its outcome */
+- (void)completeShellWrite:(NSError *)error {
+    NSData *data = [self.shellWrites firstObject];
+    id completion = [self.shellWriteCompletions firstObject];
+
+    atomic_fetch_sub(&_queuedWriteSize, [data length] - self.shellWriteOffset);
+    [self setShellWriteOffset:0];
+    [self.shellWrites removeObjectAtIndex:0];
+    [self.shellWriteCompletions removeObjectAtIndex:0];
+
+    if (completion != [NSNull null]) {
+        [self.session dispatchCallback:^{
+            ((void (^)(NSError *))completion)(error);
+        }];
+    }
+}
+
+/** Fail every queued write, a partially written one included */
+- (void)failShellWrites:(NSError *)error {
+    [self cancelShellWriteSource];
+
+    while ([self.shellWrites count] > 0) {
+        [self completeShellWrite:error];
+    }
+
+    [self setShellWriteFull:NO];
+}
+
+- (BOOL)requestSizeWidth:(NSUInteger)width height:(NSUInteger)height {
+    NMSSHSession *session = self.session;
+    [session beginSynchronousCall];
+    int rc = libssh2_channel_request_pty_size(self.channel, (int)width, (int)height);
+    [session endSynchronousCall];
+
     if (rc) {
         NMSSHLogError(@"Request size failed with error %i", rc);
     }
+    else if (self.terminal) {
+        // The terminal is only used from the shell queue once the shell started
+        NMSSHTerminal *terminal = self.terminal;
+        dispatch_block_t resize = ^{
+            [terminal resizeColumns:width rows:height];
+        };
+
+        if (self.shellQueue && ![self isOnShellQueue]) {
+            dispatch_async(self.shellQueue, resize);
+        }
+        else {
+            resize();
+        }
+    }
 
     return rc == 0;
 }
@@ -505,6 +1770,15 @@
 }
 
 - (BOOL)uploadFile:(NSString *)localPath to:(NSString *)remotePath progress:(BOOL (^)(NSUInteger))progress {
+    NMSSHSession *session = self.session;
+    [session beginSynchronousCall];
+    BOOL uploaded = [self sendFile:localPath to:remotePath progress:progress];
+    [session endSynchronousCall];
+
+    return uploaded;
+}
+
+- (BOOL)sendFile:(NSString *)localPath to:(NSString *)remotePath progress:(BOOL (^)(NSUInteger))progress {
     if (self.channel != NULL) {
         NMSSHLogWarn(@"The channel will be closed before continue");
 
@@ -597,6 +1871,15 @@
 }
 
 - (BOOL)downloadFile:(NSString *)remotePath to:(NSString *)localPath progress:(BOOL (^)(NSUInteger, NSUInteger))progress {
+    NMSSHSession *session = self.session;
+    [session beginSynchronousCall];
+    BOOL downloaded = [self receiveFile:remotePath to:localPath progress:progress];
+    [session endSynchronousCall];
+
+    return downloaded;
+}
+
+- (BOOL)receiveFile:(NSString *)remotePath to:(NSString *)localPath progress:(BOOL (^)(NSUInteger, NSUInteger))progress {
     if (self.channel != NULL) {
         NMSSHLogWarn(@"The channel will be closed before continue");
 
@@ -620,6 +1903,7 @@
 
     // Request a file via SCP
     struct stat fileinfo;
+    CFAbsoluteTime openTime = CFAbsoluteTimeGetCurrent();
     LIBSSH2_CHANNEL *channel = libssh2_scp_recv(self.session.rawSession, [remotePath UTF8String], &fileinfo);
 
     if (channel == NULL) {
@@ -629,6 +1913,7 @@
 
     [self setChannel:channel];
     [self setType:NMSSHChannelTypeSCP];
+    window_tuner_start(&_windowTuner, self.maxWindowSize, [self roundTripTimeWithOpenTime:openTime]);
 
     if ([[NSFileManager defaultManager] fileExistsAtPath:localPath]) {
         NMSSHLogInfo(@"A file already exists at %@, it will be overwritten", localPath);
@@ -649,6 +1934,7 @@
         }
 
         ssize_t rc = libssh2_channel_read(self.channel, mem, amount);
+        window_tuner_update(&_windowTuner, self.channel, rc);
 
         if (rc > 0) {
             size_t n = write(localFile, mem, rc);
@@ -665,7 +1951,7 @@
                 return NO;
             }
         }
-        else if (rc < 0) {
+        else if (rc < 0 || libssh2_channel_eof(self.channel)) {
             NMSSHLogError(@"Failed to read SCP data");
             close(localFile);
             [self closeChannel];
@@ -682,4 +1968,311 @@
     return YES;
 }
 
+- (NMSSHOperation *)uploadFile:(NSString *)localPath
+                            to:(NSString *)remotePath
+                      progress:(BOOL (^)(NSUInteger))progress
+                    completion:(void (^)(BOOL, NSError *))completion {
+    localPath = [localPath stringByExpandingTildeInPath];
+
+    // Inherit file name if to: contains a directory
+    if ([remotePath hasSuffix:@"/"]) {
+        remotePath = [remotePath stringByAppendingString:[[localPath componentsSeparatedByString:@"/"] lastObject]];
+    }
+
+    NSMutableData *buffer = [[NSMutableData alloc] initWithLength:self.bufferSize];
+
+    __block NMSSHChannelStep step = NMSSHChannelStepOpen;
+    __block LIBSSH2_CHANNEL *channel = NULL;
+    __block FILE *local = NULL;
+    __block struct stat fileinfo;
+    __block size_t length = 0, offset = 0;
+    __block NSUInteger total = 0;
+    __block BOOL pending = NO;
+    __block NSError *failure = nil;
+
+    NMSSHOperation *operation = [NMSSHOperation operationWithSession:self.session step:^NMSSHOperationStatus(NMSSHOperation *operation) {
+        NMSSHSession *session = operation.session;
+        BOOL worked = NO;
+        ssize_t rc;
+
+        if (!session.rawSession) {
+            channel = NULL;
+            pending = NO;
+        }
+
+        while (step < NMSSHChannelStepClose) {
+            // A request already sent must complete before the channel can be closed
+            if (operation.abortError && !pending) {
+                failure = failure ?: operation.abortError;
+                step = NMSSHChannelStepClose;
+                break;
+            }
+
+            switch (step) {
+                case NMSSHChannelStepOpen:
+                    if (!local) {
+                        local = fopen([localPath UTF8String], "rb");
+                        if (!local || fstat(fileno(local), &fileinfo) != 0) {
+                            NMSSHLogError(@"Can't read local file");
+                            failure = [NSError errorWithDomain:@"NMSSH"
+                                                          code:NMSSHChannelReadError
+                                                      userInfo:@{ NSLocalizedDescriptionKey : @"Can't read local file" }];
+                            step = NMSSHChannelStepClose;
+                            break;
+                        }
+                    }
+
+                    if (![session acquireRequestLockForOperation:operation]) {
+                        return NMSSHOperationStatusForProgress(worked);
+                    }
+
+                    channel = libssh2_scp_send64(session.rawSession, [remotePath UTF8String], fileinfo.st_mode & 0644,
+                                                 (unsigned long)fileinfo.st_size, 0, 0);
+                    if ((pending = (!channel && libssh2_session_last_errno(session.rawSession) == LIBSSH2_ERROR_EAGAIN))) {
+                        return NMSSHOperationStatusForProgress(worked);
+                    }
+
+                    [session releaseRequestLockForOperation:operation];
+
+                    if (!channel) {
+                        NMSSHLogError(@"Unable to open SCP session");
+                        failure = [session lastError];
+                        step = NMSSHChannelStepClose;
+                        break;
+                    }
+
+                    step = NMSSHChannelStepTransfer;
+                    break;
+
+                case NMSSHChannelStepTransfer:
+                    if (offset == length) {
+                        offset = 0;
+                        length = fread([buffer mutableBytes], 1, [buffer length], local);
+
+                        if (length == 0) {
+                            step = NMSSHChannelStepSendEOF;
+                            break;
+                        }
+                    }
+
+                    // Write the same data over and over, until error or completion
+                    rc = libssh2_channel_write(channel, (char *)[buffer bytes] + offset, length - offset);
+                    if (rc == LIBSSH2_ERROR_EAGAIN) {
+                        // A full window leaves nothing in flight, the upload can still be aborted
+                        pending = (libssh2_channel_window_write(channel) > 0);
+                        return NMSSHOperationStatusForProgress(worked);
+                    }
+
+                    if (rc < 0) {
+                        NMSSHLogError(@"Failed writing file");
+                        failure = [NSError errorWithDomain:@"NMSSH"
+                                                      code:NMSSHChannelWriteError
+                                                  userInfo:@{ NSLocalizedDescriptionKey : [[session lastError] localizedDescription] }];
+                        step = NMSSHChannelStepClose;
+                        break;
+                    }
+
+                    offset += rc;
+                    total += rc;
+
+                    if (progress && !progress(total)) {
+                        failure = [NMSSHOperation errorWithCode:NMSSHOperationCancelledError description:@"Upload cancelled"];
+                        step = NMSSHChannelStepClose;
+                    }
+                    break;
+
+                case NMSSHChannelStepSendEOF:
+                    rc = libssh2_channel_send_eof(channel);
+                    if ((pending = (rc == LIBSSH2_ERROR_EAGAIN))) {
+                        return NMSSHOperationStatusForProgress(worked);
+                    }
+
+                    step = (rc == 0 ? NMSSHChannelStepWaitEOF : NMSSHChannelStepClose);
+                    break;
+
+                default:
+                    rc = libssh2_channel_wait_eof(channel);
+                    if (rc == LIBSSH2_ERROR_EAGAIN) {
+                        return NMSSHOperationStatusForProgress(worked);
+                    }
+
+                    step = NMSSHChannelStepClose;
+                    break;
+            }
+
+            worked = YES;
+        }
+
+        if (local) {
+            fclose(local);
+            local = NULL;
+        }
+
+        if (channel_teardown(session.rawSession, &channel, &step, NULL, NULL) == LIBSSH2_ERROR_EAGAIN) {
+            return NMSSHOperationStatusForProgress(worked);
+        }
+
+        if (completion) {
+            [session dispatchCallback:^{
+                completion(failure == nil, failure);
+            }];
+        }
+
+        return NMSSHOperationStatusDone;
+    }];
+
+    [self.session startOperation:operation];
+
+    return operation;
+}
+
+- (NMSSHOperation *)downloadFile:(NSString *)remotePath
+                              to:(NSString *)localPath
+                        progress:(BOOL (^)(NSUInteger, NSUInteger))progress
+                      completion:(void (^)(BOOL, NSError *))completion {
+    localPath = [localPath stringByExpandingTildeInPath];
+
+    // Inherit file name if to: contains a directory
+    if ([localPath hasSuffix:@"/"]) {
+        localPath = [localPath stringByAppendingString:[[remotePath componentsSeparatedByString:@"/"] lastObject]];
+    }
+
+    NSMutableData *buffer = [[NSMutableData alloc] initWithLength:self.bufferSize];
+
+    __block NMSSHChannelStep step = NMSSHChannelStepOpen;
+    __block LIBSSH2_CHANNEL *channel = NULL;
+    __block int localFile = -1;
+    __block struct stat fileinfo;
+    __block off_t got = 0;
+    __block BOOL pending = NO;
+    __block NSError *failure = nil;
+    __block CFAbsoluteTime openTime = 0;
+    __block NMSSHWindowTuner windowTuner;
+    unsigned long maxWindowSize = self.maxWindowSize;
+
+    NMSSHOperation *operation = [NMSSHOperation operationWithSession:self.session step:^NMSSHOperationStatus(NMSSHOperation *operation) {
+        NMSSHSession *session = operation.session;
+        BOOL worked = NO;
+
+        if (!session.rawSession) {
+            channel = NULL;
+            pending = NO;
+        }
+
+        while (step < NMSSHChannelStepClose) {
+            // A request already sent must complete before the channel can be closed
+            if (operation.abortError && !pending) {
+                failure = failure ?: operation.abortError;
+                step = NMSSHChannelStepClose;
+                break;
+            }
+
+            if (step == NMSSHChannelStepOpen) {
+                if (![session acquireRequestLockForOperation:operation]) {
+                    return NMSSHOperationStatusForProgress(worked);
+                }
+
+                openTime = openTime ?: CFAbsoluteTimeGetCurrent();
+                channel = libssh2_scp_recv(session.rawSession, [remotePath UTF8String], &fileinfo);
+                if ((pending = (!channel && libssh2_session_last_errno(session.rawSession) == LIBSSH2_ERROR_EAGAIN))) {
+                    return NMSSHOperationStatusForProgress(worked);
+                }
+
+                [session releaseRequestLockForOperation:operation];
+
+                if (!channel) {
+                    NMSSHLogError(@"Unable to open SCP session");
+                    failure = [session lastError];
+                    step = NMSSHChannelStepClose;
+                    continue;
+                }
+
+                window_tuner_start(&windowTuner, maxWindowSize,
+                                   session.roundTripTime > 0 ? session.roundTripTime : CFAbsoluteTimeGetCurrent() - openTime);
+
+                if ([[NSFileManager defaultManager] fileExistsAtPath:localPath]) {
+                    NMSSHLogInfo(@"A file already exists at %@, it will be overwritten", localPath);
+                    [[NSFileManager defaultManager] removeItemAtPath:localPath error:nil];
+                }
+
+                // Open local file in order to write to it
+                localFile = open([localPath UTF8String], O_WRONLY|O_CREAT, 0644);
+                if (localFile < 0) {
+                    NMSSHLogError(@"Failed to open local file");
+                    failure = [NSError errorWithDomain:@"NMSSH"
+                                                  code:NMSSHChannelWriteError
+                                              userInfo:@{ NSLocalizedDescriptionKey : @"Failed to open local file" }];
+                }
+
+                step = (localFile < 0 || got >= fileinfo.st_size ? NMSSHChannelStepClose : NMSSHChannelStepTransfer);
+            }
+            else {
+                size_t amount = [buffer length];
+                if ((fileinfo.st_size - got) < amount) {
+                    amount = (size_t)(fileinfo.st_size - got);
+                }
+
+                ssize_t rc = libssh2_channel_read(channel, [buffer mutableBytes], amount);
+                window_tuner_update(&windowTuner, channel, rc);
+
+                if (rc == LIBSSH2_ERROR_EAGAIN) {
+                    return NMSSHOperationStatusForProgress(worked);
+                }
+
+                // End of file before the announced size, nothing more will come
+                if (rc == 0) {
+                    NMSSHLogError(@"SCP transfer truncated after %lld bytes", (long long)got);
+                    failure = [NSError errorWithDomain:@"NMSSH"
+                                                  code:NMSSHChannelReadError
+                                              userInfo:@{ NSLocalizedDescriptionKey : @"The remote file was truncated" }];
+                    step = NMSSHChannelStepClose;
+                    continue;
+                }
+
+                if (rc < 0 || write(localFile, [buffer bytes], rc) < rc) {
+                    NMSSHLogError(@"Failed to transfer SCP data");
+                    failure = [NSError errorWithDomain:@"NMSSH"
+                                                  code:(rc < 0 ? NMSSHChannelReadError : NMSSHChannelWriteError)
+                                              userInfo:@{ NSLocalizedDescriptionKey : @"Failed to transfer SCP data" }];
+                    step = NMSSHChannelStepClose;
+                    continue;
+                }
+
+                got += rc;
+
+                if (progress && !progress((NSUInteger)got, (NSUInteger)fileinfo.st_size)) {
+                    failure = [NMSSHOperation errorWithCode:NMSSHOperationCancelledError description:@"Download cancelled"];
+                    step = NMSSHChannelStepClose;
+                }
+                else if (got >= fileinfo.st_size) {
+                    step = NMSSHChannelStepClose;
+                }
+            }
+
+            worked = YES;
+        }
+
+        if (localFile >= 0) {
+            close(localFile);
+            localFile = -1;
+        }
+
+        if (channel_teardown(session.rawSession, &channel, &step, NULL, NULL) == LIBSSH2_ERROR_EAGAIN) {
+            return NMSSHOperationStatusForProgress(worked);
+        }
+
+        if (completion) {
+            [session dispatchCallback:^{
+                completion(failure == nil, failure);
+            }];
+        }
+
+        return NMSSHOperationStatusDone;
+    }];
+
+    [self.session startOperation:operation];
+
+    return operation;
+}
+
 @end
@@ -0,0 +1,55 @@
+#import "NMSSH.h"
+
+/**
+ NMSSHCommandResult holds the outcome of a command executed on a remote host.
+ */
+@interface NMSSHCommandResult : NSObject
+
+/** The host the command was executed on */
+@property (nonatomic, nonnull, readonly) NSString *host;
+
+/** The command that was executed */
+@property (nonatomic, nonnull, readonly) NSString *command;
+
+/** Exit status of the command, -1 if it did not run to completion */
+@property (nonatomic, readonly) int exitStatus;
+
+/** Name of the signal that terminated the command without the `SIG` prefix, e.g. `TERM` */
+@property (nonatomic, nullable, readonly) NSString *exitSignal;
+
+/** Raw data written by the command to stdout */
+@property (nonatomic, nonnull, readonly) NSData *outputData;
+
+/** Raw data written by the command to stderr */
+@property (nonatomic, nonnull, readonly) NSData *errorOutputData;
+
+/** stdout decoded as UTF-8 */
+@property (nonatomic, nullable, readonly) NSString *output;
+
+/** stderr decoded as UTF-8 */
+@property (nonatomic, nullable, readonly) NSString *errorOutput;
+
+/** Time elapsed since the host was picked up, in seconds */
+@property (nonatomic, readonly) NSTimeInterval duration;
+
+/**
+ Error that prevented the command from running to completion, nil when the
+ command exited (even with a non-zero exit status).
+ */
+@property (nonatomic, nullable, readonly) NSError *error;
+
+/** A Boolean value indicating whether the command exited with status 0 and was not killed by a signal */
+@property (nonatomic, readonly, getter = isSuccessful) BOOL successful;
+
+- (nonnull instancetype)init NS_UNAVAILABLE;
+
+/**
+ Create an empty result for a command on a host.
+
+ @param host The host the command is executed on
+ @param command The command being executed
+ @returns NMSSHCommandResult instance
+ */
+- (nonnull instancetype)initWithHost:(nonnull NSString *)host command:(nonnull NSString *)command;
+
+@end
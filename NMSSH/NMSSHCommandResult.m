@@ -0,0 +1,55 @@
+#import "NMSSHCommandResult.h"
+#import "NMSSH+Protected.h"
+
+@interface NMSSHCommandResult ()
+@property (nonatomic, strong) NSString *host;
+@property (nonatomic, strong) NSString *command;
+@property (nonatomic, strong) NSMutableData *mutableOutputData;
+@property (nonatomic, strong) NSMutableData *mutableErrorOutputData;
+@end
+
+@implementation NMSSHCommandResult
+
+- (instancetype)initWithHost:(NSString *)host command:(NSString *)command {
+    if ((self = [super init])) {
+        [self setHost:host];
+        [self setCommand:command];
+        [self setExitStatus:-1];
+        [self setMutableOutputData:[[NSMutableData alloc] init]];
+        [self setMutableErrorOutputData:[[NSMutableData alloc] init]];
+    }
+
+    return self;
+}
+
+- (NSData *)outputData {
+    return self.mutableOutputData;
+}
+
+- (NSData *)errorOutputData {
+    return self.mutableErrorOutputData;
+}
+
+- (NSString *)output {
+    return [[NSString alloc] initWithData:self.mutableOutputData encoding:NSUTF8StringEncoding];
+}
+
+- (NSString *)errorOutput {
+    return [[NSString alloc] initWithData:self.mutableErrorOutputData encoding:NSUTF8StringEncoding];
+}
+
+- (BOOL)isSuccessful {
+    return !self.error && !self.exitSignal && self.exitStatus == 0;
+}
+
+- (void)appendData:(NSData *)data isStderr:(BOOL)isStderr {
+    [(isStderr ? self.mutableErrorOutputData : self.mutableOutputData) appendData:data];
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@: %@ `%@` exit %i in %.3fs%@>",
+            NSStringFromClass([self class]), self.host, self.command, self.exitStatus, self.duration,
+            self.error ? [@" error: " stringByAppendingString:[self.error localizedDescription]] : @""];
+}
+
+@end
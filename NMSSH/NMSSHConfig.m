@@ -102,6 +102,21 @@ typedef enum {
     else if ([keyword localizedCaseInsensitiveCompare:@"identityfile"] == NSOrderedSame) {
         [self parseIdentityFileWithArguments:arguments intoArray:array];
     }
+    else if ([keyword localizedCaseInsensitiveCompare:@"ciphers"] == NSOrderedSame) {
+        [self parseAlgorithmsWithArguments:arguments intoArray:array forKey:@"ciphers"];
+    }
+    else if ([keyword localizedCaseInsensitiveCompare:@"macs"] == NSOrderedSame) {
+        [self parseAlgorithmsWithArguments:arguments intoArray:array forKey:@"macs"];
+    }
+    else if ([keyword localizedCaseInsensitiveCompare:@"kexalgorithms"] == NSOrderedSame) {
+        [self parseAlgorithmsWithArguments:arguments intoArray:array forKey:@"kexAlgorithms"];
+    }
+    else if ([keyword localizedCaseInsensitiveCompare:@"hostkeyalgorithms"] == NSOrderedSame) {
+        [self parseAlgorithmsWithArguments:arguments intoArray:array forKey:@"hostKeyAlgorithms"];
+    }
+    else if ([keyword localizedCaseInsensitiveCompare:@"compression"] == NSOrderedSame) {
+        [self parseCompressionWithArguments:arguments intoArray:array];
+    }
 }
 
 - (void)parseHostWithArguments:(NSString *)arguments intoArray:(NSMutableArray *)array {
@@ -187,6 +202,60 @@ typedef enum {
     }
 }
 
+// Parses a comma separated list of algorithms into the config property named key. Lists
+// modifying the defaults (starting with +, - or ^) can't be honored and are ignored.
+- (void)parseAlgorithmsWithArguments:(NSString *)arguments
+                           intoArray:(NSMutableArray *)array
+                              forKey:(NSString *)key {
+    if ([array count] == 0) {
+        return;
+    }
+    NMSSHHostConfig *config = [array lastObject];
+    NSRange valueRange = [self rangeOfFirstTokenInString:arguments suffix:NULL];
+
+    if (valueRange.location == NSNotFound ||
+        valueRange.length == 0) {
+        return;
+    }
+
+    NSString *value = [arguments substringWithRange:valueRange];
+    if ([value hasPrefix:@"+"] || [value hasPrefix:@"-"] || [value hasPrefix:@"^"]) {
+        return;
+    }
+
+    NSMutableArray *algorithms = [NSMutableArray array];
+    for (NSString *algorithm in [value componentsSeparatedByString:@","]) {
+        if ([algorithm length] > 0) {
+            [algorithms addObject:algorithm];
+        }
+    }
+
+    if ([algorithms count] > 0) {
+        [config setValue:[algorithms copy] forKey:key];
+    }
+}
+
+- (void)parseCompressionWithArguments:(NSString *)arguments
+                            intoArray:(NSMutableArray *)array {
+    if ([array count] == 0) {
+        return;
+    }
+    NMSSHHostConfig *config = [array lastObject];
+    NSRange valueRange = [self rangeOfFirstTokenInString:arguments suffix:NULL];
+
+    if (valueRange.location != NSNotFound &&
+        valueRange.length > 0) {
+        NSString *value = [arguments substringWithRange:valueRange];
+
+        if ([value localizedCaseInsensitiveCompare:@"yes"] == NSOrderedSame) {
+            [config setCompression:@YES];
+        }
+        else if ([value localizedCaseInsensitiveCompare:@"no"] == NSOrderedSame) {
+            [config setCompression:@NO];
+        }
+    }
+}
+
 - (NSCharacterSet *)blanksCharacterSet {
     NSMutableCharacterSet *blanksCharacterSet = [[NSMutableCharacterSet alloc] init];
     [blanksCharacterSet addCharactersInRange:NSMakeRange(' ', 1)];
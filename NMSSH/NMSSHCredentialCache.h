@@ -0,0 +1,52 @@
+#import "NMSSH.h"
+
+/**
+ NMSSHCredentialCache keeps key material and authentication outcomes across
+ sessions, so opening many sessions does not repeat the same work.
+
+ - Key files are read once and kept in memory, they are read again only when
+   the file changes on disk.
+ - The agent identity a host accepted last is remembered and tried first on
+   the next session to that host.
+
+ Every NMSSHSession uses the shared cache unless its `credentialCache` is set
+ to another instance or to nil. All methods are thread safe.
+ */
+@interface NMSSHCredentialCache : NSObject
+
+/**
+ The process-wide cache.
+
+ @returns The shared NMSSHCredentialCache instance
+ */
++ (nonnull instancetype)sharedCache;
+
+/**
+ Contents of a key file, read from disk only if it changed since the last
+ call.
+
+ @param path Filepath to the key, tildes are expanded
+ @returns The contents of the file, nil if it can't be read
+ */
+- (nullable NSData *)contentsOfKeyAtPath:(nonnull NSString *)path;
+
+/**
+ The public key blob of the agent identity last accepted by a host.
+
+ @param host Identifies the account, e.g. `user@host:port`
+ @returns The identity's public key blob, nil if none was recorded
+ */
+- (nullable NSData *)agentIdentityForHost:(nonnull NSString *)host;
+
+/**
+ Remember the agent identity a host accepted.
+
+ @param identity The identity's public key blob
+ @param host Identifies the account, e.g. `user@host:port`
+ */
+- (void)setAgentIdentity:(nonnull NSData *)identity forHost:(nonnull NSString *)host;
+
+/** Forget all cached keys and identities. */
+- (void)removeAllObjects;
+
+@end
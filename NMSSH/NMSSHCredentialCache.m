@@ -0,0 +1,128 @@
+#import "NMSSHCredentialCache.h"
+#import "NMSSH+Protected.h"
+#import <sys/stat.h>
+
+/** A key file's contents and the file state they were read from */
+@interface NMSSHCachedKey : NSObject
+@property (nonatomic, strong) NSData *contents;
+@property (nonatomic, assign) struct timespec modificationTime;
+@property (nonatomic, assign) off_t size;
+@end
+
+@implementation NMSSHCachedKey
+@end
+
+@interface NMSSHCredentialCache ()
+@property (nonatomic, strong) NSMutableDictionary *keys;
+@property (nonatomic, strong) NSMutableDictionary *agentIdentities;
+
+#if OS_OBJECT_USE_OBJC
+@property (nonatomic, strong) dispatch_queue_t cacheQueue;
+#else
+@property (nonatomic, assign) dispatch_queue_t cacheQueue;
+#endif
+@end
+
+@implementation NMSSHCredentialCache
+
+// -----------------------------------------------------------------------------
+#pragma mark - INITIALIZE THE CACHE
+// -----------------------------------------------------------------------------
+
++ (instancetype)sharedCache {
+    static NMSSHCredentialCache *cache = nil;
+
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        cache = [[NMSSHCredentialCache alloc] init];
+    });
+
+    return cache;
+}
+
+- (instancetype)init {
+    if ((self = [super init])) {
+        [self setKeys:[[NSMutableDictionary alloc] init]];
+        [self setAgentIdentities:[[NSMutableDictionary alloc] init]];
+        [self setCacheQueue:dispatch_queue_create("NMSSH.credentialCacheQueue", DISPATCH_QUEUE_SERIAL)];
+    }
+
+    return self;
+}
+
+#if !(OS_OBJECT_USE_OBJC)
+- (void)dealloc {
+    dispatch_release(self.cacheQueue);
+}
+#endif
+
+// -----------------------------------------------------------------------------
+#pragma mark - KEY FILES
+// -----------------------------------------------------------------------------
+
+- (NSData *)contentsOfKeyAtPath:(NSString *)path {
+    path = [path stringByExpandingTildeInPath];
+
+    struct stat info;
+    if (stat([path fileSystemRepresentation], &info) != 0) {
+        NMSSHLogError(@"Unable to read key %@", path);
+        return nil;
+    }
+
+    __block NMSSHCachedKey *key = nil;
+    dispatch_sync(self.cacheQueue, ^{
+        key = self.keys[path];
+    });
+
+    // Stale entries are replaced, a key file may be rotated while we run
+    if (key && key.size == info.st_size &&
+        key.modificationTime.tv_sec == info.st_mtimespec.tv_sec &&
+        key.modificationTime.tv_nsec == info.st_mtimespec.tv_nsec) {
+        return key.contents;
+    }
+
+    NSData *contents = [NSData dataWithContentsOfFile:path];
+    if (!contents) {
+        NMSSHLogError(@"Unable to read key %@", path);
+        return nil;
+    }
+
+    key = [[NMSSHCachedKey alloc] init];
+    [key setContents:contents];
+    [key setModificationTime:info.st_mtimespec];
+    [key setSize:info.st_size];
+
+    dispatch_sync(self.cacheQueue, ^{
+        self.keys[path] = key;
+    });
+
+    return contents;
+}
+
+// -----------------------------------------------------------------------------
+#pragma mark - AGENT IDENTITIES
+// -----------------------------------------------------------------------------
+
+- (NSData *)agentIdentityForHost:(NSString *)host {
+    __block NSData *identity = nil;
+    dispatch_sync(self.cacheQueue, ^{
+        identity = self.agentIdentities[host];
+    });
+
+    return identity;
+}
+
+- (void)setAgentIdentity:(NSData *)identity forHost:(NSString *)host {
+    dispatch_sync(self.cacheQueue, ^{
+        self.agentIdentities[host] = [identity copy];
+    });
+}
+
+- (void)removeAllObjects {
+    dispatch_sync(self.cacheQueue, ^{
+        [self.keys removeAllObjects];
+        [self.agentIdentities removeAllObjects];
+    });
+}
+
+@end
@@ -0,0 +1,67 @@
+#import "NMSSH.h"
+
+/**
+ NMSSHCredentials gathers the secrets a user can authenticate with.
+
+ `-[NMSSHSession authenticateWithCredentials:]` tries them in order: SSH
+ agent, public key, keyboard-interactive, password. Methods the server does
+ not offer are skipped without a round trip.
+
+    NMSSHCredentials *credentials = [[NMSSHCredentials alloc] init];
+    [credentials setUseAgent:YES];
+    [credentials setPassword:@"pass"];
+
+    [session authenticateWithCredentials:credentials];
+ */
+@interface NMSSHCredentials : NSObject <NSCopying>
+
+/** Whether to try the identities of the SSH agent, default NO */
+@property (nonatomic, assign) BOOL useAgent;
+
+/** Filepath to the public key, may be nil */
+@property (nonatomic, nullable, copy) NSString *publicKey;
+
+/** Filepath to the private key, nil to skip public key authentication */
+@property (nonatomic, nullable, copy) NSString *privateKey;
+
+/** Password for an encrypted private key */
+@property (nonatomic, nullable, copy) NSString *privateKeyPassword;
+
+/**
+ Block answering keyboard-interactive requests, nil to skip it. When no
+ block is set, keyboard-interactive is tried after password authentication
+ with the password as the answer.
+ */
+@property (nonatomic, nullable, copy) NSString *_Nonnull(^keyboardInteractiveBlock)(NSString *_Nonnull request);
+
+/** Password for password authentication, nil to skip it */
+@property (nonatomic, nullable, copy) NSString *password;
+
+/**
+ Create credentials for password authentication.
+
+ @param password Password for the user
+ @returns NMSSHCredentials instance
+ */
++ (nonnull instancetype)credentialsWithPassword:(nonnull NSString *)password;
+
+/**
+ Create credentials for public key authentication.
+
+ @param publicKey Filepath to public key
+ @param privateKey Filepath to private key
+ @param password Password for encrypted private key
+ @returns NMSSHCredentials instance
+ */
++ (nonnull instancetype)credentialsWithPublicKey:(nullable NSString *)publicKey
+                                      privateKey:(nonnull NSString *)privateKey
+                                        password:(nullable NSString *)password;
+
+/**
+ Create credentials using the identities of the SSH agent.
+
+ @returns NMSSHCredentials instance
+ */
++ (nonnull instancetype)agentCredentials;
+
+@end
@@ -0,0 +1,52 @@
+#import "NMSSHCredentials.h"
+
+@implementation NMSSHCredentials
+
++ (instancetype)credentialsWithPassword:(NSString *)password {
+    NMSSHCredentials *credentials = [[self alloc] init];
+    [credentials setPassword:password];
+
+    return credentials;
+}
+
++ (instancetype)credentialsWithPublicKey:(NSString *)publicKey
+                              privateKey:(NSString *)privateKey
+                                password:(NSString *)password {
+    NMSSHCredentials *credentials = [[self alloc] init];
+    [credentials setPublicKey:publicKey];
+    [credentials setPrivateKey:privateKey];
+    [credentials setPrivateKeyPassword:password];
+
+    return credentials;
+}
+
++ (instancetype)agentCredentials {
+    NMSSHCredentials *credentials = [[self alloc] init];
+    [credentials setUseAgent:YES];
+
+    return credentials;
+}
+
+- (id)copyWithZone:(NSZone *)zone {
+    NMSSHCredentials *credentials = [[[self class] allocWithZone:zone] init];
+    [credentials setUseAgent:self.useAgent];
+    [credentials setPublicKey:self.publicKey];
+    [credentials setPrivateKey:self.privateKey];
+    [credentials setPrivateKeyPassword:self.privateKeyPassword];
+    [credentials setKeyboardInteractiveBlock:self.keyboardInteractiveBlock];
+    [credentials setPassword:self.password];
+
+    return credentials;
+}
+
+- (NSString *)description {
+    // Never log secrets
+    return [NSString stringWithFormat:@"<%@: agent=%@ key=%@ keyboard-interactive=%@ password=%@>",
+            NSStringFromClass([self class]),
+            self.useAgent ? @"YES" : @"NO",
+            self.privateKey ?: @"none",
+            self.keyboardInteractiveBlock ? @"YES" : @"NO",
+            self.password ? @"YES" : @"NO"];
+}
+
+@end
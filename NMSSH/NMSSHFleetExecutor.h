@@ -0,0 +1,107 @@
+#import "NMSSH.h"
+
+@class NMSSHCommandResult, NMSSHConfig, NMSSHCredentials;
+
+/**
+ NMSSHFleetExecutor runs a command on a large number of hosts at once.
+
+ Every host gets a session of its own, resolved through the `configs` chain
+ the same way as `-[NMSSHSession initWithHost:configs:withDefaultPort:defaultUsername:]`.
+ At most `maxConcurrentHosts` hosts are in flight at any time, and each host
+ must connect, authenticate and run the command within `hostTimeout`.
+
+ The executor is built on the asynchronous session API, so no thread is
+ blocked per host. Results are streamed as each host completes:
+
+    NMSSHFleetExecutor *executor = [[NMSSHFleetExecutor alloc] initWithConfigs:@[config]];
+    [executor setMaxConcurrentHosts:128];
+    [executor executeCommand:@"uptime" onHosts:hosts resultHandler:^(NMSSHCommandResult *result) {
+        NSLog(@"%@: %i %@", result.host, result.exitStatus, result.output);
+    } completion:^(NSArray<NMSSHCommandResult *> *results) {
+        NSLog(@"Done with %lu hosts", (unsigned long)[results count]);
+    }];
+
+ Settings are captured when a command is started, changing them afterwards
+ only affects the following commands.
+ */
+@interface NMSSHFleetExecutor : NSObject
+
+/// ----------------------------------------------------------------------------
+/// @name Initialize a new executor
+/// ----------------------------------------------------------------------------
+
+/**
+ Create an executor resolving hosts through a chain of config files.
+
+ @param configs An array of NMSSHConfig objects ordered from highest to lowest
+     priority
+ @returns NMSSHFleetExecutor instance
+ */
+- (nonnull instancetype)initWithConfigs:(nonnull NSArray<NMSSHConfig *> *)configs NS_DESIGNATED_INITIALIZER;
+
+/// ----------------------------------------------------------------------------
+/// @name Execution settings
+/// ----------------------------------------------------------------------------
+
+/** Config files used to resolve host names, ordered from highest to lowest priority */
+@property (nonatomic, nonnull, readonly) NSArray<NMSSHConfig *> *configs;
+
+/** Username used when no config provides one, default is the current user name */
+@property (nonatomic, nonnull, copy) NSString *defaultUsername;
+
+/** Port used when no config provides one, default 22 */
+@property (nonatomic, assign) NSInteger defaultPort;
+
+/** Maximum number of hosts in flight at once across all commands, default 64 */
+@property (nonatomic, assign) NSUInteger maxConcurrentHosts;
+
+/**
+ Time (in seconds) a host is given to connect, authenticate and run the
+ command, default 30. Zero or nil means no limit.
+ */
+@property (nonatomic, nullable, strong) NSNumber *hostTimeout;
+
+/** Queue the result and completion blocks are called on, default is the main queue. */
+#if OS_OBJECT_USE_OBJC
+@property (nonatomic, nonnull, strong) dispatch_queue_t callbackQueue;
+#else
+@property (nonatomic, nonnull, assign) dispatch_queue_t callbackQueue;
+#endif
+
+/// ----------------------------------------------------------------------------
+/// @name Credentials
+/// ----------------------------------------------------------------------------
+
+/** Credentials used on every host, see NMSSHCredentials for the order methods are tried in */
+@property (nonatomic, nullable, copy) NMSSHCredentials *credentials;
+
+/// ----------------------------------------------------------------------------
+/// @name Execute a command
+/// ----------------------------------------------------------------------------
+
+/**
+ Execute a command on every host without blocking.
+
+ A host failing to connect, authenticate or run the command does not affect
+ the other hosts, the failure is reported in its result's `error`.
+
+ @param command Any shell script that is available on the hosts
+ @param hosts Host names to look up in `configs`
+ @param resultHandler Block called as soon as each host completes
+ @param completion Block called once every host completed, with the results in
+     completion order
+ */
+- (void)executeCommand:(nonnull NSString *)command
+               onHosts:(nonnull NSArray<NSString *> *)hosts
+         resultHandler:(void (^_Nullable)(NMSSHCommandResult *_Nonnull result))resultHandler
+            completion:(void (^_Nullable)(NSArray<NMSSHCommandResult *> *_Nonnull results))completion;
+
+/**
+ Cancel every command in progress.
+
+ Hosts that have not completed yet report a `NMSSHOperationCancelledError`.
+ This method can be called from any thread.
+ */
+- (void)cancel;
+
+@end
@@ -0,0 +1,157 @@
+#import "NMSSHFleetExecutor.h"
+#import "NMSSH+Protected.h"
+#import "NMSSHHostScheduler.h"
+
+/** A command started on a set of hosts, with the settings captured at that time */
+@interface NMSSHFleetRun : NMSSHHostBatch
+@property (nonatomic, strong) NSString *command;
+@property (nonatomic, strong) NSArray *configs;
+@property (nonatomic, strong) NSString *username;
+@property (nonatomic, assign) NSInteger port;
+@property (nonatomic, strong) NMSSHCredentials *credentials;
+@end
+
+@implementation NMSSHFleetRun
+@end
+
+@interface NMSSHFleetExecutor () <NMSSHHostSchedulerDelegate>
+@property (nonatomic, strong) NSArray *configs;
+@property (nonatomic, strong) NMSSHHostScheduler *scheduler;
+@end
+
+@implementation NMSSHFleetExecutor
+
+// -----------------------------------------------------------------------------
+#pragma mark - INITIALIZE A NEW EXECUTOR
+// -----------------------------------------------------------------------------
+
+- (instancetype)init {
+    return [self initWithConfigs:@[]];
+}
+
+- (instancetype)initWithConfigs:(NSArray *)configs {
+    if ((self = [super init])) {
+        [self setConfigs:[configs copy]];
+        [self setDefaultUsername:NSUserName()];
+        [self setDefaultPort:22];
+        [self setMaxConcurrentHosts:64];
+        [self setHostTimeout:@30];
+        [self setCallbackQueue:dispatch_get_main_queue()];
+
+        // Sessions report to the scheduler queue, all task bookkeeping happens on it
+        [self setScheduler:[[NMSSHHostScheduler alloc] initWithLabel:"NMSSH.fleetQueue"]];
+        [self.scheduler setDelegate:self];
+    }
+
+    return self;
+}
+
+// -----------------------------------------------------------------------------
+#pragma mark - EXECUTE A COMMAND
+// -----------------------------------------------------------------------------
+
+- (void)executeCommand:(NSString *)command
+               onHosts:(NSArray *)hosts
+         resultHandler:(void (^)(NMSSHCommandResult *))resultHandler
+            completion:(void (^)(NSArray *))completion {
+    NMSSHFleetRun *run = [[NMSSHFleetRun alloc] init];
+    [run setCommand:command];
+    [run setConfigs:self.configs];
+    [run setUsername:self.defaultUsername];
+    [run setPort:self.defaultPort];
+    [run setTimeout:[self.hostTimeout doubleValue]];
+    [run setCredentials:self.credentials ?: [[NMSSHCredentials alloc] init]];
+    [run setResultHandler:resultHandler];
+    [run setCompletion:completion];
+
+    NSMutableArray *tasks = [[NSMutableArray alloc] initWithCapacity:[hosts count]];
+    for (NSString *host in hosts) {
+        NMSSHHostTask *task = [[NMSSHHostTask alloc] init];
+        [task setResult:[[NMSSHCommandResult alloc] initWithHost:host command:command]];
+        [tasks addObject:task];
+    }
+
+    NMSSHLogInfo(@"Executing %@ on %lu hosts", command, (unsigned long)[hosts count]);
+
+    dispatch_async(self.scheduler.queue, ^{
+        [self.scheduler addBatch:run tasks:tasks];
+    });
+}
+
+- (void)cancel {
+    dispatch_async(self.scheduler.queue, ^{
+        [self.scheduler cancelWithError:[NMSSHOperation errorWithCode:NMSSHOperationCancelledError
+                                                          description:@"Operation cancelled"]];
+    });
+}
+
+// -----------------------------------------------------------------------------
+#pragma mark - TASKS
+// -----------------------------------------------------------------------------
+
+- (void)hostScheduler:(NMSSHHostScheduler *)scheduler startTask:(NMSSHHostTask *)task {
+    NMSSHFleetRun *run = (NMSSHFleetRun *)task.batch;
+    NMSSHCommandResult *result = task.result;
+
+    NMSSHSession *session = [[NMSSHSession alloc] initWithHost:result.host
+                                                       configs:run.configs
+                                               withDefaultPort:run.port
+                                               defaultUsername:run.username];
+    [session setCallbackQueue:scheduler.queue];
+    [task setSession:session];
+
+    [task setOperation:[session connectWithTimeout:[scheduler remainingTimeForTask:task] completion:^(BOOL success, NSError *error) {
+        if ([scheduler shouldContinueTask:task success:success error:error]) {
+            [self authenticateTask:task];
+        }
+    }]];
+}
+
+- (void)authenticateTask:(NMSSHHostTask *)task {
+    NMSSHHostScheduler *scheduler = self.scheduler;
+    NMSSHFleetRun *run = (NMSSHFleetRun *)task.batch;
+
+    [task setOperation:[task.session authenticateWithCredentials:run.credentials completion:^(BOOL success, NSError *error) {
+        if ([scheduler shouldContinueTask:task success:success error:error]) {
+            [self executeTask:task];
+        }
+    }]];
+}
+
+- (void)executeTask:(NMSSHHostTask *)task {
+    NMSSHHostScheduler *scheduler = self.scheduler;
+    NMSSHFleetRun *run = (NMSSHFleetRun *)task.batch;
+    NMSSHCommandResult *result = task.result;
+
+    // Output and completion are reported on the session queue
+    [task setOperation:[task.session.channel operationForCommand:run.command
+                                                          timeout:[scheduler remainingTimeForTask:task]
+                                                           output:^(NSData *data, BOOL isStderr) {
+        [result appendData:data isStderr:isStderr];
+    } completion:^(int exitStatus, NSString *exitSignal, NSError *error) {
+        dispatch_async(scheduler.queue, ^{
+            [result setExitStatus:exitStatus];
+            [result setExitSignal:exitSignal];
+            [scheduler finishTask:task error:error];
+        });
+    }]];
+}
+
+- (void)hostScheduler:(NMSSHHostScheduler *)scheduler didFinishTask:(NMSSHHostTask *)task error:(NSError *)error {
+    NMSSHCommandResult *result = task.result;
+    [result setError:error];
+    if (task.startTime > 0) {
+        [result setDuration:CFAbsoluteTimeGetCurrent() - task.startTime];
+    }
+
+    if (result.error) {
+        NMSSHLogWarn(@"%@: %@", result.host, [result.error localizedDescription]);
+    }
+}
+
+- (void)hostScheduler:(NMSSHHostScheduler *)scheduler didCompleteBatch:(NMSSHHostBatch *)batch {
+    NMSSHFleetRun *run = (NMSSHFleetRun *)batch;
+    NMSSHLogInfo(@"Executed %@ on %lu hosts", run.command, (unsigned long)[run.results count]);
+}
+
+@end
@@ -42,6 +42,33 @@
  */
 @property(nonatomic, strong) NSArray *identityFiles;
 
+/**
+ Specifies the ciphers allowed, in order of preference.
+ */
+@property(nonatomic, strong) NSArray *ciphers;
+
+/**
+ Specifies the MAC (message authentication code) algorithms, in order of
+ preference.
+ */
+@property(nonatomic, strong) NSArray *macs;
+
+/**
+ Specifies the available key exchange algorithms, in order of preference.
+ */
+@property(nonatomic, strong) NSArray *kexAlgorithms;
+
+/**
+ Specifies the host key algorithms the client wants to use, in order of
+ preference.
+ */
+@property(nonatomic, strong) NSArray *hostKeyAlgorithms;
+
+/**
+ Specifies whether to use compression, a boolean NSNumber.
+ */
+@property(nonatomic, strong) NSNumber *compression;
+
 /**
  Values for {other} are copied to {self} if not already set. Arrays are
  appended from {other} without adding duplicates.
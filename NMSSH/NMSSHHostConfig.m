@@ -39,6 +39,21 @@
     }
     [self setIdentityFiles:[self mergedArray:self.identityFiles
                                    withArray:other.identityFiles]];
+    if (!self.ciphers) {
+        [self setCiphers:other.ciphers];
+    }
+    if (!self.macs) {
+        [self setMacs:other.macs];
+    }
+    if (!self.kexAlgorithms) {
+        [self setKexAlgorithms:other.kexAlgorithms];
+    }
+    if (!self.hostKeyAlgorithms) {
+        [self setHostKeyAlgorithms:other.hostKeyAlgorithms];
+    }
+    if (self.compression == nil) {
+        [self setCompression:other.compression];
+    }
 }
 
 @end
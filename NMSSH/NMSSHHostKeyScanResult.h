@@ -0,0 +1,49 @@
+#import "NMSSH.h"
+
+/**
+ NMSSHHostKeyScanResult holds the host key fetched from a host and how it
+ compares to the known hosts files.
+ */
+@interface NMSSHHostKeyScanResult : NSObject
+
+/** The host name that was scanned */
+@property (nonatomic, nonnull, readonly) NSString *host;
+
+/** The host name or IP address the host resolved to, used in the known hosts files */
+@property (nonatomic, nullable, readonly) NSString *hostname;
+
+/** The port that was scanned */
+@property (nonatomic, readonly) NSInteger port;
+
+/** The host key blob sent by the server, nil if the scan failed */
+@property (nonatomic, nullable, readonly) NSData *hostKey;
+
+/** The type of the host key, e.g. `ssh-rsa` */
+@property (nonatomic, nullable, readonly) NSString *keyType;
+
+/** The host key's fingerprint, in the hash of the scanner's `fingerprintHash` */
+@property (nonatomic, nullable, readonly) NSString *fingerprint;
+
+/** How the host key compares to the known hosts files, NMSSHKnownHostStatusFailure if the scan failed */
+@property (nonatomic, readonly) NMSSHKnownHostStatus status;
+
+/** A Boolean value indicating whether the host key was added to a known hosts file */
+@property (nonatomic, readonly, getter = isRecorded) BOOL recorded;
+
+/** Time elapsed since the host was picked up, in seconds */
+@property (nonatomic, readonly) NSTimeInterval duration;
+
+/** Error that prevented fetching the host key */
+@property (nonatomic, nullable, readonly) NSError *error;
+
+- (nonnull instancetype)init NS_UNAVAILABLE;
+
+/**
+ Create an empty result for a host.
+
+ @param host The host name being scanned
+ @returns NMSSHHostKeyScanResult instance
+ */
+- (nonnull instancetype)initWithHost:(nonnull NSString *)host;
+
+@end
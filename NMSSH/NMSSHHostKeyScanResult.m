@@ -0,0 +1,32 @@
+#import "NMSSHHostKeyScanResult.h"
+#import "NMSSH+Protected.h"
+
+@interface NMSSHHostKeyScanResult ()
+@property (nonatomic, strong) NSString *host;
+@end
+
+@implementation NMSSHHostKeyScanResult
+
+- (instancetype)initWithHost:(NSString *)host {
+    if ((self = [super init])) {
+        [self setHost:host];
+        [self setStatus:NMSSHKnownHostStatusFailure];
+    }
+
+    return self;
+}
+
+- (NSString *)keyType {
+    return self.hostKey ? [NMSSHKnownHostsStore typeOfKey:self.hostKey] : nil;
+}
+
+- (NSString *)description {
+    NSArray *statuses = @[@"match", @"mismatch", @"not found", @"failure"];
+
+    return [NSString stringWithFormat:@"<%@: %@ %@ %@ %@ in %.3fs%@>",
+            NSStringFromClass([self class]), self.host, self.keyType ?: @"-", self.fingerprint ?: @"-",
+            statuses[self.status], self.duration,
+            self.error ? [@" error: " stringByAppendingString:[self.error localizedDescription]] : @""];
+}
+
+@end
@@ -0,0 +1,114 @@
+#import "NMSSH.h"
+
+@class NMSSHConfig, NMSSHHostKeyScanResult;
+
+/**
+ NMSSHHostKeyScanner fetches the host keys of many hosts at once and checks
+ them against the known hosts files, e.g. before rolling out to a new fleet.
+
+ Each host only goes through the key exchange, no authentication takes
+ place. Hosts are resolved through the `configs` chain the same way as
+ `-[NMSSHSession initWithHost:configs:withDefaultPort:defaultUsername:]`, at
+ most `maxConcurrentHosts` are in flight at any time and none blocks a
+ thread. Known hosts files are read through NMSSHKnownHostsStore, so they are
+ parsed once for the whole scan.
+
+    NMSSHHostKeyScanner *scanner = [[NMSSHHostKeyScanner alloc] initWithConfigs:@[config]];
+    [scanner setRecordsUnknownHosts:YES];
+    [scanner scanHosts:hosts resultHandler:nil completion:^(NSArray<NMSSHHostKeyScanResult *> *results) {
+        for (NMSSHHostKeyScanResult *result in results) {
+            if (result.status == NMSSHKnownHostStatusMismatch) {
+                NSLog(@"%@ changed its key to %@", result.host, result.fingerprint);
+            }
+        }
+    }];
+
+ The key reported for a host is of the type negotiated with it, see
+ `-[NMSSHSession preferredHostKeyMethods]`. Settings are captured when a scan
+ is started.
+ */
+@interface NMSSHHostKeyScanner : NSObject
+
+/// ----------------------------------------------------------------------------
+/// @name Initialize a new scanner
+/// ----------------------------------------------------------------------------
+
+/**
+ Create a scanner resolving hosts through a chain of config files.
+
+ @param configs An array of NMSSHConfig objects ordered from highest to lowest
+     priority
+ @returns NMSSHHostKeyScanner instance
+ */
+- (nonnull instancetype)initWithConfigs:(nonnull NSArray<NMSSHConfig *> *)configs NS_DESIGNATED_INITIALIZER;
+
+/// ----------------------------------------------------------------------------
+/// @name Scan settings
+/// ----------------------------------------------------------------------------
+
+/** Config files used to resolve host names, ordered from highest to lowest priority */
+@property (nonatomic, nonnull, readonly) NSArray<NMSSHConfig *> *configs;
+
+/** Port used when no config provides one, default 22 */
+@property (nonatomic, assign) NSInteger defaultPort;
+
+/** Maximum number of hosts in flight at once across all scans, default 256 */
+@property (nonatomic, assign) NSUInteger maxConcurrentHosts;
+
+/** Time (in seconds) a host is given to complete the key exchange, default 10. Zero or nil means no limit. */
+@property (nonatomic, nullable, strong) NSNumber *hostTimeout;
+
+/** The hash algorithm used for the results' fingerprints, default NMSSHSessionHashMD5 */
+@property (nonatomic, assign) NMSSHSessionHash fingerprintHash;
+
+/** Queue the result and completion blocks are called on, default is the main queue. */
+#if OS_OBJECT_USE_OBJC
+@property (nonatomic, nonnull, strong) dispatch_queue_t callbackQueue;
+#else
+@property (nonatomic, nonnull, assign) dispatch_queue_t callbackQueue;
+#endif
+
+/// ----------------------------------------------------------------------------
+/// @name Known hosts
+/// ----------------------------------------------------------------------------
+
+/**
+ Known hosts files checked in order, nil to use the default paths of
+ `-[NMSSHSession knownHostStatusInFiles:]`.
+ */
+@property (nonatomic, nullable, copy) NSArray<NSString *> *knownHostsFiles;
+
+/** Whether keys of hosts not found in the known hosts files are added to `recordFile`, default NO */
+@property (nonatomic, assign) BOOL recordsUnknownHosts;
+
+/** The known hosts file new keys are added to, nil for the user's default file */
+@property (nonatomic, nullable, copy) NSString *recordFile;
+
+/// ----------------------------------------------------------------------------
+/// @name Scan hosts
+/// ----------------------------------------------------------------------------
+
+/**
+ Fetch the host key of every host without blocking.
+
+ A host failing to connect does not affect the other hosts, the failure is
+ reported in its result's `error`.
+
+ @param hosts Host names to look up in `configs`
+ @param resultHandler Block called as soon as each host is scanned
+ @param completion Block called once every host was scanned, with the results
+     in completion order
+ */
+- (void)scanHosts:(nonnull NSArray<NSString *> *)hosts
+    resultHandler:(void (^_Nullable)(NMSSHHostKeyScanResult *_Nonnull result))resultHandler
+       completion:(void (^_Nullable)(NSArray<NMSSHHostKeyScanResult *> *_Nonnull results))completion;
+
+/**
+ Cancel every scan in progress.
+
+ Hosts that have not been scanned yet report a `NMSSHOperationCancelledError`.
+ This method can be called from any thread.
+ */
+- (void)cancel;
+
+@end
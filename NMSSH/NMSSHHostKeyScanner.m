@@ -0,0 +1,165 @@
+#import "NMSSHHostKeyScanner.h"
+#import "NMSSH+Protected.h"
+#import "NMSSHHostScheduler.h"
+
+/** A scan started on a set of hosts, with the settings captured at that time */
+@interface NMSSHHostKeyScan : NMSSHHostBatch
+@property (nonatomic, strong) NSArray *configs;
+@property (nonatomic, assign) NSInteger port;
+@property (nonatomic, assign) NMSSHSessionHash fingerprintHash;
+@property (nonatomic, strong) NSArray *knownHostsFiles;
+@property (nonatomic, assign) BOOL recordsUnknownHosts;
+@property (nonatomic, strong) NSString *recordFile;
+@end
+
+@implementation NMSSHHostKeyScan
+@end
+
+@interface NMSSHHostKeyScanner () <NMSSHHostSchedulerDelegate>
+@property (nonatomic, strong) NSArray *configs;
+@property (nonatomic, strong) NMSSHHostScheduler *scheduler;
+@end
+
+@implementation NMSSHHostKeyScanner
+
+// -----------------------------------------------------------------------------
+#pragma mark - INITIALIZE A NEW SCANNER
+// -----------------------------------------------------------------------------
+
+- (instancetype)init {
+    return [self initWithConfigs:@[]];
+}
+
+- (instancetype)initWithConfigs:(NSArray *)configs {
+    if ((self = [super init])) {
+        [self setConfigs:[configs copy]];
+        [self setDefaultPort:22];
+        [self setMaxConcurrentHosts:256];
+        [self setHostTimeout:@10];
+        [self setFingerprintHash:NMSSHSessionHashMD5];
+        [self setCallbackQueue:dispatch_get_main_queue()];
+
+        // Sessions report to the scheduler queue, all task bookkeeping happens on it
+        [self setScheduler:[[NMSSHHostScheduler alloc] initWithLabel:"NMSSH.hostKeyScannerQueue"]];
+        [self.scheduler setDelegate:self];
+    }
+
+    return self;
+}
+
+// -----------------------------------------------------------------------------
+#pragma mark - SCAN HOSTS
+// -----------------------------------------------------------------------------
+
+- (void)scanHosts:(NSArray *)hosts
+    resultHandler:(void (^)(NMSSHHostKeyScanResult *))resultHandler
+       completion:(void (^)(NSArray *))completion {
+    NMSSHHostKeyScan *scan = [[NMSSHHostKeyScan alloc] init];
+    [scan setConfigs:self.configs];
+    [scan setPort:self.defaultPort];
+    [scan setTimeout:[self.hostTimeout doubleValue]];
+    [scan setFingerprintHash:self.fingerprintHash];
+    [scan setKnownHostsFiles:self.knownHostsFiles];
+    [scan setRecordsUnknownHosts:self.recordsUnknownHosts];
+    [scan setRecordFile:self.recordFile];
+    [scan setResultHandler:resultHandler];
+    [scan setCompletion:completion];
+
+    NSMutableArray *tasks = [[NSMutableArray alloc] initWithCapacity:[hosts count]];
+    for (NSString *host in hosts) {
+        NMSSHHostTask *task = [[NMSSHHostTask alloc] init];
+        [task setResult:[[NMSSHHostKeyScanResult alloc] initWithHost:host]];
+        [tasks addObject:task];
+    }
+
+    NMSSHLogInfo(@"Scanning host keys of %lu hosts", (unsigned long)[hosts count]);
+
+    dispatch_async(self.scheduler.queue, ^{
+        [self.scheduler addBatch:scan tasks:tasks];
+    });
+}
+
+- (void)cancel {
+    dispatch_async(self.scheduler.queue, ^{
+        [self.scheduler cancelWithError:[NMSSHOperation errorWithCode:NMSSHOperationCancelledError
+                                                          description:@"Operation cancelled"]];
+    });
+}
+
+// -----------------------------------------------------------------------------
+#pragma mark - TASKS
+// -----------------------------------------------------------------------------
+
+- (void)hostScheduler:(NMSSHHostScheduler *)scheduler startTask:(NMSSHHostTask *)task {
+    NMSSHHostKeyScan *scan = (NMSSHHostKeyScan *)task.batch;
+    NMSSHHostKeyScanResult *result = task.result;
+
+    NMSSHSession *session = [[NMSSHSession alloc] initWithHost:result.host
+                                                       configs:scan.configs
+                                               withDefaultPort:scan.port
+                                               defaultUsername:NSUserName()];
+    [session setCallbackQueue:scheduler.queue];
+    [task setSession:session];
+
+    // Group exchange costs an extra round trip for a key we throw away
+    if (!session.preferredKeyExchangeMethods) {
+        [session setPreferredKeyExchangeMethods:@[@"diffie-hellman-group14-sha1",
+                                                  @"diffie-hellman-group-exchange-sha256",
+                                                  @"diffie-hellman-group-exchange-sha1",
+                                                  @"diffie-hellman-group1-sha1"]];
+    }
+
+    [result setHostname:session.host];
+    [result setPort:[session.port integerValue]];
+
+    [task setOperation:[session connectWithTimeout:[scheduler remainingTimeForTask:task] completion:^(BOOL success, NSError *error) {
+        if ([scheduler shouldContinueTask:task success:success error:error]) {
+            [self checkHostKeyOfTask:task];
+        }
+    }]];
+}
+
+- (void)checkHostKeyOfTask:(NMSSHHostTask *)task {
+    NMSSHHostScheduler *scheduler = self.scheduler;
+    NMSSHHostKeyScan *scan = (NMSSHHostKeyScan *)task.batch;
+    NMSSHSession *session = task.session;
+    NMSSHHostKeyScanResult *result = task.result;
+    [task setOperation:nil];
+
+    // libssh2 is only used on the session queue
+    dispatch_async(session.sessionQueue, ^{
+        [result setHostKey:[session hostKey]];
+        [result setFingerprint:[session fingerprint:scan.fingerprintHash]];
+        [result setStatus:[session knownHostStatusInFiles:scan.knownHostsFiles]];
+
+        if (result.status == NMSSHKnownHostStatusNotFound && scan.recordsUnknownHosts) {
+            [result setRecorded:[session addKnownHostName:session.host
+                                                     port:[session.port integerValue]
+                                                   toFile:scan.recordFile
+                                                 withSalt:nil]];
+        }
+
+        dispatch_async(scheduler.queue, ^{
+            [scheduler finishTask:task error:nil];
+        });
+    });
+}
+
+- (void)hostScheduler:(NMSSHHostScheduler *)scheduler didFinishTask:(NMSSHHostTask *)task error:(NSError *)error {
+    NMSSHHostKeyScanResult *result = task.result;
+    [result setError:error];
+    if (error) {
+        [result setStatus:NMSSHKnownHostStatusFailure];
+        NMSSHLogWarn(@"%@: %@", result.host, [error localizedDescription]);
+    }
+
+    if (task.startTime > 0) {
+        [result setDuration:CFAbsoluteTimeGetCurrent() - task.startTime];
+    }
+}
+
+- (void)hostScheduler:(NMSSHHostScheduler *)scheduler didCompleteBatch:(NMSSHHostBatch *)batch {
+    NMSSHLogInfo(@"Scanned host keys of %lu hosts", (unsigned long)[batch.results count]);
+}
+
+@end
@@ -0,0 +1,59 @@
+#import "NMSSH.h"
+
+/**
+ NMSSHKnownHostsStore keeps a known_hosts file in memory so checking a host
+ key does not read and parse the file on every connection.
+
+ - The file is parsed once and indexed by host name, `host` or
+   `[host]:port`. Hashed entries (`|1|salt|hash`) are indexed by their hash
+   and the lookups they resolve are remembered.
+ - The file is parsed again only when its modification time or size changes.
+ - New hosts are appended to the file, it is never rewritten.
+
+ The matching rules are those of libssh2: host names are compared literally
+ and a host is checked both as `[host]:port` and as `host`. Lines that can't
+ be used, such as `@revoked` markers, are ignored.
+
+ There is one store per file, all methods are thread safe.
+ */
+@interface NMSSHKnownHostsStore : NSObject
+
+/** Filepath of the known_hosts file */
+@property (nonatomic, nonnull, readonly) NSString *path;
+
+/**
+ The shared store of a known_hosts file.
+
+ @param path Filepath to the known_hosts file, tildes are expanded
+ @returns NMSSHKnownHostsStore instance
+ */
++ (nonnull instancetype)storeForFile:(nonnull NSString *)path;
+
+- (nonnull instancetype)init NS_UNAVAILABLE;
+
+/**
+ Checks if a host key is recognized.
+
+ @param host The hostname or IP address
+ @param port The port number of the host
+ @param key The host key blob, as returned by the server
+ @returns Known host status for the host, NMSSHKnownHostStatusNotFound if the file does not exist
+ */
+- (NMSSHKnownHostStatus)statusForHost:(nonnull NSString *)host port:(NSInteger)port key:(nonnull NSData *)key;
+
+/**
+ Appends a host to the file.
+
+ _host_ is written as `[host]:port` when _port_ is not 22. If _salt_ is set,
+ _host_ must be the base64-encoded SHA1 HMAC of the host name and is written
+ as given.
+
+ @param host The hostname or IP address, or its hash
+ @param port The port number of the host
+ @param key The host key blob
+ @param salt The base64-encoded salt used for hashing, may be nil
+ @returns Success status
+ */
+- (BOOL)addHost:(nonnull NSString *)host port:(NSInteger)port key:(nonnull NSData *)key salt:(nullable NSString *)salt;
+
+@end
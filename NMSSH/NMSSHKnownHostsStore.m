@@ -0,0 +1,423 @@
+#import "NMSSHKnownHostsStore.h"
+#import "NMSSH+Protected.h"
+#import <CommonCrypto/CommonHMAC.h>
+#import <sys/stat.h>
+
+static const char NMSSHBase64Alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// NSData's base64 methods need OS X 10.9, we support 10.8
+static NSString *NMSSHBase64Encode(NSData *data) {
+    const unsigned char *bytes = [data bytes];
+    NSUInteger length = [data length];
+    NSMutableString *string = [[NSMutableString alloc] initWithCapacity:(length + 2) / 3 * 4];
+
+    for (NSUInteger i = 0; i < length; i += 3) {
+        unsigned long triple = (unsigned long)bytes[i] << 16;
+        if (i + 1 < length) triple |= (unsigned long)bytes[i + 1] << 8;
+        if (i + 2 < length) triple |= bytes[i + 2];
+
+        [string appendFormat:@"%c%c%c%c",
+         NMSSHBase64Alphabet[(triple >> 18) & 0x3F],
+         NMSSHBase64Alphabet[(triple >> 12) & 0x3F],
+         i + 1 < length ? NMSSHBase64Alphabet[(triple >> 6) & 0x3F] : '=',
+         i + 2 < length ? NMSSHBase64Alphabet[triple & 0x3F] : '='];
+    }
+
+    return string;
+}
+
+static NSData *NMSSHBase64Decode(NSString *string) {
+    const char *chars = [string UTF8String];
+    NSMutableData *data = [[NSMutableData alloc] initWithCapacity:strlen(chars) / 4 * 3];
+    unsigned long quad = 0;
+    int count = 0;
+
+    for (const char *c = chars; *c && *c != '='; c++) {
+        const char *position = strchr(NMSSHBase64Alphabet, *c);
+        if (!position) {
+            return nil;
+        }
+
+        quad = (quad << 6) | (unsigned long)(position - NMSSHBase64Alphabet);
+        if (++count == 4) {
+            unsigned char bytes[3] = { (quad >> 16) & 0xFF, (quad >> 8) & 0xFF, quad & 0xFF };
+            [data appendBytes:bytes length:3];
+            quad = 0;
+            count = 0;
+        }
+    }
+
+    if (count == 1) {
+        return nil;
+    }
+    else if (count > 1) {
+        quad <<= 6 * (4 - count);
+        unsigned char bytes[2] = { (quad >> 16) & 0xFF, (quad >> 8) & 0xFF };
+        [data appendBytes:bytes length:count - 1];
+    }
+
+    return data;
+}
+
+/** A host key listed in the file, kept base64-encoded as decoding every line is wasted work */
+@interface NMSSHKnownHostEntry : NSObject
+@property (nonatomic, strong) NSString *keyType;
+@property (nonatomic, strong) NSString *key;
+@end
+
+@implementation NMSSHKnownHostEntry
+@end
+
+@interface NMSSHKnownHostsStore ()
+@property (nonatomic, strong) NSString *path;
+
+/** Entries of plain host names, by name */
+@property (nonatomic, strong) NSMutableDictionary *plainEntries;
+/** Entries of hashed host names, by salt and then by hash */
+@property (nonatomic, strong) NSMutableDictionary *hashedEntries;
+/** Hashed entries already looked up, by plain host name */
+@property (nonatomic, strong) NSMutableDictionary *resolvedEntries;
+
+@property (nonatomic, assign) BOOL loaded;
+@property (nonatomic, assign) struct timespec modificationTime;
+@property (nonatomic, assign) off_t size;
+
+#if OS_OBJECT_USE_OBJC
+@property (nonatomic, strong) dispatch_queue_t storeQueue;
+#else
+@property (nonatomic, assign) dispatch_queue_t storeQueue;
+#endif
+@end
+
+@implementation NMSSHKnownHostsStore
+
+// -----------------------------------------------------------------------------
+#pragma mark - INITIALIZE THE STORE
+// -----------------------------------------------------------------------------
+
++ (instancetype)storeForFile:(NSString *)path {
+    static NSMutableDictionary *stores = nil;
+    static dispatch_queue_t storesQueue = NULL;
+
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        stores = [[NSMutableDictionary alloc] init];
+        storesQueue = dispatch_queue_create("NMSSH.knownHostsStoresQueue", DISPATCH_QUEUE_SERIAL);
+    });
+
+    path = [[path stringByExpandingTildeInPath] stringByStandardizingPath];
+
+    __block NMSSHKnownHostsStore *store = nil;
+    dispatch_sync(storesQueue, ^{
+        store = stores[path];
+        if (!store) {
+            store = [[NMSSHKnownHostsStore alloc] initWithPath:path];
+            stores[path] = store;
+        }
+    });
+
+    return store;
+}
+
+- (instancetype)initWithPath:(NSString *)path {
+    if ((self = [super init])) {
+        [self setPath:path];
+        [self setPlainEntries:[[NSMutableDictionary alloc] init]];
+        [self setHashedEntries:[[NSMutableDictionary alloc] init]];
+        [self setResolvedEntries:[[NSMutableDictionary alloc] init]];
+        [self setStoreQueue:dispatch_queue_create("NMSSH.knownHostsStoreQueue", DISPATCH_QUEUE_SERIAL)];
+    }
+
+    return self;
+}
+
+#if !(OS_OBJECT_USE_OBJC)
+- (void)dealloc {
+    dispatch_release(self.storeQueue);
+}
+#endif
+
+// -----------------------------------------------------------------------------
+#pragma mark - LOADING THE FILE
+// -----------------------------------------------------------------------------
+
+/**
+ Parses the file again if it changed since it was loaded, must be called on
+ the store queue.
+
+ @returns NO if the file does not exist or can't be read
+ */
+- (BOOL)loadIfNeeded {
+    struct stat info;
+    if (stat([self.path fileSystemRepresentation], &info) != 0) {
+        NMSSHLogInfo(@"No known hosts file %@.", self.path);
+        [self resetEntries];
+        return NO;
+    }
+
+    if (self.loaded && self.size == info.st_size &&
+        self.modificationTime.tv_sec == info.st_mtimespec.tv_sec &&
+        self.modificationTime.tv_nsec == info.st_mtimespec.tv_nsec) {
+        return YES;
+    }
+
+    NSData *contents = [NSData dataWithContentsOfFile:self.path];
+    if (!contents) {
+        NMSSHLogError(@"Failed to read known hosts file %@.", self.path);
+        [self resetEntries];
+        return NO;
+    }
+
+    [self resetEntries];
+
+    NSString *string = [[NSString alloc] initWithData:contents encoding:NSUTF8StringEncoding] ?:
+                       [[NSString alloc] initWithData:contents encoding:NSISOLatin1StringEncoding];
+    [string enumerateLinesUsingBlock:^(NSString *line, BOOL *stop) {
+        [self parseLine:line];
+    }];
+
+    [self setLoaded:YES];
+    [self setModificationTime:info.st_mtimespec];
+    [self setSize:info.st_size];
+
+    NMSSHLogVerbose(@"Loaded known hosts file %@", self.path);
+
+    return YES;
+}
+
+- (void)resetEntries {
+    [self.plainEntries removeAllObjects];
+    [self.hashedEntries removeAllObjects];
+    [self.resolvedEntries removeAllObjects];
+    [self setLoaded:NO];
+}
+
+- (void)parseLine:(NSString *)line {
+    NSMutableArray *fields = [[line componentsSeparatedByCharactersInSet:[NSCharacterSet whitespaceCharacterSet]] mutableCopy];
+    [fields removeObject:@""];
+
+    // Markers such as @revoked and @cert-authority are not supported
+    if ([fields count] < 3 || [fields[0] hasPrefix:@"#"] || [fields[0] hasPrefix:@"@"]) {
+        return;
+    }
+
+    NMSSHKnownHostEntry *entry = [[NMSSHKnownHostEntry alloc] init];
+    [entry setKeyType:fields[1]];
+    [entry setKey:fields[2]];
+    [self addEntry:entry forNames:fields[0]];
+}
+
+- (void)addEntry:(NMSSHKnownHostEntry *)entry forNames:(NSString *)names {
+    if ([names hasPrefix:@"|1|"]) {
+        NSArray *parts = [names componentsSeparatedByString:@"|"];
+        if ([parts count] != 4) {
+            return;
+        }
+
+        NSData *salt = NMSSHBase64Decode(parts[2]);
+        NSData *hash = NMSSHBase64Decode(parts[3]);
+        if (!salt || !hash) {
+            return;
+        }
+
+        NSMutableDictionary *hashes = self.hashedEntries[salt];
+        if (!hashes) {
+            hashes = [[NSMutableDictionary alloc] init];
+            self.hashedEntries[salt] = hashes;
+        }
+
+        [self addEntry:entry toList:hashes forKey:hash];
+        [self.resolvedEntries removeAllObjects];
+        return;
+    }
+
+    for (NSString *name in [names componentsSeparatedByString:@","]) {
+        if ([name length] > 0) {
+            [self addEntry:entry toList:self.plainEntries forKey:name];
+        }
+    }
+}
+
+- (void)addEntry:(NMSSHKnownHostEntry *)entry toList:(NSMutableDictionary *)list forKey:(id)key {
+    NSMutableArray *entries = list[key];
+    if (!entries) {
+        entries = [[NSMutableArray alloc] initWithCapacity:1];
+        list[key] = entries;
+    }
+
+    [entries addObject:entry];
+}
+
+// -----------------------------------------------------------------------------
+#pragma mark - CHECKING A HOST
+// -----------------------------------------------------------------------------
+
+- (NSArray *)entriesForName:(NSString *)name {
+    NSArray *resolved = self.resolvedEntries[name];
+
+    if (!resolved) {
+        // Each salt needs its own hash, remember the outcome for the next lookup
+        NSMutableArray *entries = [[NSMutableArray alloc] init];
+        const char *bytes = [name UTF8String];
+        unsigned char hash[CC_SHA1_DIGEST_LENGTH];
+
+        for (NSData *salt in self.hashedEntries) {
+            CCHmac(kCCHmacAlgSHA1, [salt bytes], [salt length], bytes, strlen(bytes), hash);
+            NSArray *matches = self.hashedEntries[salt][[NSData dataWithBytes:hash length:sizeof(hash)]];
+            if (matches) {
+                [entries addObjectsFromArray:matches];
+            }
+        }
+
+        resolved = entries;
+        self.resolvedEntries[name] = resolved;
+    }
+
+    NSArray *plain = self.plainEntries[name];
+    return plain ? [plain arrayByAddingObjectsFromArray:resolved] : resolved;
+}
+
++ (NSString *)typeOfKey:(NSData *)key {
+    const unsigned char *bytes = [key bytes];
+    if ([key length] < 4) {
+        return nil;
+    }
+
+    uint32_t length = ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 8) | bytes[3];
+    if (length > [key length] - 4) {
+        return nil;
+    }
+
+    return [[NSString alloc] initWithBytes:bytes + 4 length:length encoding:NSUTF8StringEncoding];
+}
+
+- (NMSSHKnownHostStatus)statusForHost:(NSString *)host port:(NSInteger)port key:(NSData *)key {
+    NSString *keyType = [NMSSHKnownHostsStore typeOfKey:key];
+    if (!keyType) {
+        NMSSHLogError(@"Invalid host key");
+        return NMSSHKnownHostStatusFailure;
+    }
+
+    NSString *encodedKey = NMSSHBase64Encode(key);
+
+    __block NMSSHKnownHostStatus status = NMSSHKnownHostStatusNotFound;
+    dispatch_sync(self.storeQueue, ^{
+        if (![self loadIfNeeded]) {
+            return;
+        }
+
+        NSArray *names = @[[NSString stringWithFormat:@"[%@]:%ld", host, (long)port], host];
+        for (NSString *name in names) {
+            for (NMSSHKnownHostEntry *entry in [self entriesForName:name]) {
+                if (![entry.keyType isEqualToString:keyType]) {
+                    continue;
+                }
+
+                if ([entry.key isEqualToString:encodedKey]) {
+                    status = NMSSHKnownHostStatusMatch;
+                    return;
+                }
+
+                status = NMSSHKnownHostStatusMismatch;
+            }
+        }
+    });
+
+    return status;
+}
+
+// -----------------------------------------------------------------------------
+#pragma mark - ADDING A HOST
+// -----------------------------------------------------------------------------
+
+- (BOOL)addHost:(NSString *)host port:(NSInteger)port key:(NSData *)key salt:(NSString *)salt {
+    NSString *keyType = [NMSSHKnownHostsStore typeOfKey:key];
+    if (!keyType) {
+        NMSSHLogError(@"Invalid host key");
+        return NO;
+    }
+
+    NSString *names;
+    if (salt) {
+        if (!NMSSHBase64Decode(salt) || !NMSSHBase64Decode(host)) {
+            NMSSHLogError(@"The salt and hashed host name must be base64-encoded");
+            return NO;
+        }
+
+        names = [NSString stringWithFormat:@"|1|%@|%@", salt, host];
+    }
+    else if (port == 22) {
+        names = host;
+    }
+    else {
+        names = [NSString stringWithFormat:@"[%@]:%ld", host, (long)port];
+    }
+
+    NSString *line = [NSString stringWithFormat:@"%@ %@ %@\n", names, keyType, NMSSHBase64Encode(key)];
+
+    __block BOOL success = NO;
+    dispatch_sync(self.storeQueue, ^{
+        BOOL loaded = [self loadIfNeeded];
+
+        // Readable too, to check how the file ends
+        int fd = open([self.path fileSystemRepresentation], O_RDWR | O_APPEND | O_CREAT, 0600);
+        if (fd < 0) {
+            NMSSHLogError(@"Couldn't write to %@: %s", self.path, strerror(errno));
+            return;
+        }
+
+        NSMutableData *data = [[NSMutableData alloc] init];
+
+        // Don't join the new line to a last line without a line break
+        struct stat info = { 0 };
+        char last = '\n';
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            pread(fd, &last, 1, info.st_size - 1);
+        }
+
+        if (last != '\n') {
+            [data appendBytes:"\n" length:1];
+        }
+
+        [data appendData:[line dataUsingEncoding:NSUTF8StringEncoding]];
+
+        const char *bytes = [data bytes];
+        size_t remaining = [data length];
+        while (remaining > 0) {
+            ssize_t written = write(fd, bytes, remaining);
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            else if (written < 0) {
+                NMSSHLogError(@"Couldn't write to %@: %s", self.path, strerror(errno));
+                break;
+            }
+
+            bytes += written;
+            remaining -= written;
+        }
+
+        success = remaining == 0;
+
+        // Keep the index in sync with the file instead of parsing it again
+        if (success && (loaded || info.st_size == 0) && fstat(fd, &info) == 0) {
+            [self parseLine:line];
+            [self setLoaded:YES];
+            [self setModificationTime:info.st_mtimespec];
+            [self setSize:info.st_size];
+        }
+        else {
+            [self setLoaded:NO];
+        }
+
+        close(fd);
+    });
+
+    if (success) {
+        NMSSHLogInfo(@"Host added to known hosts.");
+    }
+
+    return success;
+}
+
+@end
@@ -0,0 +1,48 @@
+#import "NMSSH.h"
+
+typedef NS_ENUM(NSInteger, NMSSHOperationError) {
+    NMSSHOperationCancelledError = 100,
+    NMSSHOperationTimeoutError,
+    NMSSHOperationDisconnectedError,
+    NMSSHOperationFailedError
+};
+
+/**
+ NMSSHOperation is a handle to an asynchronous operation started on a
+ NMSSHSession, NMSSHChannel or NMSFTP instance.
+
+ Asynchronous operations never block the calling thread. They are driven by
+ non-blocking libssh2 calls on the session queue, which wakes up whenever the
+ session socket is ready, and report their result on the session's
+ `callbackQueue`.
+
+    [session authenticateByPassword:@"pass" completion:^(BOOL success, NSError *error) {
+        NMSSHOperation *operation = [session.channel execute:@"uptime"
+                                                     timeout:@10
+                                                  completion:^(NSString *response, NSError *error) {
+            NSLog(@"%@", response);
+        }];
+    }];
+
+ Any number of operations may be in flight on the same session at once, but
+ the asynchronous and synchronous APIs must not be used on the same session at
+ the same time.
+ */
+@interface NMSSHOperation : NSObject
+
+/** A Boolean value indicating whether the operation has been cancelled (read-only). */
+@property (atomic, readonly, getter = isCancelled) BOOL cancelled;
+
+/** A Boolean value indicating whether the operation has completed (read-only). */
+@property (atomic, readonly, getter = isFinished) BOOL finished;
+
+/**
+ Cancel the operation.
+
+ The operation releases its resources and calls its completion block with a
+ `NMSSHOperationCancelledError` error. Cancelling a finished operation has no
+ effect. This method can be called from any thread.
+ */
+- (void)cancel;
+
+@end
@@ -0,0 +1,92 @@
+#import "NMSSHOperation.h"
+#import "NMSSH+Protected.h"
+
+@interface NMSSHOperation ()
+@property (atomic, readwrite, getter = isCancelled) BOOL cancelled;
+@property (atomic, readwrite, getter = isFinished) BOOL finished;
+@end
+
+@implementation NMSSHOperation
+
+// -----------------------------------------------------------------------------
+#pragma mark - INITIALIZER
+// -----------------------------------------------------------------------------
+
++ (instancetype)operationWithSession:(NMSSHSession *)session step:(NMSSHOperationStatus (^)(NMSSHOperation *))step {
+    NMSSHOperation *operation = [[NMSSHOperation alloc] init];
+    [operation setSession:session];
+    [operation setStep:step];
+    [operation setRequiresSession:YES];
+
+    return operation;
+}
+
+// -----------------------------------------------------------------------------
+#pragma mark - STATE
+// -----------------------------------------------------------------------------
+
+- (void)cancel {
+    if (self.isFinished || self.isCancelled) {
+        return;
+    }
+
+    [self setCancelled:YES];
+    NMSSHLogVerbose(@"Operation %p cancelled", self);
+
+    // Give the operation a chance to clean up
+    [self.session pumpOperationsAsync];
+}
+
+- (void)setTimeout:(NSNumber *)timeout {
+    if ([timeout doubleValue] > 0) {
+        [self setDeadline:CFAbsoluteTimeGetCurrent() + [timeout doubleValue]];
+    }
+    else {
+        [self setDeadline:0];
+    }
+}
+
+- (BOOL)isExpired {
+    return self.deadline > 0 && self.deadline < CFAbsoluteTimeGetCurrent();
+}
+
++ (NSError *)errorWithCode:(NMSSHOperationError)code description:(NSString *)description {
+    return [NSError errorWithDomain:@"NMSSH"
+                               code:code
+                           userInfo:@{ NSLocalizedDescriptionKey : description }];
+}
+
+- (NMSSHOperationStatus)performStep {
+    if (self.isFinished) {
+        return NMSSHOperationStatusDone;
+    }
+
+    // Ask the step to wind down as soon as something went wrong
+    if (!self.abortError) {
+        if (self.isCancelled) {
+            [self setAbortError:[NMSSHOperation errorWithCode:NMSSHOperationCancelledError
+                                                  description:@"Operation cancelled"]];
+        }
+        else if ([self isExpired]) {
+            [self setAbortError:[NMSSHOperation errorWithCode:NMSSHOperationTimeoutError
+                                                  description:@"Operation timed out"]];
+        }
+        else if (self.requiresSession && !self.session.rawSession) {
+            [self setAbortError:[NMSSHOperation errorWithCode:NMSSHOperationDisconnectedError
+                                                  description:@"Session disconnected"]];
+        }
+    }
+
+    NMSSHOperationStatus status = self.step(self);
+
+    if (status == NMSSHOperationStatusDone) {
+        [self setFinished:YES];
+
+        // Break the retain cycles held by the step block
+        [self setStep:nil];
+    }
+
+    return status;
+}
+
+@end
@@ -0,0 +1,181 @@
+#import "NMSSH.h"
+
+@class NMSSHConfig, NMSSHCredentials, NMSFTPFile;
+
+/**
+ NMSSHResilientSession keeps a connection to a host alive across network
+ failures.
+
+ When the connection is lost, a new NMSSHSession is connected with
+ exponential backoff and authenticated with the same credentials, then the
+ operations that failed because of the loss are started again. Only
+ idempotent work is replayed:
+
+ - `infoForFileAtPath:completion:` and
+   `contentsOfDirectoryAtPath:completion:` are simply retried.
+ - `downloadFileAtPath:toLocalPath:progress:completion:` resumes at the last
+   byte written to the local file.
+ - `performIdempotentOperation:completion:` retries any work the caller knows
+   to be safe to repeat.
+
+ Everything is built on the asynchronous API, the blocks are called on
+ `callbackQueue`.
+
+    NMSSHResilientSession *resilient = [[NMSSHResilientSession alloc] initWithHost:@"example.com"
+                                                                            configs:@[]
+                                                                    withDefaultPort:22
+                                                                    defaultUsername:@"user"
+                                                                        credentials:[NMSSHCredentials agentCredentials]];
+    [resilient downloadFileAtPath:@"/var/log/big.log" toLocalPath:localPath progress:nil completion:^(BOOL success, NSError *error) {
+        NSLog(@"Downloaded after %lu reconnects", (unsigned long)resilient.reconnectCount);
+    }];
+ */
+@interface NMSSHResilientSession : NSObject
+
+/// ----------------------------------------------------------------------------
+/// @name Initialize a new resilient session
+/// ----------------------------------------------------------------------------
+
+- (nonnull instancetype)init NS_UNAVAILABLE;
+
+/**
+ Create a resilient session, it connects with the first operation.
+
+ @param host The host name to look up in _configs_
+ @param configs An array of NMSSHConfig objects ordered from highest to lowest
+     priority
+ @param defaultPort Port used when no config provides one
+ @param defaultUsername Username used when no config provides one
+ @param credentials Credentials used for every (re)authentication
+ @returns NMSSHResilientSession instance
+ */
+- (nonnull instancetype)initWithHost:(nonnull NSString *)host
+                             configs:(nonnull NSArray<NMSSHConfig *> *)configs
+                     withDefaultPort:(NSInteger)defaultPort
+                     defaultUsername:(nonnull NSString *)defaultUsername
+                         credentials:(nonnull NMSSHCredentials *)credentials NS_DESIGNATED_INITIALIZER;
+
+/// ----------------------------------------------------------------------------
+/// @name Reconnection settings
+/// ----------------------------------------------------------------------------
+
+/** The session in use, replaced by a new one after each reconnection. nil until the first connection. */
+@property (nonatomic, nullable, readonly) NMSSHSession *session;
+
+/** Credentials used for every (re)authentication */
+@property (nonatomic, nonnull, readonly) NMSSHCredentials *credentials;
+
+/**
+ Block called with every new session before it connects, e.g. to set
+ timeouts, keepalives or algorithm preferences. Don't change its callback
+ queue.
+ */
+@property (nonatomic, nullable, copy) void (^sessionConfigurationHandler)(NMSSHSession *_Nonnull session);
+
+/** Time (in seconds) each connection attempt is given, default 10 */
+@property (nonatomic, nonnull, strong) NSNumber *connectTimeout;
+
+/** Number of failed connection attempts in a row before giving up, default 5 */
+@property (nonatomic, assign) NSUInteger maxReconnectAttempts;
+
+/** Delay (in seconds) before the first reconnection attempt, doubled after each failure, default 0.5 */
+@property (nonatomic, assign) NSTimeInterval initialBackoff;
+
+/** Longest delay (in seconds) between two reconnection attempts, default 30 */
+@property (nonatomic, assign) NSTimeInterval maxBackoff;
+
+/** Number of times an operation is replayed after losing the connection, default 3 */
+@property (nonatomic, assign) NSUInteger maxOperationRetries;
+
+/** Queue the completion blocks are called on, default is the main queue. */
+#if OS_OBJECT_USE_OBJC
+@property (nonatomic, nonnull, strong) dispatch_queue_t callbackQueue;
+#else
+@property (nonatomic, nonnull, assign) dispatch_queue_t callbackQueue;
+#endif
+
+/// ----------------------------------------------------------------------------
+/// @name Recovery metrics
+/// ----------------------------------------------------------------------------
+
+/** Number of times the connection was re-established after a loss */
+@property (nonatomic, readonly) NSUInteger reconnectCount;
+
+/** Time (in seconds) from the last connection loss until the new session was authenticated */
+@property (nonatomic, readonly) NSTimeInterval lastRecoveryTime;
+
+/** Time (in seconds) spent recovering from all connection losses */
+@property (nonatomic, readonly) NSTimeInterval totalRecoveryTime;
+
+/// ----------------------------------------------------------------------------
+/// @name Connection
+/// ----------------------------------------------------------------------------
+
+/**
+ Connect and authenticate, retrying with backoff.
+
+ Calling this method is optional, operations connect when needed.
+
+ @param completion The block called once the session is authenticated or gave up
+ */
+- (void)connectWithCompletion:(void (^_Nullable)(BOOL success, NSError *_Nullable error))completion;
+
+/**
+ Disconnect and stop reconnecting, the operations in progress fail.
+
+ The session connects again with the next operation.
+ */
+- (void)disconnect;
+
+/// ----------------------------------------------------------------------------
+/// @name Idempotent operations
+/// ----------------------------------------------------------------------------
+
+/**
+ Run work that is safe to repeat, replaying it on a new session if the
+ connection is lost.
+
+ _attempt_ is called on the callback queue of the session, with an
+ authenticated session, and must call _done_ exactly once.
+
+ @param attempt Block starting the work
+ @param completion The block called with the error of the last attempt, nil on success
+ */
+- (void)performIdempotentOperation:(void (^_Nonnull)(NMSSHSession *_Nonnull session, void (^_Nonnull done)(NSError *_Nullable error)))attempt
+                        completion:(void (^_Nullable)(NSError *_Nullable error))completion;
+
+/**
+ Get information about a file, retried if the connection is lost.
+
+ @param path A file path
+ @param completion The block called with the file information, `nil` on error
+ */
+- (void)infoForFileAtPath:(nonnull NSString *)path
+               completion:(void (^_Nonnull)(NMSFTPFile *_Nullable file, NSError *_Nullable error))completion;
+
+/**
+ List a directory, retried if the connection is lost.
+
+ @param path Path to directory
+ @param completion The block called with the sorted list of files, `nil` on error
+ */
+- (void)contentsOfDirectoryAtPath:(nonnull NSString *)path
+                       completion:(void (^_Nonnull)(NSArray<NMSFTPFile *> *_Nullable contents, NSError *_Nullable error))completion;
+
+/**
+ Download a file, resuming where it stopped if the connection is lost.
+
+ An existing file at _localPath_ is replaced.
+
+ @param path An existing remote file path
+ @param localPath Path of the local file to write
+ @param progress Method called periodically with number of bytes downloaded and total file size.
+        Returns NO to abort.
+ @param completion The block called with the result
+ */
+- (void)downloadFileAtPath:(nonnull NSString *)path
+               toLocalPath:(nonnull NSString *)localPath
+                  progress:(BOOL (^_Nullable)(NSUInteger got, NSUInteger totalBytes))progress
+                completion:(void (^_Nullable)(BOOL success, NSError *_Nullable error))completion;
+
+@end
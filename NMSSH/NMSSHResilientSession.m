@@ -0,0 +1,421 @@
+#import "NMSSHResilientSession.h"
+#import "NMSSH+Protected.h"
+
+@interface NMSSHResilientSession ()
+@property (nonatomic, strong) NSString *host;
+@property (nonatomic, strong) NSArray *configs;
+@property (nonatomic, assign) NSInteger defaultPort;
+@property (nonatomic, strong) NSString *defaultUsername;
+@property (nonatomic, strong) NMSSHCredentials *credentials;
+@property (nonatomic, strong) NMSSHSession *session;
+
+@property (nonatomic, assign) NSUInteger reconnectCount;
+@property (nonatomic, assign) NSTimeInterval lastRecoveryTime;
+@property (nonatomic, assign) NSTimeInterval totalRecoveryTime;
+
+/** Whether the current session is authenticated */
+@property (nonatomic, assign) BOOL ready;
+/** Whether a connection attempt is in progress or scheduled */
+@property (nonatomic, assign) BOOL connecting;
+/** Whether a session was authenticated since the last call to disconnect */
+@property (nonatomic, assign) BOOL wasReady;
+@property (nonatomic, assign) NSUInteger failedAttempts;
+@property (nonatomic, assign) CFAbsoluteTime outageStartTime;
+/** Blocks waiting for an authenticated session */
+@property (nonatomic, strong) NSMutableArray *waiters;
+/** Changes when connection attempts are abandoned, their callbacks are then ignored */
+@property (nonatomic, assign) NSUInteger generation;
+/** Changes with each call to disconnect, operations started before are not replayed */
+@property (nonatomic, assign) NSUInteger epoch;
+
+#if OS_OBJECT_USE_OBJC
+@property (nonatomic, strong) dispatch_queue_t queue;
+#else
+@property (nonatomic, assign) dispatch_queue_t queue;
+#endif
+@end
+
+@implementation NMSSHResilientSession
+
+// -----------------------------------------------------------------------------
+#pragma mark - INITIALIZE A NEW RESILIENT SESSION
+// -----------------------------------------------------------------------------
+
+- (instancetype)initWithHost:(NSString *)host
+                     configs:(NSArray *)configs
+             withDefaultPort:(NSInteger)defaultPort
+             defaultUsername:(NSString *)defaultUsername
+                 credentials:(NMSSHCredentials *)credentials {
+    if ((self = [super init])) {
+        [self setHost:host];
+        [self setConfigs:[configs copy]];
+        [self setDefaultPort:defaultPort];
+        [self setDefaultUsername:defaultUsername];
+        [self setCredentials:[credentials copy]];
+
+        [self setConnectTimeout:@10];
+        [self setMaxReconnectAttempts:5];
+        [self setInitialBackoff:0.5];
+        [self setMaxBackoff:30];
+        [self setMaxOperationRetries:3];
+        [self setCallbackQueue:dispatch_get_main_queue()];
+
+        [self setWaiters:[[NSMutableArray alloc] init]];
+
+        // Sessions report to this queue, all the state is kept on it
+        [self setQueue:dispatch_queue_create("NMSSH.resilientSessionQueue", DISPATCH_QUEUE_SERIAL)];
+    }
+
+    return self;
+}
+
+- (void)dealloc {
+#if !(OS_OBJECT_USE_OBJC)
+    dispatch_release(_queue);
+#endif
+}
+
+// -----------------------------------------------------------------------------
+#pragma mark - CONNECTION
+// -----------------------------------------------------------------------------
+
+- (void)connectWithCompletion:(void (^)(BOOL, NSError *))completion {
+    dispatch_async(self.queue, ^{
+        [self withSession:^(NMSSHSession *session, NSError *error) {
+            [self complete:^{
+                if (completion) {
+                    completion(error == nil, error);
+                }
+            }];
+        }];
+    });
+}
+
+- (void)disconnect {
+    dispatch_async(self.queue, ^{
+        [self setEpoch:self.epoch + 1];
+        [self setWasReady:NO];
+        [self giveUp:[NMSSHOperation errorWithCode:NMSSHOperationCancelledError description:@"Session disconnected"]];
+    });
+}
+
+/**
+ Call a block with an authenticated session, connecting first if needed.
+ Must be called on the queue.
+ */
+- (void)withSession:(void (^)(NMSSHSession *session, NSError *error))block {
+    if (self.ready) {
+        block(self.session, nil);
+        return;
+    }
+
+    [self.waiters addObject:[block copy]];
+
+    if (!self.connecting) {
+        [self setConnecting:YES];
+        [self setFailedAttempts:0];
+        [self connectSession];
+    }
+}
+
+- (void)connectSession {
+    [self dropSession];
+
+    NSUInteger generation = self.generation;
+    NMSSHSession *session = [[NMSSHSession alloc] initWithHost:self.host
+                                                       configs:self.configs
+                                               withDefaultPort:self.defaultPort
+                                               defaultUsername:self.defaultUsername];
+    if (self.sessionConfigurationHandler) {
+        self.sessionConfigurationHandler(session);
+    }
+
+    [session setCallbackQueue:self.queue];
+    [self setSession:session];
+
+    [session connectWithTimeout:self.connectTimeout completion:^(BOOL success, NSError *error) {
+        if (generation != self.generation) {
+            return;
+        }
+
+        if (!success) {
+            [self connectionAttemptFailed:error];
+            return;
+        }
+
+        [session authenticateWithCredentials:self.credentials completion:^(BOOL success, NSError *error) {
+            if (generation != self.generation) {
+                return;
+            }
+
+            if (success) {
+                [self sessionReady];
+            }
+            else if (session.isConnected) {
+                // Refused credentials won't be accepted by the next session either
+                [self giveUp:error];
+            }
+            else {
+                [self connectionAttemptFailed:error];
+            }
+        }];
+    }];
+}
+
+- (void)sessionReady {
+    [self setReady:YES];
+    [self setConnecting:NO];
+    [self setWasReady:YES];
+
+    if (self.outageStartTime > 0) {
+        NSTimeInterval recoveryTime = CFAbsoluteTimeGetCurrent() - self.outageStartTime;
+        [self setOutageStartTime:0];
+        [self setLastRecoveryTime:recoveryTime];
+        [self setTotalRecoveryTime:self.totalRecoveryTime + recoveryTime];
+        [self setReconnectCount:self.reconnectCount + 1];
+
+        NMSSHLogInfo(@"Reconnected to %@ in %.3fs", self.host, recoveryTime);
+    }
+
+    [self flushWaitersWithError:nil];
+}
+
+- (void)connectionAttemptFailed:(NSError *)error {
+    [self setFailedAttempts:self.failedAttempts + 1];
+
+    if (self.failedAttempts >= MAX(self.maxReconnectAttempts, 1)) {
+        [self giveUp:error];
+        return;
+    }
+
+    // Exponential backoff with jitter, so hosts losing the same link don't retry in lockstep
+    NSTimeInterval delay = MIN(self.initialBackoff * pow(2, self.failedAttempts - 1), self.maxBackoff);
+    delay *= 0.5 + arc4random_uniform(501) / 1000.0;
+
+    NMSSHLogInfo(@"Connecting to %@ failed (%@), retrying in %.1fs", self.host, [error localizedDescription], delay);
+
+    NSUInteger generation = self.generation;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), self.queue, ^{
+        if (generation == self.generation) {
+            [self connectSession];
+        }
+    });
+}
+
+- (void)giveUp:(NSError *)error {
+    NMSSHLogWarn(@"Giving up on %@: %@", self.host, [error localizedDescription]);
+
+    [self setConnecting:NO];
+    [self setOutageStartTime:0];
+    [self dropSession];
+    [self flushWaitersWithError:error];
+}
+
+- (void)connectionLostOnSession:(NMSSHSession *)session {
+    // Another operation already noticed
+    if (session != self.session) {
+        return;
+    }
+
+    NMSSHLogWarn(@"Lost the connection to %@", self.host);
+
+    if (self.wasReady) {
+        [self setOutageStartTime:CFAbsoluteTimeGetCurrent()];
+    }
+
+    [self dropSession];
+}
+
+- (void)dropSession {
+    // Callbacks of the abandoned session are ignored from now on
+    [self setGeneration:self.generation + 1];
+    [self setReady:NO];
+
+    NMSSHSession *session = self.session;
+    [self setSession:nil];
+
+    if (session) {
+        dispatch_async(session.sessionQueue, ^{
+            [session disconnect];
+        });
+    }
+}
+
+- (void)flushWaitersWithError:(NSError *)error {
+    NSArray *waiters = [self.waiters copy];
+    [self.waiters removeAllObjects];
+
+    for (void (^waiter)(NMSSHSession *, NSError *) in waiters) {
+        waiter(error ? nil : self.session, error);
+    }
+}
+
+- (BOOL)isConnectionLossError:(NSError *)error onSession:(NMSSHSession *)session {
+    if (!session.isConnected) {
+        return YES;
+    }
+
+    if ([error.domain isEqualToString:@"NMSSH"]) {
+        return error.code == NMSSHOperationDisconnectedError || error.code == NMSSHOperationTimeoutError;
+    }
+
+    if ([error.domain isEqualToString:@"libssh2"]) {
+        switch (error.code) {
+            case LIBSSH2_ERROR_SOCKET_SEND:
+            case LIBSSH2_ERROR_SOCKET_RECV:
+            case LIBSSH2_ERROR_SOCKET_DISCONNECT:
+            case LIBSSH2_ERROR_SOCKET_TIMEOUT:
+            case LIBSSH2_ERROR_TIMEOUT:
+                return YES;
+        }
+    }
+
+    return NO;
+}
+
+- (void)complete:(dispatch_block_t)block {
+    dispatch_async(self.callbackQueue, block);
+}
+
+// -----------------------------------------------------------------------------
+#pragma mark - IDEMPOTENT OPERATIONS
+// -----------------------------------------------------------------------------
+
+- (void)performIdempotentOperation:(void (^)(NMSSHSession *, void (^)(NSError *)))attempt
+                        completion:(void (^)(NSError *))completion {
+    dispatch_async(self.queue, ^{
+        [self runOperation:attempt retries:0 epoch:self.epoch completion:completion];
+    });
+}
+
+- (void)runOperation:(void (^)(NMSSHSession *, void (^)(NSError *)))attempt
+             retries:(NSUInteger)retries
+               epoch:(NSUInteger)epoch
+          completion:(void (^)(NSError *))completion {
+    [self withSession:^(NMSSHSession *session, NSError *error) {
+        if (error) {
+            [self complete:^{
+                if (completion) {
+                    completion(error);
+                }
+            }];
+            return;
+        }
+
+        attempt(session, ^(NSError *error) {
+            dispatch_async(self.queue, ^{
+                if (error && epoch == self.epoch && retries < self.maxOperationRetries &&
+                    [self isConnectionLossError:error onSession:session]) {
+                    [self connectionLostOnSession:session];
+                    [self runOperation:attempt retries:retries + 1 epoch:epoch completion:completion];
+                    return;
+                }
+
+                [self complete:^{
+                    if (completion) {
+                        completion(error);
+                    }
+                }];
+            });
+        });
+    }];
+}
+
+/** Call a block with the connected SFTP session of a session */
+- (void)sftpForSession:(NMSSHSession *)session completion:(void (^)(NMSFTP *sftp, NSError *error))completion {
+    NMSFTP *sftp = session.sftp;
+
+    if (sftp.isConnected) {
+        completion(sftp, nil);
+        return;
+    }
+
+    [sftp connectWithCompletion:^(BOOL success, NSError *error) {
+        completion(success ? sftp : nil, error);
+    }];
+}
+
+- (void)infoForFileAtPath:(NSString *)path completion:(void (^)(NMSFTPFile *, NSError *))completion {
+    __block NMSFTPFile *info = nil;
+
+    [self performIdempotentOperation:^(NMSSHSession *session, void (^done)(NSError *)) {
+        [self sftpForSession:session completion:^(NMSFTP *sftp, NSError *error) {
+            if (!sftp) {
+                done(error);
+                return;
+            }
+
+            [sftp infoForFileAtPath:path completion:^(NMSFTPFile *file, NSError *error) {
+                info = file;
+                done(error);
+            }];
+        }];
+    } completion:^(NSError *error) {
+        completion(error ? nil : info, error);
+    }];
+}
+
+- (void)contentsOfDirectoryAtPath:(NSString *)path completion:(void (^)(NSArray *, NSError *))completion {
+    __block NSArray *contents = nil;
+
+    [self performIdempotentOperation:^(NMSSHSession *session, void (^done)(NSError *)) {
+        [self sftpForSession:session completion:^(NMSFTP *sftp, NSError *error) {
+            if (!sftp) {
+                done(error);
+                return;
+            }
+
+            [sftp contentsOfDirectoryAtPath:path completion:^(NSArray *files, NSError *error) {
+                contents = files;
+                done(error);
+            }];
+        }];
+    } completion:^(NSError *error) {
+        completion(error ? nil : contents, error);
+    }];
+}
+
+- (void)downloadFileAtPath:(NSString *)path
+               toLocalPath:(NSString *)localPath
+                  progress:(BOOL (^)(NSUInteger, NSUInteger))progress
+                completion:(void (^)(BOOL, NSError *))completion {
+    __block BOOL created = NO;
+
+    [self performIdempotentOperation:^(NMSSHSession *session, void (^done)(NSError *)) {
+        NSFileManager *fileManager = [NSFileManager defaultManager];
+
+        // The first attempt replaces the local file, the next ones continue it
+        if (!created && ![fileManager createFileAtPath:localPath contents:nil attributes:nil]) {
+            done([NMSSHOperation errorWithCode:NMSSHOperationFailedError
+                                   description:[NSString stringWithFormat:@"Unable to create %@", localPath]]);
+            return;
+        }
+
+        created = YES;
+
+        // Everything written to the file was acknowledged by the server
+        unsigned long long offset = [[fileManager attributesOfItemAtPath:localPath error:nil] fileSize];
+        NSOutputStream *outputStream = [NSOutputStream outputStreamToFileAtPath:localPath append:YES];
+
+        if (offset > 0) {
+            NMSSHLogInfo(@"Resuming the download of %@ at %llu", path, offset);
+        }
+
+        [self sftpForSession:session completion:^(NMSFTP *sftp, NSError *error) {
+            if (!sftp) {
+                done(error);
+                return;
+            }
+
+            [sftp contentsAtPath:path toStream:outputStream fromOffset:offset progress:progress completion:^(BOOL success, NSError *error) {
+                done(error);
+            }];
+        }];
+    } completion:^(NSError *error) {
+        if (completion) {
+            completion(error == nil, error);
+        }
+    }];
+}
+
+@end
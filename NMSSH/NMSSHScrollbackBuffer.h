@@ -0,0 +1,163 @@
+#import "NMSSH.h"
+
+typedef NS_OPTIONS(NSUInteger, NMSSHScrollbackSearchOptions) {
+    /** Search from the given offset towards the oldest data */
+    NMSSHScrollbackSearchBackwards       = 1 << 0,
+    /** Compare ASCII letters regardless of their case */
+    NMSSHScrollbackSearchCaseInsensitive = 1 << 1
+};
+
+/** Offset or line returned when nothing was found */
+static const uint64_t NMSSHScrollbackNotFound = UINT64_MAX;
+
+/**
+ NMSSHScrollbackBuffer records a byte stream, such as the output of a shell,
+ in a ring buffer of fixed capacity with an index of its lines.
+
+ Bytes and lines are numbered from the start of the recording. Once the
+ buffer is full, or its line index is, the oldest data is evicted, the oldest
+ line left may then have lost its beginning. The memory used is set at
+ initialization and stays the same however long the recording runs:
+
+    channel.scrollback = [[NMSSHScrollbackBuffer alloc] initWithCapacity:4 * 1024 * 1024 maxLines:100000];
+
+ The recorded bytes are read and searched in place, without copying them
+ into strings. A buffer can be read from any thread while it is written.
+ */
+@interface NMSSHScrollbackBuffer : NSObject
+
+/// ----------------------------------------------------------------------------
+/// @name Initialize a new buffer
+/// ----------------------------------------------------------------------------
+
+- (nonnull instancetype)init NS_UNAVAILABLE;
+
+/**
+ Create an empty buffer.
+
+ @param capacity Most bytes kept, at least 1
+ @param maxLines Most lines indexed, at least 1
+ @returns NMSSHScrollbackBuffer instance
+ */
+- (nonnull instancetype)initWithCapacity:(NSUInteger)capacity maxLines:(NSUInteger)maxLines NS_DESIGNATED_INITIALIZER;
+
+/// ----------------------------------------------------------------------------
+/// @name Buffer state
+/// ----------------------------------------------------------------------------
+
+/** Most bytes kept (read-only) */
+@property (nonatomic, readonly) NSUInteger capacity;
+
+/** Most lines indexed (read-only) */
+@property (nonatomic, readonly) NSUInteger maxLines;
+
+/** Offset of the oldest byte kept (read-only) */
+@property (nonatomic, readonly) uint64_t startOffset;
+
+/** Offset following the newest byte, the number of bytes ever recorded (read-only) */
+@property (nonatomic, readonly) uint64_t endOffset;
+
+/** Number of the oldest line kept (read-only) */
+@property (nonatomic, readonly) uint64_t firstLine;
+
+/**
+ Number of lines kept, the last one being the line not terminated yet, empty
+ after a line feed (read-only).
+ */
+@property (nonatomic, readonly) NSUInteger lineCount;
+
+/// ----------------------------------------------------------------------------
+/// @name Record data
+/// ----------------------------------------------------------------------------
+
+/**
+ Append bytes, evicting the oldest data if needed.
+
+ @param bytes Bytes to record
+ @param length Number of bytes
+ */
+- (void)appendBytes:(nonnull const void *)bytes length:(NSUInteger)length;
+
+/**
+ Append data, evicting the oldest data if needed.
+
+ @param data Data to record
+ */
+- (void)appendData:(nonnull NSData *)data;
+
+/**
+ Forget all the data, the numbering goes on.
+ */
+- (void)removeAllData;
+
+/// ----------------------------------------------------------------------------
+/// @name Read data
+/// ----------------------------------------------------------------------------
+
+/**
+ Read a range of bytes in place, in at most two contiguous chunks.
+
+ The range is clipped to the bytes kept. The buffer can't be written while
+ the block runs, and the block must not call the buffer.
+
+ @param offset Offset of the first byte
+ @param length Number of bytes
+ @param block Block called with each chunk and its offset, set stop to YES
+     to skip the next chunk
+ */
+- (void)enumerateBytesFromOffset:(uint64_t)offset
+                          length:(NSUInteger)length
+                      usingBlock:(void (^ _Nonnull)(const void * _Nonnull bytes, NSUInteger length, uint64_t offset, BOOL * _Nonnull stop))block;
+
+/**
+ Copy a range of bytes.
+
+ @param offset Offset of the first byte
+ @param length Number of bytes
+ @returns The bytes of the range that are still kept
+ */
+- (nonnull NSData *)dataFromOffset:(uint64_t)offset length:(NSUInteger)length;
+
+/**
+ Find the bytes of a line.
+
+ @param offset Set to the offset of the line
+ @param length Set to the length of the line without its line feed
+ @param line Number of the line
+ @returns NO if the line is not kept
+ */
+- (BOOL)getOffset:(nonnull uint64_t *)offset length:(nonnull NSUInteger *)length ofLine:(uint64_t)line;
+
+/**
+ Copy the bytes of a line.
+
+ @param line Number of the line
+ @returns The line without its line feed, nil if it is not kept
+ */
+- (nullable NSData *)dataForLine:(uint64_t)line;
+
+/**
+ Find the line holding a byte.
+
+ @param offset Offset of the byte
+ @returns Number of the line, NMSSHScrollbackNotFound if the byte is not kept
+ */
+- (uint64_t)lineAtOffset:(uint64_t)offset;
+
+/// ----------------------------------------------------------------------------
+/// @name Search data
+/// ----------------------------------------------------------------------------
+
+/**
+ Search the kept bytes for a pattern.
+
+ @param pattern The bytes to search for
+ @param offset Offset to start from, the match starts at or after it, or at
+     or before it when searching backwards
+ @param options Search options
+ @returns Offset of the first byte of the match, NMSSHScrollbackNotFound if
+     the pattern was not found
+ */
+- (uint64_t)offsetOfData:(nonnull NSData *)pattern fromOffset:(uint64_t)offset options:(NMSSHScrollbackSearchOptions)options;
+
+@end
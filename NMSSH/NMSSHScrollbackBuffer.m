@@ -0,0 +1,383 @@
+#import "NMSSHScrollbackBuffer.h"
+
+@interface NMSSHScrollbackBuffer () {
+    uint8_t *_bytes;
+    uint64_t _startOffset;
+    uint64_t _endOffset;
+
+    // Ring of the start offsets of the lines kept, the oldest at the head
+    uint64_t *_lineStarts;
+    NSUInteger _lineHead;
+    NSUInteger _lineCount;
+    uint64_t _firstLine;
+}
+
+@property (nonatomic, readwrite) NSUInteger capacity;
+@property (nonatomic, readwrite) NSUInteger maxLines;
+
+#if OS_OBJECT_USE_OBJC
+@property (nonatomic, strong) dispatch_queue_t queue;
+#else
+@property (nonatomic, assign) dispatch_queue_t queue;
+#endif
+@end
+
+@implementation NMSSHScrollbackBuffer
+
+// -----------------------------------------------------------------------------
+#pragma mark - INITIALIZER
+// -----------------------------------------------------------------------------
+
+- (instancetype)initWithCapacity:(NSUInteger)capacity maxLines:(NSUInteger)maxLines {
+    if ((self = [super init])) {
+        [self setCapacity:MAX(capacity, 1)];
+        [self setMaxLines:MAX(maxLines, 1)];
+
+        // Writes are barriers, reads run concurrently
+        [self setQueue:dispatch_queue_create("NMSSH.scrollbackQueue", DISPATCH_QUEUE_CONCURRENT)];
+
+        _bytes = malloc(self.capacity);
+        _lineStarts = malloc(self.maxLines * sizeof(uint64_t));
+        _lineStarts[0] = 0;
+        _lineCount = 1;
+    }
+
+    return self;
+}
+
+- (void)dealloc {
+    free(_bytes);
+    free(_lineStarts);
+
+#if !(OS_OBJECT_USE_OBJC)
+    dispatch_release(_queue);
+#endif
+}
+
+// -----------------------------------------------------------------------------
+#pragma mark - BUFFER STATE
+// -----------------------------------------------------------------------------
+
+- (uint64_t)startOffset {
+    __block uint64_t offset;
+    dispatch_sync(self.queue, ^{
+        offset = self->_startOffset;
+    });
+
+    return offset;
+}
+
+- (uint64_t)endOffset {
+    __block uint64_t offset;
+    dispatch_sync(self.queue, ^{
+        offset = self->_endOffset;
+    });
+
+    return offset;
+}
+
+- (uint64_t)firstLine {
+    __block uint64_t line;
+    dispatch_sync(self.queue, ^{
+        line = self->_firstLine;
+    });
+
+    return line;
+}
+
+- (NSUInteger)lineCount {
+    __block NSUInteger count;
+    dispatch_sync(self.queue, ^{
+        count = self->_lineCount;
+    });
+
+    return count;
+}
+
+// -----------------------------------------------------------------------------
+#pragma mark - RECORD DATA
+// -----------------------------------------------------------------------------
+
+- (void)appendBytes:(const void *)bytes length:(NSUInteger)length {
+    dispatch_barrier_sync(self.queue, ^{
+        const uint8_t *remaining = bytes;
+        NSUInteger remainingLength = length;
+
+        // Data longer than the buffer overwrites itself, one capacity at a time
+        while (remainingLength > 0) {
+            NSUInteger chunkLength = MIN(remainingLength, self.capacity);
+
+            if (self->_endOffset + chunkLength - self->_startOffset > self.capacity) {
+                [self evictToOffset:self->_endOffset + chunkLength - self.capacity];
+            }
+
+            NSUInteger position = (NSUInteger)(self->_endOffset % self.capacity);
+            NSUInteger firstLength = MIN(chunkLength, self.capacity - position);
+            memcpy(self->_bytes + position, remaining, firstLength);
+            memcpy(self->_bytes, remaining + firstLength, chunkLength - firstLength);
+
+            const uint8_t *cursor = remaining;
+            const uint8_t *end = remaining + chunkLength;
+            const uint8_t *lineFeed;
+
+            while ((lineFeed = memchr(cursor, '\n', end - cursor)) != NULL) {
+                [self addLineAtOffset:self->_endOffset + (lineFeed - remaining) + 1];
+                cursor = lineFeed + 1;
+            }
+
+            self->_endOffset += chunkLength;
+            remaining += chunkLength;
+            remainingLength -= chunkLength;
+        }
+    });
+}
+
+- (void)appendData:(NSData *)data {
+    [self appendBytes:[data bytes] length:[data length]];
+}
+
+- (void)removeAllData {
+    dispatch_barrier_sync(self.queue, ^{
+        self->_firstLine += self->_lineCount - 1;
+        self->_startOffset = self->_endOffset;
+        self->_lineHead = 0;
+        self->_lineStarts[0] = self->_endOffset;
+        self->_lineCount = 1;
+    });
+}
+
+/** Index a new line, dropping the oldest one if the index is full */
+- (void)addLineAtOffset:(uint64_t)offset {
+    if (_lineCount == self.maxLines) {
+        [self removeOldestLine];
+    }
+
+    _lineStarts[(_lineHead + _lineCount) % self.maxLines] = offset;
+    _lineCount++;
+
+    if (_startOffset < _lineStarts[_lineHead]) {
+        _startOffset = _lineStarts[_lineHead];
+    }
+}
+
+- (void)removeOldestLine {
+    _lineHead = (_lineHead + 1) % self.maxLines;
+    _lineCount--;
+    _firstLine++;
+}
+
+/** Evict the data before an offset, whole lines first */
+- (void)evictToOffset:(uint64_t)offset {
+    while (_lineCount > 1 && _lineStarts[(_lineHead + 1) % self.maxLines] <= offset) {
+        [self removeOldestLine];
+    }
+
+    // The oldest line loses its beginning
+    if (_lineStarts[_lineHead] < offset) {
+        _lineStarts[_lineHead] = offset;
+    }
+
+    if (_startOffset < offset) {
+        _startOffset = offset;
+    }
+}
+
+// -----------------------------------------------------------------------------
+#pragma mark - READ DATA
+// -----------------------------------------------------------------------------
+
+- (void)enumerateBytesFromOffset:(uint64_t)offset
+                          length:(NSUInteger)length
+                      usingBlock:(void (^)(const void *, NSUInteger, uint64_t, BOOL *))block {
+    dispatch_sync(self.queue, ^{
+        [self enumerateKeptBytesFromOffset:offset length:length usingBlock:block];
+    });
+}
+
+/** Enumerate the contiguous chunks of a range, on the buffer queue */
+- (void)enumerateKeptBytesFromOffset:(uint64_t)offset
+                              length:(NSUInteger)length
+                          usingBlock:(void (^)(const void *, NSUInteger, uint64_t, BOOL *))block {
+    uint64_t start = MAX(offset, _startOffset);
+    uint64_t end = MIN(offset + length, _endOffset);
+    BOOL stop = NO;
+
+    while (start < end && !stop) {
+        NSUInteger position = (NSUInteger)(start % self.capacity);
+        NSUInteger chunkLength = (NSUInteger)MIN(end - start, (uint64_t)(self.capacity - position));
+
+        block(_bytes + position, chunkLength, start, &stop);
+        start += chunkLength;
+    }
+}
+
+- (NSData *)dataFromOffset:(uint64_t)offset length:(NSUInteger)length {
+    NSMutableData *data = [[NSMutableData alloc] init];
+
+    [self enumerateBytesFromOffset:offset length:length usingBlock:^(const void *bytes, NSUInteger chunkLength, uint64_t chunkOffset, BOOL *stop) {
+        [data appendBytes:bytes length:chunkLength];
+    }];
+
+    return data;
+}
+
+- (BOOL)getOffset:(uint64_t *)offset length:(NSUInteger *)length ofLine:(uint64_t)line {
+    __block BOOL found = NO;
+
+    dispatch_sync(self.queue, ^{
+        found = [self getKeptOffset:offset length:length ofLine:line];
+    });
+
+    return found;
+}
+
+- (BOOL)getKeptOffset:(uint64_t *)offset length:(NSUInteger *)length ofLine:(uint64_t)line {
+    if (line < _firstLine || line - _firstLine >= _lineCount) {
+        return NO;
+    }
+
+    NSUInteger index = (NSUInteger)(line - _firstLine);
+    uint64_t start = _lineStarts[(_lineHead + index) % self.maxLines];
+    uint64_t end = _endOffset;
+
+    // Lines but the last one end with a line feed
+    if (index + 1 < _lineCount) {
+        end = _lineStarts[(_lineHead + index + 1) % self.maxLines] - 1;
+    }
+
+    *offset = start;
+    *length = (NSUInteger)(end - start);
+
+    return YES;
+}
+
+- (NSData *)dataForLine:(uint64_t)line {
+    __block NSMutableData *data = nil;
+
+    dispatch_sync(self.queue, ^{
+        uint64_t offset;
+        NSUInteger length;
+
+        if ([self getKeptOffset:&offset length:&length ofLine:line]) {
+            data = [[NSMutableData alloc] initWithCapacity:length];
+
+            [self enumerateKeptBytesFromOffset:offset length:length usingBlock:^(const void *bytes, NSUInteger chunkLength, uint64_t chunkOffset, BOOL *stop) {
+                [data appendBytes:bytes length:chunkLength];
+            }];
+        }
+    });
+
+    return data;
+}
+
+- (uint64_t)lineAtOffset:(uint64_t)offset {
+    __block uint64_t line = NMSSHScrollbackNotFound;
+
+    dispatch_sync(self.queue, ^{
+        if (offset < self->_startOffset || offset >= self->_endOffset) {
+            return;
+        }
+
+        // Last line starting at or before the offset
+        NSUInteger low = 0;
+        NSUInteger high = self->_lineCount - 1;
+
+        while (low < high) {
+            NSUInteger middle = low + (high - low + 1) / 2;
+
+            if (self->_lineStarts[(self->_lineHead + middle) % self.maxLines] <= offset) {
+                low = middle;
+            }
+            else {
+                high = middle - 1;
+            }
+        }
+
+        line = self->_firstLine + low;
+    });
+
+    return line;
+}
+
+// -----------------------------------------------------------------------------
+#pragma mark - SEARCH DATA
+// -----------------------------------------------------------------------------
+
+- (uint64_t)offsetOfData:(NSData *)pattern fromOffset:(uint64_t)offset options:(NMSSHScrollbackSearchOptions)options {
+    __block uint64_t found = NMSSHScrollbackNotFound;
+    const uint8_t *patternBytes = [pattern bytes];
+    NSUInteger patternLength = [pattern length];
+    BOOL caseInsensitive = (options & NMSSHScrollbackSearchCaseInsensitive) != 0;
+
+    if (patternLength == 0) {
+        return NMSSHScrollbackNotFound;
+    }
+
+    dispatch_sync(self.queue, ^{
+        if (self->_endOffset - self->_startOffset < patternLength) {
+            return;
+        }
+
+        uint64_t first = self->_startOffset;
+        uint64_t last = self->_endOffset - patternLength;
+
+        if (options & NMSSHScrollbackSearchBackwards) {
+            for (uint64_t candidate = MIN(offset, last) + 1; candidate-- > first;) {
+                if ([self matchesBytes:patternBytes length:patternLength atOffset:candidate caseInsensitive:caseInsensitive]) {
+                    found = candidate;
+                    return;
+                }
+            }
+
+            return;
+        }
+
+        uint64_t candidate = MAX(offset, first);
+
+        while (candidate <= last) {
+            if (!caseInsensitive) {
+                // Skip to the next occurrence of the first byte in the contiguous chunk
+                NSUInteger position = (NSUInteger)(candidate % self.capacity);
+                NSUInteger chunkLength = (NSUInteger)MIN(last - candidate + 1, (uint64_t)(self.capacity - position));
+                const uint8_t *next = memchr(self->_bytes + position, patternBytes[0], chunkLength);
+
+                if (next == NULL) {
+                    candidate += chunkLength;
+                    continue;
+                }
+
+                candidate += next - (self->_bytes + position);
+            }
+
+            if ([self matchesBytes:patternBytes length:patternLength atOffset:candidate caseInsensitive:caseInsensitive]) {
+                found = candidate;
+                return;
+            }
+
+            candidate++;
+        }
+    });
+
+    return found;
+}
+
+- (BOOL)matchesBytes:(const uint8_t *)bytes length:(NSUInteger)length atOffset:(uint64_t)offset caseInsensitive:(BOOL)caseInsensitive {
+    NSUInteger position = (NSUInteger)(offset % self.capacity);
+
+    for (NSUInteger i = 0; i < length; i++) {
+        uint8_t byte = _bytes[position];
+        uint8_t expected = bytes[i];
+
+        if (byte != expected && (!caseInsensitive || tolower(byte) != tolower(expected))) {
+            return NO;
+        }
+
+        if (++position == self.capacity) {
+            position = 0;
+        }
+    }
+
+    return YES;
+}
+
+@end
@@ -1,6 +1,6 @@
 #import "NMSSH.h"
 
-@class NMSSHHostConfig, NMSFTP;
+@class NMSSHHostConfig, NMSFTP, NMSSHOperation, NMSSHCredentials, NMSSHCredentialCache, NMSSHTunnel;
 @protocol NMSSHSessionDelegate;
 
 typedef NS_ENUM(NSInteger, NMSSHSessionHash) {
@@ -8,6 +8,26 @@ typedef NS_ENUM(NSInteger, NMSSHSessionHash) {
     NMSSHSessionHashSHA1
 };
 
+typedef NS_ENUM(NSInteger, NMSSHSessionMethod) {
+    NMSSHSessionMethodKeyExchange = LIBSSH2_METHOD_KEX,
+    NMSSHSessionMethodHostKey = LIBSSH2_METHOD_HOSTKEY,
+    NMSSHSessionMethodCipherClientToServer = LIBSSH2_METHOD_CRYPT_CS,
+    NMSSHSessionMethodCipherServerToClient = LIBSSH2_METHOD_CRYPT_SC,
+    NMSSHSessionMethodMACClientToServer = LIBSSH2_METHOD_MAC_CS,
+    NMSSHSessionMethodMACServerToClient = LIBSSH2_METHOD_MAC_SC,
+    NMSSHSessionMethodCompressionClientToServer = LIBSSH2_METHOD_COMP_CS,
+    NMSSHSessionMethodCompressionServerToClient = LIBSSH2_METHOD_COMP_SC
+};
+
+typedef NS_ENUM(NSInteger, NMSSHAlgorithmPreset) {
+    /** The libssh2 defaults */
+    NMSSHAlgorithmPresetDefault,
+    /** AES in counter mode and a cheap MAC without compression, for fast links */
+    NMSSHAlgorithmPresetMaxThroughput,
+    /** Default algorithms with zlib compression, for slow links */
+    NMSSHAlgorithmPresetSlowLink
+};
+
 typedef NS_ENUM(NSInteger, NMSSHKnownHostStatus) {
     NMSSHKnownHostStatusMatch,
     NMSSHKnownHostStatusMismatch,
@@ -39,8 +59,17 @@ typedef NS_ENUM(NSInteger, NMSSHKnownHostStatus) {
  NMSSH classes are not thread safe, you should use them from the same thread
  where you created the NMSSHSession instance.
 
+ The asynchronous methods (see NMSSHOperation) can be called from any thread,
+ they are serialized on the session's own queue.
+
  If you want to use multiple NMSSHSession instances at once you should implement
  the [crypto mutex callbacks](http://trac.libssh2.org/wiki/MultiThreading).
+
+ ## Socket options
+
+ The socket options (`tcpNoDelay`, buffer sizes, keepalive) are applied before
+ the socket connects, changing them has no effect on an established connection.
+ Options left at their default value keep the system default.
  */
 @interface NMSSHSession : NSObject
 
@@ -147,10 +176,17 @@ typedef NS_ENUM(NSInteger, NMSSHKnownHostStatus) {
 /** Username that will authenticate against the server. */
 @property (nonatomic, nonnull, readonly) NSString *username;
 
-/** Timeout for libssh2 blocking functions. */
+/**
+ Timeout for libssh2 blocking functions. It also bounds each authentication
+ request; a request that times out disconnects the session.
+ */
 @property (nonatomic, nonnull, strong) NSNumber *timeout;
 
-/** Last session error. */
+/**
+ Last session error. After a connection or authentication request gave up and
+ disconnected the session, a `NMSSHOperationTimeoutError` or a
+ `NMSSHOperationCancelledError` until the next connection.
+ */
 @property (nonatomic, nullable, readonly) NSError *lastError;
 
 /** The hash algorithm to use to encode the fingerprint during connection, default value is NMSSHSessionHashMD5. */
@@ -162,6 +198,112 @@ typedef NS_ENUM(NSInteger, NMSSHKnownHostStatus) {
 /** The remote host banner. */
 @property (nonatomic, nullable, readonly) NSString *remoteBanner;
 
+/// ----------------------------------------------------------------------------
+/// @name Socket options
+/// ----------------------------------------------------------------------------
+
+/** Disable Nagle's algorithm (`TCP_NODELAY`) to lower the latency of interactive shells, default NO. */
+@property (nonatomic, assign) BOOL tcpNoDelay;
+
+/**
+ Size of the socket send buffer in bytes (`SO_SNDBUF`), nil for the system
+ default. Links with a high bandwidth-delay product need at least
+ bandwidth * round trip time to be saturated.
+ */
+@property (nonatomic, nullable, strong) NSNumber *socketSendBufferSize;
+
+/** Size of the socket receive buffer in bytes (`SO_RCVBUF`), nil for the system default. */
+@property (nonatomic, nullable, strong) NSNumber *socketReceiveBufferSize;
+
+/** Enable TCP keepalive probes (`SO_KEEPALIVE`), default NO. */
+@property (nonatomic, assign) BOOL tcpKeepAlive;
+
+/** Idle time (in seconds) before the first TCP keepalive probe is sent, nil for the system default. */
+@property (nonatomic, nullable, strong) NSNumber *tcpKeepAliveIdle;
+
+/**
+ Interval (in seconds) between TCP keepalive probes, nil for the system default.
+ Maps to `TCP_KEEPINTVL`; where it is not available the system default is used
+ and a warning is logged.
+ */
+@property (nonatomic, nullable, strong) NSNumber *tcpKeepAliveInterval;
+
+/**
+ Time (in seconds) transmitted data may remain unacknowledged before the
+ connection is dropped, nil for the system default. Maps to `TCP_USER_TIMEOUT`
+ where available and to `TCP_RXT_CONNDROPTIME` on Darwin.
+ */
+@property (nonatomic, nullable, strong) NSNumber *tcpUserTimeout;
+
+/// ----------------------------------------------------------------------------
+/// @name Jump host
+/// ----------------------------------------------------------------------------
+
+/**
+ An authenticated session the connection is tunneled through, like OpenSSH's
+ `ProxyJump`, nil to connect directly. Must be set before connecting.
+
+ The jump session opens a `direct-tcpip` channel to `host` and `port`, names
+ are resolved by the jump host. The channel is relayed to this session
+ through a local socket pair, so both the synchronous and asynchronous APIs
+ work on this session. Jump sessions can be chained for any number of hops.
+
+    NMSSHSession *bastion = ...; // connected and authenticated
+    NMSSHSession *session = [[NMSSHSession alloc] initWithHost:@"10.0.0.12" port:22 andUsername:@"user"];
+    [session setJumpSession:bastion];
+    [session connect];
+
+ A jump session can carry any number of sessions at once. It is driven by its
+ asynchronous engine, so its synchronous API must not be used while it
+ carries sessions. The socket options don't apply to the socket pair.
+ */
+@property (nonatomic, nullable, strong) NMSSHSession *jumpSession;
+
+/// ----------------------------------------------------------------------------
+/// @name Algorithm preferences
+/// ----------------------------------------------------------------------------
+
+/**
+ Key exchange methods in order of preference, nil for the libssh2 defaults.
+ Like the other algorithm preferences it must be set before connecting, and
+ methods unknown to libssh2 are ignored.
+ */
+@property (nonatomic, nullable, copy) NSArray<NSString *> *preferredKeyExchangeMethods;
+
+/** Host key methods in order of preference, nil for the libssh2 defaults. */
+@property (nonatomic, nullable, copy) NSArray<NSString *> *preferredHostKeyMethods;
+
+/** Ciphers in order of preference for both directions, nil for the libssh2 defaults. */
+@property (nonatomic, nullable, copy) NSArray<NSString *> *preferredCiphers;
+
+/** MAC algorithms in order of preference for both directions, nil for the libssh2 defaults. */
+@property (nonatomic, nullable, copy) NSArray<NSString *> *preferredMACs;
+
+/**
+ Whether to offer zlib compression, default NO. Compression only pays off on
+ slow links, it costs CPU time and throughput on fast ones.
+ */
+@property (nonatomic, assign) BOOL compressionEnabled;
+
+/**
+ Replace the algorithm preferences with a preset.
+
+ libssh2 uses OpenSSL's AES implementation, which takes advantage of AES-NI
+ where the CPU supports it.
+
+ @param preset The preset to apply
+ */
+- (void)applyAlgorithmPreset:(NMSSHAlgorithmPreset)preset;
+
+/**
+ Get the algorithm negotiated with the server for a method.
+ The session must be connected to an host.
+
+ @param method The method to look up
+ @returns The name of the negotiated algorithm
+ */
+- (nullable NSString *)negotiatedMethod:(NMSSHSessionMethod)method;
+
 /// ----------------------------------------------------------------------------
 /// @name Raw libssh2 session and socket reference
 /// ----------------------------------------------------------------------------
@@ -192,6 +334,9 @@ typedef NS_ENUM(NSInteger, NMSSHKnownHostStatus) {
 /**
  Connect to the server.
 
+ The timeout covers both the TCP connection and the SSH handshake. The
+ connection can be aborted from another thread with cancelPendingOperations.
+
  @param timeout The time, in seconds, to wait before giving up.
  @returns Connection status
  */
@@ -202,6 +347,60 @@ typedef NS_ENUM(NSInteger, NMSSHKnownHostStatus) {
  */
 - (void)disconnect;
 
+/**
+ Interrupt the blocking operation currently waiting on the session socket.
+
+ The interrupted operation gives up and reports a cancellation error: channel
+ calls fail with `NMSSHChannelCancelledError`, while connection and
+ authentication requests return NO, disconnect the session and leave a
+ `NMSSHOperationCancelledError` in `lastError`. This method can be called
+ from any thread.
+ */
+- (void)cancelPendingOperations;
+
+/// ----------------------------------------------------------------------------
+/// @name Connection timings
+/// ----------------------------------------------------------------------------
+
+/** Time (in seconds) taken to establish the TCP connection. */
+@property (nonatomic, readonly) NSTimeInterval tcpConnectTime;
+
+/** Time (in seconds) from the TCP connection until the server banner was received. */
+@property (nonatomic, readonly) NSTimeInterval bannerExchangeTime;
+
+/** Time (in seconds) from the server banner until the end of the key exchange. */
+@property (nonatomic, readonly) NSTimeInterval keyExchangeTime;
+
+/** Time (in seconds) spent in authentication requests since the session connected. */
+@property (nonatomic, readonly) NSTimeInterval authenticationTime;
+
+/// ----------------------------------------------------------------------------
+/// @name Keepalive
+/// ----------------------------------------------------------------------------
+
+/**
+ Time (in seconds) a connection may stay silent before the server is probed,
+ default 0 which disables keepalives.
+
+ Keepalives stop NAT and firewalls from dropping idle connections and detect
+ servers that went away: after `keepAliveCountMax` intervals without an
+ answer the session is disconnected and the delegate receives
+ `session:didDisconnectWithError:`.
+
+ One timer drives the keepalives of every session. The probes are sent on
+ the session queue like asynchronous operations. None is sent while a call
+ of the synchronous API is in progress, a call started during a probe waits
+ for its answer. An idle SFTP session opened with `-[NMSFTP connect]` is
+ kept alive like any other between its calls.
+ */
+@property (nonatomic, assign) NSUInteger keepAliveInterval;
+
+/** Number of keepalive intervals without an answer before the server is considered gone, default 3 */
+@property (nonatomic, assign) NSUInteger keepAliveCountMax;
+
+/** Smoothed round-trip time (in seconds) measured from keepalive answers, 0 until the first answer */
+@property (atomic, readonly) NSTimeInterval roundTripTime;
+
 /// ----------------------------------------------------------------------------
 /// @name Authentication
 /// ----------------------------------------------------------------------------
@@ -275,9 +474,28 @@ typedef NS_ENUM(NSInteger, NMSSHKnownHostStatus) {
  */
 - (BOOL)connectToAgent;
 
+/**
+ Cache for key files and the agent identity each host accepted, default is
+ the shared cache. Set to nil to always read keys from disk.
+ */
+@property (nonatomic, nullable, strong) NMSSHCredentialCache *credentialCache;
+
+/**
+ Authenticate with the first accepted method among the credentials.
+
+ Methods are tried in order: agent, public key, keyboard-interactive,
+ password. Methods the server does not offer are skipped.
+
+ @param credentials The secrets to authenticate with
+ @returns Authentication success
+ */
+- (BOOL)authenticateWithCredentials:(nonnull NMSSHCredentials *)credentials;
+
 /**
  Get supported authentication methods
 
+ The list is requested once per connection and cached.
+
  @returns Array of string descripting supported authentication methods
  */
 - (nullable NSArray<NSString *> *)supportedAuthenticationMethods;
@@ -299,7 +517,8 @@ typedef NS_ENUM(NSInteger, NMSSHKnownHostStatus) {
  Checks if the hosts's key is recognized.
 
  The session must be connected. Each file is checked in order,
- returning as soon as the host is found.
+ returning as soon as the host is found. Files are parsed once and kept in
+ memory, see NMSSHKnownHostsStore.
 
  @warning In a sandboxed Mac app or iOS app, _files_ must not be `nil` as the default files are not accessible.
 
@@ -314,6 +533,7 @@ typedef NS_ENUM(NSInteger, NMSSHKnownHostStatus) {
  _hostName_ may be a numerical IP address or a full name. If it includes
  a port number, it should be formatted as `@"[{host}]:{port}"` (e.g., `@"[example.com]:2222"`).
  If _salt_ is set, then _hostName_ must contain a hostname salted and hashed with SHA1 and then base64-encoded.
+ The host is appended to the file.
 
  A simple example:
 
@@ -335,6 +555,149 @@ typedef NS_ENUM(NSInteger, NMSSHKnownHostStatus) {
                   toFile:(nullable NSString *)fileName
                 withSalt:(nullable NSString *)salt;
 
+/// ----------------------------------------------------------------------------
+/// @name Asynchronous operations
+/// ----------------------------------------------------------------------------
+
+/**
+ The queue on which the completion blocks of asynchronous operations are
+ called, default value is the main queue.
+ */
+#if OS_OBJECT_USE_OBJC
+@property (nonatomic, nonnull, strong) dispatch_queue_t callbackQueue;
+#else
+@property (nonatomic, nonnull, assign) dispatch_queue_t callbackQueue;
+#endif
+
+/**
+ Connect to the server without blocking the calling thread.
+
+ @param timeout The time, in seconds, to wait before giving up.
+ @param completion The block called once the connection succeeded or failed.
+ @returns The operation handle
+ */
+- (nonnull NMSSHOperation *)connectWithTimeout:(nonnull NSNumber *)timeout
+                                    completion:(void (^_Nullable)(BOOL success, NSError *_Nullable error))completion;
+
+/**
+ Authenticate by password without blocking the calling thread.
+
+ @param password Password for connected user
+ @param completion The block called with the authentication result.
+ @returns The operation handle
+ */
+- (nonnull NMSSHOperation *)authenticateByPassword:(nonnull NSString *)password
+                                        completion:(void (^_Nullable)(BOOL success, NSError *_Nullable error))completion;
+
+/**
+ Authenticate by private key pair from file(s) without blocking the calling
+ thread.
+
+ @param publicKey Filepath to public key
+ @param privateKey Filepath to private key
+ @param password Password for encrypted private key
+ @param completion The block called with the authentication result.
+ @returns The operation handle
+ */
+- (nonnull NMSSHOperation *)authenticateByPublicKey:(nullable NSString *)publicKey
+                                         privateKey:(nonnull NSString *)privateKey
+                                           password:(nullable NSString *)password
+                                         completion:(void (^_Nullable)(BOOL success, NSError *_Nullable error))completion;
+
+/**
+ Authenticate by private key pair without blocking the calling thread.
+
+ @param publicKey public key
+ @param privateKey private key
+ @param password Password for encrypted private key
+ @param completion The block called with the authentication result.
+ @returns The operation handle
+ */
+- (nonnull NMSSHOperation *)authenticateByInMemoryPublicKey:(nullable NSString *)publicKey
+                                                 privateKey:(nonnull NSString *)privateKey
+                                                   password:(nullable NSString *)password
+                                                 completion:(void (^_Nullable)(BOOL success, NSError *_Nullable error))completion;
+
+/**
+ Authenticate by keyboard-interactive without blocking the calling thread.
+
+ The authentication block, or the delegate when it is `nil`, is called on the
+ session queue.
+
+ @param authenticationBlock The block to apply to server requests.
+ @param completion The block called with the authentication result.
+ @returns The operation handle
+ */
+- (nonnull NMSSHOperation *)authenticateByKeyboardInteractiveUsingBlock:(NSString * _Nonnull(^_Nullable)( NSString * _Nonnull request))authenticationBlock
+                                                             completion:(void (^_Nullable)(BOOL success, NSError *_Nullable error))completion;
+
+/**
+ Authenticate with the identities of the SSH agent without blocking the
+ calling thread.
+
+ @param completion The block called with the authentication result.
+ @returns The operation handle
+ */
+- (nonnull NMSSHOperation *)connectToAgentWithCompletion:(void (^_Nullable)(BOOL success, NSError *_Nullable error))completion;
+
+/**
+ Authenticate with the first accepted method among the credentials without
+ blocking the calling thread.
+
+ Methods are tried in order: agent, public key, keyboard-interactive,
+ password. Methods the server does not offer are skipped.
+
+ @param credentials The secrets to authenticate with
+ @param completion The block called with the authentication result.
+ @returns The operation handle
+ */
+- (nonnull NMSSHOperation *)authenticateWithCredentials:(nonnull NMSSHCredentials *)credentials
+                                             completion:(void (^_Nullable)(BOOL success, NSError *_Nullable error))completion;
+
+/**
+ Get supported authentication methods without blocking the calling thread.
+
+ @param completion The block called with the supported methods, `nil` on error.
+ @returns The operation handle
+ */
+- (nonnull NMSSHOperation *)supportedAuthenticationMethodsWithCompletion:(void (^_Nonnull)(NSArray<NSString *> *_Nullable methods, NSError *_Nullable error))completion;
+
+/// ----------------------------------------------------------------------------
+/// @name Port forwarding
+/// ----------------------------------------------------------------------------
+
+/**
+ Forward the connections accepted on a local port to a host reachable from
+ the server, like `ssh -L`.
+
+ The session must be authenticated. Connections are relayed by the
+ asynchronous engine, see NMSSHTunnel.
+
+ @param localPort Port to listen on at 127.0.0.1, 0 for any free port
+ @param host Host the server connects to
+ @param port Port the server connects to
+ @returns The open tunnel, nil if the local port could not be bound
+ */
+- (nullable NMSSHTunnel *)forwardLocalPort:(NSUInteger)localPort toHost:(nonnull NSString *)host port:(NSUInteger)port;
+
+/**
+ Ask the server to listen on a port and forward the connections it accepts
+ to a local endpoint, like `ssh -R`.
+
+ The session must be authenticated. The listen request and the forwarded
+ channels are handled by the asynchronous engine, see NMSSHTunnel.
+
+ @param remotePort Port the server listens on, 0 to let the server pick one
+ @param host Host the forwarded connections are made to
+ @param port Port the forwarded connections are made to
+ @param completion The block called once the server listens or refused to
+ @returns The tunnel, nil if host could not be resolved
+ */
+- (nullable NMSSHTunnel *)forwardRemotePort:(NSUInteger)remotePort
+                                     toHost:(nonnull NSString *)host
+                                       port:(NSUInteger)port
+                                 completion:(void (^_Nullable)(BOOL success, NSError *_Nullable error))completion;
+
 /// ----------------------------------------------------------------------------
 /// @name Quick channel/sftp access
 /// ----------------------------------------------------------------------------
@@ -2,8 +2,35 @@
 #import "NMSSH+Protected.h"
 #import "NMSSHConfig.h"
 #import "NMSSHHostConfig.h"
+#import "NMSSHOperation.h"
+#import "NMSSHKeepAliveScheduler.h"
+#import "NMSSHSocketRelay.h"
+#import "NMSSHBufferPool.h"
+#import "NMSSHTunnel.h"
+
+/** Identifies the session queue, see isOnSessionQueue */
+static void *kNMSSHSessionQueueKey = &kNMSSHSessionQueueKey;
+
+/** Passes over the pending operations before yielding the session queue */
+static const NSUInteger kNMSSHMaxPumpPasses = 64;
+
+/** Channel type of the keepalive probes, servers refuse unknown types */
+static const char kNMSSHKeepAliveChannelType[] = "keepalive@nmssh";
+
+/** Returned by performSessionCall when cancelPendingOperations interrupted the request, outside the libssh2 error codes */
+static const int kNMSSHSessionCallCancelled = -1000;
+
+/** A non-blocking authentication request, returns a libssh2 error code */
+typedef int (^NMSSHAuthenticationAttempt)(NMSSHSession *session);
+
+@interface NMSSHSession () {
+    int _wakeupPipe[2];
+
+    // Synchronous calls in progress and whether a keepalive probe is in flight
+    atomic_int _synchronousCalls;
+    atomic_bool _keepAliveProbing;
+}
 
-@interface NMSSHSession ()
 @property (nonatomic, assign) LIBSSH2_AGENT *agent;
 
 @property (nonatomic, assign, getter = rawSession) LIBSSH2_SESSION *session;
@@ -12,12 +39,52 @@
 @property (nonatomic, strong) NSString *username;
 
 @property (nonatomic, copy) NSString *(^kbAuthenticationBlock)(NSString *);
+@property (nonatomic, strong) NSArray *cachedAuthenticationMethods;
+@property (nonatomic, strong) NSError *abandonedCallError;
 
 @property (nonatomic, strong) NMSSHChannel *channel;
 @property (nonatomic, strong) NMSFTP *sftp;
 @property (nonatomic, strong) NSNumber *port;
 @property (nonatomic, strong) NMSSHHostConfig *hostConfig;
 @property (nonatomic, assign) LIBSSH2_SESSION *sessionToFree;
+
+@property (nonatomic, assign) NSTimeInterval tcpConnectTime;
+@property (nonatomic, assign) NSTimeInterval bannerExchangeTime;
+@property (nonatomic, assign) NSTimeInterval keyExchangeTime;
+@property (nonatomic, assign) NSTimeInterval authenticationTime;
+
+@property (nonatomic, strong) NSArray *connectAddresses;
+@property (nonatomic, assign) NSUInteger connectAddressIndex;
+@property (nonatomic, strong) NSString *connectingAddress;
+@property (nonatomic, assign) BOOL socketConnecting;
+@property (nonatomic, assign) CFAbsoluteTime connectStartTime;
+@property (nonatomic, strong) NMSSHSocketRelay *jumpRelay;
+
+@property (atomic, assign) CFAbsoluteTime lastReceiveTime;
+@property (atomic, assign) uint64_t receiveCount;
+@property (atomic, assign) CFAbsoluteTime nextKeepAliveTime;
+@property (nonatomic, assign) CFAbsoluteTime lastKeepAliveReplyTime;
+@property (nonatomic, assign) NSUInteger missedKeepAlives;
+@property (nonatomic, weak) NMSSHOperation *keepAliveOperation;
+@property (atomic, assign) NSTimeInterval roundTripTime;
+
+@property (nonatomic, strong) NSMutableArray *operations;
+@property (nonatomic, strong) NMSSHBufferPool *bufferPool;
+@property (nonatomic, weak) NMSSHOperation *requestLockOwner;
+@property (nonatomic, assign) BOOL readSourceActive;
+@property (nonatomic, assign) BOOL writeSourceActive;
+
+#if OS_OBJECT_USE_OBJC
+@property (nonatomic, strong) dispatch_queue_t sessionQueue;
+@property (nonatomic, strong) dispatch_source_t readSource;
+@property (nonatomic, strong) dispatch_source_t writeSource;
+@property (nonatomic, strong) dispatch_group_t keepAliveGroup;
+#else
+@property (nonatomic, assign) dispatch_queue_t sessionQueue;
+@property (nonatomic, assign) dispatch_source_t readSource;
+@property (nonatomic, assign) dispatch_source_t writeSource;
+@property (nonatomic, assign) dispatch_group_t keepAliveGroup;
+#endif
 @end
 
 @implementation NMSSHSession
@@ -50,6 +117,20 @@
         [self setUsername:username];
         [self setConnected:NO];
         [self setFingerprintHash:NMSSHSessionHashMD5];
+        [self setKeepAliveCountMax:3];
+
+        _wakeupPipe[0] = -1;
+        _wakeupPipe[1] = -1;
+        atomic_init(&_synchronousCalls, 0);
+        atomic_init(&_keepAliveProbing, false);
+
+        [self setOperations:[[NSMutableArray alloc] init]];
+        [self setBufferPool:[[NMSSHBufferPool alloc] initWithBufferSize:kNMSSHBufferSize capacity:64]];
+        [self setSessionQueue:dispatch_queue_create("NMSSH.sessionQueue", DISPATCH_QUEUE_SERIAL)];
+        dispatch_queue_set_specific(self.sessionQueue, kNMSSHSessionQueueKey, (__bridge void *)self, NULL);
+        [self setKeepAliveGroup:dispatch_group_create()];
+        [self setCallbackQueue:dispatch_get_main_queue()];
+        [self setCredentialCache:[NMSSHCredentialCache sharedCache]];
     }
 
     return self;
@@ -81,6 +162,11 @@
                   andUsername:hostConfig.user];
     if (self) {
         [self setHostConfig:hostConfig];
+        [self setPreferredKeyExchangeMethods:hostConfig.kexAlgorithms];
+        [self setPreferredHostKeyMethods:hostConfig.hostKeyAlgorithms];
+        [self setPreferredCiphers:hostConfig.ciphers];
+        [self setPreferredMACs:hostConfig.macs];
+        [self setCompressionEnabled:[hostConfig.compression boolValue]];
     }
 
     return self;
@@ -104,9 +190,21 @@
 }
 
 - (void)dealloc {
+    [self destroySocketSources];
+
+#if !(OS_OBJECT_USE_OBJC)
+    dispatch_release(_sessionQueue);
+    dispatch_release(_keepAliveGroup);
+#endif
+
     if (self.sessionToFree) {
         libssh2_session_free(self.sessionToFree);
     }
+
+    if (_wakeupPipe[0] >= 0) {
+        close(_wakeupPipe[0]);
+        close(_wakeupPipe[1]);
+    }
 }
 
 // -----------------------------------------------------------------------------
@@ -164,6 +262,11 @@
 }
 
 - (NSError *)lastError {
+    // A request abandoned on timeout or cancellation disconnected the session
+    if (!self.rawSession && self.abandonedCallError) {
+        return self.abandonedCallError;
+    }
+
     if(!self.rawSession) {
         return [NSError errorWithDomain:@"libssh2" code:LIBSSH2_ERROR_NONE userInfo:@{NSLocalizedDescriptionKey : @"Error retrieving last session error due to absence of an active session."}];
     }
@@ -186,6 +289,72 @@
     return [[NSString alloc] initWithCString:banner encoding:NSUTF8StringEncoding];
 }
 
+// -----------------------------------------------------------------------------
+#pragma mark - ALGORITHM PREFERENCES
+// -----------------------------------------------------------------------------
+
+- (void)applyAlgorithmPreset:(NMSSHAlgorithmPreset)preset {
+    [self setPreferredKeyExchangeMethods:nil];
+    [self setPreferredHostKeyMethods:nil];
+    [self setPreferredCiphers:nil];
+    [self setPreferredMACs:nil];
+    [self setCompressionEnabled:NO];
+
+    switch (preset) {
+        case NMSSHAlgorithmPresetMaxThroughput:
+            // CTR mode can be computed in parallel, libssh2 1.6 has no GCM ciphers
+            [self setPreferredCiphers:@[@"aes128-ctr", @"aes192-ctr", @"aes256-ctr", @"aes128-cbc", @"aes256-cbc"]];
+            [self setPreferredMACs:@[@"hmac-sha1", @"hmac-sha2-256", @"hmac-sha2-512"]];
+            break;
+
+        case NMSSHAlgorithmPresetSlowLink:
+            [self setCompressionEnabled:YES];
+            break;
+
+        case NMSSHAlgorithmPresetDefault:
+            break;
+    }
+}
+
+- (NSString *)negotiatedMethod:(NMSSHSessionMethod)method {
+    if (!self.session) {
+        return nil;
+    }
+
+    const char *name = libssh2_session_methods(self.session, (int)method);
+    if (!name) {
+        return nil;
+    }
+
+    return [NSString stringWithUTF8String:name];
+}
+
+/** Pass the algorithm preferences to the libssh2 session, before the handshake. */
+- (void)applyAlgorithmPreferences {
+    NSDictionary *preferences = @{ @(LIBSSH2_METHOD_KEX)      : self.preferredKeyExchangeMethods ?: @[],
+                                   @(LIBSSH2_METHOD_HOSTKEY)  : self.preferredHostKeyMethods ?: @[],
+                                   @(LIBSSH2_METHOD_CRYPT_CS) : self.preferredCiphers ?: @[],
+                                   @(LIBSSH2_METHOD_CRYPT_SC) : self.preferredCiphers ?: @[],
+                                   @(LIBSSH2_METHOD_MAC_CS)   : self.preferredMACs ?: @[],
+                                   @(LIBSSH2_METHOD_MAC_SC)   : self.preferredMACs ?: @[] };
+
+    for (NSNumber *method in preferences) {
+        NSArray *methods = preferences[method];
+        if ([methods count] == 0) {
+            continue;
+        }
+
+        NSString *list = [methods componentsJoinedByString:@","];
+        if (libssh2_session_method_pref(self.session, [method intValue], [list UTF8String])) {
+            NMSSHLogWarn(@"None of the methods %@ is supported", list);
+        }
+    }
+
+    if (self.compressionEnabled && libssh2_session_flag(self.session, LIBSSH2_FLAG_COMPRESS, 1)) {
+        NMSSHLogWarn(@"Failure enabling compression");
+    }
+}
+
 // -----------------------------------------------------------------------------
 #pragma mark - OPEN/CLOSE A CONNECTION TO THE SERVER
 // -----------------------------------------------------------------------------
@@ -199,6 +368,107 @@
         [self disconnect];
     }
 
+    // A single deadline covers the TCP connection and the SSH handshake
+    CFAbsoluteTime deadline = [self deadlineForTimeout:timeout];
+
+    if (![self prepareConnection] || ![self openSocketUntil:deadline] || ![self createSession]) {
+        return NO;
+    }
+
+    // Start the session
+    int rc = [self performSessionCall:^int{
+        int rc = libssh2_session_handshake(self.session, CFSocketGetNative(_socket));
+        [self recordHandshakeProgress:rc];
+        return rc;
+    } deadline:deadline];
+
+    if (rc) {
+        NMSSHLogError(@"Failure establishing SSH session");
+        [self disconnect];
+
+        return NO;
+    }
+
+    return [self finishConnection];
+}
+
+- (NMSSHOperation *)connectWithTimeout:(NSNumber *)timeout completion:(void (^)(BOOL, NSError *))completion {
+    __block BOOL started = NO;
+
+    NMSSHOperation *operation = [NMSSHOperation operationWithSession:self step:^NMSSHOperationStatus(NMSSHOperation *operation) {
+        NMSSHSession *session = operation.session;
+        NSError *error = operation.abortError;
+
+        if (!error && !started) {
+            started = YES;
+
+            if (session.isConnected) {
+                [session disconnect];
+            }
+
+            if (![session prepareConnection] || ![session startSocketConnection]) {
+                error = [NMSSHOperation errorWithCode:NMSSHOperationFailedError
+                                          description:@"Failure establishing socket connection"];
+            }
+        }
+
+        // The libssh2 session only exists once the socket is connected
+        if (!error && session.socketConnecting) {
+            int rc = [session checkSocketConnection];
+
+            if (rc == 0) {
+                return NMSSHOperationStatusBlocked;
+            }
+
+            if (rc < 0 || ![session createSession]) {
+                error = [NMSSHOperation errorWithCode:NMSSHOperationFailedError
+                                          description:@"Failure establishing socket connection"];
+            }
+        }
+
+        if (!error && !session.rawSession) {
+            error = [NMSSHOperation errorWithCode:NMSSHOperationDisconnectedError description:@"Session disconnected"];
+        }
+
+        if (!error) {
+            int rc = libssh2_session_handshake(session.rawSession, CFSocketGetNative(session.socket));
+            [session recordHandshakeProgress:rc];
+
+            if (rc == LIBSSH2_ERROR_EAGAIN) {
+                return NMSSHOperationStatusBlocked;
+            }
+
+            if (rc) {
+                NMSSHLogError(@"Failure establishing SSH session");
+                error = [session lastError];
+            }
+            else if (![session finishConnection]) {
+                error = [NMSSHOperation errorWithCode:NMSSHOperationFailedError description:@"Fingerprint refused"];
+            }
+        }
+
+        if (error) {
+            [session disconnect];
+        }
+
+        if (completion) {
+            BOOL connected = session.isConnected;
+            [session dispatchCallback:^{
+                completion(connected, error);
+            }];
+        }
+
+        return NMSSHOperationStatusDone;
+    }];
+
+    [operation setRequiresSession:NO];
+    [operation setTimeout:timeout];
+    [self startOperation:operation];
+
+    return operation;
+}
+
+- (BOOL)prepareConnection {
     __block BOOL initialized = YES;
     static dispatch_once_t onceToken;
     dispatch_once(&onceToken, ^{
@@ -214,159 +484,922 @@
     if (!initialized) {
         return NO;
     }
-    // Try to establish a connection to the server
-    NSUInteger index = -1;
+
+    // Create the pipe used to interrupt blocking waits on the socket
+    if (_wakeupPipe[0] < 0) {
+        if (pipe(_wakeupPipe) != 0) {
+            NMSSHLogError(@"Error creating the wakeup pipe");
+            _wakeupPipe[0] = -1;
+            _wakeupPipe[1] = -1;
+
+            return NO;
+        }
+
+        fcntl(_wakeupPipe[0], F_SETFL, fcntl(_wakeupPipe[0], F_GETFL) | O_NONBLOCK);
+        fcntl(_wakeupPipe[1], F_SETFL, fcntl(_wakeupPipe[1], F_GETFL) | O_NONBLOCK);
+    }
+    [self resetCancellation];
+
+    return YES;
+}
+
+- (BOOL)openSocketUntil:(CFAbsoluteTime)deadline {
+    if (![self startSocketConnection]) {
+        [self disconnect];
+        return NO;
+    }
+
+    int rc;
+    while ((rc = [self checkSocketConnection]) == 0) {
+        int ready = [self waitSocketUntil:deadline];
+        if (ready < 0 || (ready == 0 && deadline > 0 && CFAbsoluteTimeGetCurrent() >= deadline)) {
+            NMSSHLogError(@"Socket connection to %@ timed out or was cancelled", self.connectingAddress);
+            rc = -1;
+            break;
+        }
+    }
+
+    if (rc < 0) {
+        [self disconnect];
+        return NO;
+    }
+
+    return YES;
+}
+
+- (BOOL)startSocketConnection {
+    [self setConnectStartTime:CFAbsoluteTimeGetCurrent()];
+    [self setTcpConnectTime:0];
+    [self setBannerExchangeTime:0];
+    [self setKeyExchangeTime:0];
+    [self setAuthenticationTime:0];
+
+    if (self.jumpSession) {
+        return [self connectSocketThroughJumpSession];
+    }
+
+    // Name resolution still blocks
+    [self setConnectAddresses:[self hostIPAddresses]];
+    [self setConnectAddressIndex:0];
+
+    return [self connectSocketToNextAddress];
+}
+
+/**
+ Start a non-blocking connection to the next resolved address.
+
+ @returns NO when no address is left to try
+ */
+- (BOOL)connectSocketToNextAddress {
     NSInteger port = [self.port integerValue];
-    NSArray *addresses = [self hostIPAddresses];
-    CFSocketError error = 1;
-    CFDataRef address = NULL;
-    SInt32 addressFamily;
 
-    while (addresses && ++index < [addresses count] && error) {
-        NSData *addressData = addresses[index];
-        NSString *ipAddress;
+    while (self.connectAddressIndex < [self.connectAddresses count]) {
+        NSData *addressData = self.connectAddresses[self.connectAddressIndex];
+        [self setConnectAddressIndex:self.connectAddressIndex + 1];
+
+        struct sockaddr_storage address;
+        memset(&address, 0, sizeof(address));
+        socklen_t addressLength = (socklen_t)[addressData length];
+        char str[INET6_ADDRSTRLEN];
 
         // IPv4
-        if ([addressData length] == sizeof(struct sockaddr_in)) {
-            struct sockaddr_in address4;
-            [addressData getBytes:&address4 length:sizeof(address4)];
-            address4.sin_port = htons(port);
-
-            char str[INET_ADDRSTRLEN];
-            inet_ntop(AF_INET, &(address4.sin_addr), str, INET_ADDRSTRLEN);
-            ipAddress = [NSString stringWithCString:str encoding:NSUTF8StringEncoding];
-            addressFamily = AF_INET;
-            address = CFDataCreate(kCFAllocatorDefault, (UInt8 *)&address4, sizeof(address4));
+        if (addressLength == sizeof(struct sockaddr_in)) {
+            struct sockaddr_in *address4 = (struct sockaddr_in *)&address;
+            [addressData getBytes:address4 length:sizeof(*address4)];
+            address4->sin_port = htons(port);
+            inet_ntop(AF_INET, &(address4->sin_addr), str, sizeof(str));
         } // IPv6
-        else if([addressData length] == sizeof(struct sockaddr_in6)) {
-            struct sockaddr_in6 address6;
-            [addressData getBytes:&address6 length:sizeof(address6)];
-            address6.sin6_port = htons(port);
-
-            char str[INET6_ADDRSTRLEN];
-            inet_ntop(AF_INET6, &(address6.sin6_addr), str, INET6_ADDRSTRLEN);
-            ipAddress = [NSString stringWithCString:str encoding:NSUTF8StringEncoding];
-            addressFamily = AF_INET6;
-            address = CFDataCreate(kCFAllocatorDefault, (UInt8 *)&address6, sizeof(address6));
+        else if (addressLength == sizeof(struct sockaddr_in6)) {
+            struct sockaddr_in6 *address6 = (struct sockaddr_in6 *)&address;
+            [addressData getBytes:address6 length:sizeof(*address6)];
+            address6->sin6_port = htons(port);
+            inet_ntop(AF_INET6, &(address6->sin6_addr), str, sizeof(str));
         }
         else {
             NMSSHLogVerbose(@"Unknown address, it's not IPv4 or IPv6!");
             continue;
         }
-        
+
+        [self setConnectingAddress:[NSString stringWithCString:str encoding:NSUTF8StringEncoding]];
+
         // Try to create the socket
-        _socket = CFSocketCreate(kCFAllocatorDefault, addressFamily, SOCK_STREAM, IPPROTO_IP, kCFSocketNoCallBack, NULL, NULL);
+        _socket = CFSocketCreate(kCFAllocatorDefault, address.ss_family, SOCK_STREAM, IPPROTO_IP, kCFSocketNoCallBack, NULL, NULL);
         if (!_socket) {
             NMSSHLogError(@"Error creating the socket");
-            CFRelease(address);
             return NO;
         }
-        
+
+        int sock = CFSocketGetNative(_socket);
+
         // Set NOSIGPIPE
         int set = 1;
-        if (setsockopt(CFSocketGetNative(_socket), SOL_SOCKET, SO_NOSIGPIPE, (void *)&set, sizeof(set)) != 0) {
+        if (setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, (void *)&set, sizeof(set)) != 0) {
             NMSSHLogError(@"Error setting socket option");
-            CFRelease(address);
-            [self disconnect];
+            [self closeSocket];
             return NO;
         }
-        
-        error = CFSocketConnectToAddress(_socket, address, [timeout doubleValue]);
-        CFRelease(address);
 
-        if (error) {
-            NMSSHLogVerbose(@"Socket connection to %@ on port %ld failed with reason %li, trying next address...", ipAddress, (long)port, error);
-        }
-        else {
-            NMSSHLogInfo(@"Socket connection to %@ on port %ld succesful", ipAddress, (long)port);
+        [self applySocketOptions:sock];
+
+        // libssh2 switches the socket to non-blocking mode anyway
+        fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+
+        if (connect(sock, (struct sockaddr *)&address, addressLength) == 0 || errno == EINPROGRESS) {
+            NMSSHLogVerbose(@"Connecting to %@ on port %ld", self.connectingAddress, (long)port);
+            [self setSocketConnecting:YES];
+            return YES;
         }
+
+        NMSSHLogVerbose(@"Socket connection to %@ on port %ld failed with reason %i, trying next address...",
+                        self.connectingAddress, (long)port, errno);
+        [self closeSocket];
     }
 
-    if (error) {
-        NMSSHLogError(@"Failure establishing socket connection");
-        [self disconnect];
+    NMSSHLogError(@"Failure establishing socket connection");
+
+    return NO;
+}
 
+/**
+ Connect a socket pair to a channel of the jump session. The socket is usable
+ right away, data written before the channel is open waits in the socket pair.
+ */
+- (BOOL)connectSocketThroughJumpSession {
+    NMSSHSession *jumpSession = self.jumpSession;
+    [self setConnectAddresses:nil];
+    [self setConnectingAddress:[NSString stringWithFormat:@"%@ via %@", self.host, jumpSession.host]];
+
+    if (!jumpSession.isAuthorized) {
+        NMSSHLogError(@"The jump session to %@ is not authenticated", jumpSession.host);
         return NO;
     }
 
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0) {
+        NMSSHLogError(@"Error creating the socket pair: %s", strerror(errno));
+        return NO;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        int set = 1;
+        setsockopt(sockets[i], SOL_SOCKET, SO_NOSIGPIPE, (void *)&set, sizeof(set));
+        fcntl(sockets[i], F_SETFL, fcntl(sockets[i], F_GETFL) | O_NONBLOCK);
+    }
+
+    _socket = CFSocketCreateWithNative(kCFAllocatorDefault, sockets[0], kCFSocketNoCallBack, NULL, NULL);
+    if (!_socket) {
+        NMSSHLogError(@"Error creating the socket");
+        close(sockets[0]);
+        close(sockets[1]);
+        return NO;
+    }
+
+    NMSSHSocketRelay *relay = [[NMSSHSocketRelay alloc] initWithSession:jumpSession
+                                                                 socket:sockets[1]
+                                                                   host:self.host
+                                                                   port:[self.port integerValue]];
+    [self setJumpRelay:relay];
+    [relay startWithCompletion:nil];
+
+    NMSSHLogVerbose(@"Connecting to %@ on port %@", self.connectingAddress, self.port);
+    [self setSocketConnecting:YES];
+
+    return YES;
+}
+
+- (int)checkSocketConnection {
+    int sock = CFSocketGetNative(_socket);
+    struct pollfd fds = { sock, POLLOUT, 0 };
+
+    if (poll(&fds, 1, 0) == 0) {
+        return 0;
+    }
+
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &length) != 0) {
+        error = errno;
+    }
+
+    if (error) {
+        NMSSHLogVerbose(@"Socket connection to %@ on port %@ failed with reason %i, trying next address...",
+                        self.connectingAddress, self.port, error);
+        [self closeSocket];
+
+        return [self connectSocketToNextAddress] ? 0 : -1;
+    }
+
+    [self setSocketConnecting:NO];
+    [self setTcpConnectTime:CFAbsoluteTimeGetCurrent() - self.connectStartTime];
+    NMSSHLogInfo(@"Socket connection to %@ on port %@ succesful", self.connectingAddress, self.port);
+
+    return 1;
+}
+
+- (void)closeSocket {
+    // Sources watching the descriptor must go before it is closed
+    [self destroySocketSources];
+    [self setSocketConnecting:NO];
+
+    if (_socket) {
+        CFSocketInvalidate(_socket);
+        CFRelease(_socket);
+        _socket = NULL;
+    }
+
+    // The channel of the jump session is not needed anymore
+    [self.jumpRelay close];
+    [self setJumpRelay:nil];
+}
+
+/**
+ Apply the configured socket options. The options only tune the connection,
+ failing to set one is not fatal.
+ */
+- (void)applySocketOptions:(int)sock {
+    int value;
+
+    if (self.tcpNoDelay) {
+        value = 1;
+        if (setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &value, sizeof(value)) != 0) {
+            NMSSHLogWarn(@"Error setting TCP_NODELAY: %s", strerror(errno));
+        }
+    }
+
+    // Buffer sizes must be set before connecting for the window scale to account for them
+    if (self.socketSendBufferSize) {
+        value = [self.socketSendBufferSize intValue];
+        if (setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &value, sizeof(value)) != 0) {
+            NMSSHLogWarn(@"Error setting SO_SNDBUF to %i: %s", value, strerror(errno));
+        }
+    }
+
+    if (self.socketReceiveBufferSize) {
+        value = [self.socketReceiveBufferSize intValue];
+        if (setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &value, sizeof(value)) != 0) {
+            NMSSHLogWarn(@"Error setting SO_RCVBUF to %i: %s", value, strerror(errno));
+        }
+    }
+
+    if (self.tcpKeepAlive) {
+        value = 1;
+        if (setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &value, sizeof(value)) != 0) {
+            NMSSHLogWarn(@"Error setting SO_KEEPALIVE: %s", strerror(errno));
+        }
+
+        if (self.tcpKeepAliveIdle) {
+            value = [self.tcpKeepAliveIdle intValue];
+#if defined(TCP_KEEPIDLE)
+            int option = TCP_KEEPIDLE;
+#else
+            int option = TCP_KEEPALIVE;
+#endif
+            if (setsockopt(sock, IPPROTO_TCP, option, &value, sizeof(value)) != 0) {
+                NMSSHLogWarn(@"Error setting the keepalive idle time: %s", strerror(errno));
+            }
+        }
+
+        if (self.tcpKeepAliveInterval) {
+#if defined(TCP_KEEPINTVL)
+            value = [self.tcpKeepAliveInterval intValue];
+            if (setsockopt(sock, IPPROTO_TCP, TCP_KEEPINTVL, &value, sizeof(value)) != 0) {
+                NMSSHLogWarn(@"Error setting TCP_KEEPINTVL: %s", strerror(errno));
+            }
+#else
+            NMSSHLogWarn(@"The keepalive interval is not supported on this platform, using the system default");
+#endif
+        }
+    }
+
+    if (self.tcpUserTimeout) {
+#if defined(TCP_USER_TIMEOUT)
+        value = (int)([self.tcpUserTimeout doubleValue] * 1000);
+        int option = TCP_USER_TIMEOUT;
+#elif defined(TCP_RXT_CONNDROPTIME)
+        value = [self.tcpUserTimeout intValue];
+        int option = TCP_RXT_CONNDROPTIME;
+#else
+        value = 0;
+        int option = -1;
+        NMSSHLogWarn(@"The user timeout is not supported on this platform");
+#endif
+        if (option >= 0 && setsockopt(sock, IPPROTO_TCP, option, &value, sizeof(value)) != 0) {
+            NMSSHLogWarn(@"Error setting the user timeout: %s", strerror(errno));
+        }
+    }
+}
+
+- (void)recordHandshakeProgress:(int)rc {
+    CFAbsoluteTime elapsed = CFAbsoluteTimeGetCurrent() - self.connectStartTime - self.tcpConnectTime;
+
+    // The banner is only visible once the call that received it returns
+    if (self.bannerExchangeTime == 0 && libssh2_session_banner_get(self.session)) {
+        [self setBannerExchangeTime:elapsed];
+    }
+
+    if (rc == 0) {
+        [self setKeyExchangeTime:elapsed - self.bannerExchangeTime];
+        NMSSHLogVerbose(@"Connected in %.3fs (TCP %.3fs, banner %.3fs, key exchange %.3fs)",
+                        elapsed + self.tcpConnectTime, self.tcpConnectTime, self.bannerExchangeTime, self.keyExchangeTime);
+    }
+}
+
+- (BOOL)createSession {
+    [self setAbandonedCallError:nil];
+
     // Create a session instance
     [self setSession:libssh2_session_init_ex(NULL, NULL, NULL, (__bridge void *)(self))];
 
     // Set a callback for disconnection
     libssh2_session_callback_set(self.session, LIBSSH2_CALLBACK_DISCONNECT, &disconnect_callback);
 
+    // Track incoming traffic, idle connections get keepalives
+    libssh2_session_callback_set(self.session, LIBSSH2_CALLBACK_RECV, &recv_callback);
+
     // Set blocking mode
     libssh2_session_set_blocking(self.session, 1);
 
+    [self applyAlgorithmPreferences];
+
     // Set the custom banner
     if (self.banner && libssh2_session_banner_set(self.session, [self.banner UTF8String])) {
         NMSSHLogError(@"Failure setting the banner");
     }
 
-    // Start the session
-    if (libssh2_session_handshake(self.session, CFSocketGetNative(_socket))) {
-        NMSSHLogError(@"Failure establishing SSH session");
+    return YES;
+}
+
+- (BOOL)finishConnection {
+    NMSSHLogVerbose(@"Remote host banner is %@", [self remoteBanner]);
+
+    // Get the fingerprint of the host
+    NSString *fingerprint = [self fingerprint:self.fingerprintHash];
+    NMSSHLogInfo(@"The host's fingerprint is %@", fingerprint);
+
+    if (self.delegate && [self.delegate respondsToSelector:@selector(session:shouldConnectToHostWithFingerprint:)] &&
+        ![self.delegate session:self shouldConnectToHostWithFingerprint:fingerprint]) {
+        NMSSHLogWarn(@"Fingerprint refused, aborting connection...");
+        [self disconnect];
+
+        return NO;
+    }
+
+    NMSSHLogVerbose(@"SSH session started with %@ / %@ / %@",
+                    [self negotiatedMethod:NMSSHSessionMethodKeyExchange],
+                    [self negotiatedMethod:NMSSHSessionMethodCipherClientToServer],
+                    [self negotiatedMethod:NMSSHSessionMethodMACClientToServer]);
+
+    // We managed to successfully setup a connection
+    [self setConnected:YES];
+    [self startKeepAlive];
+
+    return self.isConnected;
+}
+
+
+- (void)disconnect {
+    [self performSyncOnSessionQueue:^{
+        if (_channel) {
+            [_channel closeShell];
+            [self setChannel:nil];
+        }
+
+        if (_sftp) {
+            if ([_sftp isConnected]) {
+                [_sftp disconnect];
+            }
+            [self setSftp:nil];
+        }
+
+        if (self.agent) {
+            libssh2_agent_disconnect(self.agent);
+            libssh2_agent_free(self.agent);
+            [self setAgent:NULL];
+        }
+
+        if (self.session) {
+            libssh2_session_disconnect(self.session, "NMSSH: Disconnect");
+            [self setSessionToFree:self.session];
+            [self setSession:NULL];
+        }
+
+        [self closeSocket];
+        [self setCachedAuthenticationMethods:nil];
+        [self setNextKeepAliveTime:0];
+
+        NMSSHLogVerbose(@"Disconnected");
+        [self setConnected:NO];
+
+        // Let the pending operations report the disconnection
+        [self destroySocketSources];
+        if ([self.operations count] > 0) {
+            [self pumpOperationsAsync];
+        }
+    }];
+}
+
+// -----------------------------------------------------------------------------
+#pragma mark - ASYNCHRONOUS OPERATIONS
+// -----------------------------------------------------------------------------
+
+- (BOOL)isOnSessionQueue {
+    return dispatch_get_specific(kNMSSHSessionQueueKey) == (__bridge void *)self;
+}
+
+- (void)performSyncOnSessionQueue:(dispatch_block_t)block {
+    if ([self isOnSessionQueue]) {
+        block();
+    }
+    else {
+        dispatch_sync(self.sessionQueue, block);
+    }
+}
+
+- (void)dispatchCallback:(dispatch_block_t)block {
+    dispatch_async(self.callbackQueue, block);
+}
+
+- (void)startOperation:(NMSSHOperation *)operation {
+    dispatch_async(self.sessionQueue, ^{
+        [self.operations addObject:operation];
+
+        // Make sure the operation gets stepped when it expires
+        if (operation.deadline > 0) {
+            __weak NMSSHSession *weakSelf = self;
+            double delay = MAX(operation.deadline - CFAbsoluteTimeGetCurrent(), 0);
+            dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), self.sessionQueue, ^{
+                [weakSelf pumpOperationsFromSocket:NO];
+            });
+        }
+
+        [self pumpOperationsFromSocket:NO];
+    });
+}
+
+- (void)pumpOperationsAsync {
+    __weak NMSSHSession *weakSelf = self;
+    dispatch_async(self.sessionQueue, ^{
+        [weakSelf pumpOperationsFromSocket:NO];
+    });
+}
+
+- (void)pumpOperationsFromSocket:(BOOL)fromSocket {
+    if ([self.operations count] == 0) {
+        [self updateSocketSourcesAfterStall:NO];
+        return;
+    }
+
+    // Operations use non-blocking calls, restore the mode for the synchronous API afterwards
+    int blocking = self.session ? libssh2_session_get_blocking(self.session) : 1;
+
+    BOOL progress, anyProgress = NO;
+    NSUInteger passes = 0;
+
+    do {
+        progress = NO;
+
+        for (NMSSHOperation *operation in [self.operations copy]) {
+            // The session may have been created or replaced by the previous step
+            if (self.session) {
+                libssh2_session_set_blocking(self.session, 0);
+            }
+
+            NMSSHOperationStatus status = [operation performStep];
+
+            if (status == NMSSHOperationStatusDone) {
+                [self.operations removeObjectIdenticalTo:operation];
+                [self releaseRequestLockForOperation:operation];
+            }
+
+            if (status != NMSSHOperationStatusBlocked) {
+                progress = YES;
+            }
+        }
+
+        anyProgress = anyProgress || progress;
+    } while (progress && [self.operations count] > 0 && ++passes < kNMSSHMaxPumpPasses);
+
+    if (self.session) {
+        libssh2_session_set_blocking(self.session, blocking);
+    }
+
+    // Let other blocks scheduled on the queue run before continuing
+    if (progress && [self.operations count] > 0) {
+        [self pumpOperationsAsync];
+    }
+
+    [self updateSocketSourcesAfterStall:(fromSocket && !anyProgress)];
+}
+
+- (BOOL)acquireRequestLockForOperation:(NMSSHOperation *)operation {
+    if (!self.requestLockOwner) {
+        [self setRequestLockOwner:operation];
+    }
+
+    return self.requestLockOwner == operation;
+}
+
+- (void)releaseRequestLockForOperation:(NMSSHOperation *)operation {
+    if (self.requestLockOwner == operation) {
+        [self setRequestLockOwner:nil];
+    }
+}
+
+- (void)updateSocketSourcesAfterStall:(BOOL)stalled {
+    if ((!self.session && !self.socketConnecting) || !_socket || [self.operations count] == 0) {
+        [self setReadSourceActive:NO];
+        [self setWriteSourceActive:NO];
+        return;
+    }
+
+    if (!self.readSource) {
+        [self createSocketSources];
+    }
+
+    // Data nobody is waiting for would wake us up in a loop, stop listening until
+    // something else lets an operation progress
+    BOOL readable = NO;
+    if (stalled) {
+        struct pollfd fds = { CFSocketGetNative(_socket), POLLIN, 0 };
+        readable = poll(&fds, 1, 0) > 0 && (fds.revents & POLLIN);
+    }
+
+    // The socket becomes writable once the TCP connection is established
+    if (self.socketConnecting) {
+        [self setReadSourceActive:NO];
+        [self setWriteSourceActive:YES];
+        return;
+    }
+
+    [self setReadSourceActive:!readable];
+    [self setWriteSourceActive:(libssh2_session_block_directions(self.session) & LIBSSH2_SESSION_BLOCK_OUTBOUND) != 0];
+}
+
+- (void)createSocketSources {
+    int fd = CFSocketGetNative(_socket);
+    __weak NMSSHSession *weakSelf = self;
+
+    [self setReadSource:dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, fd, 0, self.sessionQueue)];
+    dispatch_source_set_event_handler(self.readSource, ^{
+        [weakSelf pumpOperationsFromSocket:YES];
+    });
+
+    [self setWriteSource:dispatch_source_create(DISPATCH_SOURCE_TYPE_WRITE, fd, 0, self.sessionQueue)];
+    dispatch_source_set_event_handler(self.writeSource, ^{
+        [weakSelf pumpOperationsFromSocket:YES];
+    });
+
+    // Sources are created suspended
+    _readSourceActive = NO;
+    _writeSourceActive = NO;
+}
+
+- (void)destroySocketSources {
+    // A suspended source must be resumed before it can be released
+    if (self.readSource) {
+        [self setReadSourceActive:YES];
+        dispatch_source_cancel(self.readSource);
+#if !(OS_OBJECT_USE_OBJC)
+        dispatch_release(self.readSource);
+#endif
+        [self setReadSource:nil];
+    }
+
+    if (self.writeSource) {
+        [self setWriteSourceActive:YES];
+        dispatch_source_cancel(self.writeSource);
+#if !(OS_OBJECT_USE_OBJC)
+        dispatch_release(self.writeSource);
+#endif
+        [self setWriteSource:nil];
+    }
+
+    _readSourceActive = NO;
+    _writeSourceActive = NO;
+}
+
+- (void)setReadSourceActive:(BOOL)active {
+    if (self.readSource && active != _readSourceActive) {
+        active ? dispatch_resume(self.readSource) : dispatch_suspend(self.readSource);
+    }
+
+    _readSourceActive = active && self.readSource;
+}
+
+- (void)setWriteSourceActive:(BOOL)active {
+    if (self.writeSource && active != _writeSourceActive) {
+        active ? dispatch_resume(self.writeSource) : dispatch_suspend(self.writeSource);
+    }
+
+    _writeSourceActive = active && self.writeSource;
+}
+
+// -----------------------------------------------------------------------------
+#pragma mark - WAITING ON THE SOCKET
+// -----------------------------------------------------------------------------
+
+- (int)waitSocketUntil:(CFAbsoluteTime)deadline {
+    if (!_socket || (!self.session && !self.socketConnecting)) {
+        return -1;
+    }
+
+    int timeout = -1;
+    if (deadline > 0) {
+        CFAbsoluteTime remaining = deadline - CFAbsoluteTimeGetCurrent();
+        if (remaining <= 0) {
+            return 0;
+        }
+
+        // Round up so we never wake up just before the deadline
+        timeout = (int)ceil(remaining * 1000);
+    }
+
+    int rc;
+    if (self.socketConnecting) {
+        rc = waitsocket_events(CFSocketGetNative(_socket), POLLOUT, timeout, _wakeupPipe[0]);
+    }
+    else {
+        rc = waitsocket_timeout(CFSocketGetNative(_socket), self.session, timeout, _wakeupPipe[0]);
+    }
+
+    if (rc == NMSSH_WAITSOCKET_INTERRUPTED) {
+        NMSSHLogVerbose(@"Wait on the socket cancelled");
+        [self resetCancellation];
+    }
+
+    return rc;
+}
+
+- (void)resetCancellation {
+    if (_wakeupPipe[0] < 0) {
+        return;
+    }
+
+    char buffer[16];
+    while (read(_wakeupPipe[0], buffer, sizeof(buffer)) > 0);
+}
+
+- (CFAbsoluteTime)deadlineForTimeout:(NSNumber *)timeout {
+    double seconds = [timeout doubleValue];
+
+    return seconds > 0 ? CFAbsoluteTimeGetCurrent() + seconds : 0;
+}
+
+- (int)performSessionCall:(int (^)(void))call deadline:(CFAbsoluteTime)deadline {
+    if (!self.session) {
+        return LIBSSH2_ERROR_SOCKET_DISCONNECT;
+    }
+
+    [self beginSynchronousCall];
+
+    // Waiting on our side honors the deadline and cancelPendingOperations
+    int blocking = libssh2_session_get_blocking(self.session);
+    libssh2_session_set_blocking(self.session, 0);
+
+    int rc;
+    while ((rc = call()) == LIBSSH2_ERROR_EAGAIN) {
+        int ready = [self waitSocketUntil:deadline];
+        if (ready > 0 || (ready == 0 && (deadline == 0 || CFAbsoluteTimeGetCurrent() < deadline))) {
+            continue;
+        }
+
+        if (ready == NMSSH_WAITSOCKET_INTERRUPTED) {
+            NMSSHLogError(@"Request cancelled");
+            rc = kNMSSHSessionCallCancelled;
+        }
+        else {
+            NMSSHLogError(@"Request timed out");
+            rc = LIBSSH2_ERROR_TIMEOUT;
+        }
+
+        break;
+    }
+
+    if (rc == LIBSSH2_ERROR_TIMEOUT || rc == kNMSSHSessionCallCancelled) {
+        // libssh2 can't resume an abandoned request
         [self disconnect];
+        [self setAbandonedCallError:(rc == kNMSSHSessionCallCancelled ?
+                                     [NMSSHOperation errorWithCode:NMSSHOperationCancelledError description:@"Request cancelled"] :
+                                     [NMSSHOperation errorWithCode:NMSSHOperationTimeoutError description:@"Request timed out"])];
+    }
+    else if (self.session) {
+        libssh2_session_set_blocking(self.session, blocking);
+    }
+
+    [self endSynchronousCall];
+
+    return rc;
+}
+
+- (void)cancelPendingOperations {
+    if (_wakeupPipe[1] < 0) {
+        return;
+    }
+
+    char byte = 0;
+    if (write(_wakeupPipe[1], &byte, 1) < 0 && errno != EAGAIN) {
+        NMSSHLogWarn(@"Unable to signal the wakeup pipe");
+    }
+}
+
+// -----------------------------------------------------------------------------
+#pragma mark - KEEPALIVE
+// -----------------------------------------------------------------------------
+
+- (void)setKeepAliveInterval:(NSUInteger)keepAliveInterval {
+    _keepAliveInterval = keepAliveInterval;
+
+    if (self.isConnected) {
+        [self startKeepAlive];
+    }
+}
+
+- (void)startKeepAlive {
+    if (self.keepAliveInterval == 0) {
+        [self setNextKeepAliveTime:0];
+        return;
+    }
+
+    [self setNextKeepAliveTime:CFAbsoluteTimeGetCurrent() + self.keepAliveInterval];
+    [[NMSSHKeepAliveScheduler sharedScheduler] addSession:self];
+}
+
+- (BOOL)keepAliveTimerFired:(CFAbsoluteTime)now {
+    CFAbsoluteTime next = self.nextKeepAliveTime;
+    if (next == 0) {
+        return NO;
+    }
+
+    if (now >= next) {
+        [self setNextKeepAliveTime:now + self.keepAliveInterval];
+
+        __weak NMSSHSession *weakSelf = self;
+        dispatch_async(self.sessionQueue, ^{
+            [weakSelf checkPeer];
+        });
+    }
+
+    return YES;
+}
+
+- (void)checkPeer {
+    // Servers don't accept channel requests before authentication
+    if (!self.isAuthorized || self.nextKeepAliveTime == 0) {
+        return;
+    }
+
+    // Traffic other than our own probes proves the server is there
+    CFAbsoluteTime lastReceiveTime = self.lastReceiveTime;
+    if (lastReceiveTime > self.lastKeepAliveReplyTime &&
+        CFAbsoluteTimeGetCurrent() - lastReceiveTime < self.keepAliveInterval) {
+        [self setMissedKeepAlives:0];
+        return;
+    }
+
+    if (self.keepAliveOperation) {
+        [self setMissedKeepAlives:self.missedKeepAlives + 1];
+
+        if (self.missedKeepAlives >= MAX(self.keepAliveCountMax, 1)) {
+            [self disconnectFromDeadPeer:[NMSSHOperation errorWithCode:NMSSHOperationTimeoutError
+                                                           description:@"The server stopped answering keepalives"]];
+        }
+
+        return;
+    }
+
+    // The synchronous call waits on the socket with its own timeout
+    if (atomic_load(&_synchronousCalls) > 0) {
+        return;
+    }
+
+    [self sendKeepAlive];
+}
+
+- (void)beginSynchronousCall {
+    atomic_fetch_add(&_synchronousCalls, 1);
 
-        return NO;
+    // A probe already sent must complete before libssh2 is used from another thread
+    if (atomic_load(&_keepAliveProbing) && ![self isOnSessionQueue]) {
+        dispatch_group_wait(self.keepAliveGroup, DISPATCH_TIME_FOREVER);
     }
+}
 
-    NMSSHLogVerbose(@"Remote host banner is %@", [self remoteBanner]);
+- (void)endSynchronousCall {
+    atomic_fetch_sub(&_synchronousCalls, 1);
+}
 
-    // Get the fingerprint of the host
-    NSString *fingerprint = [self fingerprint:self.fingerprintHash];
-    NMSSHLogInfo(@"The host's fingerprint is %@", fingerprint);
+/**
+ Claim libssh2 for a probe, checked against beginSynchronousCall from the
+ other side: one of them always sees the other.
 
-    if (self.delegate && [self.delegate respondsToSelector:@selector(session:shouldConnectToHostWithFingerprint:)] &&
-        ![self.delegate session:self shouldConnectToHostWithFingerprint:fingerprint]) {
-        NMSSHLogWarn(@"Fingerprint refused, aborting connection...");
-        [self disconnect];
+ @returns NO while a synchronous call is in progress
+ */
+- (BOOL)beginKeepAliveProbe {
+    dispatch_group_enter(self.keepAliveGroup);
+    atomic_store(&_keepAliveProbing, true);
 
+    if (atomic_load(&_synchronousCalls) > 0) {
+        [self endKeepAliveProbe];
         return NO;
     }
 
-    NMSSHLogVerbose(@"SSH session started");
-
-    // We managed to successfully setup a connection
-    [self setConnected:YES];
+    return YES;
+}
 
-    return self.isConnected;
+- (void)endKeepAliveProbe {
+    atomic_store(&_keepAliveProbing, false);
+    dispatch_group_leave(self.keepAliveGroup);
 }
 
+/**
+ libssh2 never reads the answers to its own keepalive messages unless a
+ channel is being read, they would pile up in the session. The probe is a
+ channel of an unknown type instead, the server must refuse it and libssh2
+ consumes the refusal.
+ */
+- (void)sendKeepAlive {
+    __block BOOL pending = NO;
+    __block CFAbsoluteTime sendTime = 0;
+
+    NMSSHOperation *operation = [NMSSHOperation operationWithSession:self step:^NMSSHOperationStatus(NMSSHOperation *operation) {
+        NMSSHSession *session = operation.session;
+
+        // A request already sent must complete before giving up
+        if (!session.rawSession || (operation.abortError && !pending)) {
+            if (sendTime > 0) {
+                [session endKeepAliveProbe];
+            }
+
+            return NMSSHOperationStatusDone;
+        }
 
-- (void)disconnect {
-    if (_channel) {
-        [_channel closeShell];
-        [self setChannel:nil];
-    }
+        if (![session acquireRequestLockForOperation:operation]) {
+            return NMSSHOperationStatusBlocked;
+        }
 
-    if (_sftp) {
-        if ([_sftp isConnected]) {
-            [_sftp disconnect];
+        if (sendTime == 0) {
+            // Skip this probe if a synchronous call started since it was due
+            if (![session beginKeepAliveProbe]) {
+                return NMSSHOperationStatusDone;
+            }
+
+            sendTime = CFAbsoluteTimeGetCurrent();
         }
-        [self setSftp:nil];
-    }
 
-    if (self.agent) {
-        libssh2_agent_disconnect(self.agent);
-        libssh2_agent_free(self.agent);
-        [self setAgent:NULL];
-    }
+        LIBSSH2_CHANNEL *channel = libssh2_channel_open_ex(session.rawSession,
+                                                           kNMSSHKeepAliveChannelType,
+                                                           sizeof(kNMSSHKeepAliveChannelType) - 1,
+                                                           LIBSSH2_CHANNEL_WINDOW_DEFAULT,
+                                                           LIBSSH2_CHANNEL_PACKET_DEFAULT,
+                                                           NULL, 0);
+        int rc = channel ? 0 : libssh2_session_last_errno(session.rawSession);
+        if ((pending = (rc == LIBSSH2_ERROR_EAGAIN))) {
+            return NMSSHOperationStatusBlocked;
+        }
 
-    if (self.session) {
-        libssh2_session_disconnect(self.session, "NMSSH: Disconnect");
-        [self setSessionToFree:self.session];
-        [self setSession:NULL];
-    }
+        [session releaseRequestLockForOperation:operation];
 
-    if (_socket) {
-        CFSocketInvalidate(_socket);
-        CFRelease(_socket);
-        _socket = NULL;
-    }
+        if (channel) {
+            libssh2_channel_free(channel);
+        }
+
+        [session endKeepAliveProbe];
+
+        if (rc == 0 || rc == LIBSSH2_ERROR_CHANNEL_FAILURE) {
+            [session keepAliveAnsweredAfter:CFAbsoluteTimeGetCurrent() - sendTime];
+        }
+        else {
+            [session disconnectFromDeadPeer:[session lastError]];
+        }
+
+        return NMSSHOperationStatusDone;
+    }];
+
+    [self setKeepAliveOperation:operation];
+    [self startOperation:operation];
+}
+
+- (void)keepAliveAnsweredAfter:(NSTimeInterval)roundTripTime {
+    [self setLastKeepAliveReplyTime:CFAbsoluteTimeGetCurrent()];
+    [self setMissedKeepAlives:0];
+
+    // Smoothed like TCP does, a single slow answer should not swing the estimate
+    NSTimeInterval smoothed = self.roundTripTime;
+    [self setRoundTripTime:(smoothed > 0 ? smoothed * 0.875 + roundTripTime * 0.125 : roundTripTime)];
+
+    NMSSHLogVerbose(@"Keepalive answered in %.1fms", roundTripTime * 1000);
+}
+
+- (void)disconnectFromDeadPeer:(NSError *)error {
+    NMSSHLogWarn(@"Disconnecting from %@: %@", self.host, [error localizedDescription]);
+    [self disconnect];
 
-    NMSSHLogVerbose(@"Disconnected");
-    [self setConnected:NO];
+    id<NMSSHSessionDelegate> delegate = self.delegate;
+    if (delegate && [delegate respondsToSelector:@selector(session:didDisconnectWithError:)]) {
+        [self dispatchCallback:^{
+            [delegate session:self didDisconnectWithError:error];
+        }];
+    }
 }
 
 // -----------------------------------------------------------------------------
@@ -392,7 +1425,9 @@
     }
 
     // Try to authenticate by password
-    int error = libssh2_userauth_password(self.session, [self.username UTF8String], [password UTF8String]);
+    int error = [self performAuthenticationCall:^int{
+        return libssh2_userauth_password(self.session, [self.username UTF8String], [password UTF8String]);
+    }];
     if (error) {
         NMSSHLogError(@"Password authentication failed with reason %i", error);
         return NO;
@@ -410,20 +1445,11 @@
         return NO;
     }
 
-    if (password == nil) {
-        password = @"";
-    }
-
-    // Get absolute paths for private/public key pair
-    const char *pubKey = [[publicKey stringByExpandingTildeInPath] UTF8String] ?: NULL;
-    const char *privKey = [[privateKey stringByExpandingTildeInPath] UTF8String] ?: NULL;
-
     // Try to authenticate with key pair and password
-    int error = libssh2_userauth_publickey_fromfile(self.session,
-                                                    [self.username UTF8String],
-                                                    pubKey,
-                                                    privKey,
-                                                    [password UTF8String]);
+    NMSSHAuthenticationAttempt attempt = [self publicKeyAttempt:publicKey privateKey:privateKey password:password];
+    int error = [self performAuthenticationCall:^int{
+        return attempt(self);
+    }];
 
     if (error) {
         NMSSHLogError(@"Public key authentication failed with reason %i", error);
@@ -447,14 +1473,16 @@
     }
 
     // Try to authenticate with key pair and password
-    int error = libssh2_userauth_publickey_frommemory(self.session,
-                                                    [self.username UTF8String],
-                                                    [self.username length],
-                                                    [publicKey UTF8String] ?: nil,
-                                                    [publicKey length] ?: 0,
-                                                    [privateKey UTF8String] ?: nil,
-                                                    [privateKey length] ?: 0,
-                                                    [password UTF8String]);
+    int error = [self performAuthenticationCall:^int{
+        return libssh2_userauth_publickey_frommemory(self.session,
+                                                     [self.username UTF8String],
+                                                     [self.username length],
+                                                     [publicKey UTF8String] ?: nil,
+                                                     [publicKey length] ?: 0,
+                                                     [privateKey UTF8String] ?: nil,
+                                                     [privateKey length] ?: 0,
+                                                     [password UTF8String]);
+    }];
 
     if (error) {
         NMSSHLogError(@"Public key authentication failed with reason %i", error);
@@ -476,7 +1504,9 @@
     }
 
     self.kbAuthenticationBlock = authenticationBlock;
-    int rc = libssh2_userauth_keyboard_interactive(self.session, [self.username UTF8String], &kb_callback);
+    int rc = [self performAuthenticationCall:^int{
+        return libssh2_userauth_keyboard_interactive(self.session, [self.username UTF8String], &kb_callback);
+    }];
     self.kbAuthenticationBlock = nil;
 
     if (rc != 0) {
@@ -494,6 +1524,63 @@
         return NO;
     }
 
+    // Try the identities until one is accepted
+    NMSSHAuthenticationAttempt attempt = [self agentAttempt];
+    int error = [self performAuthenticationCall:^int{
+        return attempt(self);
+    }];
+
+    if (error) {
+        NMSSHLogError(@"Agent authentication failed with reason %i", error);
+        return NO;
+    }
+
+    return self.isAuthorized;
+}
+
+- (BOOL)authenticateWithCredentials:(NMSSHCredentials *)credentials {
+    // Stop as soon as one method succeeds or the session is lost
+    if (credentials.useAgent && [self connectToAgent]) {
+        return YES;
+    }
+
+    if (self.session && credentials.privateKey &&
+        [self authenticateByPublicKey:credentials.publicKey
+                           privateKey:credentials.privateKey
+                          andPassword:credentials.privateKeyPassword]) {
+        return YES;
+    }
+
+    if (self.session && credentials.keyboardInteractiveBlock &&
+        [self authenticateByKeyboardInteractiveUsingBlock:credentials.keyboardInteractiveBlock]) {
+        return YES;
+    }
+
+    if (self.session && credentials.password) {
+        NSString *password = credentials.password;
+
+        if ([self authenticateByPassword:password]) {
+            return YES;
+        }
+
+        // Many servers only accept passwords through keyboard-interactive
+        if (self.session && !credentials.keyboardInteractiveBlock &&
+            [self authenticateByKeyboardInteractiveUsingBlock:^NSString *(NSString *request) {
+                return password;
+            }]) {
+            return YES;
+        }
+    }
+
+    return NO;
+}
+
+- (BOOL)openAgent {
+    if (self.agent) {
+        libssh2_agent_disconnect(self.agent);
+        libssh2_agent_free(self.agent);
+    }
+
     // Try to setup a connection to the SSH-agent
     [self setAgent:libssh2_agent_init(self.session)];
     if (!self.agent) {
@@ -513,48 +1600,418 @@
         return NO;
     }
 
-    // Search for the correct identity and try to authenticate
-    struct libssh2_agent_publickey *identity, *prev_identity = NULL;
-    while (1) {
-        int error = libssh2_agent_get_identity(self.agent, &identity, prev_identity);
-        if (error) {
-            NMSSHLogError(@"Failed to find a valid identity for the agent");
-            return NO;
-        }
+    return YES;
+}
 
-        error = libssh2_agent_userauth(self.agent, [self.username UTF8String], identity);
-        if (!error) {
-            return self.isAuthorized;
-        }
+/**
+ Run an authentication request of the synchronous API, bounded by the session
+ timeout and cancellable with cancelPendingOperations. The session is
+ disconnected when the request is abandoned.
+ */
+- (int)performAuthenticationCall:(int (^)(void))call {
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+    int rc = [self performSessionCall:call deadline:[self deadlineForTimeout:self.timeout]];
+    [self setAuthenticationTime:self.authenticationTime + CFAbsoluteTimeGetCurrent() - start];
 
-        prev_identity = identity;
+    // After a partial success the server offers the methods left to complete
+    if (rc == 0 && !self.isAuthorized) {
+        [self setCachedAuthenticationMethods:nil];
     }
 
-    return NO;
+    return rc;
 }
 
 - (NSArray *)supportedAuthenticationMethods {
     if (!self.session) {
         return nil;
     }
-    
-    char *userauthlist = libssh2_userauth_list(self.session, [self.username UTF8String],
-                                               (unsigned int)strlen([self.username UTF8String]));
-    if (userauthlist == NULL){
+
+    __block NSArray *methods = nil;
+    int rc = [self performSessionCall:^int{
+        return [self fetchAuthenticationMethods:&methods];
+    } deadline:[self deadlineForTimeout:self.timeout]];
+
+    if (rc) {
         NMSSHLogInfo(@"Failed to get authentication method for host %@:%@", self.host, self.port);
         return nil;
     }
 
+    return methods;
+}
+
+- (int)fetchAuthenticationMethods:(NSArray **)methods {
+    // The list only changes after a partial success, save a round trip per attempt
+    if (self.cachedAuthenticationMethods) {
+        *methods = self.cachedAuthenticationMethods;
+        return 0;
+    }
+
+    char *userauthlist = libssh2_userauth_list(self.session, [self.username UTF8String],
+                                               (unsigned int)strlen([self.username UTF8String]));
+    if (userauthlist == NULL) {
+        int rc = libssh2_session_last_errno(self.session);
+        return rc ?: LIBSSH2_ERROR_METHOD_NONE;
+    }
+
     NSString *authList = [NSString stringWithCString:userauthlist encoding:NSUTF8StringEncoding];
     NMSSHLogVerbose(@"User auth list: %@", authList);
 
-    return [authList componentsSeparatedByString:@","];
+    *methods = [authList componentsSeparatedByString:@","];
+    [self setCachedAuthenticationMethods:*methods];
+
+    return 0;
 }
 
 - (BOOL)supportsAuthenticationMethod:(NSString *)method {
     return [[self supportedAuthenticationMethods] containsObject:method];
 }
 
+- (NMSSHOperation *)authenticateByPassword:(NSString *)password completion:(void (^)(BOOL, NSError *))completion {
+    return [self authenticateWithMethods:@[@"password"]
+                                attempts:@[[self passwordAttempt:password]]
+                              completion:completion];
+}
+
+- (NMSSHOperation *)authenticateByPublicKey:(NSString *)publicKey
+                                 privateKey:(NSString *)privateKey
+                                   password:(NSString *)password
+                                 completion:(void (^)(BOOL, NSError *))completion {
+    return [self authenticateWithMethods:@[@"publickey"]
+                                attempts:@[[self publicKeyAttempt:publicKey privateKey:privateKey password:password]]
+                              completion:completion];
+}
+
+- (NMSSHOperation *)authenticateByInMemoryPublicKey:(NSString *)publicKey
+                                         privateKey:(NSString *)privateKey
+                                           password:(NSString *)password
+                                         completion:(void (^)(BOOL, NSError *))completion {
+    NMSSHAuthenticationAttempt attempt = ^int(NMSSHSession *session) {
+        return libssh2_userauth_publickey_frommemory(session.rawSession,
+                                                     [session.username UTF8String],
+                                                     [session.username length],
+                                                     [publicKey UTF8String] ?: nil,
+                                                     [publicKey length] ?: 0,
+                                                     [privateKey UTF8String] ?: nil,
+                                                     [privateKey length] ?: 0,
+                                                     [password ?: @"" UTF8String]);
+    };
+
+    return [self authenticateWithMethods:@[@"publickey"] attempts:@[attempt] completion:completion];
+}
+
+- (NMSSHOperation *)authenticateByKeyboardInteractiveUsingBlock:(NSString *(^)(NSString *))authenticationBlock
+                                                     completion:(void (^)(BOOL, NSError *))completion {
+    return [self authenticateWithMethods:@[@"keyboard-interactive"]
+                                attempts:@[[self keyboardInteractiveAttemptUsingBlock:authenticationBlock]]
+                              completion:completion];
+}
+
+- (NMSSHOperation *)connectToAgentWithCompletion:(void (^)(BOOL, NSError *))completion {
+    return [self authenticateWithMethods:@[@"publickey"] attempts:@[[self agentAttempt]] completion:completion];
+}
+
+- (NMSSHOperation *)authenticateWithCredentials:(NMSSHCredentials *)credentials
+                                     completion:(void (^)(BOOL, NSError *))completion {
+    NSMutableArray *methods = [[NSMutableArray alloc] init];
+    NSMutableArray *attempts = [[NSMutableArray alloc] init];
+
+    if (credentials.useAgent) {
+        [methods addObject:@"publickey"];
+        [attempts addObject:[self agentAttempt]];
+    }
+
+    if (credentials.privateKey) {
+        [methods addObject:@"publickey"];
+        [attempts addObject:[self publicKeyAttempt:credentials.publicKey
+                                        privateKey:credentials.privateKey
+                                          password:credentials.privateKeyPassword]];
+    }
+
+    if (credentials.keyboardInteractiveBlock) {
+        [methods addObject:@"keyboard-interactive"];
+        [attempts addObject:[self keyboardInteractiveAttemptUsingBlock:credentials.keyboardInteractiveBlock]];
+    }
+
+    if (credentials.password) {
+        NSString *password = credentials.password;
+        [methods addObject:@"password"];
+        [attempts addObject:[self passwordAttempt:password]];
+
+        // Many servers only accept passwords through keyboard-interactive
+        if (!credentials.keyboardInteractiveBlock) {
+            [methods addObject:@"keyboard-interactive"];
+            [attempts addObject:[self keyboardInteractiveAttemptUsingBlock:^NSString *(NSString *request) {
+                return password;
+            }]];
+        }
+    }
+
+    return [self authenticateWithMethods:methods attempts:attempts completion:completion];
+}
+
+- (NMSSHOperation *)supportedAuthenticationMethodsWithCompletion:(void (^)(NSArray *, NSError *))completion {
+    __block BOOL pending = NO;
+
+    NMSSHOperation *operation = [NMSSHOperation operationWithSession:self step:^NMSSHOperationStatus(NMSSHOperation *operation) {
+        NMSSHSession *session = operation.session;
+        NSError *error = (pending && session.rawSession ? nil : operation.abortError);
+        NSArray *methods = nil;
+
+        if (!error && ![session acquireRequestLockForOperation:operation]) {
+            return NMSSHOperationStatusBlocked;
+        }
+
+        if (!error) {
+            int rc = [session fetchAuthenticationMethods:&methods];
+
+            if ((pending = (rc == LIBSSH2_ERROR_EAGAIN))) {
+                return NMSSHOperationStatusBlocked;
+            }
+
+            if (rc) {
+                NMSSHLogInfo(@"Failed to get authentication method for host %@:%@", session.host, session.port);
+                error = [session lastError];
+            }
+        }
+
+        [session dispatchCallback:^{
+            completion(methods, error);
+        }];
+
+        return NMSSHOperationStatusDone;
+    }];
+
+    [self startOperation:operation];
+
+    return operation;
+}
+
+- (NMSSHAuthenticationAttempt)passwordAttempt:(NSString *)password {
+    return ^int(NMSSHSession *session) {
+        return libssh2_userauth_password(session.rawSession, [session.username UTF8String], [password UTF8String]);
+    };
+}
+
+- (NMSSHAuthenticationAttempt)publicKeyAttempt:(NSString *)publicKey
+                                    privateKey:(NSString *)privateKey
+                                      password:(NSString *)password {
+    NSString *pubKey = [publicKey stringByExpandingTildeInPath];
+    NSString *privKey = [privateKey stringByExpandingTildeInPath];
+
+    // Keys kept in memory by the cache spare a read from disk per session
+    NSData *privateKeyData = privKey ? [self.credentialCache contentsOfKeyAtPath:privKey] : nil;
+    NSData *publicKeyData = (privateKeyData && pubKey) ? [self.credentialCache contentsOfKeyAtPath:pubKey] : nil;
+
+    if (privateKeyData && (!pubKey || publicKeyData)) {
+        return ^int(NMSSHSession *session) {
+            return libssh2_userauth_publickey_frommemory(session.rawSession,
+                                                         [session.username UTF8String],
+                                                         [session.username length],
+                                                         [publicKeyData bytes],
+                                                         [publicKeyData length],
+                                                         [privateKeyData bytes],
+                                                         [privateKeyData length],
+                                                         [password ?: @"" UTF8String]);
+        };
+    }
+
+    return ^int(NMSSHSession *session) {
+        return libssh2_userauth_publickey_fromfile(session.rawSession,
+                                                   [session.username UTF8String],
+                                                   [pubKey UTF8String] ?: NULL,
+                                                   [privKey UTF8String] ?: NULL,
+                                                   [password ?: @"" UTF8String]);
+    };
+}
+
+- (NMSSHAuthenticationAttempt)keyboardInteractiveAttemptUsingBlock:(NSString *(^)(NSString *))authenticationBlock {
+    return ^int(NMSSHSession *session) {
+        session.kbAuthenticationBlock = authenticationBlock;
+        int rc = libssh2_userauth_keyboard_interactive(session.rawSession, [session.username UTF8String], &kb_callback);
+        session.kbAuthenticationBlock = nil;
+
+        return rc;
+    };
+}
+
+- (NMSSHAuthenticationAttempt)agentAttempt {
+    __block NSArray *identities = nil;
+    __block NSUInteger index = 0;
+
+    return ^int(NMSSHSession *session) {
+        // Talking to the local agent does not block on the network
+        if (!identities) {
+            identities = [session agentIdentities];
+
+            if ([identities count] == 0) {
+                NMSSHLogError(@"Failed to find a valid identity for the agent");
+                return LIBSSH2_ERROR_AGENT_PROTOCOL;
+            }
+        }
+
+        // Try each identity until one is accepted
+        int rc = LIBSSH2_ERROR_AGENT_PROTOCOL;
+        while (index < [identities count]) {
+            struct libssh2_agent_publickey *identity = [identities[index] pointerValue];
+            rc = libssh2_agent_userauth(session.agent, [session.username UTF8String], identity);
+
+            if (rc == LIBSSH2_ERROR_EAGAIN) {
+                return rc;
+            }
+
+            if (rc == 0) {
+                [session.credentialCache setAgentIdentity:[NSData dataWithBytes:identity->blob length:identity->blob_len]
+                                                  forHost:[session credentialCacheHost]];
+                return rc;
+            }
+
+            index++;
+        }
+
+        return rc;
+    };
+}
+
+/**
+ Open the agent and list its identities, the identity the host accepted last
+ comes first.
+ */
+- (NSArray *)agentIdentities {
+    if (![self openAgent]) {
+        return nil;
+    }
+
+    NSData *preferred = [self.credentialCache agentIdentityForHost:[self credentialCacheHost]];
+    NSMutableArray *identities = [[NSMutableArray alloc] init];
+    struct libssh2_agent_publickey *identity = NULL, *prev_identity = NULL;
+
+    while (libssh2_agent_get_identity(self.agent, &identity, prev_identity) == 0) {
+        NSValue *value = [NSValue valueWithPointer:identity];
+
+        if (preferred && identity->blob_len == [preferred length] &&
+            memcmp(identity->blob, [preferred bytes], identity->blob_len) == 0) {
+            [identities insertObject:value atIndex:0];
+        }
+        else {
+            [identities addObject:value];
+        }
+
+        prev_identity = identity;
+    }
+
+    return identities;
+}
+
+- (NSString *)credentialCacheHost {
+    return [NSString stringWithFormat:@"%@@%@:%@", self.username, self.host, self.port];
+}
+
+/**
+ Try the authentication attempts in order until one succeeds, skipping the
+ methods the server does not offer.
+ */
+- (NMSSHOperation *)authenticateWithMethods:(NSArray *)methodNames
+                                   attempts:(NSArray *)attempts
+                                 completion:(void (^)(BOOL, NSError *))completion {
+    __block NSArray *methods = nil;
+    __block NSUInteger index = 0;
+    __block BOOL pending = NO;
+    __block CFAbsoluteTime start = 0;
+    __block NSError *failure = nil;
+
+    NMSSHOperation *operation = [NMSSHOperation operationWithSession:self step:^NMSSHOperationStatus(NMSSHOperation *operation) {
+        NMSSHSession *session = operation.session;
+
+        // A request already sent must complete before giving up
+        NSError *error = (pending && session.rawSession ? nil : operation.abortError);
+        BOOL authorized = NO;
+        int rc;
+
+        if (!error && ![session acquireRequestLockForOperation:operation]) {
+            return NMSSHOperationStatusBlocked;
+        }
+
+        if (!error && start == 0) {
+            start = CFAbsoluteTimeGetCurrent();
+        }
+
+        while (!error && !authorized && index < [attempts count]) {
+            // Don't send credentials the server won't accept
+            if (!methods) {
+                rc = [session fetchAuthenticationMethods:&methods];
+
+                if ((pending = (rc == LIBSSH2_ERROR_EAGAIN))) {
+                    return NMSSHOperationStatusBlocked;
+                }
+
+                if (rc) {
+                    error = [session lastError];
+                    break;
+                }
+            }
+
+            NSString *method = methodNames[index];
+
+            if (![methods containsObject:method]) {
+                failure = [NMSSHOperation errorWithCode:NMSSHOperationFailedError
+                                            description:[NSString stringWithFormat:@"Authentication method %@ not supported", method]];
+                index++;
+                continue;
+            }
+
+            NMSSHAuthenticationAttempt attempt = attempts[index];
+            rc = attempt(session);
+
+            if ((pending = (rc == LIBSSH2_ERROR_EAGAIN))) {
+                return NMSSHOperationStatusBlocked;
+            }
+
+            if (rc) {
+                NMSSHLogError(@"Authentication by %@ failed with reason %i", method, rc);
+                failure = [session lastError];
+                index++;
+
+                if (!session.rawSession) {
+                    error = failure;
+                }
+            }
+            else if (session.isAuthorized) {
+                NMSSHLogVerbose(@"Authentication by %@ succeeded.", method);
+                authorized = YES;
+            }
+            else {
+                // Partial success, the server requires another method and
+                // may now offer different ones
+                NMSSHLogVerbose(@"Authentication by %@ partially succeeded.", method);
+                [session setCachedAuthenticationMethods:nil];
+                methods = nil;
+                index++;
+            }
+        }
+
+        if (!error && !authorized) {
+            error = failure ?: [NMSSHOperation errorWithCode:NMSSHOperationFailedError
+                                                 description:@"No authentication method succeeded"];
+        }
+
+        if (start > 0) {
+            [session setAuthenticationTime:session.authenticationTime + CFAbsoluteTimeGetCurrent() - start];
+        }
+
+        if (completion) {
+            [session dispatchCallback:^{
+                completion(authorized, error);
+            }];
+        }
+
+        return NMSSHOperationStatusDone;
+    }];
+
+    [self startOperation:operation];
+
+    return operation;
+}
+
 - (NSString *)fingerprint:(NMSSHSessionHash)hashType {
     if (!self.session) {
         return nil;
@@ -642,26 +2099,9 @@
     return status;
 }
 
-- (NMSSHKnownHostStatus)knownHostStatusWithFile:(NSString *)filename {
-    LIBSSH2_KNOWNHOSTS *knownHosts = libssh2_knownhost_init(self.session);
-    if (!knownHosts) {
-        return NMSSHKnownHostStatusFailure;
-    }
-
-    int rc = libssh2_knownhost_readfile(knownHosts,
-                                        [filename UTF8String],
-                                        LIBSSH2_KNOWNHOST_FILE_OPENSSH);
-    if (rc < 0) {
-        libssh2_knownhost_free(knownHosts);
-
-        if (rc == LIBSSH2_ERROR_FILE) {
-            NMSSHLogInfo(@"No known hosts file %@.", filename);
-            return NMSSHKnownHostStatusNotFound;
-        }
-        else {
-            NMSSHLogError(@"Failed to read known hosts file %@.", filename);
-            return NMSSHKnownHostStatusFailure;
-        }
+- (NSData *)hostKey {
+    if (!self.session) {
+        return nil;
     }
 
     int keytype;
@@ -669,127 +2109,55 @@
     const char *remotekey = libssh2_session_hostkey(self.session, &keylen, &keytype);
     if (!remotekey) {
         NMSSHLogError(@"Failed to get host key.");
-        libssh2_knownhost_free(knownHosts);
+        return nil;
+    }
+
+    return [NSData dataWithBytes:remotekey length:keylen];
+}
 
+- (NMSSHKnownHostStatus)knownHostStatusWithFile:(NSString *)filename {
+    NSData *hostKey = [self hostKey];
+    if (!hostKey) {
         return NMSSHKnownHostStatusFailure;
     }
 
-    int keybit = (keytype == LIBSSH2_HOSTKEY_TYPE_RSA ? LIBSSH2_KNOWNHOST_KEY_SSHRSA : LIBSSH2_KNOWNHOST_KEY_SSHDSS);
-    struct libssh2_knownhost *host;
     NMSSHLogInfo(@"Check for host %@, port %@ in file %@", self.host, self.port, filename);
-    int check = libssh2_knownhost_checkp(knownHosts,
-                                         [self.host UTF8String],
-                                         [self.port intValue],
-                                         remotekey,
-                                         keylen,
-                                         (LIBSSH2_KNOWNHOST_TYPE_PLAIN |
-                                          LIBSSH2_KNOWNHOST_KEYENC_RAW |
-                                          keybit),
-                                         &host);
-
-    libssh2_knownhost_free(knownHosts);
-
-    switch (check) {
-        case LIBSSH2_KNOWNHOST_CHECK_MATCH:
+    NMSSHKnownHostStatus status = [[NMSSHKnownHostsStore storeForFile:filename] statusForHost:self.host
+                                                                                         port:[self.port integerValue]
+                                                                                          key:hostKey];
+
+    switch (status) {
+        case NMSSHKnownHostStatusMatch:
             NMSSHLogInfo(@"Match");
-            return NMSSHKnownHostStatusMatch;
+            break;
 
-        case LIBSSH2_KNOWNHOST_CHECK_MISMATCH:
+        case NMSSHKnownHostStatusMismatch:
             NMSSHLogInfo(@"Mismatch");
-            return NMSSHKnownHostStatusMismatch;
+            break;
 
-        case LIBSSH2_KNOWNHOST_CHECK_NOTFOUND:
+        case NMSSHKnownHostStatusNotFound:
             NMSSHLogInfo(@"Not found");
-            return NMSSHKnownHostStatusNotFound;
+            break;
 
-        case LIBSSH2_KNOWNHOST_CHECK_FAILURE:
-        default:
+        case NMSSHKnownHostStatusFailure:
             NMSSHLogInfo(@"Failure");
-            return NMSSHKnownHostStatusFailure;
+            break;
     }
+
+    return status;
 }
 
 - (BOOL)addKnownHostName:(NSString *)host port:(NSInteger)port toFile:(NSString *)fileName withSalt:(NSString *)salt {
-    const char *hostkey;
-    size_t hklen;
-    int hktype;
-    NSString *hostname;  // Formatted as {host} or [{host}]:{port}.
-
-    if (port == 22) {
-        hostname = host;
-    }
-    else {
-        hostname = [NSString stringWithFormat:@"[%@]:%d", host, (int)port];
-    }
-
     if (!fileName) {
         fileName = [self userKnownHostsFileName];
     }
 
-    hostkey = libssh2_session_hostkey(self.session, &hklen, &hktype);
-    if (!hostkey) {
-        NMSSHLogError(@"Failed to get host key.");
-        return NO;
-    }
-
-    LIBSSH2_KNOWNHOSTS *knownHosts = libssh2_knownhost_init(self.session);
-    if (!knownHosts) {
-        NMSSHLogError(@"Failed to initialize knownhosts.");
+    NSData *hostKey = [self hostKey];
+    if (!hostKey) {
         return NO;
     }
 
-    int rc = libssh2_knownhost_readfile(knownHosts, [fileName UTF8String], LIBSSH2_KNOWNHOST_FILE_OPENSSH);
-    if (rc < 0 && rc != LIBSSH2_ERROR_FILE) {
-        NMSSHLogError(@"Failed to read known hosts file.");
-        libssh2_knownhost_free(knownHosts);
-
-        return NO;
-    }
-
-    int keybit = LIBSSH2_KNOWNHOST_KEYENC_RAW;
-    if (hktype == LIBSSH2_HOSTKEY_TYPE_RSA) {
-        keybit |= LIBSSH2_KNOWNHOST_KEY_SSHRSA;
-    }
-    else {
-        keybit |= LIBSSH2_KNOWNHOST_KEY_SSHDSS;
-    }
-
-    if (salt) {
-        keybit |= LIBSSH2_KNOWNHOST_TYPE_SHA1;
-    }
-    else {
-        keybit |= LIBSSH2_KNOWNHOST_TYPE_PLAIN;
-    }
-
-    int result = libssh2_knownhost_addc(knownHosts,
-                                        [hostname UTF8String],
-                                        [salt UTF8String],
-                                        hostkey,
-                                        hklen,
-                                        NULL,
-                                        0,
-                                        keybit,
-                                        NULL);
-    if (result) {
-        NMSSHLogError(@"Failed to add host to known hosts: error %d (%@)",
-                      result,
-                      [self lastError]);
-    }
-    else {
-        result = libssh2_knownhost_writefile(knownHosts,
-                                             [fileName UTF8String],
-                                             LIBSSH2_KNOWNHOST_FILE_OPENSSH);
-        if (result < 0) {
-            NMSSHLogError(@"Couldn't write to %@: %@",
-                          [self userKnownHostsFileName], [self lastError]);
-        }
-        else {
-            NMSSHLogInfo(@"Host added to known hosts.");
-        }
-    }
-
-    libssh2_knownhost_free(knownHosts);
-    return result == 0;
+    return [[NMSSHKnownHostsStore storeForFile:fileName] addHost:host port:port key:hostKey salt:salt];
 }
 
 - (NSString *)keyboardInteractiveRequest:(NSString *)request {
@@ -826,6 +2194,23 @@ void kb_callback(const char *name, int name_len, const char *instr, int instr_le
     }
 }
 
+ssize_t recv_callback(libssh2_socket_t socket, void *buffer, size_t length, int flags, void **abstract) {
+    ssize_t rc = recv(socket, buffer, length, flags);
+
+    // libssh2 expects the error as a negative errno
+    if (rc < 0) {
+        return -errno;
+    }
+
+    if (rc > 0) {
+        NMSSHSession *self = (__bridge NMSSHSession *)*abstract;
+        [self setLastReceiveTime:CFAbsoluteTimeGetCurrent()];
+        [self setReceiveCount:self.receiveCount + 1];
+    }
+
+    return rc;
+}
+
 void disconnect_callback(LIBSSH2_SESSION *session, int reason, const char *message, int message_len, const char *language, int language_len, void **abstract) {
     NMSSHSession *self = (__bridge NMSSHSession *)*abstract;
 
@@ -849,6 +2234,25 @@ void disconnect_callback(LIBSSH2_SESSION *session, int reason, const char *messa
     [self disconnect];
 }
 
+// -----------------------------------------------------------------------------
+#pragma mark - PORT FORWARDING
+// -----------------------------------------------------------------------------
+
+- (NMSSHTunnel *)forwardLocalPort:(NSUInteger)localPort toHost:(NSString *)host port:(NSUInteger)port {
+    return [[NMSSHTunnel alloc] initWithSession:self localPort:localPort remoteHost:host remotePort:port];
+}
+
+- (NMSSHTunnel *)forwardRemotePort:(NSUInteger)remotePort
+                            toHost:(NSString *)host
+                              port:(NSUInteger)port
+                        completion:(void (^)(BOOL, NSError *))completion {
+    return [[NMSSHTunnel alloc] initWithSession:self
+                                     remotePort:remotePort
+                                      localHost:host
+                                      localPort:port
+                                     completion:completion];
+}
+
 // -----------------------------------------------------------------------------
 #pragma mark - QUICK CHANNEL/SFTP ACCESS
 // -----------------------------------------------------------------------------
@@ -0,0 +1,79 @@
+#import "NMSSH.h"
+
+/**
+ NMSSHSocksProxy is a SOCKS5 proxy forwarding its connections through a
+ session, like `ssh -D`.
+
+ The proxy listens on 127.0.0.1 and supports the `CONNECT` command without
+ authentication. Each request gets a `direct-tcpip` channel of its own, names
+ are resolved by the server:
+
+    NMSSHSocksProxy *proxy = [[NMSSHSocksProxy alloc] initWithSession:session localPort:1080];
+    // curl --socks5-hostname 127.0.0.1:1080 http://intranet/
+
+ Handshakes and connections are handled on the session queue without
+ blocking any thread, with the same pooled buffers and flow control as
+ NMSSHTunnel. The session must be authenticated and only used through its
+ asynchronous API while the proxy is open.
+ */
+@interface NMSSHSocksProxy : NSObject
+
+/// ----------------------------------------------------------------------------
+/// @name Initialize a new proxy
+/// ----------------------------------------------------------------------------
+
+- (nonnull instancetype)init NS_UNAVAILABLE;
+
+/**
+ Listen on a local port and forward the requested connections through a
+ session.
+
+ @param session An authenticated session
+ @param localPort Port to listen on at 127.0.0.1, 0 for any free port
+ @returns NMSSHSocksProxy instance, nil if the port could not be bound
+ */
+- (nullable instancetype)initWithSession:(nonnull NMSSHSession *)session localPort:(NSUInteger)localPort NS_DESIGNATED_INITIALIZER;
+
+/// ----------------------------------------------------------------------------
+/// @name Proxy settings
+/// ----------------------------------------------------------------------------
+
+/** The session the connections are forwarded through */
+@property (nonatomic, nullable, readonly, weak) NMSSHSession *session;
+
+/** The local port the proxy listens on */
+@property (nonatomic, readonly) NSUInteger localPort;
+
+/** A Boolean value indicating whether the proxy accepts connections (read-only). */
+@property (atomic, readonly, getter = isOpen) BOOL open;
+
+/// ----------------------------------------------------------------------------
+/// @name Statistics
+/// ----------------------------------------------------------------------------
+
+/** Bytes forwarded from the clients to the remote hosts, open connections included */
+@property (nonatomic, readonly) uint64_t bytesSent;
+
+/** Bytes forwarded from the remote hosts to the clients, open connections included */
+@property (nonatomic, readonly) uint64_t bytesReceived;
+
+/** Number of connections being forwarded */
+@property (nonatomic, readonly) NSUInteger activeConnections;
+
+/** Number of `CONNECT` requests received since the proxy was opened */
+@property (nonatomic, readonly) NSUInteger totalConnections;
+
+/** Average time (in seconds) from a `CONNECT` request to the reply, a measure of the channel setup latency */
+@property (nonatomic, readonly) NSTimeInterval averageConnectTime;
+
+/// ----------------------------------------------------------------------------
+/// @name Close the proxy
+/// ----------------------------------------------------------------------------
+
+/**
+ Stop listening and close the forwarded connections. This method can be called
+ from any thread.
+ */
+- (void)close;
+
+@end
@@ -0,0 +1,507 @@
+#import "NMSSHSocksProxy.h"
+#import "NMSSH+Protected.h"
+#import "NMSSHSocketRelay.h"
+
+/** Longest handshake message: a CONNECT request with a 255 bytes long domain name */
+static const NSUInteger kNMSSHSocksMaxHandshakeLength = 262;
+
+typedef NS_ENUM(NSInteger, NMSSHSocksState) {
+    NMSSHSocksStateGreeting,
+    NMSSHSocksStateRequest
+};
+
+/** Replies defined by RFC 1928 */
+typedef NS_ENUM(uint8_t, NMSSHSocksReply) {
+    NMSSHSocksReplySucceeded = 0x00,
+    NMSSHSocksReplyConnectionRefused = 0x05,
+    NMSSHSocksReplyCommandNotSupported = 0x07,
+    NMSSHSocksReplyAddressTypeNotSupported = 0x08
+};
+
+/** A client going through the SOCKS handshake */
+@interface NMSSHSocksClient : NSObject
+@property (nonatomic, assign) int socket;
+@property (nonatomic, assign) NMSSHSocksState state;
+@property (nonatomic, strong) NSMutableData *buffer;
+
+#if OS_OBJECT_USE_OBJC
+@property (nonatomic, strong) dispatch_source_t readSource;
+#else
+@property (nonatomic, assign) dispatch_source_t readSource;
+#endif
+@end
+
+@implementation NMSSHSocksClient
+@end
+
+@interface NMSSHSocksProxy ()
+@property (nonatomic, weak) NMSSHSession *session;
+@property (nonatomic, assign) NSUInteger localPort;
+@property (atomic, readwrite, getter = isOpen) BOOL open;
+
+@property (nonatomic, assign) int listenSocket;
+@property (nonatomic, strong) NSMutableSet *clients;
+@property (nonatomic, strong) NSMutableSet *relays;
+@property (nonatomic, assign) NSUInteger requests;
+@property (nonatomic, assign) NSUInteger openedChannels;
+@property (nonatomic, assign) NSTimeInterval totalConnectTime;
+@property (nonatomic, assign) uint64_t closedBytesSent;
+@property (nonatomic, assign) uint64_t closedBytesReceived;
+
+#if OS_OBJECT_USE_OBJC
+@property (nonatomic, strong) dispatch_source_t acceptSource;
+#else
+@property (nonatomic, assign) dispatch_source_t acceptSource;
+#endif
+@end
+
+@implementation NMSSHSocksProxy
+
+// -----------------------------------------------------------------------------
+#pragma mark - INITIALIZE A NEW PROXY
+// -----------------------------------------------------------------------------
+
+- (instancetype)initWithSession:(NMSSHSession *)session localPort:(NSUInteger)localPort {
+    if ((self = [super init])) {
+        [self setSession:session];
+        [self setClients:[[NSMutableSet alloc] init]];
+        [self setRelays:[[NSMutableSet alloc] init]];
+        [self setListenSocket:-1];
+
+        if (![self listenOnPort:localPort]) {
+            return nil;
+        }
+
+        NMSSHLogInfo(@"SOCKS proxy listening on port %lu through %@", (unsigned long)self.localPort, session.host);
+    }
+
+    return self;
+}
+
+- (void)dealloc {
+    [self closeListener];
+
+    for (NMSSHSocksClient *client in self.clients) {
+        [self dropClient:client];
+    }
+
+    // Relays only reference the proxy weakly
+    for (NMSSHSocketRelay *relay in self.relays) {
+        [relay close];
+    }
+}
+
+// -----------------------------------------------------------------------------
+#pragma mark - LISTENER
+// -----------------------------------------------------------------------------
+
+- (BOOL)listenOnPort:(NSUInteger)port {
+    int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sock < 0) {
+        NMSSHLogError(@"Error creating the listening socket: %s", strerror(errno));
+        return NO;
+    }
+
+    int set = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (void *)&set, sizeof(set));
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_len = sizeof(address);
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (bind(sock, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(sock, SOMAXCONN) != 0) {
+        NMSSHLogError(@"Unable to listen on port %lu: %s", (unsigned long)port, strerror(errno));
+        close(sock);
+        return NO;
+    }
+
+    socklen_t length = sizeof(address);
+    getsockname(sock, (struct sockaddr *)&address, &length);
+    [self setLocalPort:ntohs(address.sin_port)];
+
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+    [self setListenSocket:sock];
+
+    __weak NMSSHSocksProxy *weakSelf = self;
+    [self setAcceptSource:dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, sock, 0, self.session.sessionQueue)];
+    dispatch_source_set_event_handler(self.acceptSource, ^{
+        [weakSelf acceptConnections];
+    });
+    dispatch_resume(self.acceptSource);
+
+    [self setOpen:YES];
+
+    return YES;
+}
+
+- (void)acceptConnections {
+    while (self.listenSocket >= 0) {
+        int sock = accept(self.listenSocket, NULL, NULL);
+
+        if (sock < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+
+            if (errno != EAGAIN) {
+                NMSSHLogWarn(@"Error accepting a connection on port %lu: %s", (unsigned long)self.localPort, strerror(errno));
+            }
+
+            return;
+        }
+
+        int set = 1;
+        setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, (void *)&set, sizeof(set));
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (void *)&set, sizeof(set));
+        fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+
+        NMSSHSocksClient *client = [[NMSSHSocksClient alloc] init];
+        [client setSocket:sock];
+        [client setState:NMSSHSocksStateGreeting];
+        [client setBuffer:[[NSMutableData alloc] initWithCapacity:kNMSSHSocksMaxHandshakeLength]];
+        [self.clients addObject:client];
+
+        __weak NMSSHSocksProxy *weakSelf = self;
+        __weak NMSSHSocksClient *weakClient = client;
+        [client setReadSource:dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, sock, 0, self.session.sessionQueue)];
+        dispatch_source_set_event_handler(client.readSource, ^{
+            [weakSelf readHandshakeOfClient:weakClient];
+        });
+        dispatch_resume(client.readSource);
+    }
+}
+
+- (void)closeListener {
+    int sock = self.listenSocket;
+    [self setListenSocket:-1];
+
+    // The source watches the descriptor until its cancel handler ran
+    if (self.acceptSource) {
+        if (sock >= 0) {
+            dispatch_source_set_cancel_handler(self.acceptSource, ^{
+                close(sock);
+            });
+            sock = -1;
+        }
+
+        dispatch_source_cancel(self.acceptSource);
+#if !(OS_OBJECT_USE_OBJC)
+        dispatch_release(self.acceptSource);
+#endif
+        [self setAcceptSource:nil];
+    }
+
+    if (sock >= 0) {
+        close(sock);
+    }
+
+    [self setOpen:NO];
+}
+
+- (void)close {
+    [self performOnSessionQueue:^{
+        if (self.isOpen) {
+            NMSSHLogInfo(@"Closing the SOCKS proxy on port %lu", (unsigned long)self.localPort);
+        }
+
+        [self closeListener];
+
+        for (NMSSHSocksClient *client in [self.clients allObjects]) {
+            [self dropClient:client];
+        }
+
+        for (NMSSHSocketRelay *relay in [self.relays allObjects]) {
+            [relay close];
+        }
+    }];
+}
+
+/** The clients and relays are only touched on the session queue */
+- (void)performOnSessionQueue:(dispatch_block_t)block {
+    NMSSHSession *session = self.session;
+
+    if (session) {
+        [session performSyncOnSessionQueue:block];
+    }
+    else {
+        block();
+    }
+}
+
+// -----------------------------------------------------------------------------
+#pragma mark - SOCKS HANDSHAKE
+// -----------------------------------------------------------------------------
+
+- (void)readHandshakeOfClient:(NMSSHSocksClient *)client {
+    if (!client) {
+        return;
+    }
+
+    uint8_t buffer[kNMSSHSocksMaxHandshakeLength];
+    ssize_t rc = read(client.socket, buffer, kNMSSHSocksMaxHandshakeLength - [client.buffer length]);
+
+    if (rc < 0 && (errno == EAGAIN || errno == EINTR)) {
+        return;
+    }
+
+    if (rc <= 0) {
+        [self dropClient:client];
+        return;
+    }
+
+    [client.buffer appendBytes:buffer length:rc];
+
+    // Clients may send the greeting and the request at once
+    while ([self parseHandshakeOfClient:client]);
+
+    if ([self.clients containsObject:client] && [client.buffer length] >= kNMSSHSocksMaxHandshakeLength) {
+        NMSSHLogWarn(@"SOCKS handshake too long, dropping the client");
+        [self dropClient:client];
+    }
+}
+
+/**
+ Handle the next complete handshake message of a client.
+
+ @returns Whether a message was handled and the client is still going through the handshake
+ */
+- (BOOL)parseHandshakeOfClient:(NMSSHSocksClient *)client {
+    const uint8_t *bytes = [client.buffer bytes];
+    NSUInteger length = [client.buffer length];
+
+    if (length < 2 || bytes[0] != 5) {
+        if (length > 0 && bytes[0] != 5) {
+            NMSSHLogWarn(@"Unsupported SOCKS version %d, dropping the client", bytes[0]);
+            [self dropClient:client];
+        }
+
+        return NO;
+    }
+
+    if (client.state == NMSSHSocksStateGreeting) {
+        NSUInteger methods = bytes[1];
+        if (length < 2 + methods) {
+            return NO;
+        }
+
+        // Only "no authentication" is supported, the proxy is bound to the loopback interface
+        BOOL supported = memchr(bytes + 2, 0x00, methods) != NULL;
+        uint8_t reply[2] = { 5, supported ? 0x00 : 0xFF };
+        [self writeReply:reply length:sizeof(reply) toClient:client];
+
+        if (!supported) {
+            NMSSHLogWarn(@"SOCKS client requires authentication, dropping it");
+            [self dropClient:client];
+            return NO;
+        }
+
+        [client.buffer replaceBytesInRange:NSMakeRange(0, 2 + methods) withBytes:NULL length:0];
+        [client setState:NMSSHSocksStateRequest];
+
+        return YES;
+    }
+
+    if (length < 5) {
+        return NO;
+    }
+
+    uint8_t command = bytes[1];
+    uint8_t addressType = bytes[3];
+    NSUInteger addressLength;
+
+    switch (addressType) {
+        case 1:
+            addressLength = 4;
+            break;
+        case 3:
+            addressLength = 1 + bytes[4];
+            break;
+        case 4:
+            addressLength = 16;
+            break;
+        default:
+            [self rejectClient:client reply:NMSSHSocksReplyAddressTypeNotSupported];
+            return NO;
+    }
+
+    if (length < 4 + addressLength + 2) {
+        return NO;
+    }
+
+    if (command != 1) {
+        NMSSHLogWarn(@"Unsupported SOCKS command %d", command);
+        [self rejectClient:client reply:NMSSHSocksReplyCommandNotSupported];
+        return NO;
+    }
+
+    NSString *host;
+    char address[INET6_ADDRSTRLEN];
+
+    if (addressType == 3) {
+        host = [[NSString alloc] initWithBytes:bytes + 5 length:addressLength - 1 encoding:NSUTF8StringEncoding];
+    }
+    else if (inet_ntop(addressType == 1 ? AF_INET : AF_INET6, bytes + 4, address, sizeof(address))) {
+        host = [NSString stringWithUTF8String:address];
+    }
+
+    if ([host length] == 0) {
+        [self rejectClient:client reply:NMSSHSocksReplyAddressTypeNotSupported];
+        return NO;
+    }
+
+    NSInteger port = (bytes[4 + addressLength] << 8) | bytes[4 + addressLength + 1];
+    [self connectClient:client toHost:host port:port];
+
+    return NO;
+}
+
+- (void)connectClient:(NMSSHSocksClient *)client toHost:(NSString *)host port:(NSInteger)port {
+    NMSSHSession *session = self.session;
+
+    if (!session.rawSession) {
+        NMSSHLogWarn(@"Session disconnected, refusing a SOCKS request to %@:%ld", host, (long)port);
+        uint8_t reply[10] = { 5, NMSSHSocksReplyConnectionRefused, 0, 1 };
+        [self writeReply:reply length:sizeof(reply) toClient:client];
+        [self dropClient:client];
+        return;
+    }
+
+    // The relay takes the socket over
+    int sock = client.socket;
+    [client setSocket:-1];
+    [self dropClient:client];
+
+    NMSSHSocketRelay *relay = [[NMSSHSocketRelay alloc] initWithSession:session socket:sock host:host port:port];
+    [self.relays addObject:relay];
+    [self setRequests:self.requests + 1];
+
+    CFAbsoluteTime requestTime = CFAbsoluteTimeGetCurrent();
+    __weak NMSSHSocksProxy *weakSelf = self;
+    __weak NMSSHSocketRelay *weakRelay = relay;
+
+    // The reply must not precede the channel, the client sends its data as soon as it gets it
+    [relay setOpenHandler:^(NSError *error) {
+        uint8_t reply[10] = { 5, error ? NMSSHSocksReplyConnectionRefused : NMSSHSocksReplySucceeded, 0, 1 };
+        write(sock, reply, sizeof(reply));
+
+        NMSSHSocksProxy *proxy = weakSelf;
+        if (!error) {
+            [proxy setOpenedChannels:proxy.openedChannels + 1];
+            [proxy setTotalConnectTime:proxy.totalConnectTime + CFAbsoluteTimeGetCurrent() - requestTime];
+        }
+    }];
+
+    [relay startWithCompletion:^(NSError *error) {
+        [weakSelf relayClosed:weakRelay];
+    }];
+}
+
+- (void)rejectClient:(NMSSHSocksClient *)client reply:(NMSSHSocksReply)code {
+    uint8_t reply[10] = { 5, code, 0, 1 };
+    [self writeReply:reply length:sizeof(reply) toClient:client];
+    [self dropClient:client];
+}
+
+- (void)writeReply:(const uint8_t *)reply length:(size_t)length toClient:(NMSSHSocksClient *)client {
+    // The socket buffer of a new connection always has room for a reply
+    if (write(client.socket, reply, length) != (ssize_t)length) {
+        NMSSHLogWarn(@"Unable to reply to the SOCKS client: %s", strerror(errno));
+    }
+}
+
+- (void)dropClient:(NMSSHSocksClient *)client {
+    int sock = client.socket;
+    [client setSocket:-1];
+
+    // The source watches the descriptor until its cancel handler ran
+    if (client.readSource) {
+        if (sock >= 0) {
+            dispatch_source_set_cancel_handler(client.readSource, ^{
+                close(sock);
+            });
+            sock = -1;
+        }
+
+        dispatch_source_cancel(client.readSource);
+#if !(OS_OBJECT_USE_OBJC)
+        dispatch_release(client.readSource);
+#endif
+        [client setReadSource:nil];
+    }
+
+    if (sock >= 0) {
+        close(sock);
+    }
+
+    [self.clients removeObject:client];
+}
+
+- (void)relayClosed:(NMSSHSocketRelay *)relay {
+    if (relay && [self.relays containsObject:relay]) {
+        [self setClosedBytesSent:self.closedBytesSent + relay.bytesSent];
+        [self setClosedBytesReceived:self.closedBytesReceived + relay.bytesReceived];
+        [self.relays removeObject:relay];
+    }
+}
+
+// -----------------------------------------------------------------------------
+#pragma mark - STATISTICS
+// -----------------------------------------------------------------------------
+
+- (uint64_t)bytesSent {
+    __block uint64_t bytes = 0;
+    [self performOnSessionQueue:^{
+        bytes = self.closedBytesSent;
+        for (NMSSHSocketRelay *relay in self.relays) {
+            bytes += relay.bytesSent;
+        }
+    }];
+
+    return bytes;
+}
+
+- (uint64_t)bytesReceived {
+    __block uint64_t bytes = 0;
+    [self performOnSessionQueue:^{
+        bytes = self.closedBytesReceived;
+        for (NMSSHSocketRelay *relay in self.relays) {
+            bytes += relay.bytesReceived;
+        }
+    }];
+
+    return bytes;
+}
+
+- (NSUInteger)activeConnections {
+    __block NSUInteger count = 0;
+    [self performOnSessionQueue:^{
+        count = [self.relays count];
+    }];
+
+    return count;
+}
+
+- (NSUInteger)totalConnections {
+    __block NSUInteger count = 0;
+    [self performOnSessionQueue:^{
+        count = self.requests;
+    }];
+
+    return count;
+}
+
+- (NSTimeInterval)averageConnectTime {
+    __block NSTimeInterval average = 0;
+    [self performOnSessionQueue:^{
+        if (self.openedChannels > 0) {
+            average = self.totalConnectTime / self.openedChannels;
+        }
+    }];
+
+    return average;
+}
+
+@end
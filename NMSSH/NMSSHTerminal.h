@@ -0,0 +1,169 @@
+#import "NMSSH.h"
+
+typedef NS_OPTIONS(uint16_t, NMSSHTerminalAttributes) {
+    NMSSHTerminalAttributeBold          = 1 << 0,
+    NMSSHTerminalAttributeFaint         = 1 << 1,
+    NMSSHTerminalAttributeItalic        = 1 << 2,
+    NMSSHTerminalAttributeUnderline     = 1 << 3,
+    NMSSHTerminalAttributeBlink         = 1 << 4,
+    NMSSHTerminalAttributeInverse       = 1 << 5,
+    NMSSHTerminalAttributeInvisible     = 1 << 6,
+    NMSSHTerminalAttributeStrikethrough = 1 << 7
+};
+
+/** Color of a cell drawn with the default foreground or background */
+static const uint16_t NMSSHTerminalDefaultColor = 256;
+
+/** A character cell of the screen */
+typedef struct {
+    /** Unicode code point shown in the cell, a space for blank cells */
+    uint32_t character;
+    /** Index in the xterm 256 color palette, or NMSSHTerminalDefaultColor */
+    uint16_t foreground;
+    /** Index in the xterm 256 color palette, or NMSSHTerminalDefaultColor */
+    uint16_t background;
+    NMSSHTerminalAttributes attributes;
+} NMSSHTerminalCell;
+
+/**
+ NMSSHTerminal models the screen of a VT100/xterm terminal from the output of
+ a remote shell.
+
+ The output is parsed incrementally by a table driven state machine, so a
+ sequence split between two chunks is handled like any other. Each chunk
+ updates the screen in place and the delegate is told which cells changed,
+ letting a view redraw only those:
+
+    NMSSHTerminal *terminal = [[NMSSHTerminal alloc] initWithType:NMSSHChannelPtyTerminalXterm columns:80 rows:24];
+    terminal.delegate = self;
+    channel.ptyTerminalType = NMSSHChannelPtyTerminalXterm;
+    channel.terminal = terminal;
+    [channel startShell:&error];
+
+ The cursor movements, erasing, insertion and deletion, scroll regions, tab
+ stops, SGR attributes with 256 colors, the alternate screen and the DEC line
+ drawing character set are supported, which covers full screen programs like
+ `vim`, `less` or `top`. Characters are one cell wide.
+
+ A terminal is not thread safe, it must be used from a single queue.
+ */
+@interface NMSSHTerminal : NSObject
+
+/// ----------------------------------------------------------------------------
+/// @name Initialize a new terminal
+/// ----------------------------------------------------------------------------
+
+/**
+ Create a terminal with an empty screen.
+
+ @param type The terminal type requested by the channel, decides the identity
+     reported to the remote programs
+ @param columns Width of the screen in characters
+ @param rows Height of the screen in characters
+ @returns NMSSHTerminal instance
+ */
+- (nonnull instancetype)initWithType:(NMSSHChannelPtyTerminal)type columns:(NSUInteger)columns rows:(NSUInteger)rows;
+
+/// ----------------------------------------------------------------------------
+/// @name Terminal state
+/// ----------------------------------------------------------------------------
+
+/** The receiver's `delegate`, told about the changes of the screen */
+@property (nonatomic, nullable, weak) id<NMSSHTerminalDelegate> delegate;
+
+/**
+ Block called with the replies to the queries of the remote programs, such as
+ the cursor position report, which must be written back to the shell.
+
+ Attaching the terminal to a channel sets it to write on the channel.
+ */
+@property (nonatomic, nullable, copy) void (^responseHandler)(NSData * _Nonnull response);
+
+/** The terminal type given at initialization (read-only) */
+@property (nonatomic, readonly) NMSSHChannelPtyTerminal type;
+
+/** Width of the screen in characters (read-only) */
+@property (nonatomic, readonly) NSUInteger columns;
+
+/** Height of the screen in characters (read-only) */
+@property (nonatomic, readonly) NSUInteger rows;
+
+/** Row of the cursor, 0 being the top row (read-only) */
+@property (nonatomic, readonly) NSUInteger cursorRow;
+
+/** Column of the cursor, 0 being the leftmost column (read-only) */
+@property (nonatomic, readonly) NSUInteger cursorColumn;
+
+/** A Boolean value indicating whether the cursor should be shown (read-only) */
+@property (nonatomic, readonly, getter = isCursorVisible) BOOL cursorVisible;
+
+/** A Boolean value indicating whether the alternate screen is shown (read-only) */
+@property (nonatomic, readonly, getter = isAlternateScreen) BOOL alternateScreen;
+
+/**
+ A Boolean value indicating whether the arrow keys should send their
+ application sequences, `ESC O A` instead of `ESC [ A` (read-only).
+ */
+@property (nonatomic, readonly) BOOL applicationCursorKeys;
+
+/** The window title set by the remote program (read-only) */
+@property (nonatomic, nullable, readonly) NSString *title;
+
+/// ----------------------------------------------------------------------------
+/// @name Process output
+/// ----------------------------------------------------------------------------
+
+/**
+ Update the screen with a chunk of output and tell the delegate about the
+ changes.
+
+ @param data Raw output of the shell, may end in the middle of a sequence or
+     of a UTF-8 character
+ */
+- (void)processData:(nonnull NSData *)data;
+
+/**
+ Change the size of the screen, keeping the lines above the cursor that still
+ fit. The whole screen is reported as changed.
+
+ @param columns Width of the screen in characters
+ @param rows Height of the screen in characters
+ */
+- (void)resizeColumns:(NSUInteger)columns rows:(NSUInteger)rows;
+
+/**
+ Clear the screen and restore the initial state, like the `RIS` sequence.
+ */
+- (void)reset;
+
+/// ----------------------------------------------------------------------------
+/// @name Read the screen
+/// ----------------------------------------------------------------------------
+
+/**
+ Get a cell of the screen.
+
+ @param row Row of the cell
+ @param column Column of the cell
+ @returns The cell, a blank cell if it is out of the screen
+ */
+- (NMSSHTerminalCell)cellAtRow:(NSUInteger)row column:(NSUInteger)column;
+
+/**
+ Copy cells of a row, typically a region reported to the delegate.
+
+ @param cells Array of at least `range.length` cells
+ @param row Row of the cells
+ @param range Columns to copy, must be within the screen
+ */
+- (void)getCells:(nonnull NMSSHTerminalCell *)cells row:(NSUInteger)row range:(NSRange)range;
+
+/**
+ Get the text of a row, without its trailing blanks.
+
+ @param row Row of the screen
+ @returns The text of the row
+ */
+- (nonnull NSString *)stringForRow:(NSUInteger)row;
+
+@end
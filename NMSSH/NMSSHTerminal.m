@@ -0,0 +1,1265 @@
+#import "NMSSHTerminal.h"
+
+/** Longest operating system command kept, the rest is dropped */
+static const NSUInteger kNMSSHTerminalMaxStringLength = 4096;
+
+/** Most parameters of a control sequence, the rest are dropped */
+#define NMSSH_TERMINAL_MAX_PARAMETERS 16
+
+/** States of the parser, after the DEC compatible parser of Paul Williams */
+typedef NS_ENUM(uint8_t, NMSSHTerminalState) {
+    NMSSHTerminalStateGround,
+    NMSSHTerminalStateEscape,
+    NMSSHTerminalStateEscapeIntermediate,
+    NMSSHTerminalStateCsiEntry,
+    NMSSHTerminalStateCsiParam,
+    NMSSHTerminalStateCsiIntermediate,
+    NMSSHTerminalStateCsiIgnore,
+    NMSSHTerminalStateOscString,
+    NMSSHTerminalStateIgnoredString,
+    NMSSHTerminalStateCount
+};
+
+/** Actions performed on the byte causing a transition */
+typedef NS_ENUM(uint8_t, NMSSHTerminalAction) {
+    NMSSHTerminalActionNone,
+    NMSSHTerminalActionPrint,
+    NMSSHTerminalActionUTF8,
+    NMSSHTerminalActionExecute,
+    NMSSHTerminalActionCollect,
+    NMSSHTerminalActionParam,
+    NMSSHTerminalActionEscDispatch,
+    NMSSHTerminalActionCsiDispatch,
+    NMSSHTerminalActionOscPut
+};
+
+/** Transitions of the parser, the action in the high nibble and the next state in the low nibble */
+static uint8_t kNMSSHTerminalTransitions[NMSSHTerminalStateCount][256];
+
+/** Characters of the DEC special graphics set, from 0x5F to 0x7E */
+static const uint32_t kNMSSHTerminalLineDrawing[32] = {
+    0x00A0, 0x25C6, 0x2592, 0x2409, 0x240C, 0x240D, 0x240A, 0x00B0,
+    0x00B1, 0x2424, 0x240B, 0x2518, 0x2510, 0x250C, 0x2514, 0x253C,
+    0x23BA, 0x23BB, 0x2500, 0x23BC, 0x23BD, 0x251C, 0x2524, 0x2534,
+    0x252C, 0x2502, 0x2264, 0x2265, 0x03C0, 0x2260, 0x00A3, 0x00B7
+};
+
+static void transitions_set(NMSSHTerminalState state, int first, int last, NMSSHTerminalAction action, NMSSHTerminalState next) {
+    for (int byte = first; byte <= last; byte++) {
+        kNMSSHTerminalTransitions[state][byte] = (uint8_t)((action << 4) | next);
+    }
+}
+
+/** Set the transitions shared by the states handling the C0 controls */
+static void transitions_set_controls(NMSSHTerminalState state) {
+    transitions_set(state, 0x00, 0x17, NMSSHTerminalActionExecute, state);
+    transitions_set(state, 0x19, 0x19, NMSSHTerminalActionExecute, state);
+    transitions_set(state, 0x1C, 0x1F, NMSSHTerminalActionExecute, state);
+}
+
+static void transitions_init(void) {
+    for (int state = 0; state < NMSSHTerminalStateCount; state++) {
+        transitions_set(state, 0x00, 0xFF, NMSSHTerminalActionNone, state);
+    }
+
+    NMSSHTerminalState ground = NMSSHTerminalStateGround;
+    transitions_set_controls(ground);
+    transitions_set(ground, 0x20, 0x7E, NMSSHTerminalActionPrint, ground);
+    transitions_set(ground, 0x80, 0xFF, NMSSHTerminalActionUTF8, ground);
+
+    NMSSHTerminalState escape = NMSSHTerminalStateEscape;
+    transitions_set_controls(escape);
+    transitions_set(escape, 0x20, 0x2F, NMSSHTerminalActionCollect, NMSSHTerminalStateEscapeIntermediate);
+    transitions_set(escape, 0x30, 0x7E, NMSSHTerminalActionEscDispatch, ground);
+    transitions_set(escape, 'P', 'P', NMSSHTerminalActionNone, NMSSHTerminalStateIgnoredString);
+    transitions_set(escape, 'X', 'X', NMSSHTerminalActionNone, NMSSHTerminalStateIgnoredString);
+    transitions_set(escape, '^', '_', NMSSHTerminalActionNone, NMSSHTerminalStateIgnoredString);
+    transitions_set(escape, '[', '[', NMSSHTerminalActionNone, NMSSHTerminalStateCsiEntry);
+    transitions_set(escape, ']', ']', NMSSHTerminalActionNone, NMSSHTerminalStateOscString);
+
+    NMSSHTerminalState escapeIntermediate = NMSSHTerminalStateEscapeIntermediate;
+    transitions_set_controls(escapeIntermediate);
+    transitions_set(escapeIntermediate, 0x20, 0x2F, NMSSHTerminalActionCollect, escapeIntermediate);
+    transitions_set(escapeIntermediate, 0x30, 0x7E, NMSSHTerminalActionEscDispatch, ground);
+
+    NMSSHTerminalState csiEntry = NMSSHTerminalStateCsiEntry;
+    transitions_set_controls(csiEntry);
+    transitions_set(csiEntry, 0x20, 0x2F, NMSSHTerminalActionCollect, NMSSHTerminalStateCsiIntermediate);
+    transitions_set(csiEntry, 0x30, 0x39, NMSSHTerminalActionParam, NMSSHTerminalStateCsiParam);
+    transitions_set(csiEntry, ':', ':', NMSSHTerminalActionNone, NMSSHTerminalStateCsiIgnore);
+    transitions_set(csiEntry, ';', ';', NMSSHTerminalActionParam, NMSSHTerminalStateCsiParam);
+    transitions_set(csiEntry, 0x3C, 0x3F, NMSSHTerminalActionCollect, NMSSHTerminalStateCsiParam);
+    transitions_set(csiEntry, 0x40, 0x7E, NMSSHTerminalActionCsiDispatch, ground);
+
+    NMSSHTerminalState csiParam = NMSSHTerminalStateCsiParam;
+    transitions_set_controls(csiParam);
+    transitions_set(csiParam, 0x20, 0x2F, NMSSHTerminalActionCollect, NMSSHTerminalStateCsiIntermediate);
+    transitions_set(csiParam, 0x30, 0x39, NMSSHTerminalActionParam, csiParam);
+    transitions_set(csiParam, ':', ':', NMSSHTerminalActionNone, NMSSHTerminalStateCsiIgnore);
+    transitions_set(csiParam, ';', ';', NMSSHTerminalActionParam, csiParam);
+    transitions_set(csiParam, 0x3C, 0x3F, NMSSHTerminalActionNone, NMSSHTerminalStateCsiIgnore);
+    transitions_set(csiParam, 0x40, 0x7E, NMSSHTerminalActionCsiDispatch, ground);
+
+    NMSSHTerminalState csiIntermediate = NMSSHTerminalStateCsiIntermediate;
+    transitions_set_controls(csiIntermediate);
+    transitions_set(csiIntermediate, 0x20, 0x2F, NMSSHTerminalActionCollect, csiIntermediate);
+    transitions_set(csiIntermediate, 0x30, 0x3F, NMSSHTerminalActionNone, NMSSHTerminalStateCsiIgnore);
+    transitions_set(csiIntermediate, 0x40, 0x7E, NMSSHTerminalActionCsiDispatch, ground);
+
+    NMSSHTerminalState csiIgnore = NMSSHTerminalStateCsiIgnore;
+    transitions_set_controls(csiIgnore);
+    transitions_set(csiIgnore, 0x40, 0x7E, NMSSHTerminalActionNone, ground);
+
+    // The title may be UTF-8, BEL ends the string like ST
+    NMSSHTerminalState oscString = NMSSHTerminalStateOscString;
+    transitions_set(oscString, 0x07, 0x07, NMSSHTerminalActionNone, ground);
+    transitions_set(oscString, 0x20, 0xFF, NMSSHTerminalActionOscPut, oscString);
+
+    // Controls valid in any state
+    for (int state = 0; state < NMSSHTerminalStateCount; state++) {
+        transitions_set(state, 0x18, 0x18, NMSSHTerminalActionExecute, ground);
+        transitions_set(state, 0x1A, 0x1A, NMSSHTerminalActionExecute, ground);
+        transitions_set(state, 0x1B, 0x1B, NMSSHTerminalActionNone, escape);
+    }
+}
+
+/** Cells of a screen, its rows are reordered through a map so scrolling copies no cell */
+typedef struct {
+    NMSSHTerminalCell *cells;
+    NSUInteger *rowMap;
+} NMSSHTerminalScreen;
+
+/** Cursor state saved by `DECSC` */
+typedef struct {
+    NSUInteger row;
+    NSUInteger column;
+    uint16_t foreground;
+    uint16_t background;
+    NMSSHTerminalAttributes attributes;
+    uint8_t charsets[2];
+    uint8_t activeCharset;
+    BOOL originMode;
+} NMSSHTerminalCursor;
+
+static void screen_init(NMSSHTerminalScreen *screen, NSUInteger columns, NSUInteger rows) {
+    NMSSHTerminalCell blank = { ' ', NMSSHTerminalDefaultColor, NMSSHTerminalDefaultColor, 0 };
+
+    screen->cells = malloc(columns * rows * sizeof(NMSSHTerminalCell));
+    screen->rowMap = malloc(rows * sizeof(NSUInteger));
+
+    for (NSUInteger i = 0; i < columns * rows; i++) {
+        screen->cells[i] = blank;
+    }
+
+    for (NSUInteger row = 0; row < rows; row++) {
+        screen->rowMap[row] = row;
+    }
+}
+
+static void screen_free(NMSSHTerminalScreen *screen) {
+    free(screen->cells);
+    free(screen->rowMap);
+    screen->cells = NULL;
+    screen->rowMap = NULL;
+}
+
+@interface NMSSHTerminal () {
+    NMSSHTerminalScreen _primary;
+    NMSSHTerminalScreen _alternate;
+    NMSSHTerminalScreen *_screen;
+
+    // Parser
+    NMSSHTerminalState _state;
+    NSInteger _params[NMSSH_TERMINAL_MAX_PARAMETERS];
+    NSUInteger _paramCount;
+    uint8_t _privateMarker;
+    uint8_t _intermediate;
+    uint32_t _codePoint;
+    NSUInteger _codePointRemaining;
+
+    // Graphic rendition and modes
+    uint16_t _foreground;
+    uint16_t _background;
+    NMSSHTerminalAttributes _attributes;
+    uint8_t _charsets[2];
+    uint8_t _activeCharset;
+    BOOL _wrapPending;
+    BOOL _autowrap;
+    BOOL _originMode;
+    BOOL _insertMode;
+    BOOL _newlineMode;
+    NSUInteger _scrollTop;
+    NSUInteger _scrollBottom;
+    BOOL *_tabStops;
+    NMSSHTerminalCursor _savedCursor;
+
+    // Changes not published yet
+    NSUInteger *_dirtyStart;
+    NSUInteger *_dirtyEnd;
+    NMSSHTerminalDirtyRegion *_regions;
+    NSUInteger *_scratchRows;
+    NSUInteger _publishedRow;
+    NSUInteger _publishedColumn;
+    BOOL _bellPending;
+}
+
+@property (nonatomic, readwrite) NMSSHChannelPtyTerminal type;
+@property (nonatomic, readwrite) NSUInteger columns;
+@property (nonatomic, readwrite) NSUInteger rows;
+@property (nonatomic, readwrite) NSUInteger cursorRow;
+@property (nonatomic, readwrite) NSUInteger cursorColumn;
+@property (nonatomic, readwrite, getter = isCursorVisible) BOOL cursorVisible;
+@property (nonatomic, readwrite, getter = isAlternateScreen) BOOL alternateScreen;
+@property (nonatomic, readwrite) BOOL applicationCursorKeys;
+@property (nonatomic, strong) NSString *title;
+@property (nonatomic, strong) NSMutableData *osc;
+@end
+
+@implementation NMSSHTerminal
+
+// -----------------------------------------------------------------------------
+#pragma mark - INITIALIZER
+// -----------------------------------------------------------------------------
+
++ (void)initialize {
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        transitions_init();
+    });
+}
+
+- (instancetype)initWithType:(NMSSHChannelPtyTerminal)type columns:(NSUInteger)columns rows:(NSUInteger)rows {
+    if ((self = [super init])) {
+        [self setType:type];
+        [self setOsc:[[NSMutableData alloc] init]];
+        [self allocateColumns:MAX(columns, 1) rows:MAX(rows, 1)];
+        [self reset];
+    }
+
+    return self;
+}
+
+- (void)dealloc {
+    [self freeBuffers];
+}
+
+/** Allocate empty screens and the buffers sized after them */
+- (void)allocateColumns:(NSUInteger)columns rows:(NSUInteger)rows {
+    _columns = columns;
+    _rows = rows;
+
+    screen_init(&_primary, columns, rows);
+    screen_init(&_alternate, columns, rows);
+    _screen = _alternateScreen ? &_alternate : &_primary;
+
+    _tabStops = calloc(columns, sizeof(BOOL));
+    _dirtyStart = malloc(rows * sizeof(NSUInteger));
+    _dirtyEnd = malloc(rows * sizeof(NSUInteger));
+    _regions = malloc(rows * sizeof(NMSSHTerminalDirtyRegion));
+    _scratchRows = malloc(rows * sizeof(NSUInteger));
+
+    for (NSUInteger column = 8; column < columns; column += 8) {
+        _tabStops[column] = YES;
+    }
+
+    [self markRowsDirtyFrom:0 to:rows - 1];
+}
+
+- (void)freeBuffers {
+    screen_free(&_primary);
+    screen_free(&_alternate);
+    free(_tabStops);
+    free(_dirtyStart);
+    free(_dirtyEnd);
+    free(_regions);
+    free(_scratchRows);
+}
+
+- (void)reset {
+    _state = NMSSHTerminalStateGround;
+    _codePointRemaining = 0;
+    [self.osc setLength:0];
+
+    _alternateScreen = NO;
+    _screen = &_primary;
+    _cursorVisible = YES;
+    _applicationCursorKeys = NO;
+    _newlineMode = NO;
+    [self softReset];
+
+    _cursorRow = 0;
+    _cursorColumn = 0;
+    [self eraseRowsFrom:0 to:_rows - 1];
+
+    memset(_tabStops, 0, _columns * sizeof(BOOL));
+    for (NSUInteger column = 8; column < _columns; column += 8) {
+        _tabStops[column] = YES;
+    }
+}
+
+/** Restore the modes and the rendition, like `DECSTR` */
+- (void)softReset {
+    _foreground = NMSSHTerminalDefaultColor;
+    _background = NMSSHTerminalDefaultColor;
+    _attributes = 0;
+    _charsets[0] = 'B';
+    _charsets[1] = 'B';
+    _activeCharset = 0;
+    _wrapPending = NO;
+    _autowrap = YES;
+    _originMode = NO;
+    _insertMode = NO;
+    _cursorVisible = YES;
+    _scrollTop = 0;
+    _scrollBottom = _rows - 1;
+    [self saveCursor];
+    _savedCursor.row = 0;
+    _savedCursor.column = 0;
+}
+
+// -----------------------------------------------------------------------------
+#pragma mark - PROCESS OUTPUT
+// -----------------------------------------------------------------------------
+
+- (void)processData:(NSData *)data {
+    const uint8_t *bytes = [data bytes];
+    NSUInteger length = [data length];
+    NSUInteger i = 0;
+
+    while (i < length) {
+        uint8_t byte = bytes[i];
+
+        // Runs of printable ASCII, most of the output, skip the state machine
+        if (_state == NMSSHTerminalStateGround && _codePointRemaining == 0 && byte >= 0x20 && byte < 0x7F) {
+            i += [self printASCII:bytes + i length:length - i];
+            continue;
+        }
+
+        uint8_t transition = kNMSSHTerminalTransitions[_state][byte];
+        NMSSHTerminalAction action = transition >> 4;
+        NMSSHTerminalState next = transition & 0x0F;
+
+        // A control interrupting a UTF-8 sequence
+        if (_codePointRemaining > 0 && action != NMSSHTerminalActionUTF8) {
+            _codePointRemaining = 0;
+            [self putCharacter:0xFFFD];
+        }
+
+        if (next != _state && _state == NMSSHTerminalStateOscString) {
+            [self dispatchOsc];
+        }
+
+        switch (action) {
+            case NMSSHTerminalActionNone:
+                break;
+            case NMSSHTerminalActionPrint:
+                [self putCharacter:byte];
+                break;
+            case NMSSHTerminalActionUTF8:
+                [self decodeUTF8:byte];
+                break;
+            case NMSSHTerminalActionExecute:
+                [self execute:byte];
+                break;
+            case NMSSHTerminalActionCollect:
+                if (byte >= 0x3C) {
+                    _privateMarker = byte;
+                }
+                else {
+                    // Sequences with several intermediates are not supported
+                    _intermediate = _intermediate ? 0xFF : byte;
+                }
+                break;
+            case NMSSHTerminalActionParam:
+                if (_paramCount == 0) {
+                    _paramCount = 1;
+                }
+
+                if (byte == ';') {
+                    if (_paramCount < NMSSH_TERMINAL_MAX_PARAMETERS) {
+                        _params[_paramCount++] = 0;
+                    }
+                }
+                else if (_params[_paramCount - 1] < 10000) {
+                    _params[_paramCount - 1] = _params[_paramCount - 1] * 10 + (byte - '0');
+                }
+                break;
+            case NMSSHTerminalActionEscDispatch:
+                [self dispatchEscape:byte];
+                break;
+            case NMSSHTerminalActionCsiDispatch:
+                [self dispatchCsi:byte];
+                break;
+            case NMSSHTerminalActionOscPut:
+                if ([self.osc length] < kNMSSHTerminalMaxStringLength) {
+                    [self.osc appendBytes:&byte length:1];
+                }
+                break;
+        }
+
+        if (next != _state) {
+            if (next == NMSSHTerminalStateEscape || next == NMSSHTerminalStateCsiEntry) {
+                _params[0] = 0;
+                _paramCount = 0;
+                _privateMarker = 0;
+                _intermediate = 0;
+            }
+            else if (next == NMSSHTerminalStateOscString) {
+                [self.osc setLength:0];
+            }
+
+            _state = next;
+        }
+
+        i++;
+    }
+
+    [self publishChanges];
+}
+
+/** Print printable ASCII characters, returns the number of bytes consumed */
+- (NSUInteger)printASCII:(const uint8_t *)bytes length:(NSUInteger)length {
+    NSUInteger count = 0;
+
+    while (count < length && bytes[count] >= 0x20 && bytes[count] < 0x7F) {
+        // Wrapping, inserting and translating take the slow path
+        if (_wrapPending || _insertMode || _charsets[_activeCharset] != 'B') {
+            [self putCharacter:bytes[count++]];
+            continue;
+        }
+
+        NMSSHTerminalCell *cells = [self cellsOfRow:_cursorRow];
+        NSUInteger start = _cursorColumn;
+        NSUInteger column = start;
+
+        while (count < length && column < _columns && bytes[count] >= 0x20 && bytes[count] < 0x7F) {
+            cells[column++] = (NMSSHTerminalCell){ bytes[count++], _foreground, _background, _attributes };
+        }
+
+        [self markRowDirty:_cursorRow from:start to:column];
+
+        if (column == _columns) {
+            _cursorColumn = _columns - 1;
+            _wrapPending = _autowrap;
+        }
+        else {
+            _cursorColumn = column;
+        }
+    }
+
+    return count;
+}
+
+- (void)putCharacter:(uint32_t)character {
+    if (_charsets[_activeCharset] == '0' && character >= 0x5F && character <= 0x7E) {
+        character = kNMSSHTerminalLineDrawing[character - 0x5F];
+    }
+
+    if (_wrapPending) {
+        _cursorColumn = 0;
+        _wrapPending = NO;
+        [self index];
+    }
+
+    NMSSHTerminalCell *cells = [self cellsOfRow:_cursorRow];
+
+    if (_insertMode) {
+        memmove(cells + _cursorColumn + 1, cells + _cursorColumn, (_columns - _cursorColumn - 1) * sizeof(NMSSHTerminalCell));
+        [self markRowDirty:_cursorRow from:_cursorColumn to:_columns];
+    }
+
+    cells[_cursorColumn] = (NMSSHTerminalCell){ character, _foreground, _background, _attributes };
+    [self markRowDirty:_cursorRow from:_cursorColumn to:_cursorColumn + 1];
+
+    if (_cursorColumn + 1 < _columns) {
+        _cursorColumn++;
+    }
+    else {
+        _wrapPending = _autowrap;
+    }
+}
+
+- (void)decodeUTF8:(uint8_t)byte {
+    if (_codePointRemaining > 0) {
+        if ((byte & 0xC0) == 0x80) {
+            _codePoint = (_codePoint << 6) | (byte & 0x3F);
+
+            if (--_codePointRemaining == 0) {
+                [self putCharacter:_codePoint];
+            }
+
+            return;
+        }
+
+        // A truncated sequence, the byte starts the next one
+        _codePointRemaining = 0;
+        [self putCharacter:0xFFFD];
+    }
+
+    if ((byte & 0xE0) == 0xC0) {
+        _codePoint = byte & 0x1F;
+        _codePointRemaining = 1;
+    }
+    else if ((byte & 0xF0) == 0xE0) {
+        _codePoint = byte & 0x0F;
+        _codePointRemaining = 2;
+    }
+    else if ((byte & 0xF8) == 0xF0) {
+        _codePoint = byte & 0x07;
+        _codePointRemaining = 3;
+    }
+    else {
+        [self putCharacter:0xFFFD];
+    }
+}
+
+- (void)execute:(uint8_t)byte {
+    switch (byte) {
+        case 0x07:
+            _bellPending = YES;
+            break;
+        case 0x08:
+            if (_cursorColumn > 0) {
+                _cursorColumn--;
+            }
+            _wrapPending = NO;
+            break;
+        case 0x09:
+            [self tabForward:1];
+            break;
+        case 0x0A:
+        case 0x0B:
+        case 0x0C:
+            [self index];
+            if (_newlineMode) {
+                _cursorColumn = 0;
+            }
+            _wrapPending = NO;
+            break;
+        case 0x0D:
+            _cursorColumn = 0;
+            _wrapPending = NO;
+            break;
+        case 0x0E:
+            _activeCharset = 1;
+            break;
+        case 0x0F:
+            _activeCharset = 0;
+            break;
+        default:
+            break;
+    }
+}
+
+- (void)dispatchEscape:(uint8_t)final {
+    if (_intermediate == '(' || _intermediate == ')') {
+        _charsets[_intermediate == '(' ? 0 : 1] = (final == '0') ? '0' : 'B';
+        return;
+    }
+
+    if (_intermediate == '#') {
+        // DECALN, fill the screen with E for alignment
+        if (final == '8') {
+            for (NSUInteger row = 0; row < _rows; row++) {
+                NMSSHTerminalCell *cells = [self cellsOfRow:row];
+                for (NSUInteger column = 0; column < _columns; column++) {
+                    cells[column] = (NMSSHTerminalCell){ 'E', NMSSHTerminalDefaultColor, NMSSHTerminalDefaultColor, 0 };
+                }
+            }
+            [self markRowsDirtyFrom:0 to:_rows - 1];
+        }
+        return;
+    }
+
+    if (_intermediate) {
+        return;
+    }
+
+    switch (final) {
+        case '7':
+            [self saveCursor];
+            break;
+        case '8':
+            [self restoreCursor];
+            break;
+        case 'D':
+            [self index];
+            _wrapPending = NO;
+            break;
+        case 'E':
+            [self index];
+            _cursorColumn = 0;
+            _wrapPending = NO;
+            break;
+        case 'H':
+            _tabStops[_cursorColumn] = YES;
+            break;
+        case 'M':
+            [self reverseIndex];
+            _wrapPending = NO;
+            break;
+        case 'c':
+            [self reset];
+            break;
+        default:
+            break;
+    }
+}
+
+- (void)dispatchCsi:(uint8_t)final {
+    if (_intermediate) {
+        if (_intermediate == '!' && final == 'p') {
+            [self softReset];
+        }
+        return;
+    }
+
+    if (_privateMarker == '?') {
+        if (final == 'h' || final == 'l') {
+            for (NSUInteger i = 0; i < _paramCount; i++) {
+                [self setPrivateMode:_params[i] enabled:(final == 'h')];
+            }
+        }
+        return;
+    }
+
+    if (_privateMarker == '>') {
+        if (final == 'c' && [self param:0 default:0] == 0) {
+            [self respond:(self.type == NMSSHChannelPtyTerminalXterm || self.type == NMSSHChannelPtyTerminalVT220) ? @"\033[>1;10;0c" : @"\033[>0;10;0c"];
+        }
+        return;
+    }
+
+    if (_privateMarker) {
+        return;
+    }
+
+    NSUInteger count = [self param:0 default:1];
+
+    switch (final) {
+        case '@':
+            [self insertCharacters:count];
+            break;
+        case 'A':
+            [self moveCursorToRow:(NSInteger)_cursorRow - (NSInteger)count column:_cursorColumn withinMargins:YES];
+            break;
+        case 'B':
+        case 'e':
+            [self moveCursorToRow:_cursorRow + count column:_cursorColumn withinMargins:YES];
+            break;
+        case 'C':
+        case 'a':
+            [self moveCursorToRow:_cursorRow column:_cursorColumn + count withinMargins:NO];
+            break;
+        case 'D':
+            [self moveCursorToRow:_cursorRow column:(NSInteger)_cursorColumn - (NSInteger)count withinMargins:NO];
+            break;
+        case 'E':
+            [self moveCursorToRow:_cursorRow + count column:0 withinMargins:YES];
+            break;
+        case 'F':
+            [self moveCursorToRow:(NSInteger)_cursorRow - (NSInteger)count column:0 withinMargins:YES];
+            break;
+        case 'G':
+        case '`':
+            [self moveCursorToRow:_cursorRow column:count - 1 withinMargins:NO];
+            break;
+        case 'H':
+        case 'f':
+            [self moveCursorToRow:[self param:0 default:1] - 1 + (_originMode ? _scrollTop : 0)
+                           column:[self param:1 default:1] - 1
+                    withinMargins:_originMode];
+            break;
+        case 'I':
+            [self tabForward:count];
+            break;
+        case 'J':
+            [self eraseInDisplay:[self param:0 default:0]];
+            break;
+        case 'K':
+            [self eraseInLine:[self param:0 default:0]];
+            break;
+        case 'L':
+            if (_cursorRow >= _scrollTop && _cursorRow <= _scrollBottom) {
+                [self scrollDownFrom:_cursorRow to:_scrollBottom count:count];
+                _cursorColumn = 0;
+                _wrapPending = NO;
+            }
+            break;
+        case 'M':
+            if (_cursorRow >= _scrollTop && _cursorRow <= _scrollBottom) {
+                [self scrollUpFrom:_cursorRow to:_scrollBottom count:count];
+                _cursorColumn = 0;
+                _wrapPending = NO;
+            }
+            break;
+        case 'P':
+            [self deleteCharacters:count];
+            break;
+        case 'S':
+            [self scrollUpFrom:_scrollTop to:_scrollBottom count:count];
+            break;
+        case 'T':
+            [self scrollDownFrom:_scrollTop to:_scrollBottom count:count];
+            break;
+        case 'X':
+            [self eraseRow:_cursorRow from:_cursorColumn to:MIN(_cursorColumn + count, _columns)];
+            _wrapPending = NO;
+            break;
+        case 'Z':
+            [self tabBackward:count];
+            break;
+        case 'c':
+            if ([self param:0 default:0] == 0) {
+                [self respond:[self deviceAttributes]];
+            }
+            break;
+        case 'd':
+            [self moveCursorToRow:count - 1 + (_originMode ? _scrollTop : 0) column:_cursorColumn withinMargins:_originMode];
+            break;
+        case 'g':
+            if ([self param:0 default:0] == 0) {
+                _tabStops[_cursorColumn] = NO;
+            }
+            else if ([self param:0 default:0] == 3) {
+                memset(_tabStops, 0, _columns * sizeof(BOOL));
+            }
+            break;
+        case 'h':
+        case 'l':
+            for (NSUInteger i = 0; i < _paramCount; i++) {
+                if (_params[i] == 4) {
+                    _insertMode = (final == 'h');
+                }
+                else if (_params[i] == 20) {
+                    _newlineMode = (final == 'h');
+                }
+            }
+            break;
+        case 'm':
+            [self selectGraphicRendition];
+            break;
+        case 'n':
+            if ([self param:0 default:0] == 5) {
+                [self respond:@"\033[0n"];
+            }
+            else if ([self param:0 default:0] == 6) {
+                NSUInteger row = _cursorRow - (_originMode ? _scrollTop : 0);
+                [self respond:[NSString stringWithFormat:@"\033[%lu;%luR", (unsigned long)row + 1, (unsigned long)_cursorColumn + 1]];
+            }
+            break;
+        case 'r': {
+            NSUInteger top = [self param:0 default:1];
+            NSUInteger bottom = MIN([self param:1 default:_rows], _rows);
+
+            if (top < bottom) {
+                _scrollTop = top - 1;
+                _scrollBottom = bottom - 1;
+                [self moveCursorToRow:(_originMode ? _scrollTop : 0) column:0 withinMargins:NO];
+            }
+            break;
+        }
+        case 's':
+            [self saveCursor];
+            break;
+        case 'u':
+            [self restoreCursor];
+            break;
+        default:
+            break;
+    }
+}
+
+- (void)setPrivateMode:(NSInteger)mode enabled:(BOOL)enabled {
+    switch (mode) {
+        case 1:
+            _applicationCursorKeys = enabled;
+            break;
+        case 6:
+            _originMode = enabled;
+            [self moveCursorToRow:(_originMode ? _scrollTop : 0) column:0 withinMargins:NO];
+            break;
+        case 7:
+            _autowrap = enabled;
+            break;
+        case 25:
+            _cursorVisible = enabled;
+            break;
+        case 47:
+        case 1047:
+            [self switchScreen:enabled];
+            break;
+        case 1048:
+            if (enabled) {
+                [self saveCursor];
+            }
+            else {
+                [self restoreCursor];
+            }
+            break;
+        case 1049:
+            if (enabled) {
+                [self saveCursor];
+                [self switchScreen:YES];
+                [self eraseRowsFrom:0 to:_rows - 1];
+            }
+            else {
+                [self switchScreen:NO];
+                [self restoreCursor];
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+- (void)selectGraphicRendition {
+    if (_paramCount == 0) {
+        _params[0] = 0;
+        _paramCount = 1;
+    }
+
+    for (NSUInteger i = 0; i < _paramCount; i++) {
+        NSInteger param = _params[i];
+
+        if (param >= 30 && param <= 37) {
+            _foreground = (uint16_t)(param - 30);
+        }
+        else if (param >= 40 && param <= 47) {
+            _background = (uint16_t)(param - 40);
+        }
+        else if (param >= 90 && param <= 97) {
+            _foreground = (uint16_t)(param - 90 + 8);
+        }
+        else if (param >= 100 && param <= 107) {
+            _background = (uint16_t)(param - 100 + 8);
+        }
+        else if (param == 38 || param == 48) {
+            // Extended colors, 5;index or 2;red;green;blue mapped to the color cube
+            uint16_t color;
+
+            if (i + 2 < _paramCount && _params[i + 1] == 5) {
+                color = (uint16_t)(_params[i + 2] & 0xFF);
+                i += 2;
+            }
+            else if (i + 4 < _paramCount && _params[i + 1] == 2) {
+                color = (uint16_t)(16 + 36 * ((MIN(_params[i + 2], 255) * 5 + 127) / 255)
+                           + 6 * ((MIN(_params[i + 3], 255) * 5 + 127) / 255)
+                           + ((MIN(_params[i + 4], 255) * 5 + 127) / 255));
+                i += 4;
+            }
+            else {
+                return;
+            }
+
+            if (param == 38) {
+                _foreground = color;
+            }
+            else {
+                _background = color;
+            }
+        }
+        else {
+            switch (param) {
+                case 0:
+                    _foreground = NMSSHTerminalDefaultColor;
+                    _background = NMSSHTerminalDefaultColor;
+                    _attributes = 0;
+                    break;
+                case 1: _attributes |= NMSSHTerminalAttributeBold; break;
+                case 2: _attributes |= NMSSHTerminalAttributeFaint; break;
+                case 3: _attributes |= NMSSHTerminalAttributeItalic; break;
+                case 4: _attributes |= NMSSHTerminalAttributeUnderline; break;
+                case 5: _attributes |= NMSSHTerminalAttributeBlink; break;
+                case 7: _attributes |= NMSSHTerminalAttributeInverse; break;
+                case 8: _attributes |= NMSSHTerminalAttributeInvisible; break;
+                case 9: _attributes |= NMSSHTerminalAttributeStrikethrough; break;
+                case 22: _attributes &= ~(NMSSHTerminalAttributeBold | NMSSHTerminalAttributeFaint); break;
+                case 23: _attributes &= ~NMSSHTerminalAttributeItalic; break;
+                case 24: _attributes &= ~NMSSHTerminalAttributeUnderline; break;
+                case 25: _attributes &= ~NMSSHTerminalAttributeBlink; break;
+                case 27: _attributes &= ~NMSSHTerminalAttributeInverse; break;
+                case 28: _attributes &= ~NMSSHTerminalAttributeInvisible; break;
+                case 29: _attributes &= ~NMSSHTerminalAttributeStrikethrough; break;
+                case 39: _foreground = NMSSHTerminalDefaultColor; break;
+                case 49: _background = NMSSHTerminalDefaultColor; break;
+                default: break;
+            }
+        }
+    }
+}
+
+- (void)dispatchOsc {
+    NSString *string = [[NSString alloc] initWithData:self.osc encoding:NSUTF8StringEncoding];
+    NSRange separator = [string rangeOfString:@";"];
+
+    if (separator.location == NSNotFound) {
+        return;
+    }
+
+    NSInteger command = [[string substringToIndex:separator.location] integerValue];
+
+    // Icon name and window title, or window title
+    if (command == 0 || command == 2) {
+        [self setTitle:[string substringFromIndex:NSMaxRange(separator)]];
+
+        if (self.delegate && [self.delegate respondsToSelector:@selector(terminal:didChangeTitle:)]) {
+            [self.delegate terminal:self didChangeTitle:self.title];
+        }
+    }
+}
+
+/** Reply to a primary device attributes query with the identity of the terminal type */
+- (NSString *)deviceAttributes {
+    switch (self.type) {
+        case NMSSHChannelPtyTerminalVT102:
+            return @"\033[?6c";
+        case NMSSHChannelPtyTerminalVT220:
+        case NMSSHChannelPtyTerminalXterm:
+            return @"\033[?62;1;2;6;7;8;9c";
+        default:
+            return @"\033[?1;2c";
+    }
+}
+
+- (void)respond:(NSString *)response {
+    if (self.responseHandler) {
+        self.responseHandler([response dataUsingEncoding:NSUTF8StringEncoding]);
+    }
+}
+
+- (NSUInteger)param:(NSUInteger)index default:(NSUInteger)defaultValue {
+    if (index >= _paramCount || _params[index] == 0) {
+        return defaultValue;
+    }
+
+    return (NSUInteger)_params[index];
+}
+
+// -----------------------------------------------------------------------------
+#pragma mark - SCREEN OPERATIONS
+// -----------------------------------------------------------------------------
+
+- (NMSSHTerminalCell *)cellsOfRow:(NSUInteger)row {
+    return _screen->cells + _screen->rowMap[row] * _columns;
+}
+
+- (void)markRowDirty:(NSUInteger)row from:(NSUInteger)start to:(NSUInteger)end {
+    if (start < _dirtyStart[row]) {
+        _dirtyStart[row] = start;
+    }
+
+    if (end > _dirtyEnd[row]) {
+        _dirtyEnd[row] = end;
+    }
+}
+
+- (void)markRowsDirtyFrom:(NSUInteger)top to:(NSUInteger)bottom {
+    for (NSUInteger row = top; row <= bottom; row++) {
+        _dirtyStart[row] = 0;
+        _dirtyEnd[row] = _columns;
+    }
+}
+
+- (void)eraseRow:(NSUInteger)row from:(NSUInteger)start to:(NSUInteger)end {
+    NMSSHTerminalCell *cells = [self cellsOfRow:row];
+    NMSSHTerminalCell blank = { ' ', NMSSHTerminalDefaultColor, _background, 0 };
+
+    for (NSUInteger column = start; column < end; column++) {
+        cells[column] = blank;
+    }
+
+    if (start < end) {
+        [self markRowDirty:row from:start to:end];
+    }
+}
+
+- (void)eraseRowsFrom:(NSUInteger)top to:(NSUInteger)bottom {
+    for (NSUInteger row = top; row <= bottom; row++) {
+        [self eraseRow:row from:0 to:_columns];
+    }
+}
+
+- (void)eraseInDisplay:(NSUInteger)mode {
+    if (mode == 0) {
+        [self eraseRow:_cursorRow from:_cursorColumn to:_columns];
+        if (_cursorRow + 1 < _rows) {
+            [self eraseRowsFrom:_cursorRow + 1 to:_rows - 1];
+        }
+    }
+    else if (mode == 1) {
+        if (_cursorRow > 0) {
+            [self eraseRowsFrom:0 to:_cursorRow - 1];
+        }
+        [self eraseRow:_cursorRow from:0 to:_cursorColumn + 1];
+    }
+    else if (mode == 2) {
+        [self eraseRowsFrom:0 to:_rows - 1];
+    }
+
+    _wrapPending = NO;
+}
+
+- (void)eraseInLine:(NSUInteger)mode {
+    if (mode == 0) {
+        [self eraseRow:_cursorRow from:_cursorColumn to:_columns];
+    }
+    else if (mode == 1) {
+        [self eraseRow:_cursorRow from:0 to:_cursorColumn + 1];
+    }
+    else if (mode == 2) {
+        [self eraseRow:_cursorRow from:0 to:_columns];
+    }
+
+    _wrapPending = NO;
+}
+
+- (void)insertCharacters:(NSUInteger)count {
+    NMSSHTerminalCell *cells = [self cellsOfRow:_cursorRow];
+    count = MIN(count, _columns - _cursorColumn);
+
+    memmove(cells + _cursorColumn + count, cells + _cursorColumn, (_columns - _cursorColumn - count) * sizeof(NMSSHTerminalCell));
+    [self eraseRow:_cursorRow from:_cursorColumn to:_cursorColumn + count];
+    [self markRowDirty:_cursorRow from:_cursorColumn to:_columns];
+    _wrapPending = NO;
+}
+
+- (void)deleteCharacters:(NSUInteger)count {
+    NMSSHTerminalCell *cells = [self cellsOfRow:_cursorRow];
+    count = MIN(count, _columns - _cursorColumn);
+
+    memmove(cells + _cursorColumn, cells + _cursorColumn + count, (_columns - _cursorColumn - count) * sizeof(NMSSHTerminalCell));
+    [self eraseRow:_cursorRow from:_columns - count to:_columns];
+    [self markRowDirty:_cursorRow from:_cursorColumn to:_columns];
+    _wrapPending = NO;
+}
+
+/** Scroll rows top to bottom up, blank lines enter at the bottom */
+- (void)scrollUpFrom:(NSUInteger)top to:(NSUInteger)bottom count:(NSUInteger)count {
+    NSUInteger *rowMap = _screen->rowMap;
+    NSUInteger height = bottom - top + 1;
+    count = MIN(count, height);
+
+    // Rotate the rows, the lines leaving at the top are recycled at the bottom
+    memcpy(_scratchRows, rowMap + top, count * sizeof(NSUInteger));
+    memmove(rowMap + top, rowMap + top + count, (height - count) * sizeof(NSUInteger));
+    memcpy(rowMap + bottom + 1 - count, _scratchRows, count * sizeof(NSUInteger));
+
+    [self eraseRowsFrom:bottom + 1 - count to:bottom];
+    [self markRowsDirtyFrom:top to:bottom];
+}
+
+/** Scroll rows top to bottom down, blank lines enter at the top */
+- (void)scrollDownFrom:(NSUInteger)top to:(NSUInteger)bottom count:(NSUInteger)count {
+    NSUInteger *rowMap = _screen->rowMap;
+    NSUInteger height = bottom - top + 1;
+    count = MIN(count, height);
+
+    memcpy(_scratchRows, rowMap + bottom + 1 - count, count * sizeof(NSUInteger));
+    memmove(rowMap + top + count, rowMap + top, (height - count) * sizeof(NSUInteger));
+    memcpy(rowMap + top, _scratchRows, count * sizeof(NSUInteger));
+
+    [self eraseRowsFrom:top to:top + count - 1];
+    [self markRowsDirtyFrom:top to:bottom];
+}
+
+/** Move the cursor down, scrolling at the bottom margin */
+- (void)index {
+    if (_cursorRow == _scrollBottom) {
+        [self scrollUpFrom:_scrollTop to:_scrollBottom count:1];
+    }
+    else if (_cursorRow + 1 < _rows) {
+        _cursorRow++;
+    }
+}
+
+/** Move the cursor up, scrolling at the top margin */
+- (void)reverseIndex {
+    if (_cursorRow == _scrollTop) {
+        [self scrollDownFrom:_scrollTop to:_scrollBottom count:1];
+    }
+    else if (_cursorRow > 0) {
+        _cursorRow--;
+    }
+}
+
+- (void)moveCursorToRow:(NSInteger)row column:(NSInteger)column withinMargins:(BOOL)withinMargins {
+    NSInteger top = 0;
+    NSInteger bottom = _rows - 1;
+
+    // Relative moves stop at the margins of the region the cursor is in
+    if (withinMargins && _cursorRow >= _scrollTop && _cursorRow <= _scrollBottom) {
+        top = _scrollTop;
+        bottom = _scrollBottom;
+    }
+
+    _cursorRow = MAX(top, MIN(row, bottom));
+    _cursorColumn = MAX(0, MIN(column, (NSInteger)_columns - 1));
+    _wrapPending = NO;
+}
+
+- (void)tabForward:(NSUInteger)count {
+    while (count-- > 0 && _cursorColumn + 1 < _columns) {
+        do {
+            _cursorColumn++;
+        } while (_cursorColumn + 1 < _columns && !_tabStops[_cursorColumn]);
+    }
+
+    _wrapPending = NO;
+}
+
+- (void)tabBackward:(NSUInteger)count {
+    while (count-- > 0 && _cursorColumn > 0) {
+        do {
+            _cursorColumn--;
+        } while (_cursorColumn > 0 && !_tabStops[_cursorColumn]);
+    }
+
+    _wrapPending = NO;
+}
+
+- (void)saveCursor {
+    _savedCursor = (NMSSHTerminalCursor){
+        _cursorRow, _cursorColumn, _foreground, _background, _attributes,
+        { _charsets[0], _charsets[1] }, _activeCharset, _originMode
+    };
+}
+
+- (void)restoreCursor {
+    _cursorRow = MIN(_savedCursor.row, _rows - 1);
+    _cursorColumn = MIN(_savedCursor.column, _columns - 1);
+    _foreground = _savedCursor.foreground;
+    _background = _savedCursor.background;
+    _attributes = _savedCursor.attributes;
+    _charsets[0] = _savedCursor.charsets[0];
+    _charsets[1] = _savedCursor.charsets[1];
+    _activeCharset = _savedCursor.activeCharset;
+    _originMode = _savedCursor.originMode;
+    _wrapPending = NO;
+}
+
+- (void)switchScreen:(BOOL)alternate {
+    if (alternate == _alternateScreen) {
+        return;
+    }
+
+    _alternateScreen = alternate;
+    _screen = alternate ? &_alternate : &_primary;
+    [self markRowsDirtyFrom:0 to:_rows - 1];
+}
+
+- (void)resizeColumns:(NSUInteger)columns rows:(NSUInteger)rows {
+    columns = MAX(columns, 1);
+    rows = MAX(rows, 1);
+
+    if (columns == _columns && rows == _rows) {
+        return;
+    }
+
+    // Drop lines at the top to keep the cursor on the screen
+    NSUInteger shift = (_cursorRow >= rows) ? _cursorRow - rows + 1 : 0;
+    NSUInteger oldColumns = _columns;
+    NSUInteger oldRows = _rows;
+    NMSSHTerminalScreen oldPrimary = _primary;
+    NMSSHTerminalScreen oldAlternate = _alternate;
+
+    _primary = (NMSSHTerminalScreen){ NULL, NULL };
+    _alternate = (NMSSHTerminalScreen){ NULL, NULL };
+    [self freeBuffers];
+    [self allocateColumns:columns rows:rows];
+
+    NMSSHTerminalScreen *screens[2][2] = { { &oldPrimary, &_primary }, { &oldAlternate, &_alternate } };
+    for (NSUInteger i = 0; i < 2; i++) {
+        NMSSHTerminalScreen *from = screens[i][0];
+        NMSSHTerminalScreen *to = screens[i][1];
+
+        for (NSUInteger row = 0; row < rows && row + shift < oldRows; row++) {
+            memcpy(to->cells + to->rowMap[row] * columns,
+                   from->cells + from->rowMap[row + shift] * oldColumns,
+                   MIN(columns, oldColumns) * sizeof(NMSSHTerminalCell));
+        }
+
+        screen_free(from);
+    }
+
+    _cursorRow -= shift;
+    _cursorColumn = MIN(_cursorColumn, columns - 1);
+    _savedCursor.row = MIN(_savedCursor.row, rows - 1);
+    _savedCursor.column = MIN(_savedCursor.column, columns - 1);
+    _scrollTop = 0;
+    _scrollBottom = rows - 1;
+    _wrapPending = NO;
+
+    [self publishChanges];
+}
+
+/** Tell the delegate about the changes since the last call and forget them */
+- (void)publishChanges {
+    NSUInteger count = 0;
+
+    for (NSUInteger row = 0; row < _rows; row++) {
+        if (_dirtyEnd[row] > _dirtyStart[row]) {
+            _regions[count++] = (NMSSHTerminalDirtyRegion){ row, NSMakeRange(_dirtyStart[row], _dirtyEnd[row] - _dirtyStart[row]) };
+        }
+
+        _dirtyStart[row] = NSUIntegerMax;
+        _dirtyEnd[row] = 0;
+    }
+
+    BOOL cursorMoved = (_cursorRow != _publishedRow || _cursorColumn != _publishedColumn);
+    _publishedRow = _cursorRow;
+    _publishedColumn = _cursorColumn;
+
+    if ((count > 0 || cursorMoved) && self.delegate && [self.delegate respondsToSelector:@selector(terminal:didUpdateRegions:count:)]) {
+        [self.delegate terminal:self didUpdateRegions:_regions count:count];
+    }
+
+    if (_bellPending) {
+        _bellPending = NO;
+
+        if (self.delegate && [self.delegate respondsToSelector:@selector(terminalDidRingBell:)]) {
+            [self.delegate terminalDidRingBell:self];
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+#pragma mark - READ THE SCREEN
+// -----------------------------------------------------------------------------
+
+- (NMSSHTerminalCell)cellAtRow:(NSUInteger)row column:(NSUInteger)column {
+    if (row >= _rows || column >= _columns) {
+        return (NMSSHTerminalCell){ ' ', NMSSHTerminalDefaultColor, NMSSHTerminalDefaultColor, 0 };
+    }
+
+    return [self cellsOfRow:row][column];
+}
+
+- (void)getCells:(NMSSHTerminalCell *)cells row:(NSUInteger)row range:(NSRange)range {
+    memcpy(cells, [self cellsOfRow:row] + range.location, range.length * sizeof(NMSSHTerminalCell));
+}
+
+- (NSString *)stringForRow:(NSUInteger)row {
+    if (row >= _rows) {
+        return @"";
+    }
+
+    NMSSHTerminalCell *cells = [self cellsOfRow:row];
+    NSUInteger length = _columns;
+
+    while (length > 0 && cells[length - 1].character == ' ') {
+        length--;
+    }
+
+    uint32_t *characters = malloc(MAX(length, 1) * sizeof(uint32_t));
+    for (NSUInteger column = 0; column < length; column++) {
+        characters[column] = NSSwapHostIntToLittle(cells[column].character);
+    }
+
+    NSString *string = [[NSString alloc] initWithBytes:characters length:length * sizeof(uint32_t) encoding:NSUTF32LittleEndianStringEncoding];
+    free(characters);
+
+    return string ?: @"";
+}
+
+@end
@@ -0,0 +1,130 @@
+#import "NMSSH.h"
+
+typedef NS_ENUM(NSInteger, NMSSHTunnelDirection) {
+    /** Connections accepted on a local port are forwarded through the server, like `ssh -L` */
+    NMSSHTunnelDirectionLocal,
+    /** Connections accepted by the server are forwarded to a local endpoint, like `ssh -R` */
+    NMSSHTunnelDirectionRemote
+};
+
+/**
+ NMSSHTunnel forwards TCP connections through a session in either direction.
+
+ Local tunnels are created with `-[NMSSHSession forwardLocalPort:toHost:port:]`,
+ each connection accepted on the local port gets a `direct-tcpip` channel of
+ its own:
+
+    NMSSHTunnel *tunnel = [session forwardLocalPort:0 toHost:@"db.internal" port:5432];
+    NSLog(@"Connect to 127.0.0.1:%lu", (unsigned long)tunnel.localPort);
+
+ Remote tunnels are created with
+ `-[NMSSHSession forwardRemotePort:toHost:port:completion:]`, the server
+ listens on `remotePort` and each channel it opens is connected to
+ `localHost`:`localPort`. Accepting channels is one more asynchronous
+ operation of the session, multiplexed with its other channels.
+
+ Connections are relayed on the session queue without blocking any thread.
+
+ Data is read into buffers shared by all the connections of the session and
+ written to the other side from the same buffer. A connection holds no buffer
+ while idle, reads from a side stop while the other side can't take more, so
+ the channel window paces the local sockets. The number of concurrent
+ connections is bounded by the process descriptor limit.
+
+ The session must be authenticated and only used through its asynchronous
+ API while tunnels are open.
+ */
+@interface NMSSHTunnel : NSObject
+
+/// ----------------------------------------------------------------------------
+/// @name Initialize a new tunnel
+/// ----------------------------------------------------------------------------
+
+- (nonnull instancetype)init NS_UNAVAILABLE;
+
+/**
+ Listen on a local port and forward the connections through a session.
+
+ @param session An authenticated session
+ @param localPort Port to listen on at 127.0.0.1, 0 for any free port
+ @param remoteHost Host the server connects to
+ @param remotePort Port the server connects to
+ @returns NMSSHTunnel instance, nil if the port could not be bound
+ */
+- (nullable instancetype)initWithSession:(nonnull NMSSHSession *)session
+                               localPort:(NSUInteger)localPort
+                              remoteHost:(nonnull NSString *)remoteHost
+                              remotePort:(NSUInteger)remotePort NS_DESIGNATED_INITIALIZER;
+
+/**
+ Ask the server to listen on a port and forward the connections it accepts
+ to a local endpoint.
+
+ The server decides which of its interfaces it listens on, OpenSSH only
+ listens on the loopback interface unless `GatewayPorts` is enabled.
+
+ @param session An authenticated session
+ @param remotePort Port the server listens on, 0 to let the server pick one
+ @param localHost Host the forwarded connections are made to
+ @param localPort Port the forwarded connections are made to
+ @param completion The block called once the server listens or refused to
+ @returns NMSSHTunnel instance, nil if localHost could not be resolved
+ */
+- (nullable instancetype)initWithSession:(nonnull NMSSHSession *)session
+                              remotePort:(NSUInteger)remotePort
+                               localHost:(nonnull NSString *)localHost
+                               localPort:(NSUInteger)localPort
+                              completion:(void (^_Nullable)(BOOL success, NSError *_Nullable error))completion NS_DESIGNATED_INITIALIZER;
+
+/// ----------------------------------------------------------------------------
+/// @name Tunnel settings
+/// ----------------------------------------------------------------------------
+
+/** The session the connections are forwarded through */
+@property (nonatomic, nullable, readonly, weak) NMSSHSession *session;
+
+/** Whether connections are accepted locally or by the server */
+@property (nonatomic, readonly) NMSSHTunnelDirection direction;
+
+/** The local address, 127.0.0.1 for local tunnels */
+@property (nonatomic, nonnull, readonly) NSString *localHost;
+
+/** The local port, the one listened on for local tunnels */
+@property (nonatomic, readonly) NSUInteger localPort;
+
+/** Host the server connects to, nil for remote tunnels */
+@property (nonatomic, nullable, readonly) NSString *remoteHost;
+
+/** The remote port, the one the server listens on for remote tunnels once it listens */
+@property (nonatomic, readonly) NSUInteger remotePort;
+
+/** A Boolean value indicating whether the tunnel accepts connections (read-only). */
+@property (atomic, readonly, getter = isOpen) BOOL open;
+
+/// ----------------------------------------------------------------------------
+/// @name Statistics
+/// ----------------------------------------------------------------------------
+
+/** Bytes forwarded from the local side to the remote side, open connections included */
+@property (nonatomic, readonly) uint64_t bytesSent;
+
+/** Bytes forwarded from the remote side to the local side, open connections included */
+@property (nonatomic, readonly) uint64_t bytesReceived;
+
+/** Number of connections being forwarded */
+@property (nonatomic, readonly) NSUInteger activeConnections;
+
+/** Number of connections accepted since the tunnel was opened */
+@property (nonatomic, readonly) NSUInteger totalConnections;
+
+/// ----------------------------------------------------------------------------
+/// @name Close the tunnel
+/// ----------------------------------------------------------------------------
+
+/**
+ Stop listening and close the forwarded connections. A remote tunnel cancels
+ the forwarding on the server. This method can be called from any thread.
+ */
+- (void)close;
+
+@end
@@ -0,0 +1,482 @@
+#import "NMSSHTunnel.h"
+#import "NMSSH+Protected.h"
+#import "NMSSHSocketRelay.h"
+
+@interface NMSSHTunnel ()
+@property (nonatomic, weak) NMSSHSession *session;
+@property (nonatomic, assign) NMSSHTunnelDirection direction;
+@property (nonatomic, strong) NSString *localHost;
+@property (nonatomic, assign) NSUInteger localPort;
+@property (nonatomic, strong) NSString *remoteHost;
+@property (nonatomic, assign) NSUInteger remotePort;
+@property (atomic, readwrite, getter = isOpen) BOOL open;
+
+@property (nonatomic, assign) int listenSocket;
+@property (nonatomic, strong) NSData *localAddress;
+@property (nonatomic, weak) NMSSHOperation *listenOperation;
+@property (nonatomic, strong) NSMutableSet *relays;
+@property (nonatomic, assign) NSUInteger acceptedConnections;
+@property (nonatomic, assign) uint64_t closedBytesSent;
+@property (nonatomic, assign) uint64_t closedBytesReceived;
+
+#if OS_OBJECT_USE_OBJC
+@property (nonatomic, strong) dispatch_source_t acceptSource;
+#else
+@property (nonatomic, assign) dispatch_source_t acceptSource;
+#endif
+@end
+
+@implementation NMSSHTunnel
+
+// -----------------------------------------------------------------------------
+#pragma mark - INITIALIZE A NEW TUNNEL
+// -----------------------------------------------------------------------------
+
+- (instancetype)initWithSession:(NMSSHSession *)session
+                      localPort:(NSUInteger)localPort
+                     remoteHost:(NSString *)remoteHost
+                     remotePort:(NSUInteger)remotePort {
+    if ((self = [super init])) {
+        [self setSession:session];
+        [self setDirection:NMSSHTunnelDirectionLocal];
+        [self setLocalHost:@"127.0.0.1"];
+        [self setRemoteHost:remoteHost];
+        [self setRemotePort:remotePort];
+        [self setRelays:[[NSMutableSet alloc] init]];
+        [self setListenSocket:-1];
+
+        if (![self listenOnPort:localPort]) {
+            return nil;
+        }
+
+        NMSSHLogInfo(@"Forwarding port %lu to %@:%lu through %@",
+                     (unsigned long)self.localPort, remoteHost, (unsigned long)remotePort, session.host);
+    }
+
+    return self;
+}
+
+- (instancetype)initWithSession:(NMSSHSession *)session
+                     remotePort:(NSUInteger)remotePort
+                      localHost:(NSString *)localHost
+                      localPort:(NSUInteger)localPort
+                     completion:(void (^)(BOOL, NSError *))completion {
+    if ((self = [super init])) {
+        [self setSession:session];
+        [self setDirection:NMSSHTunnelDirectionRemote];
+        [self setLocalHost:localHost];
+        [self setLocalPort:localPort];
+        [self setRemotePort:remotePort];
+        [self setRelays:[[NSMutableSet alloc] init]];
+        [self setListenSocket:-1];
+
+        // Resolved once, every forwarded channel connects to the same address
+        if (![self resolveLocalAddress]) {
+            return nil;
+        }
+
+        [self startRemoteListenerWithCompletion:completion];
+    }
+
+    return self;
+}
+
+- (void)dealloc {
+    [self closeListener];
+    [self.listenOperation cancel];
+
+    // Relays only reference the tunnel weakly
+    for (NMSSHSocketRelay *relay in self.relays) {
+        [relay close];
+    }
+}
+
+// -----------------------------------------------------------------------------
+#pragma mark - LISTENER
+// -----------------------------------------------------------------------------
+
+- (BOOL)listenOnPort:(NSUInteger)port {
+    int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sock < 0) {
+        NMSSHLogError(@"Error creating the listening socket: %s", strerror(errno));
+        return NO;
+    }
+
+    int set = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (void *)&set, sizeof(set));
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_len = sizeof(address);
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (bind(sock, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(sock, SOMAXCONN) != 0) {
+        NMSSHLogError(@"Unable to listen on port %lu: %s", (unsigned long)port, strerror(errno));
+        close(sock);
+        return NO;
+    }
+
+    socklen_t length = sizeof(address);
+    getsockname(sock, (struct sockaddr *)&address, &length);
+    [self setLocalPort:ntohs(address.sin_port)];
+
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+    [self setListenSocket:sock];
+
+    __weak NMSSHTunnel *weakSelf = self;
+    [self setAcceptSource:dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, sock, 0, self.session.sessionQueue)];
+    dispatch_source_set_event_handler(self.acceptSource, ^{
+        [weakSelf acceptConnections];
+    });
+    dispatch_resume(self.acceptSource);
+
+    [self setOpen:YES];
+
+    return YES;
+}
+
+- (BOOL)resolveLocalAddress {
+    CFHostRef host = CFHostCreateWithName(kCFAllocatorDefault, (__bridge CFStringRef)self.localHost);
+    if (!host) {
+        NMSSHLogError(@"Error allocating CFHost for %@", self.localHost);
+        return NO;
+    }
+
+    CFStreamError error;
+    NSData *addressData = nil;
+
+    if (CFHostStartInfoResolution(host, kCFHostAddresses, &error)) {
+        NSArray *addresses = (__bridge NSArray *)CFHostGetAddressing(host, NULL);
+        addressData = [[addresses firstObject] copy];
+    }
+
+    CFRelease(host);
+
+    if ([addressData length] == sizeof(struct sockaddr_in)) {
+        NSMutableData *address = [addressData mutableCopy];
+        ((struct sockaddr_in *)[address mutableBytes])->sin_port = htons(self.localPort);
+        [self setLocalAddress:address];
+    }
+    else if ([addressData length] == sizeof(struct sockaddr_in6)) {
+        NSMutableData *address = [addressData mutableCopy];
+        ((struct sockaddr_in6 *)[address mutableBytes])->sin6_port = htons(self.localPort);
+        [self setLocalAddress:address];
+    }
+    else {
+        NMSSHLogError(@"Unable to resolve host %@", self.localHost);
+        return NO;
+    }
+
+    return YES;
+}
+
+- (void)acceptConnections {
+    NMSSHSession *session = self.session;
+
+    while (self.listenSocket >= 0) {
+        int sock = accept(self.listenSocket, NULL, NULL);
+
+        if (sock < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+
+            if (errno != EAGAIN) {
+                NMSSHLogWarn(@"Error accepting a connection on port %lu: %s", (unsigned long)self.localPort, strerror(errno));
+            }
+
+            return;
+        }
+
+        if (!session.rawSession) {
+            NMSSHLogWarn(@"Session disconnected, refusing a connection on port %lu", (unsigned long)self.localPort);
+            close(sock);
+            continue;
+        }
+
+        int set = 1;
+        setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, (void *)&set, sizeof(set));
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (void *)&set, sizeof(set));
+
+        NMSSHSocketRelay *relay = [[NMSSHSocketRelay alloc] initWithSession:session
+                                                                     socket:sock
+                                                                       host:self.remoteHost
+                                                                       port:self.remotePort];
+        [self.relays addObject:relay];
+        [self setAcceptedConnections:self.acceptedConnections + 1];
+
+        __weak NMSSHTunnel *weakSelf = self;
+        __weak NMSSHSocketRelay *weakRelay = relay;
+        [relay startWithCompletion:^(NSError *error) {
+            [weakSelf relayClosed:weakRelay];
+        }];
+    }
+}
+
+// -----------------------------------------------------------------------------
+#pragma mark - REMOTE LISTENER
+// -----------------------------------------------------------------------------
+
+- (void)startRemoteListenerWithCompletion:(void (^)(BOOL, NSError *))completion {
+    NMSSHSession *session = self.session;
+    __weak NMSSHTunnel *weakSelf = self;
+
+    __block LIBSSH2_LISTENER *listener = NULL;
+    __block BOOL pending = NO;
+    __block BOOL listening = NO;
+    __block BOOL acceptable = YES;
+    __block uint64_t seenReceiveCount = 0;
+    __block NSError *failure = nil;
+
+    NMSSHOperation *operation = [NMSSHOperation operationWithSession:session step:^NMSSHOperationStatus(NMSSHOperation *operation) {
+        NMSSHSession *session = operation.session;
+        NMSSHTunnel *tunnel = weakSelf;
+        NSError *error = failure ?: operation.abortError;
+        BOOL progress = NO;
+
+        // The listener went away with the session
+        if (!session.rawSession) {
+            listener = NULL;
+            pending = NO;
+        }
+
+        if (!tunnel && !error) {
+            error = [NMSSHOperation errorWithCode:NMSSHOperationCancelledError description:@"Tunnel released"];
+        }
+
+        // A listen request already sent must complete before it can be cancelled
+        if ((!error && !listener) || pending) {
+            if (![session acquireRequestLockForOperation:operation]) {
+                return NMSSHOperationStatusBlocked;
+            }
+
+            int boundPort = 0;
+            listener = libssh2_channel_forward_listen_ex(session.rawSession, NULL, (int)tunnel.remotePort, &boundPort, 16);
+            if ((pending = (!listener && libssh2_session_last_errno(session.rawSession) == LIBSSH2_ERROR_EAGAIN))) {
+                return NMSSHOperationStatusBlocked;
+            }
+
+            [session releaseRequestLockForOperation:operation];
+
+            if (!listener) {
+                error = error ?: [NMSSHOperation errorWithCode:NMSSHOperationFailedError
+                                                   description:[NSString stringWithFormat:@"Unable to listen on port %lu", (unsigned long)tunnel.remotePort]];
+                NMSSHLogError(@"The server refused to listen on port %lu: %@",
+                              (unsigned long)tunnel.remotePort, [[session lastError] localizedDescription]);
+            }
+            else if (!error) {
+                NMSSHLogInfo(@"Forwarding port %d of %@ to %@:%lu",
+                             boundPort, session.host, tunnel.localHost, (unsigned long)tunnel.localPort);
+                [tunnel setRemotePort:boundPort];
+                [tunnel setOpen:YES];
+                listening = YES;
+                progress = YES;
+
+                if (completion) {
+                    [session dispatchCallback:^{
+                        completion(YES, nil);
+                    }];
+                }
+            }
+        }
+
+        // Channels only arrive when the session socket got data
+        while (!error) {
+            uint64_t receiveCount = session.receiveCount;
+            if (receiveCount != seenReceiveCount) {
+                seenReceiveCount = receiveCount;
+                acceptable = YES;
+            }
+
+            if (!acceptable) {
+                return NMSSHOperationStatusForProgress(progress);
+            }
+
+            LIBSSH2_CHANNEL *channel = libssh2_channel_forward_accept(listener);
+            if (!channel) {
+                if (libssh2_session_last_errno(session.rawSession) != LIBSSH2_ERROR_EAGAIN) {
+                    NMSSHLogError(@"Error accepting a forwarded channel: %@", [[session lastError] localizedDescription]);
+                    error = [session lastError];
+                    break;
+                }
+
+                acceptable = NO;
+                continue;
+            }
+
+            [tunnel relayForwardedChannel:channel];
+            progress = YES;
+        }
+
+        // Stay down while the cancellation is sent
+        failure = error;
+
+        if (listener) {
+            int rc = libssh2_channel_forward_cancel(listener);
+            if (rc == LIBSSH2_ERROR_EAGAIN) {
+                return NMSSHOperationStatusForProgress(progress);
+            }
+
+            listener = NULL;
+        }
+
+        [tunnel setOpen:NO];
+
+        if (!listening && completion) {
+            [session dispatchCallback:^{
+                completion(NO, error);
+            }];
+        }
+
+        return NMSSHOperationStatusDone;
+    }];
+
+    [self setListenOperation:operation];
+    [session startOperation:operation];
+}
+
+- (void)relayForwardedChannel:(LIBSSH2_CHANNEL *)channel {
+    NMSSHSession *session = self.session;
+    const struct sockaddr *address = [self.localAddress bytes];
+
+    int sock = socket(address->sa_family, SOCK_STREAM, IPPROTO_TCP);
+    if (sock >= 0) {
+        int set = 1;
+        setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, (void *)&set, sizeof(set));
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (void *)&set, sizeof(set));
+        fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+
+        // The relay waits for the connection to complete
+        if (connect(sock, address, (socklen_t)[self.localAddress length]) != 0 && errno != EINPROGRESS) {
+            NMSSHLogWarn(@"Unable to connect to %@:%lu: %s", self.localHost, (unsigned long)self.localPort, strerror(errno));
+            close(sock);
+            sock = -1;
+        }
+    }
+
+    NMSSHSocketRelay *relay = [[NMSSHSocketRelay alloc] initWithSession:session
+                                                                channel:channel
+                                                                 socket:sock
+                                                                   host:self.localHost
+                                                                   port:self.localPort];
+    [self.relays addObject:relay];
+    [self setAcceptedConnections:self.acceptedConnections + 1];
+
+    __weak NMSSHTunnel *weakSelf = self;
+    __weak NMSSHSocketRelay *weakRelay = relay;
+    [relay startWithCompletion:^(NSError *error) {
+        [weakSelf relayClosed:weakRelay];
+    }];
+}
+
+- (void)relayClosed:(NMSSHSocketRelay *)relay {
+    if (relay && [self.relays containsObject:relay]) {
+        [self setClosedBytesSent:self.closedBytesSent + relay.bytesSent];
+        [self setClosedBytesReceived:self.closedBytesReceived + relay.bytesReceived];
+        [self.relays removeObject:relay];
+    }
+}
+
+- (void)closeListener {
+    int sock = self.listenSocket;
+    [self setListenSocket:-1];
+
+    // The source watches the descriptor until its cancel handler ran
+    if (self.acceptSource) {
+        if (sock >= 0) {
+            dispatch_source_set_cancel_handler(self.acceptSource, ^{
+                close(sock);
+            });
+            sock = -1;
+        }
+
+        dispatch_source_cancel(self.acceptSource);
+#if !(OS_OBJECT_USE_OBJC)
+        dispatch_release(self.acceptSource);
+#endif
+        [self setAcceptSource:nil];
+    }
+
+    if (sock >= 0) {
+        close(sock);
+    }
+
+    [self setOpen:NO];
+}
+
+- (void)close {
+    [self performOnSessionQueue:^{
+        if (self.isOpen) {
+            NMSSHLogInfo(@"Closing the tunnel on port %lu", (unsigned long)self.localPort);
+        }
+
+        [self closeListener];
+        [self.listenOperation cancel];
+
+        for (NMSSHSocketRelay *relay in [self.relays allObjects]) {
+            [relay close];
+        }
+    }];
+}
+
+/** The relays are only touched on the session queue */
+- (void)performOnSessionQueue:(dispatch_block_t)block {
+    NMSSHSession *session = self.session;
+
+    if (session) {
+        [session performSyncOnSessionQueue:block];
+    }
+    else {
+        block();
+    }
+}
+
+// -----------------------------------------------------------------------------
+#pragma mark - STATISTICS
+// -----------------------------------------------------------------------------
+
+- (uint64_t)bytesSent {
+    __block uint64_t bytes = 0;
+    [self performOnSessionQueue:^{
+        bytes = self.closedBytesSent;
+        for (NMSSHSocketRelay *relay in self.relays) {
+            bytes += relay.bytesSent;
+        }
+    }];
+
+    return bytes;
+}
+
+- (uint64_t)bytesReceived {
+    __block uint64_t bytes = 0;
+    [self performOnSessionQueue:^{
+        bytes = self.closedBytesReceived;
+        for (NMSSHSocketRelay *relay in self.relays) {
+            bytes += relay.bytesReceived;
+        }
+    }];
+
+    return bytes;
+}
+
+- (NSUInteger)activeConnections {
+    __block NSUInteger count = 0;
+    [self performOnSessionQueue:^{
+        count = [self.relays count];
+    }];
+
+    return count;
+}
+
+- (NSUInteger)totalConnections {
+    __block NSUInteger count = 0;
+    [self performOnSessionQueue:^{
+        count = self.acceptedConnections;
+    }];
+
+    return count;
+}
+
+@end
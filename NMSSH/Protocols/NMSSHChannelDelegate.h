@@ -12,6 +12,9 @@
 /**
  Called when a channel read new data on the socket.
 
+ The output is decoded as a stream: a character split between two reads is
+ delivered with the second one.
+
  @param channel The channel that read the message
  @param message The message that the channel has read
  */
@@ -48,4 +51,12 @@
  */
 - (void)channelShellDidClose:(nonnull NMSSHChannel *)channel;
 
+/**
+ Called when the shell input queue has been written entirely after
+ `writeData:completion:` returned NO.
+
+ @param channel The channel whose write queue drained
+ */
+- (void)channelDidDrainWriteQueue:(nonnull NMSSHChannel *)channel;
+
 @end
@@ -0,0 +1,51 @@
+#import "NMSSH.h"
+
+@class NMSSHTerminal;
+
+/** Cells of a screen row changed by the output processed last */
+typedef struct {
+    /** Row of the screen, 0 being the top row */
+    NSUInteger row;
+    /** Columns of the row that changed */
+    NSRange columns;
+} NMSSHTerminalDirtyRegion;
+
+/**
+ Protocol for registering to receive the changes of an NMSSHTerminal screen.
+
+ The messages are sent on the queue feeding the terminal, the shell queue of
+ the channel when the terminal is attached to one. The screen must be read
+ from that queue, in these messages.
+ */
+@protocol NMSSHTerminalDelegate <NSObject>
+@optional
+
+/**
+ Called once a chunk of output has been processed, if it changed the screen
+ or moved the cursor.
+
+ Only the cells that changed are reported, in one region per row sorted by
+ row. A scroll reports every row of the scrolled region.
+
+ @param terminal The terminal that changed
+ @param regions The changed regions, only valid during the call
+ @param count Number of regions, 0 if only the cursor moved
+ */
+- (void)terminal:(nonnull NMSSHTerminal *)terminal didUpdateRegions:(nonnull const NMSSHTerminalDirtyRegion *)regions count:(NSUInteger)count;
+
+/**
+ Called when the remote program sets the window title.
+
+ @param terminal The terminal whose title changed
+ @param title The new title
+ */
+- (void)terminal:(nonnull NMSSHTerminal *)terminal didChangeTitle:(nonnull NSString *)title;
+
+/**
+ Called when the remote program rings the bell.
+
+ @param terminal The terminal that received the bell
+ */
+- (void)terminalDidRingBell:(nonnull NMSSHTerminal *)terminal;
+
+@end
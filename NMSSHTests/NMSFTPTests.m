@@ -204,4 +204,50 @@
     XCTAssertTrue([sftp removeDirectoryAtPath:destDirectoryPath], @"Remove directory");
 }
 
+// -----------------------------------------------------------------------------
+// ASYNCHRONOUS API TESTS
+// -----------------------------------------------------------------------------
+
+- (void)testAsyncWriteReadAndRemoveFile {
+    NSString *path = [NSString stringWithFormat:@"%@async_file_test.txt",
+                      [settings objectForKey:@"writable_dir"]];
+    NSData *contents = [@"Hello World" dataUsingEncoding:NSUTF8StringEncoding];
+
+    NMSFTP *asyncSFTP = [[NMSFTP alloc] initWithSession:session];
+
+    XCTestExpectation *removed = [self expectationWithDescription:@"File removed"];
+    [asyncSFTP connectWithCompletion:^(BOOL success, NSError *error) {
+        XCTAssertTrue(success, @"Asynchronous connection should work: %@", error);
+
+        [asyncSFTP writeContents:contents toFileAtPath:path progress:nil completion:^(BOOL success, NSError *error) {
+            XCTAssertTrue(success, @"Write contents to file: %@", error);
+
+            [asyncSFTP contentsAtPath:path progress:nil completion:^(NSData *readContents, NSError *error) {
+                XCTAssertEqualObjects(readContents, contents, @"Read contents at path");
+
+                [asyncSFTP removeFileAtPath:path completion:^(BOOL success, NSError *error) {
+                    XCTAssertTrue(success, @"Remove file: %@", error);
+                    [removed fulfill];
+                }];
+            }];
+        }];
+    }];
+
+    [self waitForExpectationsWithTimeout:30 handler:nil];
+}
+
+- (void)testAsyncReadingMissingFileFails {
+    NSString *path = [NSString stringWithFormat:@"%@missing_file_test.txt",
+                      [settings objectForKey:@"non_writable_dir"]];
+
+    XCTestExpectation *failed = [self expectationWithDescription:@"Read failed"];
+    [sftp contentsAtPath:path progress:nil completion:^(NSData *contents, NSError *error) {
+        XCTAssertNil(contents, @"Missing file has no contents");
+        XCTAssertNotNil(error, @"Reading a missing file reports an error");
+        [failed fulfill];
+    }];
+
+    [self waitForExpectationsWithTimeout:30 handler:nil];
+}
+
 @end
\ No newline at end of file
@@ -2,13 +2,16 @@
 #import "ConfigHelper.h"
 
 #import <NMSSH/NMSSH.h>
+#import <fcntl.h>
 
-@interface NMSSHChannelTests () {
+@interface NMSSHChannelTests () <NMSSHChannelDelegate> {
     NSDictionary *settings;
     NSString *localFilePath;
 
     NMSSHChannel *channel;
     NMSSHSession *session;
+
+    XCTestExpectation *drained;
 }
 @end
 
@@ -73,6 +76,294 @@
                          @"Execution returns the expected response");
 }
 
+- (void)testExecutingShellCommandWithSubSecondTimeout {
+    channel = [[NMSSHChannel alloc] initWithSession:session];
+
+    NSError *error = nil;
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+    [channel execute:@"sleep 5" error:&error timeout:@0.5];
+
+    XCTAssertEqual(error.code, NMSSHChannelExecutionTimeout, @"Execution past a sub-second timeout times out");
+    XCTAssertLessThan(CFAbsoluteTimeGetCurrent() - start, 2.0, @"Execution gives up soon after the timeout");
+}
+
+// -----------------------------------------------------------------------------
+// ASYNCHRONOUS EXECUTION TESTS
+// -----------------------------------------------------------------------------
+
+- (void)testExecutingShellCommandAsync {
+    channel = [[NMSSHChannel alloc] initWithSession:session];
+
+    XCTestExpectation *executed = [self expectationWithDescription:@"Command executed"];
+    [channel execute:[settings objectForKey:@"execute_command"] timeout:@10 completion:^(NSString *response, NSError *error) {
+        XCTAssertNil(error, @"Execution should not fail");
+        XCTAssertEqualObjects(response, [settings objectForKey:@"execute_expected_response"],
+                              @"Execution returns the expected response");
+        [executed fulfill];
+    }];
+
+    [self waitForExpectationsWithTimeout:30 handler:nil];
+}
+
+- (void)testCancellingAsyncCommand {
+    channel = [[NMSSHChannel alloc] initWithSession:session];
+
+    XCTestExpectation *cancelled = [self expectationWithDescription:@"Command cancelled"];
+    NMSSHOperation *operation = [channel execute:@"sleep 10" timeout:@0 completion:^(NSString *response, NSError *error) {
+        XCTAssertEqualObjects(error.domain, @"NMSSH");
+        XCTAssertEqual(error.code, NMSSHOperationCancelledError, @"Cancelled command reports a cancellation");
+        [cancelled fulfill];
+    }];
+
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(0.5 * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+        [operation cancel];
+    });
+
+    // Far less than the command would take
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+}
+
+- (void)testAsyncCommandTimesOut {
+    channel = [[NMSSHChannel alloc] initWithSession:session];
+
+    XCTestExpectation *timedOut = [self expectationWithDescription:@"Command timed out"];
+    [channel execute:@"sleep 10" timeout:@0.5 completion:^(NSString *response, NSError *error) {
+        XCTAssertEqualObjects(error.domain, @"NMSSH");
+        XCTAssertEqual(error.code, NMSSHOperationTimeoutError, @"Command past its timeout reports a timeout");
+        [timedOut fulfill];
+    }];
+
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+}
+
+// -----------------------------------------------------------------------------
+// STREAMING EXECUTION TESTS
+// -----------------------------------------------------------------------------
+
+- (void)testStreamingSeparatesOutputAndErrorOutput {
+    channel = [[NMSSHChannel alloc] initWithSession:session];
+
+    // The sinks are called on the session queue, the completion after the last of them
+    NSMutableData *output = [[NSMutableData alloc] init];
+    NSMutableData *errorOutput = [[NSMutableData alloc] init];
+
+    XCTestExpectation *executed = [self expectationWithDescription:@"Command executed"];
+    [channel execute:@"printf out; printf err >&2; exit 3" timeout:@10 output:^(NSData *data) {
+        [output appendData:data];
+    } errorOutput:^(NSData *data) {
+        [errorOutput appendData:data];
+    } completion:^(int exitStatus, NSString *exitSignal, NSError *error) {
+        XCTAssertNil(error, @"A command exiting with a status is not an error");
+        XCTAssertEqual(exitStatus, 3, @"The exit status is reported");
+        XCTAssertNil(exitSignal, @"The command was not killed");
+        XCTAssertEqualObjects(output, [@"out" dataUsingEncoding:NSUTF8StringEncoding], @"Standard output goes to its sink");
+        XCTAssertEqualObjects(errorOutput, [@"err" dataUsingEncoding:NSUTF8StringEncoding], @"Standard error goes to its sink");
+        [executed fulfill];
+    }];
+
+    [self waitForExpectationsWithTimeout:30 handler:nil];
+}
+
+- (void)testStreamingToFullFileDescriptorWaitsForReader {
+    channel = [[NMSSHChannel alloc] initWithSession:session];
+    NSUInteger length = 4 * 1024 * 1024;
+
+    int fds[2];
+    XCTAssertEqual(pipe(fds), 0, @"Create a pipe");
+    fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+
+    // A slow reader keeps the pipe full most of the time
+    __block NSUInteger received = 0;
+    dispatch_group_t reader = dispatch_group_create();
+    dispatch_group_async(reader, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        char buffer[16 * 1024];
+        ssize_t rc;
+
+        while ((rc = read(fds[0], buffer, sizeof(buffer))) > 0) {
+            received += rc;
+            usleep(1000);
+        }
+    });
+
+    XCTestExpectation *executed = [self expectationWithDescription:@"Command executed"];
+    NSString *command = [NSString stringWithFormat:@"head -c %lu /dev/zero", (unsigned long)length];
+    [channel execute:command timeout:@30 outputFileDescriptor:fds[1] errorFileDescriptor:-1 completion:^(int exitStatus, NSString *exitSignal, NSError *error) {
+        XCTAssertNil(error, @"A full descriptor is waited for, not an error");
+        XCTAssertEqual(exitStatus, 0, @"The command completes");
+
+        // The descriptors are left open, the reader stops at end of file
+        close(fds[1]);
+        [executed fulfill];
+    }];
+
+    [self waitForExpectationsWithTimeout:60 handler:nil];
+
+    XCTAssertEqual(dispatch_group_wait(reader, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(10 * NSEC_PER_SEC))), 0,
+                   @"The reader gets to the end of the output");
+    close(fds[0]);
+
+    XCTAssertEqual(received, length, @"No output is lost while the descriptor is full");
+}
+
+- (void)testStreamingInputStreamToCommand {
+    channel = [[NMSSHChannel alloc] initWithSession:session];
+
+    // Larger than the channel window, the input is sent as the window opens
+    NSMutableData *input = [[NSMutableData alloc] initWithLength:4 * 1024 * 1024];
+    for (NSUInteger i = 0; i < [input length]; i++) {
+        ((uint8_t *)[input mutableBytes])[i] = (uint8_t)(i % 251);
+    }
+
+    NSMutableData *output = [[NSMutableData alloc] init];
+
+    XCTestExpectation *executed = [self expectationWithDescription:@"Command executed"];
+    [channel execute:@"cat" timeout:@60 input:[NSInputStream inputStreamWithData:input] output:^(NSData *data) {
+        [output appendData:data];
+    } errorOutput:nil completion:^(int exitStatus, NSString *exitSignal, NSError *error) {
+        XCTAssertNil(error, @"Streaming the input should work");
+        XCTAssertEqual(exitStatus, 0, @"The command gets end of file and exits");
+        XCTAssertEqualObjects(output, input, @"The whole input reaches the command");
+        [executed fulfill];
+    }];
+
+    [self waitForExpectationsWithTimeout:90 handler:nil];
+}
+
+- (void)testStreamingPipeToCommand {
+    channel = [[NMSSHChannel alloc] initWithSession:session];
+
+    int fds[2];
+    XCTAssertEqual(pipe(fds), 0, @"Create a pipe");
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+
+    NSMutableData *output = [[NSMutableData alloc] init];
+
+    XCTestExpectation *executed = [self expectationWithDescription:@"Command executed"];
+    [channel execute:@"cat" timeout:@30 inputFileDescriptor:fds[0] output:^(NSData *data) {
+        [output appendData:data];
+    } errorOutput:nil completion:^(int exitStatus, NSString *exitSignal, NSError *error) {
+        XCTAssertNil(error, @"Streaming the input should work");
+        XCTAssertEqual(exitStatus, 0, @"The command gets end of file and exits");
+        XCTAssertEqualObjects(output, [@"one\ntwo\n" dataUsingEncoding:NSUTF8StringEncoding],
+                              @"Input written after the command started reaches it");
+        [executed fulfill];
+    }];
+
+    // The session is woken up as the pipe gets data
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(0.5 * NSEC_PER_SEC)), dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        write(fds[1], "one\n", 4);
+
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(0.5 * NSEC_PER_SEC)), dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+            write(fds[1], "two\n", 4);
+            close(fds[1]);
+        });
+    });
+
+    [self waitForExpectationsWithTimeout:30 handler:nil];
+    close(fds[0]);
+}
+
+- (void)testExecutingCommandsInBatch {
+    channel = [[NMSSHChannel alloc] initWithSession:session];
+    NSArray *commands = @[ @"echo one", @"sleep 1; echo two", @"echo three >&2; exit 3", @"echo four" ];
+
+    NSMutableArray *handled = [[NSMutableArray alloc] init];
+
+    XCTestExpectation *completed = [self expectationWithDescription:@"Batch completed"];
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+    [channel executeCommands:commands maxConcurrent:2 timeout:@10 resultHandler:^(NMSSHCommandResult *result) {
+        [handled addObject:result.command];
+    } completion:^(NSArray *results) {
+        XCTAssertEqual([results count], [commands count], @"Every command has a result");
+        XCTAssertEqual([handled count], [commands count], @"Every result was handled before the completion");
+
+        // In the order of the commands, whichever finished first
+        XCTAssertEqualObjects([results valueForKey:@"command"], commands);
+        XCTAssertEqualObjects([results[0] output], @"one\n");
+        XCTAssertEqualObjects([results[1] output], @"two\n");
+        XCTAssertEqualObjects([results[3] output], @"four\n");
+
+        // A failing command doesn't affect the others
+        XCTAssertNil([results[2] error], @"A command exiting with a status is not an error");
+        XCTAssertEqual([results[2] exitStatus], 3);
+        XCTAssertEqualObjects([results[2] errorOutput], @"three\n");
+        XCTAssertFalse([results[2] isSuccessful]);
+        XCTAssertTrue([results[0] isSuccessful]);
+
+        [completed fulfill];
+    }];
+
+    [self waitForExpectationsWithTimeout:30 handler:nil];
+
+    // The slow command runs alongside the others
+    XCTAssertLessThan(CFAbsoluteTimeGetCurrent() - start, 3.0, @"Commands in flight share the round trips");
+}
+
+- (void)testCancellingBatch {
+    channel = [[NMSSHChannel alloc] initWithSession:session];
+
+    XCTestExpectation *completed = [self expectationWithDescription:@"Batch completed"];
+    NMSSHOperation *operation = [channel executeCommands:@[ @"sleep 10", @"sleep 10", @"sleep 10" ] maxConcurrent:2 timeout:@0 resultHandler:nil completion:^(NSArray *results) {
+        for (NMSSHCommandResult *result in results) {
+            XCTAssertEqual(result.error.code, NMSSHOperationCancelledError, @"Every command not completed is cancelled");
+        }
+
+        [completed fulfill];
+    }];
+
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(0.5 * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+        [operation cancel];
+    });
+
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+}
+
+// -----------------------------------------------------------------------------
+// SHELL WRITE QUEUE TESTS
+// -----------------------------------------------------------------------------
+
+- (void)channelDidDrainWriteQueue:(NMSSHChannel *)aChannel {
+    [drained fulfill];
+}
+
+- (void)testQueuedShellWritesDrainInOrder {
+    channel = [[NMSSHChannel alloc] initWithSession:session];
+    [channel setDelegate:self];
+    [channel setWriteHighWaterMark:16];
+
+    NSError *error = nil;
+    XCTAssertTrue([channel startShell:&error], @"Starting the shell works");
+
+    drained = [self expectationWithDescription:@"Write queue drained"];
+    XCTestExpectation *written = [self expectationWithDescription:@"All writes completed"];
+
+    NSMutableArray *completed = [[NSMutableArray alloc] init];
+    NSUInteger count = 4;
+    BOOL accepted = YES;
+
+    for (NSUInteger i = 0; i < count; i++) {
+        // A comment, the shell has nothing to run
+        NSData *line = [[NSString stringWithFormat:@"# queued write %lu\n", (unsigned long)i] dataUsingEncoding:NSUTF8StringEncoding];
+        accepted = [channel writeData:line completion:^(NSError *writeError) {
+            XCTAssertNil(writeError, @"Queued write succeeds");
+            [completed addObject:@(i)];
+
+            if ([completed count] == count) {
+                [written fulfill];
+            }
+        }];
+    }
+
+    XCTAssertFalse(accepted, @"Writing past the high-water mark asks the producer to wait");
+
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+
+    XCTAssertEqualObjects(completed, (@[ @0, @1, @2, @3 ]), @"Writes complete in the order they were queued");
+    XCTAssertEqual([channel queuedWriteSize], (NSUInteger)0, @"Nothing is left in the write queue");
+
+    [channel closeShell];
+}
+
 // -----------------------------------------------------------------------------
 // SCP FILE TRANSFER TESTS
 // -----------------------------------------------------------------------------
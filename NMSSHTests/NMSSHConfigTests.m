@@ -609,4 +609,38 @@
                           @"Identity files don't match");
 }
 
+/**
+ Test that algorithm preferences and compression are read and merged.
+ */
+- (void)testAlgorithmKeywords {
+    NSString *contents =
+        @"Host fast\n"
+        @"    Ciphers aes128-ctr,aes256-ctr\n"
+        @"    MACs hmac-sha1\n"
+        @"    KexAlgorithms diffie-hellman-group14-sha1\n"
+        @"    HostKeyAlgorithms ssh-rsa,ssh-dss\n"
+        @"    Compression no\n"
+        @"Host *\n"
+        @"    Ciphers +aes128-cbc\n"
+        @"    MACs hmac-sha2-256\n"
+        @"    Compression yes\n";
+
+    NMSSHConfig *config = [[NMSSHConfig alloc] initWithString:contents];
+
+    NMSSHHostConfig *hostConfig = [config hostConfigForHost:@"fast"];
+    NSArray *expected = @[ @"aes128-ctr", @"aes256-ctr" ];
+    XCTAssertEqualObjects(hostConfig.ciphers, expected, @"Ciphers don't match");
+    XCTAssertEqualObjects(hostConfig.macs, @[ @"hmac-sha1" ], @"MACs don't match");
+    XCTAssertEqualObjects(hostConfig.kexAlgorithms, @[ @"diffie-hellman-group14-sha1" ],
+                          @"Key exchange algorithms don't match");
+    expected = @[ @"ssh-rsa", @"ssh-dss" ];
+    XCTAssertEqualObjects(hostConfig.hostKeyAlgorithms, expected, @"Host key algorithms don't match");
+    XCTAssertEqualObjects(hostConfig.compression, @NO, @"Compression doesn't match");
+
+    hostConfig = [config hostConfigForHost:@"slow"];
+    XCTAssertNil(hostConfig.ciphers, @"Lists modifying the defaults should be ignored");
+    XCTAssertEqualObjects(hostConfig.macs, @[ @"hmac-sha2-256" ], @"MACs don't match");
+    XCTAssertEqualObjects(hostConfig.compression, @YES, @"Compression doesn't match");
+}
+
 @end
@@ -0,0 +1,140 @@
+#import <XCTest/XCTest.h>
+#import <CommonCrypto/CommonHMAC.h>
+#import "NMSSH.h"
+
+@interface NMSSHKnownHostsStoreTests : XCTestCase
+
+@property (nonatomic, strong) NSString *path;
+
+@end
+
+@implementation NMSSHKnownHostsStoreTests
+
+- (void)setUp {
+    [super setUp];
+
+    // Stores are shared by path, each test gets its own file
+    self.path = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+}
+
+- (void)tearDown {
+    [[NSFileManager defaultManager] removeItemAtPath:self.path error:nil];
+
+    [super tearDown];
+}
+
+/** A host key blob of the given type */
+- (NSData *)keyOfType:(NSString *)type seed:(unsigned char)seed {
+    NSMutableData *key = [[NSMutableData alloc] init];
+    uint32_t length = htonl((uint32_t)[type length]);
+    [key appendBytes:&length length:sizeof(length)];
+    [key appendData:[type dataUsingEncoding:NSUTF8StringEncoding]];
+
+    for (unsigned char i = 0; i < 32; i++) {
+        unsigned char byte = seed + i;
+        [key appendBytes:&byte length:1];
+    }
+
+    return key;
+}
+
+- (NSString *)lineForNames:(NSString *)names key:(NSData *)key {
+    return [NSString stringWithFormat:@"%@ ssh-rsa %@\n", names, [key base64EncodedStringWithOptions:0]];
+}
+
+- (void)writeContents:(NSString *)contents {
+    XCTAssertTrue([contents writeToFile:self.path atomically:YES encoding:NSUTF8StringEncoding error:nil],
+                  @"Failed to write known hosts file");
+}
+
+/**
+ Tests that plain host names are matched, with and without a port.
+ */
+- (void)testPlainHosts {
+    NSData *key = [self keyOfType:@"ssh-rsa" seed:1];
+    NSData *otherKey = [self keyOfType:@"ssh-rsa" seed:2];
+
+    [self writeContents:[NSString stringWithFormat:@"# Comment\n%@%@",
+                         [self lineForNames:@"example.com,10.0.0.1" key:key],
+                         [self lineForNames:@"[example.com]:2222" key:otherKey]]];
+
+    NMSSHKnownHostsStore *store = [NMSSHKnownHostsStore storeForFile:self.path];
+    XCTAssertEqual([store statusForHost:@"example.com" port:22 key:key], NMSSHKnownHostStatusMatch);
+    XCTAssertEqual([store statusForHost:@"10.0.0.1" port:22 key:key], NMSSHKnownHostStatusMatch);
+    XCTAssertEqual([store statusForHost:@"example.com" port:22 key:otherKey], NMSSHKnownHostStatusMismatch);
+    XCTAssertEqual([store statusForHost:@"example.com" port:2222 key:otherKey], NMSSHKnownHostStatusMatch);
+    XCTAssertEqual([store statusForHost:@"example.org" port:22 key:key], NMSSHKnownHostStatusNotFound);
+
+    // A key of another type is not a mismatch
+    NSData *dssKey = [self keyOfType:@"ssh-dss" seed:1];
+    XCTAssertEqual([store statusForHost:@"example.com" port:22 key:dssKey], NMSSHKnownHostStatusNotFound);
+}
+
+/**
+ Tests that hashed host names are matched.
+ */
+- (void)testHashedHosts {
+    NSData *key = [self keyOfType:@"ssh-rsa" seed:1];
+    NSData *salt = [@"0123456789abcdefghij" dataUsingEncoding:NSUTF8StringEncoding];
+
+    unsigned char hash[CC_SHA1_DIGEST_LENGTH];
+    CCHmac(kCCHmacAlgSHA1, [salt bytes], [salt length], "example.com", strlen("example.com"), hash);
+    NSString *names = [NSString stringWithFormat:@"|1|%@|%@",
+                       [salt base64EncodedStringWithOptions:0],
+                       [[NSData dataWithBytes:hash length:sizeof(hash)] base64EncodedStringWithOptions:0]];
+
+    [self writeContents:[self lineForNames:names key:key]];
+
+    NMSSHKnownHostsStore *store = [NMSSHKnownHostsStore storeForFile:self.path];
+    XCTAssertEqual([store statusForHost:@"example.com" port:22 key:key], NMSSHKnownHostStatusMatch);
+    XCTAssertEqual([store statusForHost:@"example.com" port:22 key:key], NMSSHKnownHostStatusMatch);
+    XCTAssertEqual([store statusForHost:@"example.org" port:22 key:key], NMSSHKnownHostStatusNotFound);
+}
+
+/**
+ Tests that a missing file is reported as host not found.
+ */
+- (void)testMissingFile {
+    NSData *key = [self keyOfType:@"ssh-rsa" seed:1];
+    NMSSHKnownHostsStore *store = [NMSSHKnownHostsStore storeForFile:self.path];
+    XCTAssertEqual([store statusForHost:@"example.com" port:22 key:key], NMSSHKnownHostStatusNotFound);
+}
+
+/**
+ Tests that a file changed on disk is loaded again.
+ */
+- (void)testReloadChangedFile {
+    NSData *key = [self keyOfType:@"ssh-rsa" seed:1];
+    [self writeContents:[self lineForNames:@"example.org" key:key]];
+
+    NMSSHKnownHostsStore *store = [NMSSHKnownHostsStore storeForFile:self.path];
+    XCTAssertEqual([store statusForHost:@"example.com" port:22 key:key], NMSSHKnownHostStatusNotFound);
+
+    [self writeContents:[self lineForNames:@"example.com,example.org" key:key]];
+    XCTAssertEqual([store statusForHost:@"example.com" port:22 key:key], NMSSHKnownHostStatusMatch);
+}
+
+/**
+ Tests that added hosts are appended to the file.
+ */
+- (void)testAddHost {
+    NSData *key = [self keyOfType:@"ssh-rsa" seed:1];
+    NSData *otherKey = [self keyOfType:@"ssh-rsa" seed:2];
+    NSString *existing = [[self lineForNames:@"example.org" key:key] stringByTrimmingCharactersInSet:[NSCharacterSet newlineCharacterSet]];
+    [self writeContents:existing];
+
+    NMSSHKnownHostsStore *store = [NMSSHKnownHostsStore storeForFile:self.path];
+    XCTAssertTrue([store addHost:@"example.com" port:22 key:key salt:nil], @"Failed to add host");
+    XCTAssertTrue([store addHost:@"example.com" port:2222 key:otherKey salt:nil], @"Failed to add host");
+
+    XCTAssertEqual([store statusForHost:@"example.com" port:22 key:key], NMSSHKnownHostStatusMatch);
+    XCTAssertEqual([store statusForHost:@"example.com" port:2222 key:otherKey], NMSSHKnownHostStatusMatch);
+
+    NSString *expected = [NSString stringWithFormat:@"%@\n%@%@", existing,
+                          [self lineForNames:@"example.com" key:key],
+                          [self lineForNames:@"[example.com]:2222" key:otherKey]];
+    NSString *contents = [NSString stringWithContentsOfFile:self.path encoding:NSUTF8StringEncoding error:nil];
+    XCTAssertEqualObjects(contents, expected, @"Hosts were not appended");
+}
+
+@end
@@ -0,0 +1,133 @@
+#import <XCTest/XCTest.h>
+#import "NMSSH.h"
+
+@interface NMSSHScrollbackBufferTests : XCTestCase
+
+@end
+
+@implementation NMSSHScrollbackBufferTests
+
+- (void)append:(NSString *)string to:(NMSSHScrollbackBuffer *)buffer {
+    [buffer appendData:[string dataUsingEncoding:NSUTF8StringEncoding]];
+}
+
+- (NSString *)line:(uint64_t)line of:(NMSSHScrollbackBuffer *)buffer {
+    NSData *data = [buffer dataForLine:line];
+    return data ? [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding] : nil;
+}
+
+/**
+ Tests that the lines are indexed.
+ */
+- (void)testLines {
+    NMSSHScrollbackBuffer *buffer = [[NMSSHScrollbackBuffer alloc] initWithCapacity:64 maxLines:16];
+    [self append:@"one\ntw" to:buffer];
+    [self append:@"o\nthree" to:buffer];
+
+    XCTAssertEqual(buffer.lineCount, 3);
+    XCTAssertEqualObjects([self line:0 of:buffer], @"one");
+    XCTAssertEqualObjects([self line:1 of:buffer], @"two");
+    XCTAssertEqualObjects([self line:2 of:buffer], @"three");
+    XCTAssertNil([self line:3 of:buffer]);
+
+    XCTAssertEqual([buffer lineAtOffset:0], 0);
+    XCTAssertEqual([buffer lineAtOffset:3], 0);
+    XCTAssertEqual([buffer lineAtOffset:4], 1);
+    XCTAssertEqual([buffer lineAtOffset:12], 2);
+    XCTAssertEqual([buffer lineAtOffset:13], NMSSHScrollbackNotFound);
+
+    uint64_t offset;
+    NSUInteger length;
+    XCTAssertTrue([buffer getOffset:&offset length:&length ofLine:1]);
+    XCTAssertEqual(offset, 4);
+    XCTAssertEqual(length, 3);
+}
+
+/**
+ Tests that the oldest bytes are evicted once the buffer is full.
+ */
+- (void)testEvictBytes {
+    NMSSHScrollbackBuffer *buffer = [[NMSSHScrollbackBuffer alloc] initWithCapacity:8 maxLines:16];
+    [self append:@"aaa\nbbb\nccc\nddd" to:buffer];
+
+    XCTAssertEqual(buffer.startOffset, 7);
+    XCTAssertEqual(buffer.endOffset, 15);
+    XCTAssertEqual(buffer.firstLine, 1);
+
+    // The oldest line lost its beginning
+    XCTAssertNil([self line:0 of:buffer]);
+    XCTAssertEqualObjects([self line:1 of:buffer], @"");
+    XCTAssertEqualObjects([self line:2 of:buffer], @"ccc");
+    XCTAssertEqualObjects([self line:3 of:buffer], @"ddd");
+
+    NSData *data = [buffer dataFromOffset:0 length:100];
+    XCTAssertEqualObjects(data, [@"\nccc\nddd" dataUsingEncoding:NSUTF8StringEncoding]);
+}
+
+/**
+ Tests that the oldest lines are evicted once the index is full.
+ */
+- (void)testEvictLines {
+    NMSSHScrollbackBuffer *buffer = [[NMSSHScrollbackBuffer alloc] initWithCapacity:64 maxLines:2];
+    [self append:@"a\nb\nc" to:buffer];
+
+    XCTAssertEqual(buffer.firstLine, 1);
+    XCTAssertEqual(buffer.lineCount, 2);
+    XCTAssertEqual(buffer.startOffset, 2);
+    XCTAssertEqualObjects([self line:1 of:buffer], @"b");
+    XCTAssertEqualObjects([self line:2 of:buffer], @"c");
+}
+
+/**
+ Tests that a range wrapping around the end of the ring is read in two chunks.
+ */
+- (void)testEnumerateWrappedRange {
+    NMSSHScrollbackBuffer *buffer = [[NMSSHScrollbackBuffer alloc] initWithCapacity:8 maxLines:16];
+    [self append:@"abcdef" to:buffer];
+    [self append:@"ghij" to:buffer];
+
+    NSMutableArray *chunks = [[NSMutableArray alloc] init];
+    [buffer enumerateBytesFromOffset:4 length:5 usingBlock:^(const void *bytes, NSUInteger length, uint64_t offset, BOOL *stop) {
+        [chunks addObject:[NSString stringWithFormat:@"%llu:%@", offset,
+                           [[NSString alloc] initWithBytes:bytes length:length encoding:NSUTF8StringEncoding]]];
+    }];
+
+    XCTAssertEqualObjects(chunks, (@[ @"4:efgh", @"8:i" ]));
+}
+
+/**
+ Tests that data longer than the buffer keeps its end.
+ */
+- (void)testAppendLongerThanCapacity {
+    NMSSHScrollbackBuffer *buffer = [[NMSSHScrollbackBuffer alloc] initWithCapacity:4 maxLines:16];
+    [self append:@"0123456789" to:buffer];
+
+    XCTAssertEqual(buffer.startOffset, 6);
+    XCTAssertEqualObjects([buffer dataFromOffset:0 length:10], [@"6789" dataUsingEncoding:NSUTF8StringEncoding]);
+}
+
+/**
+ Tests searching forwards, backwards and regardless of case.
+ */
+- (void)testSearch {
+    NMSSHScrollbackBuffer *buffer = [[NMSSHScrollbackBuffer alloc] initWithCapacity:8 maxLines:16];
+    [self append:@"abcdef" to:buffer];
+    [self append:@"ghcj" to:buffer];
+
+    NSData *(^pattern)(NSString *) = ^(NSString *string) {
+        return [string dataUsingEncoding:NSUTF8StringEncoding];
+    };
+
+    XCTAssertEqual([buffer offsetOfData:pattern(@"fgh") fromOffset:0 options:0], 5);
+    XCTAssertEqual([buffer offsetOfData:pattern(@"c") fromOffset:0 options:0], 2);
+    XCTAssertEqual([buffer offsetOfData:pattern(@"c") fromOffset:3 options:0], 8);
+    XCTAssertEqual([buffer offsetOfData:pattern(@"c") fromOffset:UINT64_MAX options:NMSSHScrollbackSearchBackwards], 8);
+    XCTAssertEqual([buffer offsetOfData:pattern(@"c") fromOffset:7 options:NMSSHScrollbackSearchBackwards], 2);
+    XCTAssertEqual([buffer offsetOfData:pattern(@"GHC") fromOffset:0 options:0], NMSSHScrollbackNotFound);
+    XCTAssertEqual([buffer offsetOfData:pattern(@"GHC") fromOffset:0 options:NMSSHScrollbackSearchCaseInsensitive], 6);
+
+    // Evicted data is not found
+    XCTAssertEqual([buffer offsetOfData:pattern(@"ab") fromOffset:0 options:0], NMSSHScrollbackNotFound);
+}
+
+@end
@@ -224,6 +224,91 @@
                   @"work");
 }
 
+// -----------------------------------------------------------------------------
+// ASYNCHRONOUS API TESTS
+// -----------------------------------------------------------------------------
+
+- (void)testAsyncConnectionAndAuthenticationWork {
+    NSString *host = [validPasswordProtectedServer objectForKey:@"host"];
+    NSString *username = [validPasswordProtectedServer objectForKey:@"user"];
+    NSString *password = [validPasswordProtectedServer objectForKey:@"password"];
+
+    session = [[NMSSHSession alloc] initWithHost:host andUsername:username];
+
+    XCTestExpectation *authenticated = [self expectationWithDescription:@"Authenticated"];
+    [session connectWithTimeout:@10 completion:^(BOOL success, NSError *error) {
+        XCTAssertTrue(success, @"Asynchronous connection to valid server should work: %@", error);
+        XCTAssertTrue([session isConnected], @"Session is connected in the completion");
+
+        [session authenticateByPassword:password completion:^(BOOL success, NSError *error) {
+            XCTAssertTrue(success, @"Asynchronous authentication with valid password should work: %@", error);
+            XCTAssertTrue([session isAuthorized], @"Session is authorized in the completion");
+            [authenticated fulfill];
+        }];
+    }];
+
+    [self waitForExpectationsWithTimeout:30 handler:nil];
+}
+
+- (void)testAsyncAuthenticationWithInvalidPasswordFails {
+    NSString *host = [validPasswordProtectedServer objectForKey:@"host"];
+    NSString *username = [validPasswordProtectedServer objectForKey:@"user"];
+    NSString *password = [invalidServer objectForKey:@"password"];
+
+    session = [[NMSSHSession alloc] initWithHost:host andUsername:username];
+
+    XCTestExpectation *failed = [self expectationWithDescription:@"Authentication failed"];
+    [session connectWithTimeout:@10 completion:^(BOOL success, NSError *error) {
+        XCTAssertTrue(success, @"Asynchronous connection to valid server should work: %@", error);
+
+        [session authenticateByPassword:password completion:^(BOOL success, NSError *error) {
+            XCTAssertFalse(success, @"Asynchronous authentication with invalid password should not work");
+            XCTAssertNotNil(error, @"Failed authentication reports an error");
+            XCTAssertFalse([session isAuthorized], @"Session is not authorized");
+            [failed fulfill];
+        }];
+    }];
+
+    [self waitForExpectationsWithTimeout:30 handler:nil];
+}
+
+- (void)testAsyncConnectionToInvalidServerFails {
+    NSString *host = [invalidServer objectForKey:@"host"];
+    NSString *username = [invalidServer objectForKey:@"user"];
+
+    session = [[NMSSHSession alloc] initWithHost:host andUsername:username];
+
+    XCTestExpectation *failed = [self expectationWithDescription:@"Connection failed"];
+    [session connectWithTimeout:@5 completion:^(BOOL success, NSError *error) {
+        XCTAssertFalse(success, @"Asynchronous connection to invalid server should not work");
+        XCTAssertNotNil(error, @"Failed connection reports an error");
+        [failed fulfill];
+    }];
+
+    [self waitForExpectationsWithTimeout:30 handler:nil];
+}
+
+- (void)testCancellingAsyncConnection {
+    NSString *host = [validPasswordProtectedServer objectForKey:@"host"];
+    NSString *username = [validPasswordProtectedServer objectForKey:@"user"];
+
+    session = [[NMSSHSession alloc] initWithHost:host andUsername:username];
+
+    XCTestExpectation *cancelled = [self expectationWithDescription:@"Connection cancelled"];
+    NMSSHOperation *operation = [session connectWithTimeout:@10 completion:^(BOOL success, NSError *error) {
+        XCTAssertFalse(success, @"Cancelled connection should not succeed");
+        XCTAssertEqualObjects(error.domain, @"NMSSH");
+        XCTAssertEqual(error.code, NMSSHOperationCancelledError, @"Cancelled connection reports a cancellation");
+        [cancelled fulfill];
+    }];
+    [operation cancel];
+
+    [self waitForExpectationsWithTimeout:30 handler:^(NSError *error) {
+        XCTAssertTrue([operation isCancelled], @"Operation is cancelled");
+        XCTAssertTrue([operation isFinished], @"Operation is finished");
+    }];
+}
+
 // -----------------------------------------------------------------------------
 // CONFIG TESTS
 // -----------------------------------------------------------------------------
@@ -0,0 +1,207 @@
+#import <XCTest/XCTest.h>
+#import "NMSSH.h"
+
+@interface NMSSHTerminalTests : XCTestCase <NMSSHTerminalDelegate>
+
+@property (nonatomic, strong) NMSSHTerminal *terminal;
+@property (nonatomic, strong) NSMutableArray *updates;
+@property (nonatomic, strong) NSMutableData *responses;
+
+@end
+
+@implementation NMSSHTerminalTests
+
+- (void)setUp {
+    [super setUp];
+
+    self.terminal = [[NMSSHTerminal alloc] initWithType:NMSSHChannelPtyTerminalXterm columns:10 rows:4];
+    self.terminal.delegate = self;
+    self.updates = [[NSMutableArray alloc] init];
+    self.responses = [[NSMutableData alloc] init];
+
+    __weak NMSSHTerminalTests *weakSelf = self;
+    self.terminal.responseHandler = ^(NSData *response) {
+        [weakSelf.responses appendData:response];
+    };
+
+    // The initial screen is reported with the first chunk
+    [self process:@""];
+    [self.updates removeAllObjects];
+}
+
+- (void)terminal:(NMSSHTerminal *)terminal didUpdateRegions:(const NMSSHTerminalDirtyRegion *)regions count:(NSUInteger)count {
+    NSMutableArray *update = [[NSMutableArray alloc] init];
+
+    for (NSUInteger i = 0; i < count; i++) {
+        [update addObject:[NSString stringWithFormat:@"%lu:%@", (unsigned long)regions[i].row, NSStringFromRange(regions[i].columns)]];
+    }
+
+    [self.updates addObject:update];
+}
+
+- (void)process:(NSString *)output {
+    [self.terminal processData:[output dataUsingEncoding:NSUTF8StringEncoding]];
+}
+
+- (NSArray *)screen {
+    NSMutableArray *rows = [[NSMutableArray alloc] init];
+
+    for (NSUInteger row = 0; row < self.terminal.rows; row++) {
+        [rows addObject:[self.terminal stringForRow:row]];
+    }
+
+    return rows;
+}
+
+/**
+ Tests that text wraps at the right margin and scrolls at the bottom.
+ */
+- (void)testWrapAndScroll {
+    [self process:@"0123456789abc\r\nline 2\r\nline 3\r\nline 4"];
+
+    XCTAssertEqualObjects([self screen], (@[ @"abc", @"line 2", @"line 3", @"line 4" ]));
+    XCTAssertEqual(self.terminal.cursorRow, 3);
+    XCTAssertEqual(self.terminal.cursorColumn, 6);
+}
+
+/**
+ Tests that only the changed cells are reported.
+ */
+- (void)testDirtyRegions {
+    [self process:@"\033[2;3Hab"];
+    XCTAssertEqualObjects(self.updates, (@[ @[ @"1:{2, 2}" ] ]));
+
+    // Moving the cursor alone is reported without regions
+    [self process:@"\033[H"];
+    XCTAssertEqualObjects([self.updates lastObject], @[]);
+
+    // Nothing changed, nothing reported
+    NSUInteger count = [self.updates count];
+    [self process:@"\033[H"];
+    XCTAssertEqual([self.updates count], count);
+
+    [self process:@"\033[4;1H\n"];
+    XCTAssertEqualObjects([self.updates lastObject], (@[ @"0:{0, 10}", @"1:{0, 10}", @"2:{0, 10}", @"3:{0, 10}" ]));
+    XCTAssertEqualObjects([self screen], (@[ @"  ab", @"", @"", @"" ]));
+}
+
+/**
+ Tests that sequences and characters split between chunks are parsed.
+ */
+- (void)testSplitSequences {
+    [self.terminal processData:[NSData dataWithBytes:"\033[3" length:3]];
+    [self.terminal processData:[NSData dataWithBytes:"1mx\xC3" length:4]];
+    [self.terminal processData:[NSData dataWithBytes:"\xA9" length:1]];
+
+    XCTAssertEqualObjects([self.terminal stringForRow:0], @"xé");
+    XCTAssertEqual([self.terminal cellAtRow:0 column:0].foreground, 1);
+    XCTAssertEqual([self.terminal cellAtRow:0 column:1].foreground, 1);
+}
+
+/**
+ Tests the graphic rendition.
+ */
+- (void)testGraphicRendition {
+    [self process:@"\033[1;4;38;5;200;48;2;255;0;0ma\033[22;39mb\033[0mc"];
+
+    NMSSHTerminalCell cell = [self.terminal cellAtRow:0 column:0];
+    XCTAssertEqual(cell.attributes, NMSSHTerminalAttributeBold | NMSSHTerminalAttributeUnderline);
+    XCTAssertEqual(cell.foreground, 200);
+    XCTAssertEqual(cell.background, 196);
+
+    cell = [self.terminal cellAtRow:0 column:1];
+    XCTAssertEqual(cell.attributes, NMSSHTerminalAttributeUnderline);
+    XCTAssertEqual(cell.foreground, NMSSHTerminalDefaultColor);
+    XCTAssertEqual(cell.background, 196);
+
+    cell = [self.terminal cellAtRow:0 column:2];
+    XCTAssertEqual(cell.attributes, 0);
+    XCTAssertEqual(cell.background, NMSSHTerminalDefaultColor);
+}
+
+/**
+ Tests erasing, inserting and deleting.
+ */
+- (void)testEditing {
+    [self process:@"abcdef\r\nghij\r\nklmn"];
+
+    [self process:@"\033[1;3H\033[2P"];
+    XCTAssertEqualObjects([self.terminal stringForRow:0], @"abef");
+
+    [self process:@"\033[2@"];
+    XCTAssertEqualObjects([self.terminal stringForRow:0], @"ab  ef");
+
+    [self process:@"\033[2;2H\033[K"];
+    XCTAssertEqualObjects([self.terminal stringForRow:1], @"g");
+
+    [self process:@"\033[L"];
+    XCTAssertEqualObjects([self screen], (@[ @"ab  ef", @"", @"g", @"klmn" ]));
+
+    [self process:@"\033[2M"];
+    XCTAssertEqualObjects([self screen], (@[ @"ab  ef", @"klmn", @"", @"" ]));
+
+    [self process:@"\033[2J"];
+    XCTAssertEqualObjects([self screen], (@[ @"", @"", @"", @"" ]));
+}
+
+/**
+ Tests that a scroll region keeps the lines outside of it.
+ */
+- (void)testScrollRegion {
+    [self process:@"top\r\n1\r\n2\r\nbottom"];
+    [self process:@"\033[2;3r\033[3;1H\nnew"];
+
+    XCTAssertEqualObjects([self screen], (@[ @"top", @"2", @"new", @"bottom" ]));
+
+    [self process:@"\033[2;1H\033M"];
+    XCTAssertEqualObjects([self screen], (@[ @"top", @"", @"2", @"bottom" ]));
+}
+
+/**
+ Tests that the alternate screen leaves the primary screen untouched.
+ */
+- (void)testAlternateScreen {
+    [self process:@"shell $ "];
+    [self process:@"\033[?1049h\033[Hvim"];
+
+    XCTAssertTrue(self.terminal.isAlternateScreen);
+    XCTAssertEqualObjects([self.terminal stringForRow:0], @"vim");
+
+    [self process:@"\033[?1049l"];
+    XCTAssertFalse(self.terminal.isAlternateScreen);
+    XCTAssertEqualObjects([self.terminal stringForRow:0], @"shell $");
+    XCTAssertEqual(self.terminal.cursorColumn, 8);
+}
+
+/**
+ Tests the replies to the queries and the title.
+ */
+- (void)testQueriesAndTitle {
+    [self process:@"\033[2;5H\033[6n\033[c\033]0;build ✓\a"];
+
+    NSString *responses = [[NSString alloc] initWithData:self.responses encoding:NSUTF8StringEncoding];
+    XCTAssertEqualObjects(responses, @"\033[2;5R\033[?62;1;2;6;7;8;9c");
+    XCTAssertEqualObjects(self.terminal.title, @"build ✓");
+}
+
+/**
+ Tests the line drawing character set.
+ */
+- (void)testLineDrawing {
+    [self process:@"\033(0lqk\033(Bq"];
+    XCTAssertEqualObjects([self.terminal stringForRow:0], @"┌─┐q");
+}
+
+/**
+ Tests that resizing keeps the lines above the cursor.
+ */
+- (void)testResize {
+    [self process:@"1\r\n2\r\n3\r\n4"];
+    [self.terminal resizeColumns:5 rows:2];
+
+    XCTAssertEqualObjects([self screen], (@[ @"3", @"4" ]));
+    XCTAssertEqual(self.terminal.cursorRow, 1);
+    XCTAssertEqualObjects([self.updates lastObject], (@[ @"0:{0, 5}", @"1:{0, 5}" ]));
+}
+
+@end